@@ -0,0 +1,234 @@
+/*********************************************************************
+ *
+ * Micro-benchmarks for the datalogger and timed report decoders
+ *
+ * - - - - - - - - - License information: - - - - - - - - -
+ *
+ *  Copyright (C) 2011 and beyond by Yoctopuce Sarl, Switzerland.
+ *
+ *  Yoctopuce Sarl (hereafter Licensor) grants to you a perpetual
+ *  non-exclusive license to use, modify, copy and integrate this
+ *  file into your software for the sole purpose of interfacing 
+ *  with Yoctopuce products. 
+ *
+ *  You may reproduce and distribute copies of this file in 
+ *  source or object form, as long as the sole purpose of this
+ *  code is to interface with Yoctopuce products. You must retain 
+ *  this notice in the distributed source file.
+ *
+ *  You should refer to Yoctopuce General Terms and Conditions
+ *  for additional information regarding your rights and 
+ *  obligations.
+ *
+ *  THE SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING 
+ *  WITHOUT LIMITATION, ANY WARRANTY OF MERCHANTABILITY, FITNESS 
+ *  FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO
+ *  EVENT SHALL LICENSOR BE LIABLE FOR ANY INCIDENTAL, SPECIAL,
+ *  INDIRECT OR CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA, 
+ *  COST OF PROCUREMENT OF SUBSTITUTE GOODS, TECHNOLOGY OR 
+ *  SERVICES, ANY CLAIMS BY THIRD PARTIES (INCLUDING BUT NOT 
+ *  LIMITED TO ANY DEFENSE THEREOF), ANY CLAIMS FOR INDEMNITY OR
+ *  CONTRIBUTION, OR OTHER SIMILAR COSTS, WHETHER ASSERTED ON THE
+ *  BASIS OF CONTRACT, TORT (INCLUDING NEGLIGENCE), BREACH OF
+ *  WARRANTY, OR OTHERWISE.
+ *
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "yocto_api.h"
+#include "yocto_temperature.h"
+
+using namespace std;
+
+// Appends a 16-bit word in the datalogger encoding (see YAPI::_decodeWords)
+static void encodeWord(string& res, int val)
+{
+	char c = (char)('0' + ((val >> 10) & 63));
+	res += (char)('0' + (val & 31));
+	res += (char)('0' + ((val >> 5) & 31));
+	res += (c == '\\' ? 'z' : c);
+}
+
+// Encodes nrows averaged measures in the 32-bit format of recent firmwares:
+// avg, min and max per row, values in 1/1000
+static string makeRows(int nrows)
+{
+	string res;
+	for (int r = 0; r < nrows; r++)
+	{
+		int avg = (int)floor(20000 + 5000 * sin(r / 30.0));
+		int lo = avg - 50, hi = avg + 50;
+		encodeWord(res, avg & 0xffff);
+		encodeWord(res, ((avg >> 16) & 0xffff) ^ 0x8000);
+		encodeWord(res, lo & 0xffff);
+		encodeWord(res, (lo >> 16) & 0xffff);
+		encodeWord(res, hi & 0xffff);
+		encodeWord(res, (hi >> 16) & 0xffff);
+	}
+	return res;
+}
+
+// Dataset description, as returned by logger.json?id=..., with a single run
+static string makeDataSet(int nrows)
+{
+	string hdr;
+	encodeWord(hdr, 1);
+	encodeWord(hdr, 0);
+	encodeWord(hdr, 1700000000 & 0xffff);
+	encodeWord(hdr, 1700000000 >> 16);
+	encodeWord(hdr, 0x200 | 60);
+	encodeWord(hdr, 0);
+	encodeWord(hdr, 1);
+	encodeWord(hdr, nrows);
+	encodeWord(hdr, 20000);
+	encodeWord(hdr, 0x8000);
+	encodeWord(hdr, 14950);
+	encodeWord(hdr, 0);
+	encodeWord(hdr, 25050);
+	encodeWord(hdr, 0);
+	return "{\"id\":\"temperature1\",\"unit\":\"'C\",\"calib\":\"0,\",\"cal\":\"\",\"streams\":[\"" + hdr + "\"]}";
+}
+
+static void report(const char* bench, const char* name, int items, int count, u64 elapsed)
+{
+	printf("{\"bench\":\"%s\",\"case\":\"%s\",\"items\":%d,\"iterations\":%d,"
+		   "\"us_per_op\":%.3f,\"ns_per_item\":%.1f}\n", bench, name, items, count,
+		   elapsed * 1000.0 / count, elapsed * 1000000.0 / count / items);
+}
+
+static void benchDecodeWords(const char* name, int nrows, int minMs)
+{
+	string data = makeRows(nrows);
+	int count = 0;
+	u64 start = YAPI::GetTickCount();
+	u64 elapsed;
+	do
+	{
+		for (int i = 0; i < 10; i++)
+		{
+			if ((int)YAPI::_decodeWords(data).size() != 6 * nrows)
+			{
+				fprintf(stderr, "decodeWords failed\n");
+				return;
+			}
+		}
+		count += 10;
+		elapsed = YAPI::GetTickCount() - start;
+	}
+	while (elapsed < (u64)minMs);
+	report("decode_words", name, 6 * nrows, count, elapsed);
+}
+
+// Calibration parameters, as published by the calibrationParam attribute
+static void benchDecodeFloats(const char* name, int nvals, int minMs)
+{
+	string data;
+	for (int i = 0; i < nvals; i++)
+	{
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%s%d.%03d", (i ? "," : ""), (i % 2 ? -i : i) * 37, i % 1000);
+		data += buf;
+	}
+	int count = 0;
+	u64 start = YAPI::GetTickCount();
+	u64 elapsed;
+	do
+	{
+		for (int i = 0; i < 10; i++)
+		{
+			if ((int)YAPI::_decodeFloats(data).size() != nvals)
+			{
+				fprintf(stderr, "decodeFloats failed\n");
+				return;
+			}
+		}
+		count += 10;
+		elapsed = YAPI::GetTickCount() - start;
+	}
+	while (elapsed < (u64)minMs);
+	report("decode_floats", name, nvals, count, elapsed);
+}
+
+// Decodes the measures of a downloaded run, as YDataSet::loadMore() does
+static void benchParseStream(const char* name, int nrows, int minMs)
+{
+	YTemperature* sensor = YTemperature::FindTemperature("TMPSENS1-00001.temperature1");
+	YDataSet dataset(sensor);
+	string rows = "\"" + makeRows(nrows) + "\"";
+	if (dataset._parse(makeDataSet(nrows)) < 0 || dataset.get_privateDataStreams().size() != 1)
+	{
+		fprintf(stderr, "dataset parsing failed\n");
+		return;
+	}
+	YDataStream* stream = dataset.get_privateDataStreams()[0];
+	int count = 0;
+	u64 start = YAPI::GetTickCount();
+	u64 elapsed;
+	do
+	{
+		for (int i = 0; i < 10; i++)
+		{
+			stream->_parseStream(rows);
+			if (stream->get_rowCount() != nrows)
+			{
+				fprintf(stderr, "parseStream failed\n");
+				return;
+			}
+		}
+		count += 10;
+		elapsed = YAPI::GetTickCount() - start;
+	}
+	while (elapsed < (u64)minMs);
+	report("parse_stream", name, nrows, count, elapsed);
+}
+
+static void benchTimedReport(const char* name, const vector<int>& data, int minMs)
+{
+	YTemperature* sensor = YTemperature::FindTemperature("TMPSENS1-00001.temperature2");
+	double timestamp = 1700000000;
+	double check = 0;
+	int count = 0;
+	u64 start = YAPI::GetTickCount();
+	u64 elapsed;
+	do
+	{
+		for (int i = 0; i < 100; i++)
+		{
+			timestamp += 0.1;
+			check += sensor->_decodeTimedReport(timestamp, data).get_averageValue();
+		}
+		count += 100;
+		elapsed = YAPI::GetTickCount() - start;
+	}
+	while (elapsed < (u64)minMs);
+	if (check == 0)
+	{
+		fprintf(stderr, "decodeTimedReport failed\n");
+		return;
+	}
+	report("timed_report", name, 1, count, elapsed);
+}
+
+int main(void)
+{
+	int minMs = 500;
+	// 32-bit format: sub-second value, then averaged value with min/max deltas
+	int subsecond[] = {2, 0x20, 0x4e, 0x00, 0x00};
+	int averaged[] = {2, 0x03, 0x20, 0x4e, 0x00, 0x00, 0x32, 0x32};
+
+	benchDecodeWords("rows-60", 60, minMs);
+	benchDecodeWords("rows-3600", 3600, minMs);
+	benchDecodeFloats("values-4", 4, minMs);
+	benchDecodeFloats("values-64", 64, minMs);
+	benchParseStream("rows-60", 60, minMs);
+	benchParseStream("rows-3600", 3600, minMs);
+	benchTimedReport("subsecond", vector<int>(subsecond, subsecond + 5), minMs);
+	benchTimedReport("averaged", vector<int>(averaged, averaged + 8), minMs);
+	YAPI::FreeAPI();
+	return 0;
+}
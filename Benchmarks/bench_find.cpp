@@ -0,0 +1,100 @@
+/*********************************************************************
+ *
+ * Micro-benchmarks for the YFunction instance cache used by FindXxx()
+ *
+ * - - - - - - - - - License information: - - - - - - - - -
+ *
+ *  Copyright (C) 2011 and beyond by Yoctopuce Sarl, Switzerland.
+ *
+ *  Yoctopuce Sarl (hereafter Licensor) grants to you a perpetual
+ *  non-exclusive license to use, modify, copy and integrate this
+ *  file into your software for the sole purpose of interfacing 
+ *  with Yoctopuce products. 
+ *
+ *  You may reproduce and distribute copies of this file in 
+ *  source or object form, as long as the sole purpose of this
+ *  code is to interface with Yoctopuce products. You must retain 
+ *  this notice in the distributed source file.
+ *
+ *  You should refer to Yoctopuce General Terms and Conditions
+ *  for additional information regarding your rights and 
+ *  obligations.
+ *
+ *  THE SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING 
+ *  WITHOUT LIMITATION, ANY WARRANTY OF MERCHANTABILITY, FITNESS 
+ *  FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO
+ *  EVENT SHALL LICENSOR BE LIABLE FOR ANY INCIDENTAL, SPECIAL,
+ *  INDIRECT OR CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA, 
+ *  COST OF PROCUREMENT OF SUBSTITUTE GOODS, TECHNOLOGY OR 
+ *  SERVICES, ANY CLAIMS BY THIRD PARTIES (INCLUDING BUT NOT 
+ *  LIMITED TO ANY DEFENSE THEREOF), ANY CLAIMS FOR INDEMNITY OR
+ *  CONTRIBUTION, OR OTHER SIMILAR COSTS, WHETHER ASSERTED ON THE
+ *  BASIS OF CONTRACT, TORT (INCLUDING NEGLIGENCE), BREACH OF
+ *  WARRANTY, OR OTHERWISE.
+ *
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "yocto_api.h"
+#include "yocto_temperature.h"
+#include "yocto_humidity.h"
+
+using namespace std;
+
+// Resolves the same set of names over and over, as an application polling
+// its sensors by name does, and reports the mean time per FindXxx() call
+static void benchFind(const char* name, int nfunc, int minMs)
+{
+	vector<string> names;
+	for (int i = 0; i < nfunc; i++)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "TMPSENS1-%05d.temperature%d", i / 4, i % 4 + 1);
+		names.push_back(buf);
+		// a second class in the cache, with the same function names
+		snprintf(buf, sizeof(buf), "TMPSENS1-%05d.humidity", i / 4);
+		YHumidity::FindHumidity(buf);
+	}
+	for (int i = 0; i < nfunc; i++)
+	{
+		YTemperature::FindTemperature(names[i]);
+	}
+	int count = 0;
+	u64 start = YAPI::GetTickCount();
+	u64 elapsed;
+	do
+	{
+		for (int r = 0; r < 10; r++)
+		{
+			for (int i = 0; i < nfunc; i++)
+			{
+				if (YTemperature::FindTemperature(names[i]) == NULL)
+				{
+					fprintf(stderr, "lookup failed\n");
+					return;
+				}
+			}
+		}
+		count += 10 * nfunc;
+		elapsed = YAPI::GetTickCount() - start;
+	}
+	while (elapsed < (u64)minMs);
+
+	printf("{\"bench\":\"find_function\",\"case\":\"%s\",\"functions\":%d,\"iterations\":%d,"
+		   "\"ns_per_op\":%.1f}\n", name, nfunc, count, elapsed * 1000000.0 / count);
+}
+
+int main(void)
+{
+	int minMs = 500;
+
+	benchFind("cache-16", 16, minMs);
+	benchFind("cache-256", 256, minMs);
+	benchFind("cache-4096", 4096, minMs);
+	YAPI::FreeAPI();
+	return 0;
+}
@@ -0,0 +1,206 @@
+/*********************************************************************
+ *
+ * Micro-benchmarks for the string hash table and the yellow pages
+ *
+ * - - - - - - - - - License information: - - - - - - - - -
+ *
+ *  Copyright (C) 2011 and beyond by Yoctopuce Sarl, Switzerland.
+ *
+ *  Yoctopuce Sarl (hereafter Licensor) grants to you a perpetual
+ *  non-exclusive license to use, modify, copy and integrate this
+ *  file into your software for the sole purpose of interfacing 
+ *  with Yoctopuce products. 
+ *
+ *  You may reproduce and distribute copies of this file in 
+ *  source or object form, as long as the sole purpose of this
+ *  code is to interface with Yoctopuce products. You must retain 
+ *  this notice in the distributed source file.
+ *
+ *  You should refer to Yoctopuce General Terms and Conditions
+ *  for additional information regarding your rights and 
+ *  obligations.
+ *
+ *  THE SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING 
+ *  WITHOUT LIMITATION, ANY WARRANTY OF MERCHANTABILITY, FITNESS 
+ *  FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO
+ *  EVENT SHALL LICENSOR BE LIABLE FOR ANY INCIDENTAL, SPECIAL,
+ *  INDIRECT OR CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA, 
+ *  COST OF PROCUREMENT OF SUBSTITUTE GOODS, TECHNOLOGY OR 
+ *  SERVICES, ANY CLAIMS BY THIRD PARTIES (INCLUDING BUT NOT 
+ *  LIMITED TO ANY DEFENSE THEREOF), ANY CLAIMS FOR INDEMNITY OR
+ *  CONTRIBUTION, OR OTHER SIMILAR COSTS, WHETHER ASSERTED ON THE
+ *  BASIS OF CONTRACT, TORT (INCLUDING NEGLIGENCE), BREACH OF
+ *  WARRANTY, OR OTHERWISE.
+ *
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "yapi/yproto.h"
+#include "yapi/yhash.h"
+
+// Registers ndev devices with nfunc temperature functions each, the way
+// the network enumeration fills the white and yellow pages
+static void registerDevices(int ndev, int nfunc)
+{
+	char buf[64];
+	int d, f;
+	yStrRef categ = yHashPutStr("Temperature");
+
+	for (d = 0; d < ndev; d++)
+	{
+		yStrRef serial, lname;
+		YSPRINTF(buf, sizeof(buf), "TMPSENS1-%05d", d);
+		serial = yHashPutStr(buf);
+		YSPRINTF(buf, sizeof(buf), "room%d", d);
+		lname = yHashPutStr(buf);
+		wpRegister(-1, serial, lname, yHashPutStr("Yocto-Thermistor"), 12, yHashUrlUSB(serial), 0);
+		ypRegister(YSTRREF_MODULE_STRING, serial, YSTRREF_mODULE_STRING, lname, YOCTO_AKA_YFUNCTION, -1, NULL);
+		for (f = 1; f <= nfunc; f++)
+		{
+			yStrRef funcid, funcname;
+			YSPRINTF(buf, sizeof(buf), "temperature%d", f);
+			funcid = yHashPutStr(buf);
+			YSPRINTF(buf, sizeof(buf), "probe%d-%d", d, f);
+			funcname = yHashPutStr(buf);
+			ypRegister(categ, serial, funcid, funcname, YOCTO_AKA_YSENSOR, f, "21.50");
+		}
+	}
+}
+
+static void report(const char* bench, const char* name, int items, int count, u64 elapsed)
+{
+	printf("{\"bench\":\"%s\",\"case\":\"%s\",\"items\":%d,\"iterations\":%d,\"ns_per_op\":%.1f}\n",
+	       bench, name, items, count, elapsed * 1000000.0 / count);
+}
+
+// Looks up strings that are already in the table: yHashPutStr is called
+// for every name found in a notification or an api.json reply
+static void benchHash(int ndev, int nfunc, int minMs)
+{
+	char name[64];
+	char** strs = (char**)malloc(ndev * nfunc * sizeof(char*));
+	int nstr = 0, count, i, r;
+	u64 start, elapsed;
+
+	for (i = 0; i < ndev * nfunc; i++)
+	{
+		strs[nstr] = (char*)malloc(32);
+		YSPRINTF(strs[nstr], 32, "probe%d-%d", i / nfunc, i % nfunc + 1);
+		nstr++;
+	}
+	YSPRINTF(name, sizeof(name), "strings-%d", nstr);
+	count = 0;
+	start = yapiGetTickCount();
+	do
+	{
+		for (r = 0; r < 10; r++)
+		{
+			for (i = 0; i < nstr; i++)
+			{
+				if (yHashPutStr(strs[i]) == INVALID_HASH_IDX) return;
+			}
+		}
+		count += 10 * nstr;
+		elapsed = yapiGetTickCount() - start;
+	}
+	while (elapsed < (u64)minMs);
+	report("hash_put", name, nstr, count, elapsed);
+
+	count = 0;
+	start = yapiGetTickCount();
+	do
+	{
+		for (r = 0; r < 10; r++)
+		{
+			for (i = 0; i < nstr; i++)
+			{
+				if (yHashTestStr(strs[i]) == INVALID_HASH_IDX) return;
+			}
+			// misses, as for names that were never registered
+			for (i = 0; i < nstr; i++)
+			{
+				yHashTestStr("unknown-function-name");
+			}
+		}
+		count += 20 * nstr;
+		elapsed = yapiGetTickCount() - start;
+	}
+	while (elapsed < (u64)minMs);
+	report("hash_test", name, nstr, count, elapsed);
+
+	for (i = 0; i < nstr; i++)
+	{
+		free(strs[i]);
+	}
+	free(strs);
+}
+
+// Resolves functions by hardware id, by module name and function id, and by
+// logical name alone, as FindXxx() does on a cache miss
+static void benchSearch(int ndev, int nfunc, int minMs)
+{
+	static const char* kinds[] = {"hardware-id", "module-name", "logical-name"};
+	char name[64];
+	char buf[64];
+	int kind, count, d, f;
+	u64 start, elapsed;
+
+	for (kind = 0; kind < 3; kind++)
+	{
+		count = 0;
+		start = yapiGetTickCount();
+		do
+		{
+			for (d = 0; d < ndev; d++)
+			{
+				for (f = 1; f <= nfunc; f++)
+				{
+					switch (kind)
+					{
+					case 0:
+						YSPRINTF(buf, sizeof(buf), "TMPSENS1-%05d.temperature%d", d, f);
+						break;
+					case 1:
+						YSPRINTF(buf, sizeof(buf), "room%d.temperature%d", d, f);
+						break;
+					default:
+						YSPRINTF(buf, sizeof(buf), "probe%d-%d", d, f);
+						break;
+					}
+					if (ypSearch("Temperature", buf) < 0)
+					{
+						fprintf(stderr, "ypSearch(%s) failed\n", buf);
+						return;
+					}
+				}
+			}
+			count += ndev * nfunc;
+			elapsed = yapiGetTickCount() - start;
+		}
+		while (elapsed < (u64)minMs);
+		YSPRINTF(name, sizeof(name), "%s-%d", kinds[kind], ndev * nfunc);
+		report("yp_search", name, ndev * nfunc, count, elapsed);
+	}
+}
+
+int main(void)
+{
+	char errmsg[YOCTO_ERRMSG_LEN];
+	int minMs = 500;
+
+	if (yapiInitAPI(0, errmsg) < 0)
+	{
+		fprintf(stderr, "%s\n", errmsg);
+		return 1;
+	}
+	registerDevices(64, 4);
+	benchHash(64, 4, minMs);
+	benchSearch(8, 4, minMs);
+	benchSearch(64, 4, minMs);
+	yapiFreeAPI();
+	return 0;
+}
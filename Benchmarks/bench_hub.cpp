@@ -0,0 +1,454 @@
+/*********************************************************************
+ *
+ * End-to-end benchmarks against simulated VirtualHubs: notification
+ * throughput, datalogger and file downloads, and attribute writes
+ *
+ * - - - - - - - - - License information: - - - - - - - - -
+ *
+ *  Copyright (C) 2011 and beyond by Yoctopuce Sarl, Switzerland.
+ *
+ *  Yoctopuce Sarl (hereafter Licensor) grants to you a perpetual
+ *  non-exclusive license to use, modify, copy and integrate this
+ *  file into your software for the sole purpose of interfacing 
+ *  with Yoctopuce products. 
+ *
+ *  You may reproduce and distribute copies of this file in 
+ *  source or object form, as long as the sole purpose of this
+ *  code is to interface with Yoctopuce products. You must retain 
+ *  this notice in the distributed source file.
+ *
+ *  You should refer to Yoctopuce General Terms and Conditions
+ *  for additional information regarding your rights and 
+ *  obligations.
+ *
+ *  THE SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING 
+ *  WITHOUT LIMITATION, ANY WARRANTY OF MERCHANTABILITY, FITNESS 
+ *  FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO
+ *  EVENT SHALL LICENSOR BE LIABLE FOR ANY INCIDENTAL, SPECIAL,
+ *  INDIRECT OR CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA, 
+ *  COST OF PROCUREMENT OF SUBSTITUTE GOODS, TECHNOLOGY OR 
+ *  SERVICES, ANY CLAIMS BY THIRD PARTIES (INCLUDING BUT NOT 
+ *  LIMITED TO ANY DEFENSE THEREOF), ANY CLAIMS FOR INDEMNITY OR
+ *  CONTRIBUTION, OR OTHER SIMILAR COSTS, WHETHER ASSERTED ON THE
+ *  BASIS OF CONTRACT, TORT (INCLUDING NEGLIGENCE), BREACH OF
+ *  WARRANTY, OR OTHERWISE.
+ *
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "yocto_api.h"
+#include "yocto_temperature.h"
+#include "yapi/yapi.h"
+#include "yhubsim.h"
+
+using namespace std;
+
+static int callbacks;
+static int arrivals;
+static int removals;
+
+static void valueCallback(YTemperature* func, const string& value)
+{
+	callbacks++;
+}
+
+static void arrivalCallback(YModule* module)
+{
+	arrivals++;
+}
+
+static void removalCallback(YModule* module)
+{
+	removals++;
+}
+
+// Returns the WebSocket frames sent to the hubs so far, and the socket
+// writes used to send them
+static void wsWriteStats(u64& frames, u64& writes)
+{
+	vector<yMetricsEntry> entries;
+	string errmsg;
+
+	frames = 0;
+	writes = 0;
+	YAPI::GetMetrics(entries, errmsg);
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (entries[i].kind == YMETRICS_HUB)
+		{
+			frames += entries[i].wsFrames;
+			writes += entries[i].wsWrites;
+		}
+	}
+}
+
+// Starts nhubs simulators with distinct serial numbers and registers them
+static bool startHubs(vector<YHubSim*>& hubs, int nhubs, const YHubSimConfig& base, bool ws)
+{
+	string errmsg;
+	for (int h = 0; h < nhubs; h++)
+	{
+		YHubSimConfig config = base;
+		config.serialBase = 1 + h * config.modules;
+		config.seed = base.seed + h;
+		YHubSim* sim = new YHubSim(config);
+		hubs.push_back(sim);
+		if (sim->start(errmsg) != YAPI_SUCCESS || YAPI::RegisterHub(sim->url(ws), errmsg) != YAPI_SUCCESS)
+		{
+			fprintf(stderr, "%s\n", errmsg.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+static void stopHubs(vector<YHubSim*>& hubs)
+{
+	YAPI::FreeAPI();
+	for (size_t h = 0; h < hubs.size(); h++)
+	{
+		delete hubs[h];
+	}
+	hubs.clear();
+}
+
+static u64 sentNotifications(const vector<YHubSim*>& hubs)
+{
+	u64 res = 0;
+	for (size_t h = 0; h < hubs.size(); h++)
+	{
+		res += hubs[h]->stats().notifications;
+	}
+	return res;
+}
+
+// Counts the value callbacks delivered while the hubs publish notifications
+// for every sensor, and compares with the number of notifications sent.
+// Notifications that repeat the previous value do not trigger a callback.
+static void benchNotifications(const char* name, bool ws, int nhubs, int modules, int sensors, double rate, int durationMs)
+{
+	YHubSimConfig config;
+	vector<YHubSim*> hubs;
+	string errmsg;
+
+	config.modules = modules;
+	config.sensors = sensors;
+	config.valueRate = rate;
+	if (startHubs(hubs, nhubs, config, ws))
+	{
+		int nsensors = 0;
+		for (YTemperature* t = YTemperature::FirstTemperature(); t; t = t->nextTemperature())
+		{
+			t->registerValueCallback(valueCallback);
+			nsensors++;
+		}
+		YAPI::HandleEvents(errmsg);
+		callbacks = 0;
+		u64 sent = sentNotifications(hubs);
+		u64 start = YAPI::GetTickCount();
+		u64 elapsed = 0;
+		do
+		{
+			YAPI::Sleep(10, errmsg);
+			elapsed = YAPI::GetTickCount() - start;
+		}
+		while (elapsed < (u64)durationMs);
+		sent = sentNotifications(hubs) - sent;
+		printf("{\"bench\":\"notifications\",\"case\":\"%s\",\"sensors\":%d,\"sent\":%llu,\"callbacks\":%d,"
+			   "\"callbacks_per_s\":%.0f,\"delivered\":%.3f}\n", name, nsensors, (unsigned long long)sent, callbacks,
+			   callbacks * 1000.0 / elapsed, sent ? (double)callbacks / sent : 0.0);
+	}
+	stopHubs(hubs);
+}
+
+// Downloads the whole datalogger content of one sensor with loadMore()
+static void benchDataset(const char* name, bool ws, int runs, int rows, int minMs)
+{
+	YHubSimConfig config;
+	vector<YHubSim*> hubs;
+
+	config.modules = 1;
+	config.sensors = 1;
+	config.valueRate = 0;
+	config.loggerRuns = runs;
+	config.loggerRows = rows;
+	if (startHubs(hubs, 1, config, ws))
+	{
+		YTemperature* sensor = YTemperature::FindTemperature(hubs[0]->moduleSerial(0) + ".temperature1");
+		int count = 0;
+		size_t measures = 0;
+		u64 start = YAPI::GetTickCount();
+		u64 elapsed = 0;
+		do
+		{
+			YDataSet dataset = sensor->get_recordedData(0, 0);
+			int progress;
+			do
+			{
+				progress = dataset.loadMore();
+			}
+			while (progress >= 0 && progress < 100);
+			if (progress < 0 || dataset.get_measures().size() != (size_t)(runs * rows))
+			{
+				fprintf(stderr, "dataset download failed (%d)\n", progress);
+				break;
+			}
+			measures += dataset.get_measures().size();
+			count++;
+			elapsed = YAPI::GetTickCount() - start;
+		}
+		while (elapsed < (u64)minMs);
+		if (count > 0)
+		{
+			printf("{\"bench\":\"dataset\",\"case\":\"%s\",\"measures\":%d,\"iterations\":%d,"
+				   "\"ms_per_op\":%.2f,\"measures_per_s\":%.0f}\n", name, runs * rows, count,
+				   (double)elapsed / count, measures * 1000.0 / elapsed);
+		}
+	}
+	stopHubs(hubs);
+}
+
+// Downloads the full api.json of a hub as a file, with HTTP/1.1 headers
+static void benchDownload(const char* name, bool ws, int modules, int minMs)
+{
+	YHubSimConfig config;
+	vector<YHubSim*> hubs;
+
+	config.modules = modules;
+	config.sensors = 4;
+	config.valueRate = 0;
+	if (startHubs(hubs, 1, config, ws))
+	{
+		YModule* hub = YModule::FindModule(hubs[0]->hubSerial());
+		int count = 0;
+		size_t bytes = 0, size = 0;
+		u64 start = YAPI::GetTickCount();
+		u64 elapsed = 0;
+		do
+		{
+			string data = hub->download("api.json");
+			if (data.size() < 1000)
+			{
+				fprintf(stderr, "download failed\n");
+				break;
+			}
+			size = data.size();
+			bytes += size;
+			count++;
+			elapsed = YAPI::GetTickCount() - start;
+		}
+		while (elapsed < (u64)minMs);
+		if (count > 0)
+		{
+			printf("{\"bench\":\"download\",\"case\":\"%s\",\"bytes\":%d,\"iterations\":%d,"
+				   "\"ms_per_op\":%.2f,\"mb_per_s\":%.1f}\n", name, (int)size, count,
+				   (double)elapsed / count, bytes / 1000.0 / elapsed);
+		}
+	}
+	stopHubs(hubs);
+}
+
+// Writes an attribute of every sensor in turn, waiting for each reply
+static void benchWrites(const char* name, bool ws, int latencyMs, int minMs)
+{
+	YHubSimConfig config;
+	vector<YHubSim*> hubs;
+
+	config.modules = 4;
+	config.sensors = 2;
+	config.valueRate = 1;
+	config.latencyMs = latencyMs;
+	if (startHubs(hubs, 1, config, ws))
+	{
+		vector<YTemperature*> sensors;
+		for (YTemperature* t = YTemperature::FirstTemperature(); t; t = t->nextTemperature())
+		{
+			sensors.push_back(t);
+		}
+		int count = 0;
+		u64 conns = hubs[0]->stats().connections;
+		u64 frames, writes, frames2, writes2;
+		wsWriteStats(frames, writes);
+		u64 start = YAPI::GetTickCount();
+		u64 elapsed = 0;
+		do
+		{
+			// a small set of names, since every new string is kept in the hash table
+			char lname[32];
+			snprintf(lname, sizeof(lname), "probe%d", count % 32);
+			if (sensors[count % sensors.size()]->set_logicalName(lname) != YAPI_SUCCESS)
+			{
+				fprintf(stderr, "write failed\n");
+				break;
+			}
+			count++;
+			elapsed = YAPI::GetTickCount() - start;
+		}
+		while (elapsed < (u64)minMs);
+		conns = hubs[0]->stats().connections - conns;
+		wsWriteStats(frames2, writes2);
+		if (count > 0)
+		{
+			printf("{\"bench\":\"writes\",\"case\":\"%s\",\"iterations\":%d,\"ms_per_op\":%.3f,\"ops_per_s\":%.0f,\"connections_per_op\":%.3f,"
+				   "\"ws_frames_per_write\":%.2f}\n", name, count, (double)elapsed / count, count * 1000.0 / elapsed, (double)conns / count,
+				   writes2 > writes ? (double)(frames2 - frames) / (writes2 - writes) : 0.0);
+		}
+	}
+	stopHubs(hubs);
+}
+
+static void writeDone(void* context, const u8* result, u32 resultlen, int retcode, const char* errmsg)
+{
+	if (retcode != YAPI_SUCCESS)
+	{
+		fprintf(stderr, "write failed: %s\n", errmsg);
+	}
+	(*(std::atomic<int>*)context)++;
+}
+
+// Sends asynchronous writes to several modules at once through the
+// low-level API, which keeps one request slot per module, and waits for all
+// replies before the next round. Each round addresses the next group of
+// modules, so that every module slot gets used in turn.
+static void benchParallelWrites(const char* name, bool ws, int modules, int width, int latencyMs, int minMs)
+{
+	YHubSimConfig config;
+	vector<YHubSim*> hubs;
+	string errmsg;
+
+	config.modules = modules;
+	config.sensors = 1;
+	config.valueRate = 1;
+	config.latencyMs = latencyMs;
+	if (startHubs(hubs, 1, config, ws))
+	{
+		std::atomic<int> done(0);
+		int count = 0;
+		u64 conns = hubs[0]->stats().connections;
+		u64 frames, writes, frames2, writes2;
+		wsWriteStats(frames, writes);
+		u64 start = YAPI::GetTickCount();
+		u64 elapsed = 0;
+		do
+		{
+			for (int i = 0; i < width; i++)
+			{
+				string serial = hubs[0]->moduleSerial(count % modules);
+				char request[128], errbuf[YOCTO_ERRMSG_LEN];
+				snprintf(request, sizeof(request), "GET /bySerial/%s/api/module/logicalName?logicalName=probe%d&. \r\n\r\n",
+						 serial.c_str(), count % 32);
+				if (yapiHTTPRequestAsyncEx(serial.c_str(), request, (int)strlen(request), writeDone, &done, errbuf) != YAPI_SUCCESS)
+				{
+					fprintf(stderr, "write failed: %s\n", errbuf);
+					done++;
+				}
+				count++;
+			}
+			while (done < count)
+			{
+				YAPI::Sleep(0, errmsg);
+			}
+			elapsed = YAPI::GetTickCount() - start;
+		}
+		while (elapsed < (u64)minMs);
+		YHubSimStats stats = hubs[0]->stats();
+		wsWriteStats(frames2, writes2);
+		if (count > 0)
+		{
+			printf("{\"bench\":\"parallel-writes\",\"case\":\"%s\",\"iterations\":%d,\"ms_per_round\":%.3f,\"ops_per_s\":%.0f,"
+				   "\"connections_per_op\":%.3f,\"peak_connections\":%d,\"ws_frames_per_write\":%.2f}\n", name, count,
+				   (double)elapsed * width / count, count * 1000.0 / elapsed, (double)(stats.connections - conns) / count,
+				   (int)stats.peakConnections, writes2 > writes ? (double)(frames2 - frames) / (writes2 - writes) : 0.0);
+		}
+	}
+	stopHubs(hubs);
+}
+
+// Unplugs and plugs back a module in turn while the application polls the
+// device list, and measures the traffic sent by the hub for each arrival.
+// The same devices are announced whether the full list is reloaded
+// (validity 0) or only the plugged module is fetched.
+static void benchDeviceList(const char* name, bool ws, int modules, int validity, int durationMs)
+{
+	YHubSimConfig config;
+	vector<YHubSim*> hubs;
+	string errmsg;
+
+	config.modules = modules;
+	config.sensors = 4;
+	config.valueRate = 0;
+	YAPI::SetDeviceListValidity(validity);
+	if (startHubs(hubs, 1, config, ws))
+	{
+		YAPI::RegisterDeviceArrivalCallback(arrivalCallback);
+		YAPI::RegisterDeviceRemovalCallback(removalCallback);
+		YAPI::UpdateDeviceList(errmsg);
+		arrivals = 0;
+		removals = 0;
+		u64 sent = hubs[0]->stats().bytesSent;
+		u64 requests = hubs[0]->stats().requests;
+		u64 start = YAPI::GetTickCount();
+		u64 elapsed = 0;
+		int toggles = 0;
+		do
+		{
+			// module 0 goes away and comes back every 200 ms
+			u64 now = YAPI::GetTickCount();
+			if ((int)((now - start) / 100) > toggles)
+			{
+				hubs[0]->plugModule(0, (toggles % 2) == 1);
+				toggles++;
+			}
+			YAPI::UpdateDeviceList(errmsg);
+			YAPI::Sleep(5, errmsg);
+			elapsed = YAPI::GetTickCount() - start;
+		}
+		while (elapsed < (u64)durationMs);
+		sent = hubs[0]->stats().bytesSent - sent;
+		requests = hubs[0]->stats().requests - requests;
+		printf("{\"bench\":\"devicelist\",\"case\":\"%s\",\"modules\":%d,\"arrivals\":%d,\"removals\":%d,"
+			   "\"requests\":%llu,\"bytes_per_arrival\":%.0f}\n", name, modules, arrivals, removals,
+			   (unsigned long long)requests, arrivals ? (double)sent / arrivals : 0.0);
+		YAPI::RegisterDeviceArrivalCallback(NULL);
+		YAPI::RegisterDeviceRemovalCallback(NULL);
+	}
+	stopHubs(hubs);
+}
+
+int main(int argc, char* argv[])
+{
+	int minMs = 500;
+	int durationMs = 2000;
+
+	for (int p = 0; p < 2; p++)
+	{
+		bool ws = (p == 1);
+		char name[64];
+		snprintf(name, sizeof(name), "%s-1x4x2", ws ? "ws" : "http");
+		benchNotifications(name, ws, 1, 4, 2, 20, durationMs);
+		snprintf(name, sizeof(name), "%s-4x16x4", ws ? "ws" : "http");
+		benchNotifications(name, ws, 4, 16, 4, 10, durationMs);
+		snprintf(name, sizeof(name), "%s-3x600", ws ? "ws" : "http");
+		benchDataset(name, ws, 3, 600, minMs);
+		snprintf(name, sizeof(name), "%s-api-64", ws ? "ws" : "http");
+		benchDownload(name, ws, 64, minMs);
+		snprintf(name, sizeof(name), "%s-local", ws ? "ws" : "http");
+		benchWrites(name, ws, 0, minMs);
+		snprintf(name, sizeof(name), "%s-5ms", ws ? "ws" : "http");
+		benchWrites(name, ws, 5, minMs);
+		snprintf(name, sizeof(name), "%s-8of8-5ms", ws ? "ws" : "http");
+		benchParallelWrites(name, ws, 8, 8, 5, minMs);
+		snprintf(name, sizeof(name), "%s-8of64-5ms", ws ? "ws" : "http");
+		benchParallelWrites(name, ws, 64, 8, 5, minMs);
+		snprintf(name, sizeof(name), "%s-full-32", ws ? "ws" : "http");
+		benchDeviceList(name, ws, 32, 0, durationMs);
+		snprintf(name, sizeof(name), "%s-incremental-32", ws ? "ws" : "http");
+		benchDeviceList(name, ws, 32, 60, durationMs);
+	}
+	return 0;
+}
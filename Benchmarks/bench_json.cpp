@@ -0,0 +1,315 @@
+/*********************************************************************
+ *
+ * Micro-benchmarks for the JSON parser used on api.json payloads
+ *
+ * - - - - - - - - - License information: - - - - - - - - -
+ *
+ *  Copyright (C) 2011 and beyond by Yoctopuce Sarl, Switzerland.
+ *
+ *  Yoctopuce Sarl (hereafter Licensor) grants to you a perpetual
+ *  non-exclusive license to use, modify, copy and integrate this
+ *  file into your software for the sole purpose of interfacing 
+ *  with Yoctopuce products. 
+ *
+ *  You may reproduce and distribute copies of this file in 
+ *  source or object form, as long as the sole purpose of this
+ *  code is to interface with Yoctopuce products. You must retain 
+ *  this notice in the distributed source file.
+ *
+ *  You should refer to Yoctopuce General Terms and Conditions
+ *  for additional information regarding your rights and 
+ *  obligations.
+ *
+ *  THE SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING 
+ *  WITHOUT LIMITATION, ANY WARRANTY OF MERCHANTABILITY, FITNESS 
+ *  FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO
+ *  EVENT SHALL LICENSOR BE LIABLE FOR ANY INCIDENTAL, SPECIAL,
+ *  INDIRECT OR CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA, 
+ *  COST OF PROCUREMENT OF SUBSTITUTE GOODS, TECHNOLOGY OR 
+ *  SERVICES, ANY CLAIMS BY THIRD PARTIES (INCLUDING BUT NOT 
+ *  LIMITED TO ANY DEFENSE THEREOF), ANY CLAIMS FOR INDEMNITY OR
+ *  CONTRIBUTION, OR OTHER SIMILAR COSTS, WHETHER ASSERTED ON THE
+ *  BASIS OF CONTRACT, TORT (INCLUDING NEGLIGENCE), BREACH OF
+ *  WARRANTY, OR OTHERWISE.
+ *
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "yocto_api.h"
+#include "yocto_genericsensor.h"
+
+using namespace std;
+
+// Heap accounting: every allocation is prefixed with its size, so that the
+// current and peak heap usage can be tracked without any platform support
+static size_t heapCurrent = 0;
+static size_t heapPeak = 0;
+static size_t heapAllocs = 0;
+
+void* operator new(size_t size)
+{
+	size_t* blk = (size_t*)malloc(size + 2 * sizeof(size_t));
+	if (blk == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	blk[0] = size;
+	heapCurrent += size;
+	heapAllocs++;
+	if (heapCurrent > heapPeak)
+	{
+		heapPeak = heapCurrent;
+	}
+	return blk + 2;
+}
+
+void operator delete(void* ptr) throw()
+{
+	if (ptr != NULL)
+	{
+		size_t* blk = (size_t*)ptr - 2;
+		heapCurrent -= blk[0];
+		free(blk);
+	}
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete[](void* ptr) throw()
+{
+	operator delete(ptr);
+}
+
+// Builds an api.json reply similar to the one of a large module, with one
+// module block and nfunc sensor-like functions
+static string makeApiJson(int nfunc)
+{
+	string res = "{\"module\":{\"productName\":\"Yocto-Benchmark\",\"serialNumber\":\"BENCHMK1-12345\","
+		"\"logicalName\":\"\",\"productId\":1234,\"productRelease\":1,\"firmwareRelease\":\"27180\","
+		"\"persistentSettings\":1,\"luminosity\":50,\"beacon\":0,\"upTime\":123456789,\"usbCurrent\":120,"
+		"\"rebootCountdown\":0,\"userVar\":0}";
+	for (int i = 1; i <= nfunc; i++)
+	{
+		char buf[1024];
+		snprintf(buf, sizeof(buf), ",\"genericSensor%d\":{\"logicalName\":\"channel%d\","
+				 "\"advertisedValue\":\"%d.125\",\"unit\":\"mA\",\"currentValue\":%d345,"
+				 "\"lowestValue\":-12345,\"highestValue\":%d9876,\"currentRawValue\":%d.5,"
+				 "\"logFrequency\":\"1/s\",\"reportFrequency\":\"OFF\",\"advMode\":0,"
+				 "\"calibrationParam\":\"0,\",\"resolution\":0.001,\"sensorState\":0,"
+				 "\"signalValue\":%d.25,\"signalUnit\":\"mA\",\"signalRange\":\"4...20\","
+				 "\"valueRange\":\"0...1000\",\"signalBias\":0,\"signalSampling\":0,"
+				 "\"enabled\":1,\"note\":\"path\\/to\\/sensor\"}",
+				 i, i, i, i, i, i, i);
+		res += buf;
+	}
+	res += ",\"dataLogger\":{\"logicalName\":\"\",\"advertisedValue\":\"OFF\",\"currentRunIndex\":0,"
+		"\"timeUTC\":0,\"recording\":0,\"autoStart\":0,\"beaconDriven\":0,\"clearHistory\":0},"
+		"\"files\":{\"logicalName\":\"\",\"advertisedValue\":\"0\",\"filesCount\":0,\"freeSpace\":51200}}";
+	return res;
+}
+
+// Converts a JSON document into the compact array form sent by devices in
+// reply to api.json?fw=..., where object values are listed without keys
+static string makeCompactJson(YJSONContent* node)
+{
+	string res;
+	if (node->getJSONType() == OBJECT)
+	{
+		YJSONObject* obj = (YJSONObject*)node;
+		res = "[";
+		for (unsigned i = 0; i < obj->keys().size(); i++)
+		{
+			if (i > 0) res += ",";
+			res += makeCompactJson(obj->get(obj->getKeyFromIdx(i)));
+		}
+		res += "]";
+		return res;
+	}
+	return node->toJSON();
+}
+
+static string loadFile(const char* path)
+{
+	string res;
+	FILE* f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		return res;
+	}
+	char buf[4096];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+	{
+		res.append(buf, len);
+	}
+	fclose(f);
+	return res;
+}
+
+// Parses a document the way YDevice::requestAPI does. In lazy mode, only
+// the members are indexed and a single function is then loaded, as done by
+// YFunction::_load_unsafe
+static YJSONObject* parseDoc(const string& json, YJSONObject* reference, const char* lazyKey)
+{
+	YJSONObject* obj = new YJSONObject(json, 0, (int)json.length());
+	if (lazyKey)
+	{
+		obj->parseLazy(reference);
+		obj->getYJSONObject(lazyKey);
+	}
+	else if (reference)
+	{
+		obj->parseWithRef(reference);
+	}
+	else
+	{
+		obj->parse();
+	}
+	return obj;
+}
+
+// Parses the document repeatedly for at least minMs, and reports the mean
+// parse time along with the heap usage and allocation count of one parse
+static void benchParse(const char* name, const string& json, YJSONObject* reference, const char* lazyKey, int minMs)
+{
+	size_t base = heapCurrent;
+	size_t allocs0 = heapAllocs;
+	heapPeak = heapCurrent;
+	YJSONObject* obj = parseDoc(json, reference, lazyKey);
+	size_t peak = heapPeak - base;
+	size_t retained = heapCurrent - base;
+	size_t allocs = heapAllocs - allocs0;
+	delete obj;
+
+	int count = 0;
+	u64 start = YAPI::GetTickCount();
+	u64 elapsed;
+	do
+	{
+		for (int i = 0; i < 10; i++)
+		{
+			obj = parseDoc(json, reference, lazyKey);
+			delete obj;
+		}
+		count += 10;
+		elapsed = YAPI::GetTickCount() - start;
+	}
+	while (elapsed < (u64)minMs);
+
+	printf("{\"bench\":\"json_parse\",\"case\":\"%s\",\"bytes\":%u,\"iterations\":%d,"
+		   "\"us_per_op\":%.2f,\"peak_heap\":%u,\"retained_heap\":%u,\"allocs\":%u}\n",
+		   name, (unsigned)json.length(), count, elapsed * 1000.0 / count,
+		   (unsigned)peak, (unsigned)retained, (unsigned)allocs);
+}
+
+// Exposes the generated attribute decoder of a sensor class
+class BenchGenericSensor : public YGenericSensor
+{
+public:
+	BenchGenericSensor() : YGenericSensor("bench")
+	{}
+
+	int parseAttr(YJSONObject* json_val)
+	{
+		return _parseAttr(json_val);
+	}
+};
+
+// Decodes the attributes of every function of an already parsed document,
+// as done on each cache refresh, and reports the mean time per function
+static void benchParseAttr(const char* name, const string& json, int minMs)
+{
+	BenchGenericSensor sensor;
+	YJSONObject* obj = parseDoc(json, NULL, NULL);
+	vector<YJSONObject*> funcs;
+	vector<string> keys = obj->keys();
+	for (unsigned i = 0; i < keys.size(); i++)
+	{
+		YJSONContent* item = obj->get(keys[i]);
+		if (item->getJSONType() == OBJECT)
+		{
+			funcs.push_back((YJSONObject*)item);
+		}
+	}
+	int count = 0;
+	u64 start = YAPI::GetTickCount();
+	u64 elapsed;
+	do
+	{
+		for (int i = 0; i < 10; i++)
+		{
+			for (unsigned f = 0; f < funcs.size(); f++)
+			{
+				sensor.parseAttr(funcs[f]);
+			}
+		}
+		count += 10 * (int)funcs.size();
+		elapsed = YAPI::GetTickCount() - start;
+	}
+	while (elapsed < (u64)minMs);
+	delete obj;
+
+	printf("{\"bench\":\"parse_attr\",\"case\":\"%s\",\"functions\":%u,\"iterations\":%d,"
+		   "\"us_per_op\":%.3f}\n", name, (unsigned)funcs.size(), count, elapsed * 1000.0 / count);
+}
+
+static void benchDocument(const char* name, const string& json, int minMs)
+{
+	char casename[256];
+	benchParse(name, json, NULL, NULL, minMs);
+	// same document as received from a device which already knows the reference
+	try
+	{
+		YJSONObject* reference = new YJSONObject(json, 0, (int)json.length());
+		reference->parse();
+		string compact = makeCompactJson(reference);
+		snprintf(casename, sizeof(casename), "%s-fw", name);
+		benchParse(casename, compact, reference, NULL, minMs);
+		// load a single function, the last one to be the worst case
+		string lastKey = reference->getKeyFromIdx((int)reference->keys().size() - 1);
+		snprintf(casename, sizeof(casename), "%s-lazy1", name);
+		benchParse(casename, json, NULL, lastKey.c_str(), minMs);
+		snprintf(casename, sizeof(casename), "%s-fw-lazy1", name);
+		benchParse(casename, compact, reference, lastKey.c_str(), minMs);
+		delete reference;
+	}
+	catch (std::exception& ex)
+	{
+		fprintf(stderr, "%s: %s\n", name, ex.what());
+	}
+	benchParseAttr(name, json, minMs);
+}
+
+int main(int argc, const char* argv[])
+{
+	int minMs = 500;
+	int i;
+
+	// real api.json payloads captured from devices can be passed as arguments
+	for (i = 1; i < argc; i++)
+	{
+		string json = loadFile(argv[i]);
+		if (json.length() == 0)
+		{
+			fprintf(stderr, "Unable to read %s\n", argv[i]);
+			return 1;
+		}
+		benchDocument(argv[i], json, minMs);
+	}
+	if (argc > 1)
+	{
+		return 0;
+	}
+	benchDocument("api-4fn", makeApiJson(4), minMs);
+	benchDocument("api-20fn", makeApiJson(20), minMs);
+	benchDocument("api-80fn", makeApiJson(80), minMs);
+	return 0;
+}
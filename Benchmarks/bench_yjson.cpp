@@ -0,0 +1,185 @@
+/*********************************************************************
+ *
+ * Micro-benchmarks for the low-level JSON lexer used on hub replies
+ *
+ * - - - - - - - - - License information: - - - - - - - - -
+ *
+ *  Copyright (C) 2011 and beyond by Yoctopuce Sarl, Switzerland.
+ *
+ *  Yoctopuce Sarl (hereafter Licensor) grants to you a perpetual
+ *  non-exclusive license to use, modify, copy and integrate this
+ *  file into your software for the sole purpose of interfacing 
+ *  with Yoctopuce products. 
+ *
+ *  You may reproduce and distribute copies of this file in 
+ *  source or object form, as long as the sole purpose of this
+ *  code is to interface with Yoctopuce products. You must retain 
+ *  this notice in the distributed source file.
+ *
+ *  You should refer to Yoctopuce General Terms and Conditions
+ *  for additional information regarding your rights and 
+ *  obligations.
+ *
+ *  THE SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING 
+ *  WITHOUT LIMITATION, ANY WARRANTY OF MERCHANTABILITY, FITNESS 
+ *  FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO
+ *  EVENT SHALL LICENSOR BE LIABLE FOR ANY INCIDENTAL, SPECIAL,
+ *  INDIRECT OR CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA, 
+ *  COST OF PROCUREMENT OF SUBSTITUTE GOODS, TECHNOLOGY OR 
+ *  SERVICES, ANY CLAIMS BY THIRD PARTIES (INCLUDING BUT NOT 
+ *  LIMITED TO ANY DEFENSE THEREOF), ANY CLAIMS FOR INDEMNITY OR
+ *  CONTRIBUTION, OR OTHER SIMILAR COSTS, WHETHER ASSERTED ON THE
+ *  BASIS OF CONTRACT, TORT (INCLUDING NEGLIGENCE), BREACH OF
+ *  WARRANTY, OR OTHERWISE.
+ *
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "yocto_api.h"
+#include "yapi/yjson.h"
+
+using namespace std;
+
+// Builds the reply of a hub to "GET /api.json" as used by the network
+// enumeration, with ndev devices and nfunc functions per device
+static string makeHubReply(int ndev, int nfunc)
+{
+	char buf[1024];
+	string res = "OK\r\n\r\n{\"module\":{\"productName\":\"YoctoHub-Ethernet\",\"serialNumber\":\"YHUBETH1-12345\","
+		"\"logicalName\":\"benchHub\",\"productId\":14,\"productRelease\":1,\"firmwareRelease\":\"27180\","
+		"\"persistentSettings\":1,\"luminosity\":50,\"beacon\":0,\"upTime\":123456789,\"usbCurrent\":120,"
+		"\"rebootCountdown\":0,\"userVar\":0},"
+		"\"network\":{\"logicalName\":\"\",\"advertisedValue\":\"192.168.1.42\",\"readiness\":4,"
+		"\"macAddress\":\"00:23:C2:12:34:56\",\"ipAddress\":\"192.168.1.42\",\"subnetMask\":\"255.255.255.0\","
+		"\"router\":\"192.168.1.1\",\"ipConfig\":\"DHCP:169.254.1.42\\/16\\/169.254.0.1\","
+		"\"primaryDNS\":\"8.8.8.8\",\"secondaryDNS\":\"8.8.4.4\",\"ntpServer\":\"pool.ntp.org\","
+		"\"userPassword\":\"\",\"adminPassword\":\"\",\"httpPort\":80,\"defaultPage\":\"index.html\","
+		"\"discoverable\":1,\"wwwWatchdogDelay\":0,\"callbackUrl\":\"http:\\/\\/www.example.com\\/yoctopuce\\/callback.php\","
+		"\"callbackMethod\":1,\"callbackEncoding\":0,\"callbackCredentials\":\"\",\"callbackInitialDelay\":0,"
+		"\"callbackSchedule\":\"\",\"callbackMinDelay\":60,\"callbackMaxDelay\":600,\"poeCurrent\":0}";
+	for (int p = 1; p <= 4; p++)
+	{
+		snprintf(buf, sizeof(buf), ",\"hubPort%d\":{\"logicalName\":\"YOCTO%05d\",\"advertisedValue\":\"ON\","
+				 "\"enabled\":1,\"portState\":2,\"baudRate\":12}", p, p);
+		res += buf;
+	}
+	res += ",\"services\":{\"whitePages\":[";
+	for (int d = 0; d < ndev; d++)
+	{
+		snprintf(buf, sizeof(buf), "%s{\"serialNumber\":\"YSENSOR1-%05d\",\"logicalName\":\"sensor%d\","
+				 "\"productName\":\"Yocto-Benchmark-Sensor\",\"productId\":%d,"
+				 "\"networkUrl\":\"\\/bySerial\\/YSENSOR1-%05d\\/api\",\"beacon\":0,\"index\":%d}",
+				 (d ? "," : ""), d, d, 100 + d, d, d);
+		res += buf;
+	}
+	res += "],\"yellowPages\":{\"GenericSensor\":[";
+	for (int d = 0; d < ndev; d++)
+	{
+		for (int f = 1; f <= nfunc; f++)
+		{
+			snprintf(buf, sizeof(buf), "%s{\"baseType\":1,\"hardwareId\":\"YSENSOR1-%05d.genericSensor%d\","
+					 "\"logicalName\":\"channel%d\",\"advertisedValue\":\"%d.125\",\"index\":%d}",
+					 (d || f > 1 ? "," : ""), d, f, f, d * 10 + f, f);
+			res += buf;
+		}
+	}
+	res += "],\"DataLogger\":[";
+	for (int d = 0; d < ndev; d++)
+	{
+		snprintf(buf, sizeof(buf), "%s{\"baseType\":0,\"hardwareId\":\"YSENSOR1-%05d.dataLogger\","
+				 "\"logicalName\":\"\",\"advertisedValue\":\"OFF\",\"index\":%d}",
+				 (d ? "," : ""), d, nfunc + 1);
+		res += buf;
+	}
+	res += "]}}}";
+	return res;
+}
+
+// Runs the state machine over the whole reply, fed in 1500 bytes chunks as
+// done by yNetHubEnumEx. In enumeration mode, all top-level members except
+// "services" are skipped. Returns the number of tokens and a checksum of
+// their content, so that different parser builds can be compared
+static int walkReply(const string& reply, bool enumMode, unsigned* checksum)
+{
+	yJsonStateMachine j;
+	yJsonRetCode jstate = YJSON_NEED_INPUT;
+	const char* src = reply.c_str();
+	const char* end = src + reply.length();
+	unsigned sum = 0;
+	int ntok = 0;
+
+	memset(&j, 0, sizeof(j));
+	j.st = YJSON_HTTP_START;
+	while (src < end && jstate == YJSON_NEED_INPUT)
+	{
+		j.src = src;
+		j.end = (end - src > 1500 ? src + 1500 : end);
+		src = j.end;
+		jstate = yJsonParse(&j);
+		while (jstate == YJSON_PARSE_AVAIL)
+		{
+			ntok++;
+			sum = sum * 31 + (unsigned)j.st;
+			for (const char* p = j.token; *p; p++)
+			{
+				sum = sum * 31 + (unsigned char)*p;
+			}
+			if (enumMode && j.st == YJSON_PARSE_MEMBNAME && j.depth == 1 && strcmp(j.token, "services") != 0)
+			{
+				yJsonSkip(&j, 1);
+			}
+			jstate = yJsonParse(&j);
+		}
+	}
+	*checksum = sum;
+	return (jstate == YJSON_SUCCESS || jstate == YJSON_NEED_INPUT ? ntok : -1);
+}
+
+// Walks the reply repeatedly for at least minMs, and reports the mean time
+// per walk along with the resulting throughput
+static void benchWalk(const char* name, const string& reply, bool enumMode, int minMs)
+{
+	unsigned checksum;
+	int ntok = walkReply(reply, enumMode, &checksum);
+	int count = 0;
+	u64 start = YAPI::GetTickCount();
+	u64 elapsed;
+	do
+	{
+		for (int i = 0; i < 10; i++)
+		{
+			unsigned dummy;
+			walkReply(reply, enumMode, &dummy);
+		}
+		count += 10;
+		elapsed = YAPI::GetTickCount() - start;
+	}
+	while (elapsed < (u64)minMs);
+
+	double us = elapsed * 1000.0 / count;
+	printf("{\"bench\":\"yjson_parse\",\"case\":\"%s%s\",\"bytes\":%u,\"iterations\":%d,"
+		   "\"us_per_op\":%.2f,\"mb_per_s\":%.1f,\"tokens\":%d,\"checksum\":\"%08x\"}\n",
+		   name, (enumMode ? "-enum" : ""), (unsigned)reply.length(), count, us,
+		   (us > 0 ? reply.length() / us : 0.0), ntok, checksum);
+}
+
+int main(void)
+{
+	int minMs = 500;
+	int sizes[][2] = {{4, 2}, {32, 4}, {128, 8}};
+
+	for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		char name[64];
+		string reply = makeHubReply(sizes[i][0], sizes[i][1]);
+		snprintf(name, sizeof(name), "hub-%ddev", sizes[i][0]);
+		benchWalk(name, reply, false, minMs);
+		benchWalk(name, reply, true, minMs);
+	}
+	return 0;
+}
@@ -0,0 +1,118 @@
+/*********************************************************************
+ *
+ * Standalone VirtualHub simulator, for benchmarks run against a
+ * separate process
+ *
+ * - - - - - - - - - License information: - - - - - - - - -
+ *
+ *  Copyright (C) 2011 and beyond by Yoctopuce Sarl, Switzerland.
+ *
+ *  Yoctopuce Sarl (hereafter Licensor) grants to you a perpetual
+ *  non-exclusive license to use, modify, copy and integrate this
+ *  file into your software for the sole purpose of interfacing
+ *  with Yoctopuce products.
+ *
+ *  You may reproduce and distribute copies of this file in
+ *  source or object form, as long as the sole purpose of this
+ *  code is to interface with Yoctopuce products. You must retain
+ *  this notice in the distributed source file.
+ *
+ *  You should refer to Yoctopuce General Terms and Conditions
+ *  for additional information regarding your rights and
+ *  obligations.
+ *
+ *  THE SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING
+ *  WITHOUT LIMITATION, ANY WARRANTY OF MERCHANTABILITY, FITNESS
+ *  FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO
+ *  EVENT SHALL LICENSOR BE LIABLE FOR ANY INCIDENTAL, SPECIAL,
+ *  INDIRECT OR CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA,
+ *  COST OF PROCUREMENT OF SUBSTITUTE GOODS, TECHNOLOGY OR
+ *  SERVICES, ANY CLAIMS BY THIRD PARTIES (INCLUDING BUT NOT
+ *  LIMITED TO ANY DEFENSE THEREOF), ANY CLAIMS FOR INDEMNITY OR
+ *  CONTRIBUTION, OR OTHER SIMILAR COSTS, WHETHER ASSERTED ON THE
+ *  BASIS OF CONTRACT, TORT (INCLUDING NEGLIGENCE), BREACH OF
+ *  WARRANTY, OR OTHERWISE.
+ *
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "yhubsim.h"
+
+static void usage(const char* prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"  -p port      TCP port (default: first free port)\n"
+		"  -m modules   number of modules (default: 4)\n"
+		"  -b serial    serial number of the first module (default: 1)\n"
+		"  -s sensors   temperature functions per module (default: 2)\n"
+		"  -v rate      value notifications per second and sensor (default: 10)\n"
+		"  -r rate      timed reports per second and module (default: 0)\n"
+		"  -l ms        reply latency\n"
+		"  -j ms        random extra latency\n"
+		"  -n ratio     fraction of notifications dropped\n"
+		"  -q ratio     fraction of requests left without reply\n"
+		"  -R runs      datalogger runs per sensor (default: 3)\n"
+		"  -N rows      measures per datalogger run (default: 600)\n"
+		"  -S seed      random seed\n"
+		"  -d seconds   stop after this delay (default: run until killed)\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+	YHubSimConfig config;
+	int duration = 0;
+	int opt;
+	string errmsg;
+
+	while ((opt = getopt(argc, argv, "p:m:b:s:v:r:l:j:n:q:R:N:S:d:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'p': config.port = atoi(optarg); break;
+		case 'm': config.modules = atoi(optarg); break;
+		case 'b': config.serialBase = atoi(optarg); break;
+		case 's': config.sensors = atoi(optarg); break;
+		case 'v': config.valueRate = atof(optarg); break;
+		case 'r': config.reportRate = atof(optarg); break;
+		case 'l': config.latencyMs = atoi(optarg); break;
+		case 'j': config.jitterMs = atoi(optarg); break;
+		case 'n': config.notifLoss = atof(optarg); break;
+		case 'q': config.requestLoss = atof(optarg); break;
+		case 'R': config.loggerRuns = atoi(optarg); break;
+		case 'N': config.loggerRows = atoi(optarg); break;
+		case 'S': config.seed = (unsigned)atoi(optarg); break;
+		case 'd': duration = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	YHubSim sim(config);
+	if (sim.start(errmsg) != YAPI_SUCCESS)
+	{
+		fprintf(stderr, "%s\n", errmsg.c_str());
+		return 1;
+	}
+	// first line tells the driving script where to connect
+	printf("{\"url\":\"%s\",\"ws\":\"%s\",\"hub\":\"%s\",\"modules\":%d}\n",
+	       sim.url(false).c_str(), sim.url(true).c_str(), sim.hubSerial().c_str(), config.modules);
+	fflush(stdout);
+	for (int elapsed = 0; duration == 0 || elapsed < duration; elapsed++)
+	{
+		sleep(1);
+	}
+	sim.stop();
+	YHubSimStats stats = sim.stats();
+	printf("{\"connections\":%llu,\"requests\":%llu,\"droppedRequests\":%llu,\"notifications\":%llu,"
+	       "\"droppedNotifications\":%llu,\"bytesSent\":%llu,\"bytesReceived\":%llu}\n",
+	       (unsigned long long)stats.connections, (unsigned long long)stats.requests,
+	       (unsigned long long)stats.droppedRequests, (unsigned long long)stats.notifications,
+	       (unsigned long long)stats.droppedNotifications, (unsigned long long)stats.bytesSent,
+	       (unsigned long long)stats.bytesReceived);
+	return 0;
+}
@@ -0,0 +1,1785 @@
+/*********************************************************************
+ *
+ * Local VirtualHub-compatible simulator used by the benchmarks
+ *
+ * - - - - - - - - - License information: - - - - - - - - -
+ *
+ *  Copyright (C) 2011 and beyond by Yoctopuce Sarl, Switzerland.
+ *
+ *  Yoctopuce Sarl (hereafter Licensor) grants to you a perpetual
+ *  non-exclusive license to use, modify, copy and integrate this
+ *  file into your software for the sole purpose of interfacing
+ *  with Yoctopuce products.
+ *
+ *  You may reproduce and distribute copies of this file in
+ *  source or object form, as long as the sole purpose of this
+ *  code is to interface with Yoctopuce products. You must retain
+ *  this notice in the distributed source file.
+ *
+ *  You should refer to Yoctopuce General Terms and Conditions
+ *  for additional information regarding your rights and
+ *  obligations.
+ *
+ *  THE SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING
+ *  WITHOUT LIMITATION, ANY WARRANTY OF MERCHANTABILITY, FITNESS
+ *  FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO
+ *  EVENT SHALL LICENSOR BE LIABLE FOR ANY INCIDENTAL, SPECIAL,
+ *  INDIRECT OR CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA,
+ *  COST OF PROCUREMENT OF SUBSTITUTE GOODS, TECHNOLOGY OR
+ *  SERVICES, ANY CLAIMS BY THIRD PARTIES (INCLUDING BUT NOT
+ *  LIMITED TO ANY DEFENSE THEREOF), ANY CLAIMS FOR INDEMNITY OR
+ *  CONTRIBUTION, OR OTHER SIMILAR COSTS, WHETHER ASSERTED ON THE
+ *  BASIS OF CONTRACT, TORT (INCLUDING NEGLIGENCE), BREACH OF
+ *  WARRANTY, OR OTHERWISE.
+ *
+ *********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+
+#include "yhubsim.h"
+
+#define SIM_WS_MAX_DATA        124     // payload of a frame, after the stream header
+#define SIM_UPLOAD_ACK_START   2108    // first upload ack expected by the client
+#define SIM_UPLOAD_ACK_STEP    1024
+#define SIM_ASYNC_WAIT_US      3000    // time given to a trailing async-close frame
+#define SIM_PING_US            1000000
+
+static u64 simNow(void)
+{
+	return (u64)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void simSleep(int ms)
+{
+	if (ms > 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+	}
+}
+
+//
+// Helpers for the WebSocket handshake. The library has its own SHA-1, but
+// it keeps its state in a static buffer that the client side of the same
+// process may be using at the same time.
+//
+
+static u32 simRol(u32 v, int n)
+{
+	return (v << n) | (v >> (32 - n));
+}
+
+static void simSHA1(const string& text, u8 digest[20])
+{
+	u32 h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+	string msg = text;
+	u64 bits = (u64)text.size() * 8;
+	msg += (char)0x80;
+	while (msg.size() % 64 != 56)
+	{
+		msg += (char)0;
+	}
+	for (int i = 7; i >= 0; i--)
+	{
+		msg += (char)(bits >> (i * 8));
+	}
+	for (size_t blk = 0; blk < msg.size(); blk += 64)
+	{
+		u32 w[80];
+		u32 a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for (int i = 0; i < 16; i++)
+		{
+			const u8* p = (const u8*)msg.data() + blk + i * 4;
+			w[i] = ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | p[3];
+		}
+		for (int i = 16; i < 80; i++)
+		{
+			w[i] = simRol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+		}
+		for (int i = 0; i < 80; i++)
+		{
+			u32 f, k, tmp;
+			if (i < 20)
+			{
+				f = (b & c) | (~b & d);
+				k = 0x5A827999;
+			}
+			else if (i < 40)
+			{
+				f = b ^ c ^ d;
+				k = 0x6ED9EBA1;
+			}
+			else if (i < 60)
+			{
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8F1BBCDC;
+			}
+			else
+			{
+				f = b ^ c ^ d;
+				k = 0xCA62C1D6;
+			}
+			tmp = simRol(a, 5) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = simRol(b, 30);
+			b = a;
+			a = tmp;
+		}
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+	}
+	for (int i = 0; i < 20; i++)
+	{
+		digest[i] = (u8)(h[i / 4] >> (24 - (i % 4) * 8));
+	}
+}
+
+static string simBase64(const u8* data, int len)
+{
+	static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	string res;
+	for (int i = 0; i < len; i += 3)
+	{
+		u32 v = (u32)data[i] << 16;
+		if (i + 1 < len) v |= (u32)data[i + 1] << 8;
+		if (i + 2 < len) v |= data[i + 2];
+		res += alphabet[(v >> 18) & 63];
+		res += alphabet[(v >> 12) & 63];
+		res += (i + 1 < len ? alphabet[(v >> 6) & 63] : '=');
+		res += (i + 2 < len ? alphabet[v & 63] : '=');
+	}
+	return res;
+}
+
+// Returns the value of a header line, or an empty string
+static string simHeader(const string& req, const char* name)
+{
+	size_t namelen = strlen(name);
+	size_t pos = req.find("\r\n");
+	size_t hdrend = req.find("\r\n\r\n");
+	while (pos != string::npos && pos < hdrend)
+	{
+		size_t eol = req.find("\r\n", pos + 2);
+		if (eol == string::npos) break;
+		if (eol - pos - 2 > namelen && strncasecmp(req.c_str() + pos + 2, name, namelen) == 0 && req[pos + 2 + namelen] == ':')
+		{
+			size_t start = pos + 3 + namelen;
+			while (start < eol && req[start] == ' ') start++;
+			return req.substr(start, eol - start);
+		}
+		pos = eol;
+	}
+	return "";
+}
+
+// Tells whether a request (headers and POST body) has been fully received
+static bool simRequestComplete(const string& req)
+{
+	size_t hdrend = req.find("\r\n\r\n");
+	if (hdrend == string::npos)
+	{
+		return false;
+	}
+	if (req.compare(0, 5, "POST ") != 0)
+	{
+		return true;
+	}
+	string len = simHeader(req, "Content-Length");
+	if (len != "")
+	{
+		return req.size() >= hdrend + 4 + (size_t)atoi(len.c_str());
+	}
+	string type = simHeader(req, "Content-Type");
+	size_t bpos = type.find("boundary=");
+	if (bpos == string::npos)
+	{
+		return true;
+	}
+	string endmark = "--" + type.substr(bpos + 9) + "--";
+	return req.find(endmark, hdrend) != string::npos;
+}
+
+static string simUrlDecode(const string& str)
+{
+	string res;
+	for (size_t i = 0; i < str.size(); i++)
+	{
+		if (str[i] == '%' && i + 2 < str.size() && isxdigit((u8)str[i + 1]) && isxdigit((u8)str[i + 2]))
+		{
+			res += (char)strtol(str.substr(i + 1, 2).c_str(), NULL, 16);
+			i += 2;
+		}
+		else
+		{
+			res += str[i];
+		}
+	}
+	return res;
+}
+
+static string simJsonString(const string& str)
+{
+	string res = "\"";
+	for (size_t i = 0; i < str.size(); i++)
+	{
+		if (str[i] == '"' || str[i] == '\\') res += '\\';
+		res += str[i];
+	}
+	return res + "\"";
+}
+
+static string simFormat(const char* fmt, double val)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), fmt, val);
+	return buf;
+}
+
+static string simInt(s64 val)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%lld", (long long)val);
+	return buf;
+}
+
+// Appends the datalogger encoding of a 16-bit word (see YAPI::_decodeWords)
+static void simEncodeWord(string& res, int val)
+{
+	char c = (char)('0' + ((val >> 10) & 63));
+	res += (char)('0' + (val & 31));
+	res += (char)('0' + ((val >> 5) & 31));
+	res += (c == '\\' ? 'z' : c);
+}
+
+//
+// Data model: the hub and its synthetic modules
+//
+
+struct YHubSimAttr
+{
+	string name;
+	string value;
+	bool text;
+};
+
+struct YHubSimFunction
+{
+	string id;
+	string className;
+	int baseType;
+	int sensor;     // 1-based index of temperature functions, 0 otherwise
+	vector<YHubSimAttr> attrs;
+};
+
+struct YHubSimDevice
+{
+	string serial;
+	string product;
+	string firmware;
+	int productId;
+	bool present;   // false while the module is unplugged
+	vector<YHubSimFunction> functions;
+};
+
+class YHubSimModel
+{
+public:
+	YHubSimModel(const YHubSimConfig& config, const string& hubSerial);
+
+	// Serves a REST request on a device, returns the HTTP status code
+	int handle(const string& serial, const string& path, const string& query,
+	           string& body, string& contentType, vector<string>& notifications);
+	string valueNotification(int devydx, int sensor);
+	string timedReport(int devydx);
+	bool present(int devydx);
+	string plug(int devydx, bool present);
+
+	vector<YHubSimDevice> devices; // devices[0] is the hub itself
+
+private:
+	double sensorValue(int devydx, int sensor, double t) const;
+	string attrValue(int devydx, const YHubSimFunction& fn, const YHubSimAttr& attr) const;
+	string attrJson(int devydx, const YHubSimFunction& fn, const YHubSimAttr& attr) const;
+	string functionJson(int devydx, const YHubSimFunction& fn) const;
+	string deviceJson(int devydx) const;
+	string compactJson(int devydx) const;
+	string servicesJson(void) const;
+	string setAttr(int devydx, YHubSimFunction& fn, const string& name, const string& value);
+	string loggerJson(int devydx, const string& id, int run, bool rows) const;
+	string streamJson(int devydx, int sensor, int run, bool rows) const;
+
+	const YHubSimConfig& _config;
+	std::mutex _lock;
+	u64 _startUs;
+	u32 _startUtc;
+};
+
+static void simAddAttr(YHubSimFunction& fn, const char* name, const string& value, bool text)
+{
+	YHubSimAttr attr;
+	attr.name = name;
+	attr.value = value;
+	attr.text = text;
+	fn.attrs.push_back(attr);
+}
+
+static YHubSimFunction simModuleFunction(const string& serial, const char* product, int productId, const string& firmware)
+{
+	YHubSimFunction fn;
+	fn.id = "module";
+	fn.className = "Module";
+	fn.baseType = 0;
+	fn.sensor = 0;
+	simAddAttr(fn, "productName", product, true);
+	simAddAttr(fn, "serialNumber", serial, true);
+	simAddAttr(fn, "logicalName", "", true);
+	simAddAttr(fn, "productId", simInt(productId), false);
+	simAddAttr(fn, "productRelease", "1", false);
+	simAddAttr(fn, "firmwareRelease", firmware, true);
+	simAddAttr(fn, "persistentSettings", "0", false);
+	simAddAttr(fn, "luminosity", "50", false);
+	simAddAttr(fn, "beacon", "0", false);
+	simAddAttr(fn, "upTime", "", false);
+	simAddAttr(fn, "usbCurrent", "21", false);
+	simAddAttr(fn, "rebootCountdown", "0", false);
+	simAddAttr(fn, "userVar", "0", false);
+	return fn;
+}
+
+YHubSimModel::YHubSimModel(const YHubSimConfig& config, const string& hubSerial) : _config(config)
+{
+	YHubSimDevice hub;
+	hub.serial = hubSerial;
+	hub.product = "VirtualHub";
+	hub.firmware = "51000";
+	hub.productId = 0;
+	hub.present = true;
+	hub.functions.push_back(simModuleFunction(hub.serial, "VirtualHub", 0, hub.firmware));
+	devices.push_back(hub);
+	for (int i = 1; i <= config.modules; i++)
+	{
+		YHubSimDevice dev;
+		// sized for any int, although serialBase is clamped to five digits
+		char serial[32];
+		snprintf(serial, sizeof(serial), "TMPSENS1-%05d", config.serialBase + i - 1);
+		dev.serial = serial;
+		dev.product = "Yocto-Thermistor";
+		dev.firmware = "60000";
+		dev.productId = 12;
+		dev.present = true;
+		dev.functions.push_back(simModuleFunction(dev.serial, "Yocto-Thermistor", 12, dev.firmware));
+		for (int s = 1; s <= config.sensors; s++)
+		{
+			YHubSimFunction fn;
+			fn.id = "temperature" + simInt(s);
+			fn.className = "Temperature";
+			fn.baseType = 1;
+			fn.sensor = s;
+			simAddAttr(fn, "logicalName", "", true);
+			simAddAttr(fn, "advertisedValue", "", true);
+			simAddAttr(fn, "unit", "'C", true);
+			simAddAttr(fn, "currentValue", "", false);
+			simAddAttr(fn, "lowestValue", "983040", false);
+			simAddAttr(fn, "highestValue", "1638400", false);
+			simAddAttr(fn, "currentRawValue", "", false);
+			simAddAttr(fn, "logFrequency", "1/s", true);
+			simAddAttr(fn, "reportFrequency", "OFF", true);
+			simAddAttr(fn, "advMode", "0", false);
+			simAddAttr(fn, "calibrationParam", "0,", true);
+			simAddAttr(fn, "resolution", "655", false);
+			simAddAttr(fn, "sensorState", "0", false);
+			simAddAttr(fn, "sensorType", "0", false);
+			simAddAttr(fn, "signalValue", "0", false);
+			simAddAttr(fn, "signalUnit", "Ohm", true);
+			simAddAttr(fn, "command", "", true);
+			dev.functions.push_back(fn);
+		}
+		YHubSimFunction logger;
+		logger.id = "dataLogger";
+		logger.className = "DataLogger";
+		logger.baseType = 0;
+		logger.sensor = 0;
+		simAddAttr(logger, "logicalName", "", true);
+		simAddAttr(logger, "advertisedValue", "OFF", true);
+		simAddAttr(logger, "currentRunIndex", simInt(config.loggerRuns), false);
+		simAddAttr(logger, "timeUTC", "", false);
+		simAddAttr(logger, "recording", "0", false);
+		simAddAttr(logger, "autoStart", "0", false);
+		simAddAttr(logger, "beaconDriven", "0", false);
+		simAddAttr(logger, "usage", "0", false);
+		simAddAttr(logger, "clearHistory", "0", false);
+		dev.functions.push_back(logger);
+		devices.push_back(dev);
+	}
+	_startUs = simNow();
+	_startUtc = (u32)time(NULL);
+}
+
+// Values follow a slow sine wave with a per-sensor phase, in 1/100 degrees
+double YHubSimModel::sensorValue(int devydx, int sensor, double t) const
+{
+	double val = 20.0 + 5.0 * sin(2 * M_PI * t / 60.0 + devydx * 0.7 + sensor * 0.3);
+	return floor(val * 100 + 0.5) / 100;
+}
+
+string YHubSimModel::attrValue(int devydx, const YHubSimFunction& fn, const YHubSimAttr& attr) const
+{
+	double t = (simNow() - _startUs) / 1e6;
+	if (attr.name == "upTime")
+	{
+		return simInt((s64)(t * 1000));
+	}
+	if (attr.name == "timeUTC")
+	{
+		return simInt((s64)time(NULL));
+	}
+	if (fn.sensor)
+	{
+		if (attr.name == "advertisedValue")
+		{
+			return simFormat("%.2f", sensorValue(devydx, fn.sensor, t));
+		}
+		if (attr.name == "currentValue" || attr.name == "currentRawValue")
+		{
+			return simInt((s64)floor(sensorValue(devydx, fn.sensor, t) * 65536 + 0.5));
+		}
+	}
+	return attr.value;
+}
+
+string YHubSimModel::attrJson(int devydx, const YHubSimFunction& fn, const YHubSimAttr& attr) const
+{
+	string val = attrValue(devydx, fn, attr);
+	return attr.text ? simJsonString(val) : val;
+}
+
+string YHubSimModel::functionJson(int devydx, const YHubSimFunction& fn) const
+{
+	string res = "{";
+	for (size_t i = 0; i < fn.attrs.size(); i++)
+	{
+		if (i > 0) res += ",";
+		res += simJsonString(fn.attrs[i].name) + ":" + attrJson(devydx, fn, fn.attrs[i]);
+	}
+	return res + "}";
+}
+
+string YHubSimModel::deviceJson(int devydx) const
+{
+	const YHubSimDevice& dev = devices[devydx];
+	string res = "{";
+	for (size_t i = 0; i < dev.functions.size(); i++)
+	{
+		if (i > 0) res += ",";
+		res += simJsonString(dev.functions[i].id) + ":" + functionJson(devydx, dev.functions[i]);
+	}
+	if (devydx == 0)
+	{
+		res += ",\"services\":" + servicesJson();
+	}
+	return res + "}";
+}
+
+// Reply to api.json?fw=..., attribute values only, in the order of the full reply
+string YHubSimModel::compactJson(int devydx) const
+{
+	const YHubSimDevice& dev = devices[devydx];
+	string res = "[";
+	for (size_t i = 0; i < dev.functions.size(); i++)
+	{
+		const YHubSimFunction& fn = dev.functions[i];
+		if (i > 0) res += ",";
+		res += "[";
+		for (size_t j = 0; j < fn.attrs.size(); j++)
+		{
+			if (j > 0) res += ",";
+			res += attrJson(devydx, fn, fn.attrs[j]);
+		}
+		res += "]";
+	}
+	return res + "]";
+}
+
+string YHubSimModel::servicesJson(void) const
+{
+	vector<string> classes;
+	vector<string> entries;
+	string res = "{\"whitePages\":[";
+	for (size_t d = 0; d < devices.size(); d++)
+	{
+		const YHubSimDevice& dev = devices[d];
+		const YHubSimFunction& module = dev.functions[0];
+		if (!dev.present) continue;
+		if (d > 0) res += ",";
+		res += "{\"serialNumber\":" + simJsonString(dev.serial) +
+			",\"logicalName\":" + simJsonString(module.attrs[2].value) +
+			",\"productName\":" + simJsonString(dev.product) +
+			",\"productId\":" + simInt(dev.productId) +
+			",\"networkUrl\":" + simJsonString(d == 0 ? "/api" : "/bySerial/" + dev.serial + "/api") +
+			",\"beacon\":" + module.attrs[8].value +
+			",\"index\":" + simInt(d) + "}";
+		for (size_t f = 0; f < dev.functions.size(); f++)
+		{
+			const YHubSimFunction& fn = dev.functions[f];
+			size_t c;
+			for (c = 0; c < classes.size(); c++)
+			{
+				if (classes[c] == fn.className) break;
+			}
+			if (c == classes.size())
+			{
+				classes.push_back(fn.className);
+				entries.push_back("");
+			}
+			string adv;
+			for (size_t a = 0; a < fn.attrs.size(); a++)
+			{
+				if (fn.attrs[a].name == "advertisedValue")
+				{
+					adv = attrValue((int)d, fn, fn.attrs[a]);
+				}
+			}
+			if (entries[c] != "") entries[c] += ",";
+			entries[c] += "{\"baseType\":" + simInt(fn.baseType) +
+				",\"hardwareId\":" + simJsonString(dev.serial + "." + fn.id) +
+				",\"logicalName\":" + simJsonString(fn.id == "module" ? fn.attrs[2].value : fn.attrs[0].value) +
+				",\"advertisedValue\":" + simJsonString(adv) +
+				",\"index\":" + simInt(f) + "}";
+		}
+	}
+	res += "],\"yellowPages\":{";
+	for (size_t c = 0; c < classes.size(); c++)
+	{
+		if (c > 0) res += ",";
+		res += simJsonString(classes[c]) + ":[" + entries[c] + "]";
+	}
+	return res + "}}";
+}
+
+// Stores a new attribute value, returns the notification to broadcast if any
+string YHubSimModel::setAttr(int devydx, YHubSimFunction& fn, const string& name, const string& value)
+{
+	static const char* readOnly[] = {
+		"productName", "serialNumber", "productId", "productRelease", "firmwareRelease", "upTime",
+		"usbCurrent", "advertisedValue", "currentValue", "currentRawValue", "currentRunIndex",
+		"timeUTC", "usage", NULL
+	};
+	const YHubSimDevice& dev = devices[devydx];
+	for (int i = 0; readOnly[i]; i++)
+	{
+		if (name == readOnly[i]) return "";
+	}
+	for (size_t i = 0; i < fn.attrs.size(); i++)
+	{
+		YHubSimAttr& attr = fn.attrs[i];
+		if (attr.name != name) continue;
+		if (!attr.text)
+		{
+			char* end;
+			strtod(value.c_str(), &end);
+			if (value == "" || *end) return "";
+		}
+		attr.value = value;
+		if (fn.id == "module" && (name == "logicalName" || name == "beacon"))
+		{
+			return "YN010" + dev.serial + "," + fn.attrs[2].value + "," + fn.attrs[8].value + "\n";
+		}
+		if (name == "logicalName")
+		{
+			return "YN014" + dev.serial + "," + fn.id + "," + value + "\n";
+		}
+		return "";
+	}
+	return "";
+}
+
+// Header of a datalogger run (scal32 format), optionally followed by its measures
+string YHubSimModel::streamJson(int devydx, int sensor, int run, bool rows) const
+{
+	int nrows = _config.loggerRows;
+	u32 utc = _startUtc - (u32)(_config.loggerRuns - run + 1) * (u32)(nrows + 60);
+	int minv = 0x7fffffff, maxv = -0x7fffffff;
+	s64 total = 0;
+	string data;
+	for (int r = 0; r < nrows; r++)
+	{
+		int avg = (int)floor(sensorValue(devydx, sensor, (double)(s64)(utc + r - _startUtc)) * 1000 + 0.5);
+		int lo = avg - 50, hi = avg + 50;
+		if (lo < minv) minv = lo;
+		if (hi > maxv) maxv = hi;
+		total += avg;
+		simEncodeWord(data, avg & 0xffff);
+		simEncodeWord(data, ((avg >> 16) & 0xffff) ^ 0x8000);
+		simEncodeWord(data, lo & 0xffff);
+		simEncodeWord(data, (lo >> 16) & 0xffff);
+		simEncodeWord(data, hi & 0xffff);
+		simEncodeWord(data, (hi >> 16) & 0xffff);
+	}
+	if (rows)
+	{
+		return "\"" + data + "\"";
+	}
+	int avg = (nrows > 0 ? (int)(total / nrows) : 0);
+	string hdr;
+	simEncodeWord(hdr, run & 0xffff);
+	simEncodeWord(hdr, run >> 16);
+	simEncodeWord(hdr, utc & 0xffff);
+	simEncodeWord(hdr, utc >> 16);
+	simEncodeWord(hdr, 0x200 | 60); // averaged, 60 samples per minute
+	simEncodeWord(hdr, 0);
+	simEncodeWord(hdr, 1);
+	simEncodeWord(hdr, nrows);
+	simEncodeWord(hdr, avg & 0xffff);
+	simEncodeWord(hdr, ((avg >> 16) & 0xffff) ^ 0x8000);
+	simEncodeWord(hdr, minv & 0xffff);
+	simEncodeWord(hdr, (minv >> 16) & 0xffff);
+	simEncodeWord(hdr, maxv & 0xffff);
+	simEncodeWord(hdr, (maxv >> 16) & 0xffff);
+	return "\"" + hdr + "\"";
+}
+
+string YHubSimModel::loggerJson(int devydx, const string& id, int run, bool rows) const
+{
+	const YHubSimDevice& dev = devices[devydx];
+	string res;
+	for (size_t f = 0; f < dev.functions.size(); f++)
+	{
+		const YHubSimFunction& fn = dev.functions[f];
+		if (!fn.sensor || (id != "" && id != fn.id)) continue;
+		if (rows)
+		{
+			if (run < 1 || run > _config.loggerRuns) return "\"\"";
+			return streamJson(devydx, fn.sensor, run, true);
+		}
+		if (res != "") res += ",";
+		res += "{\"id\":" + simJsonString(fn.id) + ",\"unit\":\"'C\",\"calib\":\"0,\",\"cal\":\"\",\"streams\":[";
+		for (int r = 1; r <= _config.loggerRuns; r++)
+		{
+			if (r > 1) res += ",";
+			res += streamJson(devydx, fn.sensor, r, false);
+		}
+		res += "]}";
+	}
+	if (id != "")
+	{
+		return (res == "" ? "{}" : res);
+	}
+	return "[" + res + "]";
+}
+
+int YHubSimModel::handle(const string& serial, const string& path, const string& query,
+                         string& body, string& contentType, vector<string>& notifications)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	vector<std::pair<string, string> > args;
+	int devydx = -1;
+
+	for (size_t d = 0; d < devices.size(); d++)
+	{
+		if (devices[d].serial == serial) devydx = (int)d;
+	}
+	if (devydx < 0 || !devices[devydx].present)
+	{
+		return 404;
+	}
+	for (size_t pos = 0; pos < query.size();)
+	{
+		size_t end = query.find('&', pos);
+		if (end == string::npos) end = query.size();
+		string arg = query.substr(pos, end - pos);
+		size_t eq = arg.find('=');
+		if (eq != string::npos)
+		{
+			args.push_back(std::make_pair(arg.substr(0, eq), simUrlDecode(arg.substr(eq + 1))));
+		}
+		pos = end + 1;
+	}
+	contentType = "application/json";
+	if (path == "api.json" || path == "api")
+	{
+		for (size_t i = 0; i < args.size(); i++)
+		{
+			if (args[i].first == "fw" && devydx > 0 && args[i].second == devices[devydx].firmware)
+			{
+				body = compactJson(devydx);
+				return 200;
+			}
+		}
+		body = deviceJson(devydx);
+		return 200;
+	}
+	if (path == "logger.json")
+	{
+		string id;
+		int run = 0;
+		bool rows = false;
+		for (size_t i = 0; i < args.size(); i++)
+		{
+			if (args[i].first == "id") id = args[i].second;
+			if (args[i].first == "run")
+			{
+				run = atoi(args[i].second.c_str());
+				rows = true;
+			}
+		}
+		body = loggerJson(devydx, id, run, rows);
+		return 200;
+	}
+	if (path == "upload.html")
+	{
+		contentType = "text/plain";
+		body = "OK";
+		return 200;
+	}
+	if (path.compare(0, 4, "api/") != 0)
+	{
+		return 404;
+	}
+	// api/<function>[.json | /[<attribute>[.json]]]
+	string funcid = path.substr(4);
+	string attrname;
+	bool json = true;
+	size_t slash = funcid.find('/');
+	if (slash != string::npos)
+	{
+		attrname = funcid.substr(slash + 1);
+		funcid = funcid.substr(0, slash);
+		if (attrname.size() >= 5 && attrname.compare(attrname.size() - 5, 5, ".json") == 0)
+		{
+			attrname = attrname.substr(0, attrname.size() - 5);
+		}
+		else if (attrname != "")
+		{
+			json = false;
+		}
+	}
+	else if (funcid.size() >= 5 && funcid.compare(funcid.size() - 5, 5, ".json") == 0)
+	{
+		funcid = funcid.substr(0, funcid.size() - 5);
+	}
+	YHubSimDevice& dev = devices[devydx];
+	for (size_t f = 0; f < dev.functions.size(); f++)
+	{
+		YHubSimFunction& fn = dev.functions[f];
+		if (fn.id != funcid) continue;
+		for (size_t i = 0; i < args.size(); i++)
+		{
+			string notif = setAttr(devydx, fn, args[i].first, args[i].second);
+			if (notif != "")
+			{
+				notifications.push_back(notif);
+			}
+		}
+		if (attrname == "")
+		{
+			body = functionJson(devydx, fn);
+			return 200;
+		}
+		for (size_t a = 0; a < fn.attrs.size(); a++)
+		{
+			if (fn.attrs[a].name != attrname) continue;
+			if (json)
+			{
+				body = attrJson(devydx, fn, fn.attrs[a]);
+			}
+			else
+			{
+				body = attrValue(devydx, fn, fn.attrs[a]);
+				contentType = "text/plain";
+			}
+			return 200;
+		}
+		return 404;
+	}
+	return 404;
+}
+
+static string simYdxPrefix(char pkttype, int devydx, int funydx)
+{
+	string res(1, pkttype);
+	if (devydx >= 128)
+	{
+		res += (char)('A' + devydx - 128);
+		res += (char)('0' + funydx + 64);
+	}
+	else
+	{
+		res += (char)('A' + devydx);
+		res += (char)('0' + funydx);
+	}
+	return res;
+}
+
+static string simHexBytes(u32 val, int nbytes)
+{
+	string res;
+	char buf[4];
+	for (int i = 0; i < nbytes; i++)
+	{
+		snprintf(buf, sizeof(buf), "%02X", (val >> (8 * i)) & 0xff);
+		res += buf;
+	}
+	return res;
+}
+
+// Short value notification: 'y', device and function index, advertised value
+string YHubSimModel::valueNotification(int devydx, int sensor)
+{
+	double t = (simNow() - _startUs) / 1e6;
+	return simYdxPrefix(NOTIFY_NETPKT_FUNCVALYDX, devydx, sensor) +
+		simFormat("%.2f", sensorValue(devydx, sensor, t)) + "\n";
+}
+
+// Timed report of all sensors of a module: device time, then one 32-bit
+// sub-second report per sensor, values in 1/1000
+string YHubSimModel::timedReport(int devydx)
+{
+	u64 now = simNow();
+	double t = (now - _startUs) / 1e6;
+	u32 utc = _startUtc + (u32)t;
+	u32 frac = (u32)((t - floor(t)) * 250);
+	string res = simYdxPrefix(NOTIFY_NETPKT_TIMEV2YDX, devydx, 15) + simHexBytes(utc, 4) + simHexBytes(frac, 1) + "\n";
+	for (int s = 1; s <= _config.sensors; s++)
+	{
+		s32 milli = (s32)floor(sensorValue(devydx, s, t) * 1000 + 0.5);
+		res += simYdxPrefix(NOTIFY_NETPKT_TIMEV2YDX, devydx, s) + simHexBytes((u32)milli, 4) + "\n";
+	}
+	return res;
+}
+
+bool YHubSimModel::present(int devydx)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return devices[devydx].present;
+}
+
+// Changes the presence of a module, returns the notifications sent by a hub
+// in that case: child plug or unplug with the index of the module, then its
+// name and the name, index and class of each function on arrival
+string YHubSimModel::plug(int devydx, bool present)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	YHubSimDevice& dev = devices[devydx];
+	if (dev.present == present)
+	{
+		return "";
+	}
+	dev.present = present;
+	if (!present)
+	{
+		return "YN012" + devices[0].serial + "," + dev.serial + ",0\n";
+	}
+	const YHubSimFunction& module = dev.functions[0];
+	string res = "YN012" + devices[0].serial + "," + dev.serial + ",1," + simInt(devydx) + "\n";
+	res += "YN010" + dev.serial + "," + module.attrs[2].value + "," + module.attrs[8].value + "\n";
+	for (size_t f = 1; f < dev.functions.size(); f++)
+	{
+		const YHubSimFunction& fn = dev.functions[f];
+		res += "YN018" + dev.serial + "," + fn.id + "," + fn.attrs[0].value + "," + simInt(f) + "," + simInt(fn.baseType) + "\n";
+	}
+	return res;
+}
+
+//
+// Client connections
+//
+
+class YHubSimConnection
+{
+public:
+	YHubSimConnection(YHubSim* sim, int sock, unsigned seed);
+	void run(void);
+	void shutdownSocket(void);
+	void pushNotification(const string& notification);
+
+private:
+	struct Job
+	{
+		string request;
+		int asyncId;    // -1 for a synchronous request
+	};
+
+	struct Channel
+	{
+		std::mutex lock;
+		std::condition_variable cond;
+		std::deque<Job> queue;
+		std::thread worker;
+		unsigned seed;
+		string request;     // request being received
+		u32 received;
+		u32 acked;
+		u64 deferredUntil;  // complete request waiting for a possible async-close frame
+	};
+
+	bool sendAll(const string& data);
+	bool readRequest(string& req);
+	string reply(const string& req);
+	bool serveHttp(const string& req);
+	void serveWebSocket(const string& req);
+	void notifyLoop(bool websocket);
+	void wsReader(void);
+	void wsWorker(int chan);
+	bool wsHandleFrame(const u8* data, int len);
+	void wsDispatch(int chan, int asyncId);
+	bool wsSend(int stream, int chan, const string& data);
+	bool wsSendReply(int chan, const string& data, int asyncId);
+	bool wsSendMeta(const u8* meta, int len);
+	bool wsSendNotifications(const string& data);
+
+	YHubSim* _sim;
+	int _sock;
+	unsigned _seed;
+	std::atomic<bool> _closing;
+	std::mutex _writeLock;
+	std::mutex _notLock;
+	std::condition_variable _notCond;
+	string _pending;
+	bool _subscribed;
+	string _inbuf;
+	Channel _chan[4];
+};
+
+YHubSimConnection::YHubSimConnection(YHubSim* sim, int sock, unsigned seed) :
+	_sim(sim), _sock(sock), _seed(seed), _closing(false), _subscribed(false)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		_chan[i].seed = seed * 31 + i;
+		_chan[i].received = 0;
+		_chan[i].acked = 0;
+		_chan[i].deferredUntil = 0;
+	}
+}
+
+void YHubSimConnection::shutdownSocket(void)
+{
+	_closing = true;
+	shutdown(_sock, SHUT_RDWR);
+	_notCond.notify_all();
+	for (int i = 0; i < 4; i++)
+	{
+		std::lock_guard<std::mutex> guard(_chan[i].lock);
+		_chan[i].cond.notify_all();
+	}
+}
+
+void YHubSimConnection::pushNotification(const string& notification)
+{
+	std::lock_guard<std::mutex> guard(_notLock);
+	if (_subscribed)
+	{
+		_pending += notification;
+		_notCond.notify_all();
+	}
+}
+
+bool YHubSimConnection::sendAll(const string& data)
+{
+	size_t pos = 0;
+	while (pos < data.size())
+	{
+		ssize_t res = send(_sock, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+		if (res <= 0)
+		{
+			return false;
+		}
+		pos += res;
+	}
+	_sim->_bytesSent += data.size();
+	return true;
+}
+
+bool YHubSimConnection::readRequest(string& req)
+{
+	char buf[4096];
+	while (!simRequestComplete(_inbuf))
+	{
+		ssize_t res = recv(_sock, buf, sizeof(buf), 0);
+		if (res <= 0)
+		{
+			return false;
+		}
+		_sim->_bytesReceived += res;
+		_inbuf.append(buf, res);
+	}
+	size_t hdrend = _inbuf.find("\r\n\r\n") + 4;
+	if (_inbuf.compare(0, 5, "POST ") == 0)
+	{
+		hdrend = _inbuf.size();
+	}
+	req = _inbuf.substr(0, hdrend);
+	_inbuf.erase(0, hdrend);
+	return true;
+}
+
+// Builds the full reply to a request, headers included
+string YHubSimConnection::reply(const string& req)
+{
+	size_t eol = req.find("\r\n");
+	string line = req.substr(0, eol);
+	size_t start = line.find(' ');
+	size_t end = (start == string::npos ? string::npos : line.find(' ', start + 1));
+	bool http11 = line.find(" HTTP/1.1") != string::npos;
+	string url, serial = _sim->hubSerial(), path, query, body, contentType;
+	vector<string> notifications;
+	int status;
+
+	if (start == string::npos)
+	{
+		return "HTTP/1.1 400 Bad Request\r\n\r\n";
+	}
+	url = line.substr(start + 1, end == string::npos ? string::npos : end - start - 1);
+	if (url.compare(0, 10, "/bySerial/") == 0)
+	{
+		size_t slash = url.find('/', 10);
+		serial = url.substr(10, slash == string::npos ? string::npos : slash - 10);
+		url = (slash == string::npos ? "/" : url.substr(slash));
+	}
+	path = url.substr(1);
+	size_t qpos = path.find('?');
+	if (qpos != string::npos)
+	{
+		query = path.substr(qpos + 1);
+		path = path.substr(0, qpos);
+	}
+	status = _sim->_model->handle(serial, path, query, body, contentType, notifications);
+	for (size_t i = 0; i < notifications.size(); i++)
+	{
+		_sim->broadcast(notifications[i]);
+	}
+	if (status != 200)
+	{
+		return "HTTP/1.1 404 Not Found\r\n\r\n";
+	}
+	if (!http11)
+	{
+		return "OK\r\n\r\n" + body;
+	}
+	return "HTTP/1.1 200 OK\r\nContent-Type: " + contentType + "\r\nContent-Length: " + simInt((s64)body.size()) +
+		"\r\nConnection: close\r\n\r\n" + body;
+}
+
+void YHubSimConnection::run(void)
+{
+	string req;
+	_sim->_connCount++;
+	if (readRequest(req))
+	{
+		if (strcasecmp(simHeader(req, "Upgrade").c_str(), "websocket") == 0)
+		{
+			serveWebSocket(req);
+		}
+		else if (req.compare(0, 12, "GET /not.byn") == 0)
+		{
+			if (sendAll("HTTP/1.1 200 OK\r\n\r\n"))
+			{
+				notifyLoop(false);
+			}
+		}
+		else
+		{
+			// keep-alive requests are served on the same connection until
+			// the client asks for a regular one
+			while (serveHttp(req) && readRequest(req));
+		}
+	}
+	close(_sock);
+	// the connection object is deleted by the simulator, do not touch it anymore
+	_sim->connectionDone(this);
+}
+
+// Answers a single HTTP request, and returns true when the connection stays
+// open: like the hub, a successful GET ending with "&." gets the abbreviated
+// "0K" reply and the client may send its next request on the same socket
+bool YHubSimConnection::serveHttp(const string& req)
+{
+	size_t eol = req.find("\r\n");
+	bool keepalive = (req.compare(0, 4, "GET ") == 0 && eol != string::npos && eol >= 3 && req.compare(eol - 3, 3, "&. ") == 0);
+	string out;
+
+	_sim->_requests++;
+	simSleep(_sim->replyDelay(&_seed));
+	if (_sim->drop(_sim->_config.requestLoss, &_seed))
+	{
+		_sim->_droppedRequests++;
+		return false;
+	}
+	out = reply(req);
+	if (keepalive && out.compare(0, 4, "OK\r\n") == 0)
+	{
+		return sendAll("0K\r\n\r\n\r\n");
+	}
+	sendAll(out);
+	return false;
+}
+
+// Streams the notification channel: value notifications and timed reports
+// at the configured rates, name changes and a keep-alive every second
+void YHubSimConnection::notifyLoop(bool websocket)
+{
+	const YHubSimConfig& cfg = _sim->_config;
+	int nsensors = cfg.modules * cfg.sensors;
+	u64 start = simNow();
+	u64 valueSlot = (nsensors > 0 && cfg.valueRate > 0 ? (u64)(1e6 / cfg.valueRate / nsensors) + 1 : 0);
+	u64 reportSlot = (cfg.modules > 0 && cfg.reportRate > 0 ? (u64)(1e6 / cfg.reportRate / cfg.modules) + 1 : 0);
+	u64 valueCount = 0, reportCount = 0;
+	u64 lastSend = 0;
+	string out = "YN01@0\n\n"; // sync position, followed by a newline to announce keep-alives
+
+	{
+		std::lock_guard<std::mutex> guard(_notLock);
+		_subscribed = true;
+	}
+	while (!_closing && _sim->_running)
+	{
+		u64 now = simNow();
+		u64 wake = now + SIM_PING_US;
+		// emit notifications round-robin so that each sensor gets its own rate
+		if (valueSlot)
+		{
+			if (start + valueCount * valueSlot + 1000000 < now)
+			{
+				valueCount = (now - start) / valueSlot; // do not try to catch up a long stall
+			}
+			while (start + valueCount * valueSlot <= now)
+			{
+				int idx = (int)(valueCount % nsensors);
+				valueCount++;
+				if (!_sim->_model->present(1 + idx / cfg.sensors))
+				{
+					continue;
+				}
+				if (_sim->drop(cfg.notifLoss, &_seed))
+				{
+					_sim->_droppedNotifications++;
+					continue;
+				}
+				_sim->_notifications++;
+				out += _sim->_model->valueNotification(1 + idx / cfg.sensors, 1 + idx % cfg.sensors);
+			}
+			if (start + valueCount * valueSlot < wake) wake = start + valueCount * valueSlot;
+		}
+		if (reportSlot)
+		{
+			if (start + reportCount * reportSlot + 1000000 < now)
+			{
+				reportCount = (now - start) / reportSlot;
+			}
+			while (start + reportCount * reportSlot <= now)
+			{
+				int idx = (int)(reportCount % cfg.modules);
+				reportCount++;
+				if (!_sim->_model->present(1 + idx))
+				{
+					continue;
+				}
+				if (_sim->drop(cfg.notifLoss, &_seed))
+				{
+					_sim->_droppedNotifications++;
+					continue;
+				}
+				_sim->_notifications++;
+				out += _sim->_model->timedReport(1 + idx);
+			}
+			if (start + reportCount * reportSlot < wake) wake = start + reportCount * reportSlot;
+		}
+		{
+			std::lock_guard<std::mutex> guard(_notLock);
+			out += _pending;
+			_pending.clear();
+		}
+		if (out == "" && now >= lastSend + SIM_PING_US)
+		{
+			out = "\n";
+		}
+		if (out != "")
+		{
+			if (!(websocket ? wsSendNotifications(out) : sendAll(out)))
+			{
+				break;
+			}
+			out.clear();
+			lastSend = now;
+		}
+		if (lastSend + SIM_PING_US < wake)
+		{
+			wake = lastSend + SIM_PING_US;
+		}
+		now = simNow();
+		std::unique_lock<std::mutex> lock(_notLock);
+		if (wake > now && _pending == "" && !_closing)
+		{
+			_notCond.wait_for(lock, std::chrono::microseconds(wake - now));
+		}
+	}
+	std::lock_guard<std::mutex> guard(_notLock);
+	_subscribed = false;
+}
+
+//
+// WebSocket protocol
+//
+
+bool YHubSimConnection::wsSend(int stream, int chan, const string& data)
+{
+	string frames;
+	size_t pos = 0;
+	do
+	{
+		size_t len = data.size() - pos;
+		if (len > SIM_WS_MAX_DATA) len = SIM_WS_MAX_DATA;
+		frames += (char)0x82;
+		frames += (char)(len + 1);
+		frames += (char)((stream << 3) | chan);
+		frames.append(data, pos, len);
+		pos += len;
+	}
+	while (pos < data.size());
+	std::lock_guard<std::mutex> guard(_writeLock);
+	return sendAll(frames);
+}
+
+// Sends a reply on a TCP channel, the last frame closes the request
+bool YHubSimConnection::wsSendReply(int chan, const string& data, int asyncId)
+{
+	string frames;
+	size_t pos = 0;
+	for (;;)
+	{
+		size_t len = data.size() - pos;
+		int stream = YSTREAM_TCP;
+		if (asyncId >= 0 && len < SIM_WS_MAX_DATA)
+		{
+			stream = YSTREAM_TCP_ASYNCCLOSE;
+		}
+		else if (asyncId < 0 && len <= SIM_WS_MAX_DATA)
+		{
+			stream = YSTREAM_TCP_CLOSE;
+		}
+		else
+		{
+			len = SIM_WS_MAX_DATA;
+		}
+		frames += (char)0x82;
+		frames += (char)(len + 1 + (stream == YSTREAM_TCP_ASYNCCLOSE ? 1 : 0));
+		frames += (char)((stream << 3) | chan);
+		frames.append(data, pos, len);
+		pos += len;
+		if (stream == YSTREAM_TCP_ASYNCCLOSE)
+		{
+			frames += (char)asyncId;
+		}
+		if (stream != YSTREAM_TCP) break;
+	}
+	std::lock_guard<std::mutex> guard(_writeLock);
+	return sendAll(frames);
+}
+
+bool YHubSimConnection::wsSendMeta(const u8* meta, int len)
+{
+	return wsSend(YSTREAM_META, 0, string((const char*)meta, len));
+}
+
+bool YHubSimConnection::wsSendNotifications(const string& data)
+{
+	return wsSend(YSTREAM_TCP_NOTIF, 0, data);
+}
+
+void YHubSimConnection::serveWebSocket(const string& req)
+{
+	static const char* magic = YOCTO_WEBSOCKET_MAGIC;
+	u8 digest[20];
+	u8 announce[USB_META_WS_ANNOUNCE_SIZE];
+	string serial = _sim->hubSerial();
+	u32 nonce = rand_r(&_seed);
+
+	simSHA1(simHeader(req, "Sec-WebSocket-Key") + magic, digest);
+	if (!sendAll("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Accept: " + simBase64(digest, 20) + "\r\n\r\n"))
+	{
+		return;
+	}
+	memset(announce, 0, sizeof(announce));
+	announce[0] = USB_META_WS_ANNOUNCE;
+	announce[1] = USB_META_WS_PROTO_V2;
+	announce[4] = (u8)nonce;
+	announce[5] = (u8)(nonce >> 8);
+	announce[6] = (u8)(nonce >> 16);
+	announce[7] = (u8)(nonce >> 24);
+	memcpy(announce + 8, serial.c_str(), serial.size());
+	if (!wsSendMeta(announce, sizeof(announce)))
+	{
+		return;
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		_chan[i].worker = std::thread(&YHubSimConnection::wsWorker, this, i);
+	}
+	std::thread notifier(&YHubSimConnection::notifyLoop, this, true);
+	wsReader();
+	_closing = true;
+	_notCond.notify_all();
+	for (int i = 0; i < 4; i++)
+	{
+		{
+			std::lock_guard<std::mutex> guard(_chan[i].lock);
+			_chan[i].cond.notify_all();
+		}
+		_chan[i].worker.join();
+	}
+	notifier.join();
+}
+
+void YHubSimConnection::wsReader(void)
+{
+	string buf = _inbuf;
+	char tmp[4096];
+
+	while (!_closing && _sim->_running)
+	{
+		u64 now = simNow();
+		int timeout = 1000;
+		for (int i = 0; i < 4; i++)
+		{
+			if (!_chan[i].deferredUntil) continue;
+			if (_chan[i].deferredUntil <= now)
+			{
+				wsDispatch(i, -1);
+			}
+			else if (timeout > 1 + (int)((_chan[i].deferredUntil - now) / 1000))
+			{
+				timeout = 1 + (int)((_chan[i].deferredUntil - now) / 1000);
+			}
+		}
+		struct pollfd pfd;
+		pfd.fd = _sock;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, timeout) <= 0)
+		{
+			continue;
+		}
+		ssize_t res = recv(_sock, tmp, sizeof(tmp), 0);
+		if (res <= 0)
+		{
+			return;
+		}
+		_sim->_bytesReceived += res;
+		buf.append(tmp, res);
+		while (buf.size() >= 2)
+		{
+			u8 opcode = (u8)buf[0] & 0x0f;
+			size_t len = (u8)buf[1] & 0x7f;
+			size_t hdr = 2;
+			bool masked = ((u8)buf[1] & 0x80) != 0;
+			if (len == 126)
+			{
+				if (buf.size() < 4) break;
+				len = ((u8)buf[2] << 8) | (u8)buf[3];
+				hdr = 4;
+			}
+			else if (len == 127)
+			{
+				return;
+			}
+			if (masked) hdr += 4;
+			if (buf.size() < hdr + len) break;
+			vector<u8> payload(len);
+			for (size_t i = 0; i < len; i++)
+			{
+				payload[i] = (u8)buf[hdr + i] ^ (masked ? (u8)buf[hdr - 4 + (i & 3)] : 0);
+			}
+			buf.erase(0, hdr + len);
+			if (opcode == 8)
+			{
+				std::lock_guard<std::mutex> guard(_writeLock);
+				sendAll(string("\x88\x02\x03\xe8", 4));
+				return;
+			}
+			if ((opcode == 2 || opcode == 0) && len > 0 && !wsHandleFrame(payload.data(), (int)len))
+			{
+				return;
+			}
+		}
+	}
+}
+
+bool YHubSimConnection::wsHandleFrame(const u8* data, int len)
+{
+	int stream = data[0] >> 3;
+	int chan = data[0] & 7;
+	Channel* ch;
+
+	data++;
+	len--;
+	if (stream == YSTREAM_META)
+	{
+		if (len >= (int)USB_META_WS_AUTHENTICATION_SIZE && data[0] == USB_META_WS_AUTHENTICATION)
+		{
+			// no password on the simulator: grant read-write access
+			u8 auth[USB_META_WS_AUTHENTICATION_SIZE];
+			memset(auth, 0, sizeof(auth));
+			auth[0] = USB_META_WS_AUTHENTICATION;
+			auth[1] = data[1];
+			auth[2] = USB_META_WS_AUTH_FLAGS_RW;
+			memcpy(auth + 4, data + 4, 4);
+			return wsSendMeta(auth, sizeof(auth));
+		}
+		return true;
+	}
+	if (chan >= 4)
+	{
+		return true;
+	}
+	ch = &_chan[chan];
+	switch (stream)
+	{
+	case YSTREAM_TCP:
+		if (ch->deferredUntil)
+		{
+			wsDispatch(chan, -1);
+		}
+		if (ch->request == "")
+		{
+			ch->received = 0;
+			ch->acked = 0;
+		}
+		ch->request.append((const char*)data, len);
+		ch->received += len;
+		if (chan == 0 && ch->received >= SIM_UPLOAD_ACK_START &&
+			(ch->acked == 0 || ch->received >= ch->acked + SIM_UPLOAD_ACK_STEP))
+		{
+			u8 ack[USB_META_ACK_UPLOAD_SIZE];
+			ack[0] = USB_META_ACK_UPLOAD;
+			ack[1] = (u8)chan;
+			ack[2] = (u8)ch->received;
+			ack[3] = (u8)(ch->received >> 8);
+			ack[4] = (u8)(ch->received >> 16);
+			ack[5] = (u8)(ch->received >> 24);
+			ch->acked = ch->received;
+			if (!wsSendMeta(ack, sizeof(ack)))
+			{
+				return false;
+			}
+		}
+		if (simRequestComplete(ch->request))
+		{
+			if (len == SIM_WS_MAX_DATA)
+			{
+				// a full frame may be followed by an empty async-close
+				ch->deferredUntil = simNow() + SIM_ASYNC_WAIT_US;
+			}
+			else
+			{
+				wsDispatch(chan, -1);
+			}
+		}
+		break;
+	case YSTREAM_TCP_ASYNCCLOSE:
+		if (len < 1)
+		{
+			break;
+		}
+		ch->request.append((const char*)data, len - 1);
+		wsDispatch(chan, data[len - 1]);
+		break;
+	case YSTREAM_TCP_CLOSE:
+		// ack of our close, or request aborted by the client
+		if (!ch->deferredUntil)
+		{
+			ch->request.clear();
+		}
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+void YHubSimConnection::wsDispatch(int chan, int asyncId)
+{
+	Channel& ch = _chan[chan];
+	Job job;
+	job.request = ch.request;
+	job.asyncId = asyncId;
+	ch.request.clear();
+	ch.deferredUntil = 0;
+	if (job.request == "")
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> guard(ch.lock);
+	ch.queue.push_back(job);
+	ch.cond.notify_all();
+}
+
+// Requests of a channel are served in order, channels run in parallel
+void YHubSimConnection::wsWorker(int chan)
+{
+	Channel& ch = _chan[chan];
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(ch.lock);
+			while (ch.queue.empty() && !_closing)
+			{
+				ch.cond.wait(lock);
+			}
+			if (_closing)
+			{
+				return;
+			}
+			job = ch.queue.front();
+			ch.queue.pop_front();
+		}
+		_sim->_requests++;
+		simSleep(_sim->replyDelay(&ch.seed));
+		if (_sim->drop(_sim->_config.requestLoss, &ch.seed))
+		{
+			// close the request without any data
+			_sim->_droppedRequests++;
+			wsSendReply(chan, "", job.asyncId);
+			continue;
+		}
+		if (!wsSendReply(chan, reply(job.request), job.asyncId))
+		{
+			return;
+		}
+	}
+}
+
+//
+// Simulator
+//
+
+YHubSimConfig::YHubSimConfig() :
+	port(0), modules(4), serialBase(1), sensors(2), valueRate(10), reportRate(0), latencyMs(0), jitterMs(0),
+	notifLoss(0), requestLoss(0), loggerRuns(3), loggerRows(600), seed(1)
+{
+}
+
+YHubSim::YHubSim(const YHubSimConfig& config) :
+	_config(config), _listenSock(-1), _port(0), _running(false), _connCount(0), _connPeak(0), _requests(0),
+	_droppedRequests(0), _notifications(0), _droppedNotifications(0), _bytesSent(0), _bytesReceived(0)
+{
+	char serial[YOCTO_SERIAL_LEN];
+	if (_config.modules < 0) _config.modules = 0;
+	if (_config.modules > 250) _config.modules = 250;
+	if (_config.serialBase < 1) _config.serialBase = 1;
+	if (_config.serialBase > 100000 - _config.modules) _config.serialBase = 100000 - _config.modules;
+	if (_config.sensors < 1) _config.sensors = 1;
+	if (_config.sensors > 12) _config.sensors = 12;
+	if (_config.loggerRuns < 0) _config.loggerRuns = 0;
+	if (_config.loggerRows < 0) _config.loggerRows = 0;
+	snprintf(serial, sizeof(serial), "VIRTHUB0-%08x", _config.seed * 2654435761u);
+	_model = new YHubSimModel(_config, serial);
+}
+
+YHubSim::~YHubSim()
+{
+	stop();
+	delete _model;
+}
+
+int YHubSim::start(string& errmsg)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	int opt = 1;
+
+	if (_running)
+	{
+		return YAPI_SUCCESS;
+	}
+	_listenSock = socket(AF_INET, SOCK_STREAM, 0);
+	if (_listenSock < 0)
+	{
+		errmsg = "Unable to create socket";
+		return YAPI_IO_ERROR;
+	}
+	setsockopt(_listenSock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((u16)_config.port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(_listenSock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(_listenSock, 128) < 0 ||
+		getsockname(_listenSock, (struct sockaddr*)&addr, &addrlen) < 0)
+	{
+		errmsg = "Unable to listen on port " + simInt(_config.port) + ": " + strerror(errno);
+		close(_listenSock);
+		_listenSock = -1;
+		return YAPI_IO_ERROR;
+	}
+	_port = ntohs(addr.sin_port);
+	_running = true;
+	_acceptThread = std::thread(&YHubSim::acceptLoop, this);
+	return YAPI_SUCCESS;
+}
+
+void YHubSim::stop(void)
+{
+	if (!_running)
+	{
+		return;
+	}
+	_running = false;
+	_acceptThread.join();
+	close(_listenSock);
+	_listenSock = -1;
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> guard(_connLock);
+			if (_connections.empty()) break;
+			for (size_t i = 0; i < _connections.size(); i++)
+			{
+				_connections[i]->shutdownSocket();
+			}
+		}
+		simSleep(5);
+	}
+}
+
+void YHubSim::acceptLoop(void)
+{
+	unsigned count = 0;
+	while (_running)
+	{
+		struct pollfd pfd;
+		pfd.fd = _listenSock;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 100) <= 0)
+		{
+			continue;
+		}
+		int sock = accept(_listenSock, NULL, NULL);
+		if (sock < 0)
+		{
+			continue;
+		}
+		int opt = 1;
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+		YHubSimConnection* conn = new YHubSimConnection(this, sock, _config.seed * 7919 + count++);
+		{
+			std::lock_guard<std::mutex> guard(_connLock);
+			_connections.push_back(conn);
+			if (_connections.size() > _connPeak)
+			{
+				_connPeak = _connections.size();
+			}
+		}
+		std::thread(&YHubSimConnection::run, conn).detach();
+	}
+}
+
+void YHubSim::connectionDone(YHubSimConnection* conn)
+{
+	std::lock_guard<std::mutex> guard(_connLock);
+	for (size_t i = 0; i < _connections.size(); i++)
+	{
+		if (_connections[i] == conn)
+		{
+			_connections.erase(_connections.begin() + i);
+			break;
+		}
+	}
+	delete conn;
+}
+
+void YHubSim::broadcast(const string& notification)
+{
+	std::lock_guard<std::mutex> guard(_connLock);
+	for (size_t i = 0; i < _connections.size(); i++)
+	{
+		_connections[i]->pushNotification(notification);
+	}
+}
+
+int YHubSim::replyDelay(unsigned* seed) const
+{
+	int delay = _config.latencyMs;
+	if (_config.jitterMs > 0)
+	{
+		delay += rand_r(seed) % (_config.jitterMs + 1);
+	}
+	return delay;
+}
+
+bool YHubSim::drop(double rate, unsigned* seed) const
+{
+	return rate > 0 && rand_r(seed) / (RAND_MAX + 1.0) < rate;
+}
+
+int YHubSim::port(void) const
+{
+	return _port;
+}
+
+string YHubSim::url(bool websocket) const
+{
+	return (websocket ? "ws://127.0.0.1:" : "http://127.0.0.1:") + simInt(_port);
+}
+
+string YHubSim::hubSerial(void) const
+{
+	return _model->devices[0].serial;
+}
+
+string YHubSim::moduleSerial(int index) const
+{
+	if (index < 0 || index + 1 >= (int)_model->devices.size())
+	{
+		return "";
+	}
+	return _model->devices[index + 1].serial;
+}
+
+void YHubSim::plugModule(int index, bool present)
+{
+	if (index < 0 || index + 1 >= (int)_model->devices.size())
+	{
+		return;
+	}
+	string notifications = _model->plug(index + 1, present);
+	if (notifications != "")
+	{
+		broadcast(notifications);
+	}
+}
+
+YHubSimStats YHubSim::stats(void) const
+{
+	YHubSimStats res;
+	res.connections = _connCount;
+	res.peakConnections = _connPeak;
+	res.requests = _requests;
+	res.droppedRequests = _droppedRequests;
+	res.notifications = _notifications;
+	res.droppedNotifications = _droppedNotifications;
+	res.bytesSent = _bytesSent;
+	res.bytesReceived = _bytesReceived;
+	return res;
+}
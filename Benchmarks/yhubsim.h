@@ -0,0 +1,149 @@
+/*********************************************************************
+ *
+ * Local VirtualHub-compatible simulator used by the benchmarks
+ *
+ * - - - - - - - - - License information: - - - - - - - - -
+ *
+ *  Copyright (C) 2011 and beyond by Yoctopuce Sarl, Switzerland.
+ *
+ *  Yoctopuce Sarl (hereafter Licensor) grants to you a perpetual
+ *  non-exclusive license to use, modify, copy and integrate this
+ *  file into your software for the sole purpose of interfacing
+ *  with Yoctopuce products.
+ *
+ *  You may reproduce and distribute copies of this file in
+ *  source or object form, as long as the sole purpose of this
+ *  code is to interface with Yoctopuce products. You must retain
+ *  this notice in the distributed source file.
+ *
+ *  You should refer to Yoctopuce General Terms and Conditions
+ *  for additional information regarding your rights and
+ *  obligations.
+ *
+ *  THE SOFTWARE AND DOCUMENTATION ARE PROVIDED "AS IS" WITHOUT
+ *  WARRANTY OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING
+ *  WITHOUT LIMITATION, ANY WARRANTY OF MERCHANTABILITY, FITNESS
+ *  FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO
+ *  EVENT SHALL LICENSOR BE LIABLE FOR ANY INCIDENTAL, SPECIAL,
+ *  INDIRECT OR CONSEQUENTIAL DAMAGES, LOST PROFITS OR LOST DATA,
+ *  COST OF PROCUREMENT OF SUBSTITUTE GOODS, TECHNOLOGY OR
+ *  SERVICES, ANY CLAIMS BY THIRD PARTIES (INCLUDING BUT NOT
+ *  LIMITED TO ANY DEFENSE THEREOF), ANY CLAIMS FOR INDEMNITY OR
+ *  CONTRIBUTION, OR OTHER SIMILAR COSTS, WHETHER ASSERTED ON THE
+ *  BASIS OF CONTRACT, TORT (INCLUDING NEGLIGENCE), BREACH OF
+ *  WARRANTY, OR OTHERWISE.
+ *
+ *********************************************************************/
+
+#ifndef YHUBSIM_H
+#define YHUBSIM_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "yapi/ydef.h"
+
+using std::string;
+using std::vector;
+
+// Simulator settings
+struct YHubSimConfig
+{
+	int port;           // TCP port to listen on, 0 to pick a free one
+	int modules;        // number of synthetic modules behind the hub
+	int serialBase;     // serial number of the first module, so that
+	                    // several simulators can run side by side
+	int sensors;        // temperature functions per module (1..12)
+	double valueRate;   // value notifications per second, per sensor
+	double reportRate;  // timed reports per second, per module (0: none)
+	int latencyMs;      // delay added before every reply
+	int jitterMs;       // random extra delay, up to this value
+	double notifLoss;   // fraction of notifications dropped
+	double requestLoss; // fraction of requests left without reply
+	int loggerRuns;     // datalogger runs recorded per sensor
+	int loggerRows;     // measures recorded per run
+	unsigned seed;      // seed of the random generators
+
+	YHubSimConfig();
+};
+
+// Activity counters, updated atomically
+struct YHubSimStats
+{
+	u64 connections;
+	u64 peakConnections; // most connections open at the same time
+	u64 requests;
+	u64 droppedRequests;
+	u64 notifications;
+	u64 droppedNotifications;
+	u64 bytesSent;
+	u64 bytesReceived;
+};
+
+class YHubSimModel;
+class YHubSimConnection;
+
+/**
+ * Serves the VirtualHub protocol on 127.0.0.1: /api.json (full and compact
+ * replies), the REST API of each function, /not.byn notifications over
+ * HTTP, the WebSocket channel used by ws:// hubs, and the datalogger
+ * streams (logger.json). Modules are synthetic temperature sensors whose
+ * values follow a slow sine wave, so that results are reproducible.
+ * Network errors can be injected with the latency and loss settings, and
+ * modules can be unplugged and plugged back with plugModule().
+ *
+ * Requests are sent with a plain hub URL, for instance
+ * YAPI::RegisterHub(sim.url(true)) for the WebSocket protocol.
+ */
+class YHubSim
+{
+public:
+	YHubSim(const YHubSimConfig& config);
+	~YHubSim();
+
+	// Starts listening and serving in background threads.
+	// Returns YAPI_SUCCESS or a negative error code.
+	int start(string& errmsg);
+	// Closes all connections and stops the server threads
+	void stop(void);
+
+	int port(void) const;
+	string url(bool websocket) const;
+	string hubSerial(void) const;
+	string moduleSerial(int index) const;
+	// Simulates the removal or the arrival of a module, and broadcasts
+	// the notifications that a hub sends in that case
+	void plugModule(int index, bool present);
+	YHubSimStats stats(void) const;
+
+private:
+	friend class YHubSimConnection;
+
+	void acceptLoop(void);
+	void connectionDone(YHubSimConnection* conn);
+	void broadcast(const string& notification);
+	int replyDelay(unsigned* seed) const;
+	bool drop(double rate, unsigned* seed) const;
+
+	YHubSimConfig _config;
+	YHubSimModel* _model;
+	int _listenSock;
+	int _port;
+	std::atomic<bool> _running;
+	std::thread _acceptThread;
+	std::mutex _connLock;
+	vector<YHubSimConnection*> _connections;
+	std::atomic<u64> _connCount;
+	std::atomic<u64> _connPeak;
+	std::atomic<u64> _requests;
+	std::atomic<u64> _droppedRequests;
+	std::atomic<u64> _notifications;
+	std::atomic<u64> _droppedNotifications;
+	std::atomic<u64> _bytesSent;
+	std::atomic<u64> _bytesReceived;
+};
+
+#endif
@@ -47,6 +47,7 @@
 #include <time.h>
 #else
 #include <sys/time.h>
+#include <fcntl.h>
 #endif
 
 static YRETCODE yapiUpdateDeviceList_internal(u32 forceupdate, char* errmsg);
@@ -55,196 +56,113 @@ static YRETCODE yapiPreregisterHub_internal(const char* url, char* errmsg);
 static YRETCODE yapiHandleEvents_internal(char* errmsg);
 static YRETCODE yapiHTTPRequestAsyncEx_internal(int tcpchan, const char* device, const char* request, int len, yapiRequestAsyncCallback callback, void* context, char* errmsg);
 
-//#define DEBUG_YAPI_REQ
 
-
-#ifdef DEBUG_YAPI_REQ
-
-#include <direct.h>
-static int global_req_count = 0;
-
-static void write_onfile(int fileno, char *mode, const char *firstline, int firstline_len, const char * buffer, int bufferlen)
+void yFunctionUpdate(YAPI_FUNCTION fundescr, const char* value)
 {
-    char filename[128];
-    FILE *f;
-    int retry_count = 1;
-    YSPRINTF(filename, 128,"req_trace\\req_%03d.bin", fileno);
-// write on file
-retry:
-    if (YFOPEN(&f, filename, mode) != 0) {
-        if (retry_count--){
-            _mkdir("req_trace");
-            goto retry;
-        }
-        return -1;
-    }
-    fwrite(firstline, 1, firstline_len, f);
-    if (buffer) {
-        fwrite(buffer, 1, bufferlen, f);
-    }
-    fclose(f);
-    return 0;
-}
-
-
-#define FILE_NO_BIT_MASK 0XFFF
-
-static int YREQ_LOG_START(const char *msg, const char *device, const char * request, int requestsize)
-{
-    char buffer[2048], buffer2[64];
-    struct tm timeinfo;
-    time_t rawtime;
-    int threadIdx, count, first_len;
-
-//we may need to add mutex here
-    count = global_req_count++;
-    int fileno = count & FILE_NO_BIT_MASK;
-// compute time string
-    time(&rawtime);
-    localtime_s(&timeinfo, &rawtime);
-    strftime(buffer2, sizeof(buffer2), "%Y-%m-%d %H:%M:%S", &timeinfo);
-//format first info line
-    threadIdx = yThreadIndex();
-    first_len = YSPRINTF(buffer, 2048, "[%s/%"FMTu64"](%d):no=%d = %s on %s\n",buffer2, yapiGetTickCount(), threadIdx, count, msg, device);
-    write_onfile(fileno, "wb", buffer, first_len, request, requestsize);
-    return count;
-}
-
-static int YREQ_LOG_APPEND(int count, const char *msg, const char * response, int responsesize, u64 start_tm)
-{
-    char buffer[2048], buffer2[64];
-    struct tm timeinfo;
-    time_t rawtime;
-    int threadIdx, first_len;
-
-//we may need to add mutex here
-    int fileno = count & FILE_NO_BIT_MASK;
-// compute time string
-    time(&rawtime);
-    localtime_s(&timeinfo, &rawtime);
-    strftime(buffer2, sizeof(buffer2), "%Y-%m-%d %H:%M:%S", &timeinfo);
-//format first info line
-    threadIdx = yThreadIndex();
-    first_len = YSPRINTF(buffer, 2048, "[%s/%"FMTu64"](%d):no=%d : %s responsesize=%d\n",buffer2, yapiGetTickCount() - start_tm, threadIdx, count, msg, responsesize);
-// write on file
-    write_onfile(fileno, "ab", buffer, first_len, response, responsesize);
-    return count;
-}
-
-static int YREQ_LOG_APPEND_ERR(int count, const char *msg, const char *errmsg, int error, u64 start_tm)
-{
-    char buffer[2048], buffer2[64];
-    struct tm timeinfo;
-    time_t rawtime;
-    int threadIdx, first_len;
-
-//we may need to add mutex here
-    int fileno = count & FILE_NO_BIT_MASK;
-// compute time string
-    time(&rawtime);
-    localtime_s(&timeinfo, &rawtime);
-    strftime(buffer2, sizeof(buffer2), "%Y-%m-%d %H:%M:%S", &timeinfo);
-//format first info line
-    threadIdx = yThreadIndex();
-    first_len = YSPRINTF(buffer, 2048, "[%s/%"FMTu64"](%d):no=%d : %s errmsg(%d)=%s\n", buffer2, yapiGetTickCount()- start_tm, threadIdx, count, msg, error, errmsg);
-// write on file
-    write_onfile(fileno, "ab", buffer, first_len, NULL, 0);
-    return count;
+	ymetricsNotification((yStrRef)(fundescr & 0xffff));
+	if (yContext->functionCallback)
+	{
+		yEnterCriticalSection(&yContext->functionCallbackCS);
+		if (ytraceRunning && ytraceSample())
+		{
+			ytraceRecord(YTRACE_VALUE, fundescr, 0, 0, value, value ? YSTRLEN(value) : 0);
+		}
+		yContext->functionCallback(fundescr, value);
+		yLeaveCriticalSection(&yContext->functionCallbackCS);
+	}
 }
-#endif
-
-
-//#define DEBUG_CALLBACK
 
-#ifdef DEBUG_CALLBACK
+void yFunctionTimedUpdate(YAPI_FUNCTION fundescr, double deviceTime, const u8* report, u32 len)
+{
+	ymetricsNotification((yStrRef)(fundescr & 0xffff));
+	if (yContext->timedReportCallback)
+	{
+		yEnterCriticalSection(&yContext->functionCallbackCS);
+		if (ytraceRunning && ytraceSample())
+		{
+			ytraceRecord(YTRACE_TIMEDREPORT, fundescr, (s32)deviceTime, (s32)((deviceTime - (s32)deviceTime) * 1000), (const char*)report, len);
+		}
+		yContext->timedReportCallback(fundescr, deviceTime, report, len);
+		yLeaveCriticalSection(&yContext->functionCallbackCS);
+	}
+}
 
 
-#include <direct.h>
-static int global_callback_count = 0;
+/*****************************************************************************
+ Pending events notification
+ ****************************************************************************/
 
-static write_cb_onfile(YAPI_FUNCTION fundescr, const char *value)
+// Called by the threads that receive something for yapiHandleEvents (USB
+// packets, network notifications, hub discovery). Wakes up yapiSleep and
+// yapiWaitForEvents, and makes the event pipe readable. Only the first
+// signal after yapiHandleEvents writes to the pipe.
+void ySignalPendingEvents(void)
 {
-    char filename[128];
-    FILE *f;
-    int retry_count = 1;
-    int fileno = global_callback_count >> 16;
-    char *mode ="ab";
-    char buffer[2048], buffer2[64];
-    struct tm timeinfo;
-    time_t rawtime;
-    int threadIdx, bufferlen;
-    char serial[YOCTO_SERIAL_LEN], funcId[YOCTO_FUNCTION_LEN];
-
-    if ((global_callback_count & 0xffff) == 0) {
-        mode = "wb";
-    }
-
-    YSPRINTF(filename, 128,"callback_trace\\callback_%d.txt", fileno);
-// compute time string
-    time(&rawtime);
-    localtime_s(&timeinfo, &rawtime);
-    strftime(buffer2, sizeof(buffer2), "%Y-%m-%d %H:%M:%S", &timeinfo);
-//format first info line
-    threadIdx = yThreadIndex();
-    if (value == NULL){
-        value = "(NULL)";
-    }
-    if(ypGetFunctionInfo(fundescr, serial, funcId, NULL, NULL) < 0){
-        bufferlen = YSPRINTF(buffer, 2048, "[%s/%"FMTu64"](%d):no=%d : invalid function ID (%X)\n",buffer2, yapiGetTickCount(), threadIdx, global_callback_count, fundescr);
-    }else {
-        bufferlen = YSPRINTF(buffer, 2048, "[%s/%"FMTu64"](%d):no=%d : %s.%s (%X)=%s\n",buffer2, yapiGetTickCount(), threadIdx, global_callback_count, serial,funcId, fundescr, value);
-    }
-    global_callback_count++;
+	yContextSt* ctx = yContext;
 
-
-// write on file
-retry:
-    if (YFOPEN(&f, filename, mode) != 0) {
-        if (retry_count--){
-            _mkdir("callback_trace");
-            goto retry;
-        }
-        return -1;
-    }
-    fwrite(buffer, 1, bufferlen, f);
-    fclose(f);
-    return 0;
+	if (ctx == NULL)
+		return;
+	if (!ctx->eventPending)
+	{
+		ctx->eventPending = 1;
+#ifndef WINDOWS_API
+		if (ctx->eventPipe[1] >= 0)
+		{
+			char c = 1;
+			if (write(ctx->eventPipe[1], &c, 1) < 0)
+			{
+				// pipe is full, thus already readable
+			}
+		}
+#endif
+	}
+	ySetEvent(&ctx->exitSleepEvent);
 }
 
-static write_timedcb_onfile(YAPI_FUNCTION fundescr, double deviceTime, const u8 *report, u32 len)
+// Must be called before processing the events, so that any event arriving
+// meanwhile is signaled again
+static void yClearPendingEvents(void)
 {
-    char buffer[256];
-    YSPRINTF(buffer, 2048, "Timed %f %p:%u",deviceTime, report, len);
-    return write_cb_onfile(fundescr, buffer);
-}
+#ifndef WINDOWS_API
+	char buffer[64];
 
+	if (yContext->eventPipe[0] >= 0)
+	{
+		while (read(yContext->eventPipe[0], buffer, sizeof(buffer)) > 0);
+	}
 #endif
+	yContext->eventPending = 0;
+	yMemoryBarrier();
+}
 
-
-void yFunctionUpdate(YAPI_FUNCTION fundescr, const char* value)
+static void yCreateEventPipe(yContextSt* ctx)
 {
-	if (yContext->functionCallback)
+#ifndef WINDOWS_API
+	int i;
+
+	if (pipe(ctx->eventPipe) < 0)
 	{
-		yEnterCriticalSection(&yContext->functionCallbackCS);
-#ifdef DEBUG_CALLBACK
-        write_cb_onfile(fundescr, value);
-#endif
-		yContext->functionCallback(fundescr, value);
-		yLeaveCriticalSection(&yContext->functionCallbackCS);
+		ctx->eventPipe[0] = ctx->eventPipe[1] = -1;
+		return;
 	}
+	for (i = 0; i < 2; i++)
+	{
+		fcntl(ctx->eventPipe[i], F_SETFL, fcntl(ctx->eventPipe[i], F_GETFL) | O_NONBLOCK);
+		fcntl(ctx->eventPipe[i], F_SETFD, FD_CLOEXEC);
+	}
+#endif
 }
 
-void yFunctionTimedUpdate(YAPI_FUNCTION fundescr, double deviceTime, const u8* report, u32 len)
+static void yCloseEventPipe(yContextSt* ctx)
 {
-	if (yContext->timedReportCallback)
+#ifndef WINDOWS_API
+	if (ctx->eventPipe[0] >= 0)
 	{
-		yEnterCriticalSection(&yContext->functionCallbackCS);
-#ifdef DEBUG_CALLBACK
-        write_timedcb_onfile(fundescr, deviceTime, report, len);
-#endif
-		yContext->timedReportCallback(fundescr, deviceTime, report, len);
-		yLeaveCriticalSection(&yContext->functionCallbackCS);
+		close(ctx->eventPipe[0]);
+		close(ctx->eventPipe[1]);
+		ctx->eventPipe[0] = ctx->eventPipe[1] = -1;
 	}
+#endif
 }
 
 
@@ -1121,33 +1039,31 @@ static int yEnuJson(ENU_CONTEXT* enus, yJsonStateMachine* j)
 	return YAPI_SUCCESS;
 }
 
-// connect to a network hub and do an enumeration
-// this function will do TCP IO and will do a timeout if
-// the hub is off line.
-// USE NO NOT USE THIS FUNCTION BUT yNetHubEnum INSTEAD
-static int yNetHubEnumEx(HubSt* hub, ENU_CONTEXT* enus, char* errmsg)
+typedef int (*yJsonReplyParser)(void* ctx, yJsonStateMachine* j);
+
+// send a GET request to a network hub and feed the reply to a json parser
+// this function will do TCP IO and will do a timeout if the hub is off line.
+static int yNetHubJsonRequest(HubSt* hub, const char* request, yJsonReplyParser parser, void* ctx, char* errmsg)
 {
 	yJsonStateMachine j;
 	u8 buffer[1500];
 	int res;
-	const char* request = "GET /api.json \r\n\r\n";// no HTTP/1.1 suffix -> light headers
 	yJsonRetCode jstate = YJSON_NEED_INPUT;
 	u64 enumTimeout;
 	RequestSt* req;
-#ifdef DEBUG_YAPI_REQ
-    int req_count = YREQ_LOG_START("yNetHubEnumEx", hub->name, request, YSTRLEN(request));
-    u64 start_tm = yapiGetTickCount();
-#endif
+	int trace_id = ytraceReqStart(hub->name, request, YSTRLEN(request));
+	u64 start_tm = yapiGetTickCount();
+
 	req = yReqAlloc(hub);
 	if (YISERR((res = yReqOpen(req, 2 * YIO_DEFAULT_TCP_TIMEOUT, 0, request, YSTRLEN(request), YIO_DEFAULT_TCP_TIMEOUT, NULL, NULL, NULL, NULL, errmsg))))
 	{
+		ytraceReqEnd(trace_id, res, 0, errmsg, start_tm);
 		yReqFree(req);
 		return res;
 	}
 	// init yjson parser
 	memset(&j, 0, sizeof(j));
 	j.st = YJSON_HTTP_START;
-	enus->state = ENU_HTTP_START;
 	enumTimeout = yapiGetTickCount() + 10000;
 	while (jstate == YJSON_NEED_INPUT)
 	{
@@ -1159,16 +1075,17 @@ static int yNetHubEnumEx(HubSt* hub, ENU_CONTEXT* enus, char* errmsg)
 		res = yReqRead(req, buffer, sizeof(buffer));
 		while (res > 0)
 		{
-#ifdef DEBUG_YAPI_REQ
-            YREQ_LOG_APPEND(req_count, "yNetHubEnumEx", buffer, res, start_tm);
-#endif
+			if (trace_id)
+			{
+				ytraceRecord(YTRACE_REQ_DATA, trace_id, res, 0, NULL, 0);
+			}
 			j.src = (char*)buffer;
 			j.end = (char*)buffer + res;
 			// parse all we can on this buffer
 			jstate = yJsonParse(&j);
 			while (jstate == YJSON_PARSE_AVAIL)
 			{
-				if (YISERR(yEnuJson(enus,&j)))
+				if (YISERR(parser(ctx, &j)))
 				{
 					jstate = YJSON_FAILED;
 					break;
@@ -1183,6 +1100,7 @@ static int yNetHubEnumEx(HubSt* hub, ENU_CONTEXT* enus, char* errmsg)
 			if (YISERR(res))
 			{
 				// any specific error during select
+				ytraceReqEnd(trace_id, res, 0, errmsg, start_tm);
 				yReqClose(req);
 				yReqFree(req);
 				return res;
@@ -1192,14 +1110,19 @@ static int yNetHubEnumEx(HubSt* hub, ENU_CONTEXT* enus, char* errmsg)
 				// connection close before end of result
 				res = YERR(YAPI_IO_ERROR);
 			}
-			if (yapiGetTickCount() >= enumTimeout)
+			if (jstate == YJSON_NEED_INPUT && yapiGetTickCount() >= enumTimeout)
 			{
 				res = YERR(YAPI_TIMEOUT);
+				ytraceReqEnd(trace_id, res, 0, errmsg, start_tm);
+				yReqClose(req);
+				yReqFree(req);
+				return res;
 			}
 		}
 	}
 	yReqClose(req);
 	yReqFree(req);
+	ytraceReqEnd(trace_id, res, 0, errmsg, start_tm);
 
 	if (res == YAPI_SUCCESS)
 	{
@@ -1218,6 +1141,280 @@ static int yNetHubEnumEx(HubSt* hub, ENU_CONTEXT* enus, char* errmsg)
 	return YAPI_SUCCESS;
 }
 
+static int yEnuJsonParser(void* ctx, yJsonStateMachine* j)
+{
+	return yEnuJson((ENU_CONTEXT*)ctx, j);
+}
+
+// connect to a network hub and do an enumeration
+// this function will do TCP IO and will do a timeout if
+// the hub is off line.
+// USE NO NOT USE THIS FUNCTION BUT yNetHubEnum INSTEAD
+static int yNetHubEnumEx(HubSt* hub, ENU_CONTEXT* enus, char* errmsg)
+{
+	const char* request = "GET /api.json \r\n\r\n";// no HTTP/1.1 suffix -> light headers
+
+	enus->state = ENU_HTTP_START;
+	return yNetHubJsonRequest(hub, request, yEnuJsonParser, enus, errmsg);
+}
+
+
+/*****************************************************************
+ * Incremental enumeration
+ *
+ * Once a hub has been fully enumerated, device arrivals announced on
+ * its notification channel (child plug, or name of an unknown device)
+ * are queued by the notification thread. The next yNetHubEnum only
+ * fetches /bySerial/<serial>/api.json for these devices, removals and
+ * name changes being applied directly by the notifications. A full
+ * enumeration is still done when the channel has been reestablished,
+ * when the queue has overflowed, when a device could not be fetched,
+ * when its hub index or the class of one of its functions has not been
+ * announced, and every yContext->devListValidity ms as a consistency
+ * check.
+*****************************************************************/
+
+// Queues a device announced by a notification, devYdx is MAX_YDX_PER_HUB
+// when the notification does not tell it
+static void yNetHubQueueDevice(HubSt* hub, yStrRef serialref, u8 devYdx)
+{
+	int i;
+
+	if (serialref == INVALID_HASH_IDX || serialref == hub->serial)
+		return;
+	yEnterCriticalSection(&hub->access);
+	for (i = 0; i < hub->nbPendingDevs; i++)
+	{
+		if (hub->pendingDevs[i] == serialref)
+			break;
+	}
+	if (i < hub->nbPendingDevs)
+	{
+		if (devYdx < MAX_YDX_PER_HUB)
+		{
+			hub->pendingDevYdx[i] = devYdx;
+		}
+	}
+	else if (hub->nbPendingDevs < NET_HUB_MAX_PENDING_DEVS)
+	{
+		hub->pendingDevs[i] = serialref;
+		hub->pendingDevYdx[i] = devYdx;
+		hub->nbPendingDevs++;
+	}
+	else
+	{
+		hub->pendingOverflow = 1;
+	}
+	yLeaveCriticalSection(&hub->access);
+	// apply it on the next yapiUpdateDeviceList
+	hub->devListExpires = 0;
+}
+
+static void yNetHubUnqueueDevice(HubSt* hub, yStrRef serialref)
+{
+	int i;
+
+	yEnterCriticalSection(&hub->access);
+	for (i = 0; i < hub->nbPendingDevs; i++)
+	{
+		if (hub->pendingDevs[i] == serialref)
+		{
+			hub->nbPendingDevs--;
+			memmove(hub->pendingDevs + i, hub->pendingDevs + i + 1, (hub->nbPendingDevs - i) * sizeof(yStrRef));
+			memmove(hub->pendingDevYdx + i, hub->pendingDevYdx + i + 1, hub->nbPendingDevs - i);
+			break;
+		}
+	}
+	yLeaveCriticalSection(&hub->access);
+}
+
+typedef struct
+{
+	HubSt* hub;
+	ENU_PARSE_STATE state; // attribute expected next, ENU_API between attributes
+	yStrRef serial;
+	u8 devYdx;
+	int infunc;
+	yStrRef funcId;
+	yStrRef logicalName;
+	yStrRef productName;
+	u16 productId;
+	s8 beacon;
+	char advertisedValue[YOCTO_PUBVAL_LEN];
+	int unknownClass; // a function has not been announced by FUNCNAMEYDX
+} DEV_ENU_CONTEXT;
+
+// Registers a function of the device once its closing brace is parsed
+static void yDevEnuCommit(DEV_ENU_CONTEXT* denus)
+{
+	char serial[YOCTO_SERIAL_LEN];
+	char funcid[YOCTO_FUNCTION_LEN];
+	char devUrlBuf[YOCTO_SERIAL_LEN + 16];
+	char hwid[YOCTO_SERIAL_LEN + YOCTO_FUNCTION_LEN];
+	yUrlRef devurl;
+
+	yHashGetStr(denus->serial, serial, YOCTO_SERIAL_LEN);
+	if (denus->funcId == YSTRREF_mODULE_STRING)
+	{
+		YSPRINTF(devUrlBuf, sizeof(devUrlBuf), "/bySerial/%s/api", serial);
+		devurl = yHashUrlFromRef(denus->hub->url, devUrlBuf);
+		if (wpGetDevYdx(denus->serial) < 0)
+		{
+			wpSafeRegister(denus->hub, denus->devYdx, denus->serial, denus->logicalName, denus->productName, denus->productId, devurl, denus->beacon);
+		}
+		else
+		{
+			wpSafeUpdate(denus->hub, denus->devYdx, denus->serial, denus->logicalName, devurl, denus->beacon);
+		}
+	}
+	else
+	{
+		// class and index of the function come from its FUNCNAMEYDX notification,
+		// the device api.json does not tell them
+		yHashGetStr(denus->funcId, funcid, YOCTO_FUNCTION_LEN);
+		YSPRINTF(hwid, sizeof(hwid), "%s.%s", serial, funcid);
+		if (ypSearch("Function", hwid) < 0)
+		{
+			denus->unknownClass = 1;
+			return;
+		}
+		ypUpdateUSB(serial, funcid, yHashGetStrPtr(denus->logicalName), -1, -1, denus->advertisedValue);
+	}
+}
+
+// Parses the reply to /bySerial/<serial>/api.json
+static int yDevEnuJson(void* ctx, yJsonStateMachine* j)
+{
+	DEV_ENU_CONTEXT* denus = (DEV_ENU_CONTEXT*)ctx;
+
+	switch (j->st)
+	{
+	case YJSON_HTTP_READ_CODE:
+		if (YSTRCMP(j->token, "200"))
+		{
+			return YAPI_IO_ERROR;
+		}
+		break;
+	case YJSON_PARSE_STRUCT:
+		if (j->depth == 2 && j->token[0] == '{')
+		{
+			denus->infunc = 1;
+			denus->state = ENU_API;
+			denus->logicalName = YSTRREF_EMPTY_STRING;
+			denus->productName = YSTRREF_EMPTY_STRING;
+			denus->productId = 0;
+			denus->beacon = 0;
+			memset(denus->advertisedValue, 0, sizeof(denus->advertisedValue));
+		}
+		else if (j->depth == 1 && denus->infunc)
+		{
+			yDevEnuCommit(denus);
+			denus->infunc = 0;
+		}
+		break;
+	case YJSON_PARSE_MEMBNAME:
+		if (j->depth == 1)
+		{
+			denus->funcId = yHashPutStr(j->token);
+		}
+		else if (denus->funcId == YSTRREF_mODULE_STRING && YSTRCMP(j->token, "productName") == 0)
+		{
+			denus->state = ENU_WP_PRODUCTNAME;
+		}
+		else if (denus->funcId == YSTRREF_mODULE_STRING && YSTRCMP(j->token, "productId") == 0)
+		{
+			denus->state = ENU_WP_PRODUCTID;
+		}
+		else if (denus->funcId == YSTRREF_mODULE_STRING && YSTRCMP(j->token, "beacon") == 0)
+		{
+			denus->state = ENU_WP_BEACON;
+		}
+		else if (YSTRCMP(j->token, "logicalName") == 0)
+		{
+			denus->state = ENU_WP_LOGICALNAME;
+		}
+		else if (YSTRCMP(j->token, "advertisedValue") == 0)
+		{
+			denus->state = ENU_YP_ADVERTISEDVALUE;
+		}
+		else
+		{
+			yJsonSkip(j, 1);
+		}
+		break;
+	case YJSON_PARSE_STRING:
+	case YJSON_PARSE_NUM:
+	case YJSON_PARSE_SYMBOL:
+		switch (denus->state)
+		{
+		case ENU_WP_PRODUCTNAME:
+			denus->productName = yHashPutStr(j->token);
+			break;
+		case ENU_WP_PRODUCTID:
+			denus->productId = atoi(j->token);
+			break;
+		case ENU_WP_BEACON:
+			denus->beacon = atoi(j->token);
+			break;
+		case ENU_WP_LOGICALNAME:
+			denus->logicalName = yHashPutStr(j->token);
+			break;
+		case ENU_YP_ADVERTISEDVALUE:
+			YSTRNCPY(denus->advertisedValue, YOCTO_PUBVAL_LEN, j->token, YOCTO_PUBVAL_SIZE);
+			break;
+		default:
+			break;
+		}
+		denus->state = ENU_API;
+		break;
+	default:
+		break;
+	}
+	return YAPI_SUCCESS;
+}
+
+// Fetches the descriptors of the devices queued by the notifications
+static int yNetHubEnumPending(HubSt* hub, char* errmsg)
+{
+	DEV_ENU_CONTEXT denus;
+	char request[YOCTO_SERIAL_LEN + 40];
+	int res, pending;
+
+	for (;;)
+	{
+		memset(&denus, 0, sizeof(denus));
+		denus.hub = hub;
+		yEnterCriticalSection(&hub->access);
+		pending = hub->nbPendingDevs;
+		if (pending > 0)
+		{
+			denus.serial = hub->pendingDevs[0];
+			denus.devYdx = hub->pendingDevYdx[0];
+		}
+		yLeaveCriticalSection(&hub->access);
+		if (pending == 0)
+		{
+			return YAPI_SUCCESS;
+		}
+		if (denus.devYdx >= MAX_YDX_PER_HUB)
+		{
+			// notifications of this device could not be mapped without its index
+			return YERRMSG(YAPI_NOT_SUPPORTED, "Hub index of the device is unknown");
+		}
+		YSPRINTF(request, sizeof(request), "GET /bySerial/%s/api.json \r\n\r\n", yHashGetStrPtr(denus.serial));
+		res = yNetHubJsonRequest(hub, request, yDevEnuJson, &denus, errmsg);
+		if (YISERR(res))
+		{
+			return res;
+		}
+		if (denus.unknownClass)
+		{
+			return YERRMSG(YAPI_NOT_SUPPORTED, "Class of a function of the device is unknown");
+		}
+		yNetHubUnqueueDevice(hub, denus.serial);
+	}
+}
+
 
 // helper for yNetHubEnumEx that will trigger TCP connection (and potentially
 // timeout) only when it is really needed.
@@ -1226,12 +1423,41 @@ static int yNetHubEnum(HubSt* hub, int forceupdate, char* errmsg)
 	ENU_CONTEXT enus;
 	int i, res;
 	yStrRef knownDevices[128];
+	u32 connCount;
+	int enumerated = 0;
+	u64 now = yapiGetTickCount();
 
 	//check if the expiration has expired;
-	if (!forceupdate && hub->devListExpires > yapiGetTickCount())
+	if (!forceupdate && hub->devListExpires > now)
 	{
 		return YAPI_SUCCESS;
 	}
+	if (!hub->mandatory && hub->state != NET_HUB_ESTABLISHED && hub->snapshotExpires > now)
+	{
+		// keep the devices restored from the registry snapshot while the hub connects
+		return YAPI_SUCCESS;
+	}
+	if (hub->state == NET_HUB_ESTABLISHED && hub->send_ping && hub->connCount == hub->enumConnCount &&
+		!hub->pendingOverflow && hub->devListFullExpires > now)
+	{
+		// no notification has been missed since the last full enumeration:
+		// only fetch the devices that have been announced since then
+		res = yNetHubEnumPending(hub, errmsg);
+		if (res == YAPI_SUCCESS)
+		{
+			hub->devListExpires = now + 10000;
+			return YAPI_SUCCESS;
+		}
+		dbglog("incremental enumeration of hub %s failed (%s)\n", hub->name, errmsg);
+	}
+
+	// the full enumeration covers all arrivals queued until now
+	yEnterCriticalSection(&hub->access);
+	connCount = hub->connCount;
+	hub->nbPendingDevs = 0;
+	hub->pendingOverflow = 0;
+	yLeaveCriticalSection(&hub->access);
+	hub->devListFullExpires = 0;
 
 	// et base url (then entry point)
 	memset(&enus, 0, sizeof(enus));
@@ -1266,12 +1492,14 @@ static int yNetHubEnum(HubSt* hub, int forceupdate, char* errmsg)
 			{
 				return res;
 			}
+			enumerated = 1;
 		}
 	}
 	else
 	{
 		// if the hub is optional we will not triger an error but
 		// instead unregister all know device connecte on this hub
+		res = YAPI_IO_ERROR;
 		if (hub->state == NET_HUB_ESTABLISHED)
 		{
 			// the hub send ping notification -> we can rely on helperthread status
@@ -1281,6 +1509,7 @@ static int yNetHubEnum(HubSt* hub, int forceupdate, char* errmsg)
 				dbglog("error with hub %s : %s",hub->name,errmsg);
 			}
 		}
+		enumerated = !YISERR(res);
 	}
 
 	for (i = 0; i < enus.nbKnownDevices; i++)
@@ -1290,37 +1519,292 @@ static int yNetHubEnum(HubSt* hub, int forceupdate, char* errmsg)
 			unregisterNetDevice(knownDevices[i]);
 		}
 	}
+	hub->snapshotExpires = 0;
+	now = yapiGetTickCount();
 	if (hub->state == NET_HUB_ESTABLISHED)
 	{
-		hub->devListExpires = yapiGetTickCount() + 10000; // 10s validity when notification are working properly
+		hub->devListExpires = now + 10000; // 10s validity when notification are working properly
 	}
 	else
 	{
-		hub->devListExpires = yapiGetTickCount() + 500;
+		hub->devListExpires = now + 500;
+	}
+	if (enumerated)
+	{
+		hub->enumConnCount = connCount;
+		hub->devListFullExpires = now + yContext->devListValidity;
 	}
 	return YAPI_SUCCESS;
 }
 
 
-// initialize NetHubSt sctructure. no IO in this function
-static HubSt* yapiAllocHub(const char* url, char* errmsg)
+/*****************************************************************
+ * Registry snapshot
+ *
+ * The white and yellow pages of the network hubs are saved in a JSON
+ * file, with one member per hub that uses the same layout as the
+ * "services" member of api.json, at the same depth so that it fits
+ * in the JSON parser stack:
+ *   {"version":1,"host:port":{"whitePages":[...],"yellowPages":{...}},...}
+ * When a hub is registered, its saved entries are replayed through
+ * yEnuJson so that its devices can be resolved before the hub is
+ * reached. They are kept until the first enumeration of the hub,
+ * which reconciles them, or until the hub has failed to connect.
+ * Until then, the restored devices are flagged as tentative in the
+ * white pages (see yapiIsDeviceTentative), and wpRegister clears the
+ * flag when the enumeration confirms them.
+ * Hub-relative device indexes are not saved, so that notifications
+ * are only decoded once the hub has been enumerated again.
+*****************************************************************/
+
+static void ySnapshotHubName(HubSt* hub, char* buffer)
 {
-	char* name;
-	int len;
-	yHash huburl;
-	yStrRef user, password;
-	HubSt* hub;
+	char host[YOCTO_HOSTNAME_NAME];
+	u16 port;
 
-	huburl = yHashUrl(url, "", 0, errmsg);
-	if (huburl == INVALID_HASH_IDX)
+	yHashGetUrlPort(hub->url, host, &port, NULL, NULL, NULL);
+	YSPRINTF(buffer, YOCTO_HOSTNAME_NAME + 8, "%s:%u", host, port);
+}
+
+static void ySnapshotPutStr(FILE* f, const char* str)
+{
+	fputc('"', f);
+	for (; *str; str++)
 	{
-		return NULL;
+		if (*str == '"' || *str == '\\')
+		{
+			fputc('\\', f);
+		}
+		if ((u8)*str >= ' ')
+		{
+			fputc(*str, f);
+		}
 	}
+	fputc('"', f);
+}
 
-	hub = yMalloc(sizeof(HubSt));
-	memset(hub, 0, sizeof(HubSt));
-	memset(hub->devYdxMap, 255, sizeof(hub->devYdxMap));
-	yInitWakeUpSocket(&hub->wuce);
+// Writes the entries of one hub, if it has known devices
+static void ySnapshotWriteHub(FILE* f, HubSt* hub)
+{
+	yStrRef serials[128];
+	char huburl[YOCTO_HOSTNAME_NAME + 8];
+	char productname[YOCTO_PRODUCTNAME_LEN];
+	char logicalname[YOCTO_LOGICAL_LEN];
+	char devurl[YOCTO_SERIAL_LEN * 2 + 16];
+	char serialstr[YOCTO_SERIAL_LEN];
+	char funcIdstr[YOCTO_FUNCTION_LEN];
+	char funcNamestr[YOCTO_LOGICAL_LEN];
+	char funcVal[YOCTO_PUBVAL_LEN];
+	char categ[YOCTO_FUNCTION_LEN];
+	yStrRef serial, funcId, funcName;
+	Notification_funydx funcInfo;
+	yBlkHdl cat_hdl, hdl;
+	int nbdev, i, funydx, nwp, ncateg, nfunc;
+	u16 deviceid;
+	u8 beacon;
+
+	nbdev = wpGetAllDevUsingHubUrl(hub->url, serials, 128);
+	if (nbdev <= 0 || nbdev > 128)
+	{
+		return;
+	}
+	ySnapshotHubName(hub, huburl);
+	fprintf(f, ",\n\"%s\":{\"whitePages\":[", huburl);
+	nwp = 0;
+	for (i = 0; i < nbdev; i++)
+	{
+		if (wpGetDeviceInfo(serials[i], &deviceid, productname, serialstr, logicalname, &beacon) < 0 ||
+			wpGetDeviceUrl(serials[i], NULL, devurl, sizeof(devurl) - 4, NULL) < 0)
+		{
+			continue;
+		}
+		YSTRCAT(devurl, sizeof(devurl), "api");
+		fprintf(f, "%s{\"serialNumber\":", nwp++ ? "," : "");
+		ySnapshotPutStr(f, serialstr);
+		fprintf(f, ",\"logicalName\":");
+		ySnapshotPutStr(f, logicalname);
+		fprintf(f, ",\"productName\":");
+		ySnapshotPutStr(f, productname);
+		fprintf(f, ",\"productId\":%u,\"networkUrl\":\"%s\",\"beacon\":%u}", deviceid, devurl, beacon);
+	}
+	fprintf(f, "],\"yellowPages\":{");
+	ncateg = 0;
+	// the yellow pages lists may be modified by the notification threads
+	yEnterCriticalSection(&yYpMutex);
+	for (cat_hdl = yYpListHead; cat_hdl != INVALID_BLK_HDL; cat_hdl = yBlkListSeek(cat_hdl, 1))
+	{
+		ypGetCategory(cat_hdl, categ, &hdl);
+		// module entries are rebuilt from the white pages
+		if (YSTRCMP(categ, "Module") == 0)
+			continue;
+		nfunc = 0;
+		for (; hdl != INVALID_BLK_HDL; hdl = yBlkListSeek(hdl, 1))
+		{
+			memset(funcVal, 0, sizeof(funcVal));
+			funydx = ypGetAttributes(hdl, &serial, &funcId, &funcName, &funcInfo, funcVal);
+			if (funydx < 0)
+				continue;
+			for (i = 0; i < nbdev && serials[i] != serial; i++);
+			if (i == nbdev)
+				continue;
+			if (nfunc == 0)
+			{
+				fprintf(f, "%s\"%s\":[", ncateg ? "," : "", categ);
+				ncateg++;
+			}
+			yHashGetStr(serial, serialstr, YOCTO_SERIAL_LEN);
+			yHashGetStr(funcId, funcIdstr, YOCTO_FUNCTION_LEN);
+			yHashGetStr(funcName, funcNamestr, YOCTO_LOGICAL_LEN);
+			fprintf(f, "%s{\"baseType\":%d,\"hardwareId\":\"%s.%s\",\"logicalName\":", nfunc ? "," : "",
+			        ypGetType(hdl), serialstr, funcIdstr);
+			ySnapshotPutStr(f, funcNamestr);
+			fprintf(f, ",\"advertisedValue\":");
+			ySnapshotPutStr(f, funcVal);
+			fprintf(f, ",\"index\":%d}", funydx);
+			nfunc++;
+		}
+		if (nfunc > 0)
+		{
+			fprintf(f, "]");
+		}
+	}
+	yLeaveCriticalSection(&yYpMutex);
+	fprintf(f, "}}");
+}
+
+// Must be called with updateDev_cs held
+static int ySnapshotSave(const char* file, char* errmsg)
+{
+	char tmpfile[TRACEFILE_NAMELEN + 8];
+	FILE* f;
+	int i;
+
+	YSPRINTF(tmpfile, sizeof(tmpfile), "%s.tmp", file);
+	if (YFOPEN(&f, tmpfile, "w") != 0)
+	{
+		return YERRMSG(YAPI_IO_ERROR, "Unable to create the registry snapshot file");
+	}
+	fprintf(f, "{\"version\":1");
+	for (i = 0; i < NBMAX_NET_HUB; i++)
+	{
+		if (yContext->nethub[i])
+		{
+			ySnapshotWriteHub(f, yContext->nethub[i]);
+		}
+	}
+	fprintf(f, "\n}\n");
+	if (fclose(f) != 0)
+	{
+		remove(tmpfile);
+		return YERRMSG(YAPI_IO_ERROR, "Unable to write the registry snapshot file");
+	}
+#ifdef WINDOWS_API
+	remove(file);
+#endif
+	if (rename(tmpfile, file) != 0)
+	{
+		remove(tmpfile);
+		return YERRMSG(YAPI_IO_ERROR, "Unable to replace the registry snapshot file");
+	}
+	return YAPI_SUCCESS;
+}
+
+// Replays the entries saved for a hub, as if they came from its api.json.
+// Must be called with updateDev_cs held
+static void ySnapshotApply(HubSt* hub)
+{
+	yJsonStateMachine j;
+	ENU_CONTEXT enus;
+	yStrRef knownDevices[128];
+	yStrRef liveDevices[128];
+	char huburl[YOCTO_HOSTNAME_NAME + 8];
+	int match = 0;
+	int nbLive, nbDevices, i, k;
+
+	if (yContext->snapshotData == NULL)
+		return;
+	ySnapshotHubName(hub, huburl);
+	memset(&enus, 0, sizeof(enus));
+	enus.hub = hub;
+	enus.knownDevices = knownDevices;
+	enus.nbKnownDevices = wpGetAllDevUsingHubUrl(hub->url, knownDevices, 128);
+	if (enus.nbKnownDevices > 128)
+		return;
+	// yEnuJson clears the entries of knownDevices that it meets
+	nbLive = enus.nbKnownDevices;
+	memcpy(liveDevices, knownDevices, nbLive * sizeof(yStrRef));
+	memset(&j, 0, sizeof(j));
+	j.src = yContext->snapshotData;
+	j.end = j.src + yContext->snapshotSize;
+	j.st = YJSON_START;
+	while (yJsonParse(&j) == YJSON_PARSE_AVAIL)
+	{
+		if (match)
+		{
+			// the closing brace of the hub object is reported at the root depth
+			if (j.depth < 2)
+				break;
+			if (YISERR(yEnuJson(&enus, &j)))
+			{
+				dbglog("invalid registry snapshot entry for %s\n", huburl);
+				break;
+			}
+		}
+		else if (j.depth == 1 && j.st == YJSON_PARSE_MEMBNAME)
+		{
+			if (YSTRCMP(j.token, huburl) == 0)
+			{
+				match = 1;
+				enus.state = ENU_SERVICE;
+			}
+			else
+			{
+				yJsonSkip(&j, 1);
+			}
+		}
+	}
+	if (!match)
+		return;
+	// the devices that were not already registered are only tentative
+	nbDevices = wpGetAllDevUsingHubUrl(hub->url, knownDevices, 128);
+	for (i = 0; i < nbDevices && i < 128; i++)
+	{
+		for (k = 0; k < nbLive; k++)
+		{
+			if (liveDevices[k] == knownDevices[i])
+				break;
+		}
+		if (k == nbLive)
+		{
+			wpMarkTentative(knownDevices[i]);
+		}
+	}
+	if (nbDevices > 0)
+	{
+		hub->snapshotExpires = yapiGetTickCount() + YIO_DEFAULT_TCP_TIMEOUT;
+	}
+}
+
+
+// initialize NetHubSt sctructure. no IO in this function
+static HubSt* yapiAllocHub(const char* url, char* errmsg)
+{
+	char* name;
+	int len;
+	yHash huburl;
+	yStrRef user, password;
+	HubSt* hub;
+
+	huburl = yHashUrl(url, "", 0, errmsg);
+	if (huburl == INVALID_HASH_IDX)
+	{
+		return NULL;
+	}
+
+	hub = yMalloc(sizeof(HubSt));
+	memset(hub, 0, sizeof(HubSt));
+	memset(hub->devYdxMap, 255, sizeof(hub->devYdxMap));
+	yInitWakeUpSocket(&hub->wuce);
 	// compute an hashed url
 	hub->url = huburl;
 	len = YSTRLEN(url);
@@ -1371,6 +1855,7 @@ static void yapiFreeHub(HubSt* hub)
 			yReqFree(hub->http.notReq);
 		}
 	}
+	yHTTPPoolFlush(hub);
 	yDeleteCriticalSection(&hub->access);
 	yFifoCleanup(&hub->not_fifo);
 	if (hub->name) yFree(hub->name);
@@ -1438,6 +1923,7 @@ static void ssdpEntryUpdate(const char* serial, const char* urlToRegister, const
 			yEnterCriticalSection(&yContext->deviceCallbackCS);
 			yContext->hubDiscoveryCallback(serial, urlToRegister);
 			yLeaveCriticalSection(&yContext->deviceCallbackCS);
+			ySignalPendingEvents();
 		}
 	}
 
@@ -1565,6 +2051,7 @@ static YRETCODE yapiInitAPI_internal(int detect_type, char* errmsg)
 	ctx = (yContextSt*)yMalloc(sizeof(yContextSt));
 	yMemset(ctx,0,sizeof(yContextSt));
 	ctx->detecttype = detect_type;
+	ctx->devListValidity = NET_HUB_DEFAULT_DEVLIST_VALIDITY * 1000;
 
 	//initialize enumeration CS
 	initializeAllCS(ctx);
@@ -1595,18 +2082,21 @@ static YRETCODE yapiInitAPI_internal(int detect_type, char* errmsg)
 	}
 
 	yCreateEvent(&ctx->exitSleepEvent);
+	yCreateEventPipe(ctx);
 
 	if (detect_type & Y_DETECT_NET)
 	{
 		if (YISERR(ySSDPStart(&ctx->SSDP, ssdpEntryUpdate, errmsg)))
 		{
 			yTcpShutdown();
-			yCloseEvent(&yContext->exitSleepEvent);
+			yCloseEvent(&ctx->exitSleepEvent);
+			yCloseEventPipe(ctx);
 			deleteAllCS(ctx);
 			yFree(ctx);
 			return YAPI_IO_ERROR;
 		}
 	}
+	ymetricsInit();
 	yContext = ctx;
 #ifndef YAPI_IN_YDEVICE
 	yProgInit();
@@ -1650,6 +2140,20 @@ static void yapiFreeAPI_internal(void)
 	}
 
 	ySSDPStop(&yContext->SSDP);
+	if (yContext->snapshotFile)
+	{
+		if (YISERR(ySnapshotSave(yContext->snapshotFile, errmsg)))
+		{
+			dbglog("registry snapshot: %s\n", errmsg);
+		}
+		yFree(yContext->snapshotFile);
+		yContext->snapshotFile = NULL;
+	}
+	if (yContext->snapshotData)
+	{
+		yFree(yContext->snapshotData);
+		yContext->snapshotData = NULL;
+	}
 	//unregister all Network hub
 	for (i = 0; i < NBMAX_NET_HUB; i++)
 	{
@@ -1662,6 +2166,7 @@ static void yapiFreeAPI_internal(void)
 	yHashFree();
 	yTcpShutdown();
 	yCloseEvent(&yContext->exitSleepEvent);
+	yCloseEventPipe(yContext);
 
 	yLeaveCriticalSection(&yContext->updateDev_cs);
 	yLeaveCriticalSection(&yContext->handleEv_cs);
@@ -1669,6 +2174,7 @@ static void yapiFreeAPI_internal(void)
 	deleteAllCS(yContext);
 	ySafeMemoryDump(yContext);
 	yFree(yContext);
+	ymetricsFree();
 	ySafeMemoryStop();
 #ifdef DEBUG_CRITICAL_SECTION
     yFreeDebugCS();
@@ -1848,8 +2354,8 @@ static void wpUpdateTCP(HubSt* hub, const char* serial, const char* name, u8 bea
 
 	if (devydx < 0)
 	{
-		// drop notification until we have register the device with
-		// a real enumeration
+		// the device is registered by the next enumeration
+		yNetHubQueueDevice(hub, serialref, MAX_YDX_PER_HUB);
 		return;
 	}
 
@@ -2240,6 +2746,10 @@ int handleNetNotification(HubSt* hub)
             dumpNotif(Dbuffer);
 #endif
 		ypUpdateUSB(serial, funcid, name, funclass, funydx,NULL);
+		if (wpGetDevYdx(yHashPutStr(serial)) < 0)
+		{
+			yNetHubQueueDevice(hub, yHashPutStr(serial), MAX_YDX_PER_HUB);
+		}
 		break;
 	case NOTIFY_NETPKT_CHILD:
 		children = p;
@@ -2260,8 +2770,19 @@ int handleNetNotification(HubSt* hub)
 #endif
 		if (*p == '0')
 		{
+			yNetHubUnqueueDevice(hub, yHashPutStr(children));
 			unregisterNetDevice(yHashPutStr(children));
 		}
+		else if (*p == '1')
+		{
+			// newer hubs append the index of the child in their own device list
+			devydx = MAX_YDX_PER_HUB;
+			if (p[1] == NOTIFY_NETPKT_SEP && (unsigned)atoi(p + 2) < MAX_YDX_PER_HUB)
+			{
+				devydx = (u8)atoi(p + 2);
+			}
+			yNetHubQueueDevice(hub, yHashPutStr(children), devydx);
+		}
 		break;
 	case NOTIFY_NETPKT_LOG:
 #ifdef DEBUG_NET_NOTIFICATION
@@ -2384,6 +2905,7 @@ static void* yhelper_thread(void* ctx)
 						hub->attemptDelay = 8000;
 					hub->lastAttempt = yapiGetTickCount();
 					hub->retryCount++;
+					ymetricsReconnect(hub);
 					yEnterCriticalSection(&hub->access);
 					hub->errcode = ySetErr(res, hub->errmsg, errmsg, NULL, 0);
 					yLeaveCriticalSection(&hub->access);
@@ -2464,6 +2986,7 @@ static void* yhelper_thread(void* ctx)
 										if (!memcmp((u8 *)buffer, (u8 *)"HTTP/1.1 200", 12))
 										{
 											hub->state = NET_HUB_ESTABLISHED;
+											hub->connCount++;
 										}
 									}
 									if (hub->state != NET_HUB_ESTABLISHED)
@@ -2479,6 +3002,7 @@ static void* yhelper_thread(void* ctx)
 							if (hub->state == NET_HUB_ESTABLISHED)
 							{
 								while (handleNetNotification(hub));
+								ySignalPendingEvents();
 							}
 							hub->http.lastTraffic = yapiGetTickCount();
 						}
@@ -2518,6 +3042,7 @@ static void* yhelper_thread(void* ctx)
 								hub->attemptDelay = 8000;
 							hub->lastAttempt = yapiGetTickCount();
 							hub->retryCount++;
+							ymetricsReconnect(hub);
 							yEnterCriticalSection(&hub->access);
 							hub->errcode = ySetErr(res, hub->errmsg, errmsg, NULL, 0);
 							yLeaveCriticalSection(&hub->access);
@@ -2587,9 +3112,159 @@ static YRETCODE yapiUnlockDeviceCallBack_internal(char* errmsg)
 }
 
 
+// Registers a network hub and starts its helper thread, without waiting
+// for the connection. A hub that is already registered is reused as it is,
+// and *newhub is set to 0.
+static YRETCODE yapiStartNetHub(const char* url, int mandatory, HubSt** hub, int* newhub, char* errmsg)
+{
+	HubSt* hubst;
+	int i, res;
+	int firstfree;
+	void* (*thead_handler)(void*);
+
+	*newhub = 0;
+	hubst = yapiAllocHub(url, errmsg);
+	if (hubst == NULL)
+	{
+		return YAPI_INVALID_ARGUMENT;
+	}
+	if (mandatory)
+	{
+		hubst->mandatory = 1;
+	}
+	//look if we allready know this
+	yEnterCriticalSection(&yContext->enum_cs);
+	firstfree = NBMAX_NET_HUB;
+	for (i = 0; i < NBMAX_NET_HUB; i++)
+	{
+		if (yContext->nethub[i] && yHashSameHub(yContext->nethub[i]->url, hubst->url))
+			break;
+		if (firstfree == NBMAX_NET_HUB && yContext->nethub[i] == NULL)
+		{
+			firstfree = i;
+		}
+	}
+
+
+	if (i >= NBMAX_NET_HUB && firstfree < NBMAX_NET_HUB)
+	{
+		i = firstfree;
+		// save mapping attributed from first access
+#ifdef TRACE_NET_HUB
+            dbglog("HUB: register %x->%s \n", hubst->url, hubst->name);
+#endif
+		yContext->nethub[i] = hubst;
+		*newhub = 1;
+		if (YISERR(res = yStartWakeUpSocket(&yContext->nethub[i]->wuce, errmsg)))
+		{
+			yLeaveCriticalSection(&yContext->enum_cs);
+			return (YRETCODE)res;
+		}
+		if (hubst->proto == PROTO_WEBSOCKET)
+		{
+			thead_handler = ws_thread;
+		}
+		else
+		{
+			thead_handler = yhelper_thread;
+		}
+		//yThreadCreate will not create a new thread if there is already one running
+		if (yThreadCreate(&yContext->nethub[i]->net_thread, thead_handler, (void*)yContext->nethub[i]) < 0)
+		{
+			yLeaveCriticalSection(&yContext->enum_cs);
+			return YERRMSG(YAPI_IO_ERROR, "Unable to start helper thread");
+		}
+		yDringWakeUpSocket(&yContext->nethub[i]->wuce, 1, errmsg);
+	}
+	else if (i < NBMAX_NET_HUB)
+	{
+		// already registered: check the running instance instead
+		yapiFreeHub(hubst);
+		hubst = yContext->nethub[i];
+	}
+	yLeaveCriticalSection(&yContext->enum_cs);
+	if (i == NBMAX_NET_HUB)
+	{
+		yapiFreeHub(hubst);
+		return YERRMSG(YAPI_INVALID_ARGUMENT, "Too many network hub registered");
+	}
+	if (*newhub && yContext->snapshotData)
+	{
+		yEnterCriticalSection(&yContext->updateDev_cs);
+		ySnapshotApply(hubst);
+		yLeaveCriticalSection(&yContext->updateDev_cs);
+	}
+	*hub = hubst;
+	return YAPI_SUCCESS;
+}
+
+// Returns 1 while the helper thread of a hub is still busy with its first connection
+static int yapiNetHubConnecting(HubSt* hubst)
+{
+	return hubst->state != NET_HUB_ESTABLISHED && hubst->state != NET_HUB_CLOSED && hubst->retryCount == 0;
+}
+
+// Checks the outcome of the first connection of a hub and runs its first
+// enumeration. On failure, a hub registered by this call is unregistered,
+// and a hub that already existed is left as it was.
+static YRETCODE yapiCompleteNetHub(HubSt* hubst, const char* url, int newhub, char* errmsg)
+{
+	int res;
+
+	if (hubst->state != NET_HUB_ESTABLISHED)
+	{
+		yEnterCriticalSection(&hubst->access);
+		res = YERRMSGSILENT(hubst->errcode, hubst->errmsg);
+		yLeaveCriticalSection(&hubst->access);
+		if (!YISERR(res))
+		{
+			return YERRMSG(YAPI_IO_ERROR, "hub not ready");
+		}
+		if (newhub)
+		{
+			unregisterNetHub(hubst->url);
+		}
+		return res;
+	}
+	yEnterCriticalSection(&yContext->updateDev_cs);
+	res = yNetHubEnum(hubst, 1, errmsg);
+	yLeaveCriticalSection(&yContext->updateDev_cs);
+	if (YISERR(res))
+	{
+		if (newhub)
+		{
+			yapiUnregisterHub_internal(url);
+		}
+		return res;
+	}
+	hubst->mandatory = 1;
+	if (hubst->proto != PROTO_WEBSOCKET)
+	{
+		// for HTTP test admin pass if the hub require it
+		if (hubst->writeProtected && hubst->http.s_user && strcmp(hubst->http.s_user, "admin") == 0)
+		{
+			YIOHDL iohdl;
+			const char* request = "GET /api/module/serial?serial=&. ";
+			char* reply = NULL;
+			int replysize = 0;
+			int tmpres = yapiHTTPRequestSyncStartEx_internal(&iohdl, 0, yHashGetStrPtr(hubst->serial), request, YSTRLEN(request), &reply, &replysize, NULL, NULL, errmsg);
+			if (tmpres == YAPI_UNAUTHORIZED)
+			{
+				return tmpres;
+			}
+			if (tmpres == YAPI_SUCCESS)
+			{
+				yapiHTTPRequestSyncDone_internal(&iohdl, errmsg);
+			}
+		}
+	}
+
+	return res;
+}
+
+
 static YRETCODE yapiRegisterHubEx(const char* url, int checkacces, char* errmsg)
 {
-	int i;
 	int res;
 
 	if (!yContext)
@@ -2636,118 +3311,20 @@ static YRETCODE yapiRegisterHubEx(const char* url, int checkacces, char* errmsg)
 	}
 	else
 	{
-		HubSt* hubst = NULL;
-		int firstfree;
-		void* (*thead_handler)(void*);
-
-		hubst = yapiAllocHub(url, errmsg);
-		if (hubst == NULL)
-		{
-			return YAPI_INVALID_ARGUMENT;
-		}
-		if (checkacces)
-		{
-			hubst->mandatory = 1;
-		}
-		//look if we allready know this
-		yEnterCriticalSection(&yContext->enum_cs);
-		firstfree = NBMAX_NET_HUB;
-		for (i = 0; i < NBMAX_NET_HUB; i++)
-		{
-			if (yContext->nethub[i] && yHashSameHub(yContext->nethub[i]->url, hubst->url))
-				break;
-			if (firstfree == NBMAX_NET_HUB && yContext->nethub[i] == NULL)
-			{
-				firstfree = i;
-			}
-		}
-
-
-		if (i >= NBMAX_NET_HUB && firstfree < NBMAX_NET_HUB)
-		{
-			i = firstfree;
-			// save mapping attributed from first access
-#ifdef TRACE_NET_HUB
-            dbglog("HUB: register %x->%s \n", hubst->url, hubst->name);
-#endif
-			yContext->nethub[i] = hubst;
-			if (YISERR(res = yStartWakeUpSocket(&yContext->nethub[i]->wuce, errmsg)))
-			{
-				yLeaveCriticalSection(&yContext->enum_cs);
-				return (YRETCODE)res;
-			}
-			if (hubst->proto == PROTO_WEBSOCKET)
-			{
-				thead_handler = ws_thread;
-			}
-			else
-			{
-				thead_handler = yhelper_thread;
-			}
-			//yThreadCreate will not create a new thread if there is already one running
-			if (yThreadCreate(&yContext->nethub[i]->net_thread, thead_handler, (void*)yContext->nethub[i]) < 0)
-			{
-				yLeaveCriticalSection(&yContext->enum_cs);
-				return YERRMSG(YAPI_IO_ERROR, "Unable to start helper thread");
-			}
-			yDringWakeUpSocket(&yContext->nethub[i]->wuce, 1, errmsg);
-		}
-		yLeaveCriticalSection(&yContext->enum_cs);
-		if (i == NBMAX_NET_HUB)
-		{
-			yapiFreeHub(hubst);
-			return YERRMSG(YAPI_INVALID_ARGUMENT, "Too many network hub registered");
-		}
+		HubSt* hubst;
+		int newhub;
+		u64 timeout;
 
+		YPROPERR(yapiStartNetHub(url, checkacces, &hubst, &newhub, errmsg));
 		if (checkacces)
 		{
 			// ensure the thread has been able to connect to the hub
-			u64 timeout = yapiGetTickCount() + YIO_DEFAULT_TCP_TIMEOUT;
-			while (hubst->state != NET_HUB_ESTABLISHED && hubst->state != NET_HUB_CLOSED && hubst->retryCount == 0 && timeout > yapiGetTickCount())
+			timeout = yapiGetTickCount() + YIO_DEFAULT_TCP_TIMEOUT;
+			while (yapiNetHubConnecting(hubst) && timeout > yapiGetTickCount())
 			{
 				yapiSleep(100, errmsg);
 			}
-			if (hubst->state != NET_HUB_ESTABLISHED)
-			{
-				yEnterCriticalSection(&hubst->access);
-				res = YERRMSGSILENT(yContext->nethub[i]->errcode, yContext->nethub[i]->errmsg);
-				yLeaveCriticalSection(&hubst->access);
-				if (!YISERR(res))
-				{
-					return YERRMSG(YAPI_IO_ERROR, "hub not ready");
-				}
-				unregisterNetHub(hubst->url);
-				return res;
-			}
-			yEnterCriticalSection(&yContext->updateDev_cs);
-			res = yNetHubEnum(hubst, 1, errmsg);
-			yLeaveCriticalSection(&yContext->updateDev_cs);
-			if (YISERR(res))
-			{
-				yapiUnregisterHub_internal(url);
-			}
-			else if (hubst->proto != PROTO_WEBSOCKET)
-			{
-				// for HTTP test admin pass if the hub require it
-				if (hubst->writeProtected && hubst->http.s_user && strcmp(hubst->http.s_user, "admin") == 0)
-				{
-					YIOHDL iohdl;
-					const char* request = "GET /api/module/serial?serial=&. ";
-					char* reply = NULL;
-					int replysize = 0;
-					int tmpres = yapiHTTPRequestSyncStartEx_internal(&iohdl, 0, yHashGetStrPtr(hubst->serial), request, YSTRLEN(request), &reply, &replysize, NULL, NULL, errmsg);
-					if (tmpres == YAPI_UNAUTHORIZED)
-					{
-						return tmpres;
-					}
-					if (tmpres == YAPI_SUCCESS)
-					{
-						yapiHTTPRequestSyncDone_internal(&iohdl, errmsg);
-					}
-				}
-			}
-
-			return res;
+			return yapiCompleteNetHub(hubst, url, newhub, errmsg);
 		}
 	}
 	return YAPI_SUCCESS;
@@ -2812,6 +3389,7 @@ static int pingURLOnhub(HubSt* hubst, const char* request, int mstimeout, char*
 			if (yapiGetTickCount() >= globalTimeout)
 			{
 				res = YERR(YAPI_TIMEOUT);
+				break;
 			}
 		}
 	}
@@ -2936,6 +3514,159 @@ static YRETCODE yapiPreregisterHub_internal(const char* url, char* errmsg)
 	return res;
 }
 
+// Invokes the per-hub callback, returns 1 if the hub is ready
+static int yapiReportHub(yapiRegisterHubCallback callback, void* context, const char* url, YRETCODE res, const char* errmsg)
+{
+	if (callback)
+	{
+		callback(context, url, res, YISERR(res) ? errmsg : "");
+	}
+	return YISERR(res) ? 0 : 1;
+}
+
+// Same as yapiRegisterHub on each url, but all network hubs connect at
+// the same time. Failed connections are reported as soon as they are
+// known, and connected hubs are enumerated one at a time since the
+// enumerations are serialized by updateDev_cs anyway.
+static int yapiRegisterHubs_internal(const char** urls, int count, int mstimeout, yapiRegisterHubCallback callback, void* context, char* errmsg)
+{
+	HubSt** hubs;
+	yUrlRef* failed;
+	u8* newhubs;
+	char huberr[YOCTO_ERRMSG_LEN];
+	YRETCODE res;
+	u64 deadline;
+	int i, k, newhub, enumerated, pending = 0, nbready = 0;
+
+	if (count < 0 || (count > 0 && urls == NULL))
+	{
+		return YERRMSG(YAPI_INVALID_ARGUMENT, "Invalid hub list");
+	}
+	if (!yContext)
+	{
+		YPROPERR(yapiInitAPI_internal(0,errmsg));
+	}
+	if (mstimeout <= 0)
+	{
+		mstimeout = YIO_DEFAULT_TCP_TIMEOUT;
+	}
+	deadline = yapiGetTickCount() + mstimeout;
+	hubs = (HubSt**)yMalloc((count + 1) * sizeof(HubSt*));
+	memset(hubs, 0, (count + 1) * sizeof(HubSt*));
+	failed = (yUrlRef*)yMalloc((count + 1) * sizeof(yUrlRef));
+	newhubs = (u8*)yMalloc(count + 1);
+	memset(newhubs, 0, count + 1);
+	for (i = 0; i < count; i++)
+	{
+		failed[i] = INVALID_HASH_IDX;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (urls[i] == NULL)
+		{
+			res = (YRETCODE)ySetErr(YAPI_INVALID_ARGUMENT, huberr, "Invalid hub url", NULL, 0);
+		}
+		else if (YSTRICMP(urls[i],"usb") == 0 || YSTRICMP(urls[i],"net") == 0)
+		{
+			res = yapiRegisterHubEx(urls[i], 1, huberr);
+		}
+		else
+		{
+			res = yapiStartNetHub(urls[i], 1, &hubs[i], &newhub, huberr);
+			if (!YISERR(res))
+			{
+				newhubs[i] = (u8)newhub;
+				// a hub listed twice is reported once
+				for (k = 0; k < i && hubs[k] != hubs[i]; k++);
+				if (k < i)
+				{
+					hubs[i] = NULL;
+				}
+				else
+				{
+					pending++;
+				}
+				continue;
+			}
+		}
+		nbready += yapiReportHub(callback, context, urls[i] ? urls[i] : "", res, huberr);
+	}
+	while (pending > 0)
+	{
+		// failed connections need no network traffic
+		for (i = 0; i < count; i++)
+		{
+			if (hubs[i] && hubs[i]->state != NET_HUB_ESTABLISHED && !yapiNetHubConnecting(hubs[i]))
+			{
+				yEnterCriticalSection(&hubs[i]->access);
+				res = (YRETCODE)ySetErr(hubs[i]->errcode, huberr, hubs[i]->errmsg, NULL, 0);
+				yLeaveCriticalSection(&hubs[i]->access);
+				if (!YISERR(res))
+				{
+					res = (YRETCODE)ySetErr(YAPI_IO_ERROR, huberr, "hub not ready", NULL, 0);
+				}
+				if (newhubs[i])
+				{
+					// stop its thread now, it is unregistered once all hubs are done
+					failed[i] = hubs[i]->url;
+					hubs[i]->state = NET_HUB_TOCLOSE;
+					yThreadRequestEnd(&hubs[i]->net_thread);
+					yDringWakeUpSocket(&hubs[i]->wuce, 0, huberr);
+				}
+				hubs[i] = NULL;
+				pending--;
+				yapiReportHub(callback, context, urls[i], res, huberr);
+			}
+		}
+		enumerated = 0;
+		for (i = 0; i < count && yapiGetTickCount() < deadline; i++)
+		{
+			if (hubs[i] && hubs[i]->state == NET_HUB_ESTABLISHED)
+			{
+				res = yapiCompleteNetHub(hubs[i], urls[i], newhubs[i], huberr);
+				hubs[i] = NULL;
+				pending--;
+				nbready += yapiReportHub(callback, context, urls[i], res, huberr);
+				enumerated = 1;
+				break;
+			}
+		}
+		if (yapiGetTickCount() >= deadline)
+		{
+			for (i = 0; i < count; i++)
+			{
+				if (hubs[i])
+				{
+					// keep trying in background, as a preregistered hub
+					if (newhubs[i])
+					{
+						hubs[i]->mandatory = 0;
+					}
+					hubs[i] = NULL;
+					pending--;
+					res = (YRETCODE)ySetErr(YAPI_TIMEOUT, huberr, "hub not ready", NULL, 0);
+					yapiReportHub(callback, context, urls[i], res, huberr);
+				}
+			}
+		}
+		else if (!enumerated)
+		{
+			yapiSleep(10, huberr);
+		}
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (failed[i] != INVALID_HASH_IDX)
+		{
+			unregisterNetHub(failed[i]);
+		}
+	}
+	yFree(newhubs);
+	yFree(failed);
+	yFree(hubs);
+	return nbready;
+}
+
 static void yapiUnregisterHub_internal(const char* url)
 {
 	yUrlRef huburl;
@@ -2991,39 +3722,168 @@ static YRETCODE yapiUpdateDeviceList_internal(u32 forceupdate, char* errmsg)
 	}
 	else
 	{
-		// if we do not force an update
-		if (!yTryEnterCriticalSection(&yContext->updateDev_cs))
+		// if we do not force an update
+		if (!yTryEnterCriticalSection(&yContext->updateDev_cs))
+		{
+			return YAPI_SUCCESS;
+		}
+	}
+	if (yContext->detecttype & Y_DETECT_USB)
+	{
+		err = yUSBUpdateDeviceList(errmsg);
+	}
+
+	for (i = 0; i < NBMAX_NET_HUB; i++)
+	{
+		if (yContext->nethub[i])
+		{
+			int subres;
+			if (YISERR(subres = yNetHubEnum(yContext->nethub[i], forceupdate, suberr)) && err == YAPI_SUCCESS)
+			{
+				//keep first generated error
+				char buffer[YOCTO_HOSTNAME_NAME] = "";
+				u16 port;
+				err = (YRETCODE)subres;
+				yHashGetUrlPort(yContext->nethub[i]->url, buffer, &port, NULL, NULL, NULL);
+				if (errmsg)
+				{
+					YSPRINTF(errmsg,YOCTO_ERRMSG_LEN, "Enumeration failed for %s:%d (%s)", buffer, port, suberr);
+				}
+			}
+		}
+	}
+	if (yContext->snapshotInterval && yapiGetTickCount() >= yContext->snapshotNextSave)
+	{
+		if (YISERR(ySnapshotSave(yContext->snapshotFile, suberr)))
+		{
+			dbglog("registry snapshot: %s\n", suberr);
+		}
+		yContext->snapshotNextSave = yapiGetTickCount() + yContext->snapshotInterval;
+	}
+	yLeaveCriticalSection(&yContext->updateDev_cs);
+
+	return err;
+}
+
+
+static void yapiSetNetDevListValidity_internal(int sValidity)
+{
+	u64 fullExpires;
+	int i;
+
+	if (!yContext)
+		return;
+	if (sValidity < 0)
+	{
+		sValidity = 0;
+	}
+	yEnterCriticalSection(&yContext->updateDev_cs);
+	yContext->devListValidity = (u32)sValidity * 1000;
+	// a shorter period applies at once
+	fullExpires = yapiGetTickCount() + yContext->devListValidity;
+	for (i = 0; i < NBMAX_NET_HUB; i++)
+	{
+		if (yContext->nethub[i] && yContext->nethub[i]->devListFullExpires > fullExpires)
+		{
+			yContext->nethub[i]->devListFullExpires = fullExpires;
+		}
+	}
+	yLeaveCriticalSection(&yContext->updateDev_cs);
+}
+
+static int yapiGetNetDevListValidity_internal(void)
+{
+	if (!yContext)
+		return NET_HUB_DEFAULT_DEVLIST_VALIDITY;
+	return (int)(yContext->devListValidity / 1000);
+}
+
+
+static YRETCODE yapiSetRegistrySnapshot_internal(const char* file, int autosaveSeconds, char* errmsg)
+{
+	FILE* f;
+	char* data = NULL;
+	long size = 0;
+	int i, len;
+
+	if (!yContext)
+	{
+		YPROPERR(yapiInitAPI_internal(0,errmsg));
+	}
+	if (file && *file)
+	{
+		len = YSTRLEN(file);
+		if (len >= TRACEFILE_NAMELEN)
 		{
-			return YAPI_SUCCESS;
+			return YERRMSG(YAPI_INVALID_ARGUMENT, "Registry snapshot file name too long");
+		}
+		// a missing file is not an error, it is created on the first save
+		if (YFOPEN(&f, file, "rb") == 0)
+		{
+			fseek(f, 0, SEEK_END);
+			size = ftell(f);
+			fseek(f, 0, SEEK_SET);
+			if (size > 0)
+			{
+				data = (char*)yMalloc(size + 1);
+				size = (long)fread(data, 1, size, f);
+				data[size] = 0;
+			}
+			fclose(f);
 		}
 	}
-	if (yContext->detecttype & Y_DETECT_USB)
+	yEnterCriticalSection(&yContext->updateDev_cs);
+	if (yContext->snapshotFile)
 	{
-		err = yUSBUpdateDeviceList(errmsg);
+		yFree(yContext->snapshotFile);
+		yContext->snapshotFile = NULL;
 	}
-
-	for (i = 0; i < NBMAX_NET_HUB; i++)
+	if (yContext->snapshotData)
 	{
-		if (yContext->nethub[i])
+		yFree(yContext->snapshotData);
+		yContext->snapshotData = NULL;
+	}
+	yContext->snapshotSize = 0;
+	yContext->snapshotInterval = 0;
+	if (file && *file)
+	{
+		len = YSTRLEN(file);
+		yContext->snapshotFile = (char*)yMalloc(len + 1);
+		memcpy(yContext->snapshotFile, file, len + 1);
+		yContext->snapshotData = data;
+		yContext->snapshotSize = (int)size;
+		yContext->snapshotInterval = (autosaveSeconds > 0 ? (u32)autosaveSeconds * 1000 : 0);
+		yContext->snapshotNextSave = yapiGetTickCount() + yContext->snapshotInterval;
+		// hubs registered before the snapshot was loaded
+		for (i = 0; i < NBMAX_NET_HUB; i++)
 		{
-			int subres;
-			if (YISERR(subres = yNetHubEnum(yContext->nethub[i], forceupdate, suberr)) && err == YAPI_SUCCESS)
+			if (yContext->nethub[i])
 			{
-				//keep first generated error
-				char buffer[YOCTO_HOSTNAME_NAME] = "";
-				u16 port;
-				err = (YRETCODE)subres;
-				yHashGetUrlPort(yContext->nethub[i]->url, buffer, &port, NULL, NULL, NULL);
-				if (errmsg)
-				{
-					YSPRINTF(errmsg,YOCTO_ERRMSG_LEN, "Enumeration failed for %s:%d (%s)", buffer, port, suberr);
-				}
+				ySnapshotApply(yContext->nethub[i]);
 			}
 		}
 	}
 	yLeaveCriticalSection(&yContext->updateDev_cs);
+	return YAPI_SUCCESS;
+}
 
-	return err;
+static YRETCODE yapiSaveRegistrySnapshot_internal(char* errmsg)
+{
+	YRETCODE res;
+
+	if (!yContext)
+		return YERR(YAPI_NOT_INITIALIZED);
+	yEnterCriticalSection(&yContext->updateDev_cs);
+	if (yContext->snapshotFile == NULL)
+	{
+		res = YERRMSG(YAPI_INVALID_ARGUMENT, "No registry snapshot file set (see yapiSetRegistrySnapshot)");
+	}
+	else
+	{
+		res = (YRETCODE)ySnapshotSave(yContext->snapshotFile, errmsg);
+	}
+	yLeaveCriticalSection(&yContext->updateDev_cs);
+	return res;
 }
 
 
@@ -3034,13 +3894,100 @@ static YRETCODE yapiHandleEvents_internal(char* errmsg)
 	// we need only one thread to handle the event at a time
 	if (yTryEnterCriticalSection(&yContext->handleEv_cs))
 	{
-		YRETCODE res = (YRETCODE)yUsbIdle();
+		YRETCODE res;
+		yClearPendingEvents();
+		res = (YRETCODE)yUsbIdle();
 		yLeaveCriticalSection(&yContext->handleEv_cs);
 		return res;
 	}
 	return YAPI_SUCCESS;
 }
 
+static int yapiGetEventFd_internal(char* errmsg)
+{
+	if (!yContext)
+		return YERR(YAPI_NOT_INITIALIZED);
+#ifdef WINDOWS_API
+	return YERRMSG(YAPI_NOT_SUPPORTED, "No event file descriptor on this platform (use yapiWaitForEvents)");
+#else
+	if (yContext->eventPipe[0] < 0)
+		return YERRMSG(YAPI_IO_ERROR, "Unable to create the event pipe");
+	return yContext->eventPipe[0];
+#endif
+}
+
+static int yapiWaitForEvents_internal(int ms_timeout, char* errmsg)
+{
+	u64 now, timeout;
+
+	if (!yContext)
+		return YERR(YAPI_NOT_INITIALIZED);
+	timeout = yapiGetTickCount() + (ms_timeout < 0 ? 0 : ms_timeout);
+	// the wake-up event may still be set by events already handled
+	while (!yContext->eventPending)
+	{
+		if (ms_timeout < 0)
+		{
+			yWaitForEvent(&yContext->exitSleepEvent, -1);
+			continue;
+		}
+		now = yapiGetTickCount();
+		if (now >= timeout)
+			break;
+		yWaitForEvent(&yContext->exitSleepEvent, (int)(timeout - now));
+	}
+	return yContext->eventPending ? 1 : 0;
+}
+
+static int yapiGetMetrics_internal(yMetricsEntry* entries, int maxentries, int* neededentries, char* errmsg)
+{
+	int count;
+
+	if (!yContext)
+		return YERR(YAPI_NOT_INITIALIZED);
+	if (maxentries < 0 || (maxentries > 0 && entries == NULL))
+		return YERR(YAPI_INVALID_ARGUMENT);
+	count = ymetricsGet(entries, maxentries);
+	if (neededentries)
+		*neededentries = count;
+	return (count < maxentries ? count : maxentries);
+}
+
+static int yapiGetMetricsText_internal(char* buffer, int buffersize, int* fullsize, char* errmsg)
+{
+	char* text;
+	int len;
+
+	if (!yContext)
+		return YERR(YAPI_NOT_INITIALIZED);
+	if (buffersize < 0 || (buffersize > 0 && buffer == NULL))
+		return YERR(YAPI_INVALID_ARGUMENT);
+	len = ymetricsRender(&text);
+	if (fullsize)
+		*fullsize = len;
+	if (buffersize > 0)
+	{
+		if (len >= buffersize)
+			len = buffersize - 1;
+		if (len > 0)
+			memcpy(buffer, text, len);
+		buffer[len] = 0;
+	}
+	else
+	{
+		len = 0;
+	}
+	if (text)
+		yFree(text);
+	return len;
+}
+
+static void yapiRecordCallback_internal(YAPI_FUNCTION fundescr, u64 start_us)
+{
+	u64 now = ymetricsTime();
+	ymetricsCallback((yStrRef)(fundescr & 0xffff), now > start_us ? now - start_us : 0);
+}
+
 u64 test_pkt = 0;
 u64 test_tout = 0;
 
@@ -3313,6 +4260,20 @@ static YRETCODE yapiGetDeviceInfo_internal(YAPI_DEVICE devdesc, yDeviceSt* infos
 	return YAPI_SUCCESS;
 }
 
+static int yapiIsDeviceTentative_internal(YAPI_DEVICE devdesc, char* errmsg)
+{
+	int res;
+
+	if (!yContext)
+		return YERR(YAPI_NOT_INITIALIZED);
+	if (devdesc < 0)
+		return YERR(YAPI_INVALID_ARGUMENT);
+	res = wpIsTentative(devdesc & 0xffff);
+	if (res < 0)
+		return YERR(YAPI_DEVICE_NOT_FOUND);
+	return res;
+}
+
 static YRETCODE yapiGetDevicePath_internal(YAPI_DEVICE devdesc, char* rootdevice, char* request, int requestsize, int* neededsize, char* errmsg)
 {
 	YRETCODE res;
@@ -3514,6 +4475,32 @@ static int yapiRequestOpenUSB(YIOHDL_internal* iohdl, HubSt* hub, YAPI_DEVICE de
 }
 
 
+// Modules behind a hub are reached through the hub with a /bySerial/ prefix:
+// account such requests to the module actually addressed
+static yStrRef yapiMetricsSerial(YAPI_DEVICE dev, const char* request, int reqlen)
+{
+	char serial[YOCTO_SERIAL_LEN];
+	const char* p = request;
+	const char* end = request + reqlen;
+	int len;
+
+	while (p < end && *p != ' ')
+		p++;
+	p++;
+	if (end - p > 10 && memcmp(p, "/bySerial/", 10) == 0)
+	{
+		p += 10;
+		for (len = 0; p + len < end && p[len] != '/' && len < YOCTO_SERIAL_LEN - 1; len++)
+		{
+			serial[len] = p[len];
+		}
+		serial[len] = 0;
+		return yHashTestStr(serial);
+	}
+	return (yStrRef)dev;
+}
+
+
 static int yapiRequestOpenHTTP(YIOHDL_internal* iohdl, HubSt* hub, YAPI_DEVICE dev, const char* request, int reqlen, int wait_for_start, u64 mstimeout, yapiRequestAsyncCallback callback, void* context, char* errmsg)
 {
 	YRETCODE res;
@@ -3553,6 +4540,7 @@ static int yapiRequestOpenHTTP(YIOHDL_internal* iohdl, HubSt* hub, YAPI_DEVICE d
 		return YAPI_IO_ERROR;
 	}
 
+	tcpreq->metricsSerial = yapiMetricsSerial(dev, request, reqlen);
 	res = (YRETCODE)yReqOpen(tcpreq, wait_for_start, 0, request, reqlen, mstimeout, callback, context, NULL, NULL, errmsg);
 	if (res != YAPI_SUCCESS)
 	{
@@ -3618,6 +4606,7 @@ static int yapiRequestOpenWS(YIOHDL_internal* iohdl, HubSt* hub, YAPI_DEVICE dev
 		return YERRMSG(YAPI_TIMEOUT, "hub is not ready");
 	}
 
+	req->metricsSerial = yapiMetricsSerial(dev, request, reqlen);
 	res = (YRETCODE)yReqOpen(req, 2 * YIO_DEFAULT_TCP_TIMEOUT, tcpchan, request, reqlen, mstimeout, callback, context, progress_cb, progress_ctx, errmsg);
 	if (res != YAPI_SUCCESS)
 	{
@@ -3822,10 +4811,9 @@ YRETCODE yapiHTTPRequestSyncStartEx_internal(YIOHDL* iohdl, int tcpchan, const c
 {
 	YRETCODE res;
 	YIOHDL_internal* internalio;
-#ifdef DEBUG_YAPI_REQ
-    int req_count = YREQ_LOG_START("SyncStartEx", device, request, requestsize);
-    u64 start_tm = yapiGetTickCount();
-#endif
+	int trace_id = ytraceReqStart(device, request, requestsize);
+	u64 start_tm = yapiGetTickCount();
+	u64 metrics_tm = ymetricsTime();
 
 
 	if (!yContext)
@@ -3865,13 +4853,8 @@ YRETCODE yapiHTTPRequestSyncStartEx_internal(YIOHDL* iohdl, int tcpchan, const c
 		yContext->yiohdl_first = internalio;
 		yLeaveCriticalSection(&yContext->io_cs);
 	}
-#ifdef DEBUG_YAPI_REQ
-    if (res < 0) {
-        YREQ_LOG_APPEND_ERR(req_count, "SyncStartEx", errmsg, res, start_tm);
-    } else {
-        YREQ_LOG_APPEND(req_count, "SyncStartEx", *reply, *replysize, start_tm);
-    }
-#endif
+	ytraceReqEnd(trace_id, res, YISERR(res) ? 0 : *replysize, errmsg, start_tm);
+	ymetricsRequest(yapiMetricsSerial(wpSearch(device), request, requestsize), metrics_tm, requestsize, YISERR(res) ? 0 : *replysize, res);
 
 	return res;
 }
@@ -3933,10 +4916,29 @@ YRETCODE yapiHTTPRequestSyncDone_internal(YIOHDL* iohdl, char* errmsg)
 
 static void asyncDrop(void* context, const u8* result, u32 resultlen, int retcode, const char* errmsg)
 {
-#ifdef DEBUG_YAPI_REQ
-    int req_count = (((u8*)context) - ((u8*)NULL));
-    YREQ_LOG_APPEND(req_count, "ASync", result, resultlen, 0);
-#endif
+	int trace_id = (int)(((u8*)context) - ((u8*)NULL));
+	if (trace_id)
+	{
+		ytraceRecord(YTRACE_REQ_END, trace_id, YISERR(retcode) ? retcode : (int)resultlen, 0, errmsg, YISERR(retcode) && errmsg ? YSTRLEN(errmsg) : 0);
+	}
+}
+
+// Context of a traced async request with a user callback
+typedef struct
+{
+	yapiRequestAsyncCallback callback;
+	void* context;
+	int trace_id;
+	u64 start_tm;
+} AsyncTraceCtx;
+
+static void asyncTraced(void* context, const u8* result, u32 resultlen, int retcode, const char* errmsg)
+{
+	AsyncTraceCtx* ctx = (AsyncTraceCtx*)context;
+
+	ytraceReqEnd(ctx->trace_id, retcode, (int)resultlen, errmsg, ctx->start_tm);
+	ctx->callback(ctx->context, result, resultlen, retcode, errmsg);
+	yFree(ctx);
 }
 
 
@@ -3945,28 +4947,38 @@ static YRETCODE yapiHTTPRequestAsyncEx_internal(int tcpchan, const char* device,
 	YIOHDL_internal iohdl;
 	YRETCODE res;
 	int retryCount = 1;
-#ifdef DEBUG_YAPI_REQ
-    int yreq_count = YREQ_LOG_START("ASync", device, request, len);
-#endif
+	u64 start_tm = yapiGetTickCount();
+	int trace_id;
+	AsyncTraceCtx* traced = NULL;
 
 	if (!yContext)
 		return YERR(YAPI_NOT_INITIALIZED);
 
+	trace_id = ytraceReqStart(device, request, len);
+	if (callback == NULL)
+	{
+		callback = asyncDrop;
+		context = ((u8*)NULL) + trace_id;
+	}
+	else if (trace_id)
+	{
+		// the end of the request is recorded before the user callback is called
+		traced = (AsyncTraceCtx*)yMalloc(sizeof(AsyncTraceCtx));
+		traced->callback = callback;
+		traced->context = context;
+		traced->trace_id = trace_id;
+		traced->start_tm = start_tm;
+		callback = asyncTraced;
+		context = traced;
+	}
 	do
 	{
-		if (callback == NULL)
-		{
-			callback = asyncDrop;
-#ifdef DEBUG_YAPI_REQ
-            context = ((u8*)NULL) + yreq_count;
-#endif
-		}
 		res = yapiRequestOpen(&iohdl, tcpchan, device, request, len, callback, context, NULL,NULL, errmsg);
 		if (YISERR(res))
 		{
 			if (res == YAPI_UNAUTHORIZED)
 			{
-				return res;
+				break;
 			}
 
 			if (retryCount)
@@ -3976,13 +4988,22 @@ static YRETCODE yapiHTTPRequestAsyncEx_internal(int tcpchan, const char* device,
 				if (YISERR(yapiUpdateDeviceList_internal(1, suberr)))
 				{
 					dbglog("yapiUpdateDeviceList failled too with %s\n",errmsg);
-					return res;
+					break;
 				}
 			}
 		}
 	}
 	while (res != YAPI_SUCCESS && retryCount--);
 
+	if (YISERR(res))
+	{
+		// the callback will never be called
+		ytraceReqEnd(trace_id, res, 0, errmsg, start_tm);
+		if (traced)
+		{
+			yFree(traced);
+		}
+	}
 	return res;
 }
 
@@ -4244,37 +5265,32 @@ static int yapiGetSubdevices_internal(const char* serial, char* buffer, int buff
 static const char* yapiJsonValueParseArray(yJsonStateMachine* j, const char* path, int* result, char* errmsg);
 
 
-static void skipJsonStruct(yJsonStateMachine* j)
+// skip up to the end of the struct or array that has just been opened; the closing
+// token is the first one of the same type found below the depth of the opening one
+static void skipJsonContainer(yJsonStateMachine* j, yJsonState type)
 {
+	int depth = j->depth;
 #ifdef DEBUG_JSON_PARSE
     dbglog("skip  %s(%d):%s\n", yJsonStateStr[j->st], j->st, j->token);
 #endif
-	yJsonParse(j);
-	do
+	while (yJsonParse(j) == YJSON_PARSE_AVAIL && (j->st != type || j->depth >= depth))
 	{
 #ifdef DEBUG_JSON_PARSE
         dbglog("... %s(%d):%s\n", yJsonStateStr[j->st], j->st, j->token);
 #endif
-		yJsonSkip(j, 1);
 	}
-	while (yJsonParse(j) == YJSON_PARSE_AVAIL && j->st != YJSON_PARSE_STRUCT);
+}
+
+
+static void skipJsonStruct(yJsonStateMachine* j)
+{
+	skipJsonContainer(j, YJSON_PARSE_STRUCT);
 }
 
 
 static void skipJsonArray(yJsonStateMachine* j)
 {
-#ifdef DEBUG_JSON_PARSE
-    dbglog("skip  %s(%d):%s\n", yJsonStateStr[j->st], j->st, j->token);
-#endif
-	yJsonParse(j);
-	do
-	{
-#ifdef DEBUG_JSON_PARSE
-        dbglog("... %s(%d):%s\n", yJsonStateStr[j->st], j->st, j->token);
-#endif
-		yJsonSkip(j, 1);
-	}
-	while (yJsonParse(j) == YJSON_PARSE_AVAIL && j->st != YJSON_PARSE_ARRAY);
+	skipJsonContainer(j, YJSON_PARSE_ARRAY);
 }
 
 
@@ -4741,7 +5757,23 @@ typedef enum
     trcGetSubdevices,
     trcGetMem,
     trcFreeMem,
-    trcGetSubDevcies
+    trcGetSubDevcies,
+    trcUpdateFirmwareSession,
+    trcGetFirmwareSessionProgress,
+    trcStartTraceRecorder,
+    trcStopTraceRecorder,
+    trcDecodeTraceFile,
+    trcGetEventFd,
+    trcWaitForEvents,
+    trcGetMetrics,
+    trcGetMetricsText,
+    trcResetMetrics,
+    trcSetRegistrySnapshot,
+    trcSaveRegistrySnapshot,
+    trcRegisterHubs,
+    trcSetNetDevListValidity,
+    trcGetNetDevListValidity,
+    trcIsDeviceTentative
 } TRC_FUN;
 
 static const char * trc_funname[] =
@@ -4800,7 +5832,23 @@ static const char * trc_funname[] =
     "GetSubdev",
     "getmem",
     "freemem",
-    "getsubdev"
+    "getsubdev",
+    "UpFwSession",
+    "FwSessionProg",
+    "StartTrcRec",
+    "StopTrcRec",
+    "DecodeTrc",
+    "GetEventFd",
+    "WaitForEvents",
+    "GetMetrics",
+    "GetMetricsText",
+    "ResetMetrics",
+    "SetRegSnapshot",
+    "SaveRegSnapshot",
+    "RegHubs",
+    "SetDevListValidity",
+    "GetDevListValidity",
+    "IsDevTentative"
 };
 
 static const char *dlltracefile = YDLL_TRACE_FILE;
@@ -4987,6 +6035,15 @@ YRETCODE YAPI_FUNCTION_EXPORT yapiPreregisterHub(const char* url, char* errmsg)
 	return res;
 }
 
+int YAPI_FUNCTION_EXPORT yapiRegisterHubs(const char** urls, int count, int mstimeout, yapiRegisterHubCallback callback, void* context, char* errmsg)
+{
+	int res;
+	YDLL_CALL_ENTER(trcRegisterHubs);
+	res = yapiRegisterHubs_internal(urls, count, mstimeout, callback, context, errmsg);
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
 void YAPI_FUNCTION_EXPORT yapiUnregisterHub(const char* url)
 {
 	YDLL_CALL_ENTER(trcUnregisterHub);
@@ -5021,6 +6078,99 @@ YRETCODE YAPI_FUNCTION_EXPORT yapiSleep(int ms_duration, char* errmsg)
 	return res;
 }
 
+int YAPI_FUNCTION_EXPORT yapiGetEventFd(char* errmsg)
+{
+	int res;
+	YDLL_CALL_ENTER(trcGetEventFd);
+	res = yapiGetEventFd_internal(errmsg);
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
+int YAPI_FUNCTION_EXPORT yapiWaitForEvents(int ms_timeout, char* errmsg)
+{
+	int res;
+	YDLL_CALL_ENTER(trcWaitForEvents);
+	res = yapiWaitForEvents_internal(ms_timeout, errmsg);
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
+YRETCODE YAPI_FUNCTION_EXPORT yapiSetRegistrySnapshot(const char* file, int autosaveSeconds, char* errmsg)
+{
+	YRETCODE res;
+	YDLL_CALL_ENTER(trcSetRegistrySnapshot);
+	res = yapiSetRegistrySnapshot_internal(file, autosaveSeconds, errmsg);
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
+YRETCODE YAPI_FUNCTION_EXPORT yapiSaveRegistrySnapshot(char* errmsg)
+{
+	YRETCODE res;
+	YDLL_CALL_ENTER(trcSaveRegistrySnapshot);
+	res = yapiSaveRegistrySnapshot_internal(errmsg);
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
+void YAPI_FUNCTION_EXPORT yapiSetNetDevListValidity(int sValidity)
+{
+	YDLL_CALL_ENTER(trcSetNetDevListValidity);
+	yapiSetNetDevListValidity_internal(sValidity);
+	YDLL_CALL_LEAVEVOID();
+}
+
+int YAPI_FUNCTION_EXPORT yapiGetNetDevListValidity(void)
+{
+	int res;
+	YDLL_CALL_ENTER(trcGetNetDevListValidity);
+	res = yapiGetNetDevListValidity_internal();
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
+int YAPI_FUNCTION_EXPORT yapiGetMetrics(yMetricsEntry* entries, int maxentries, int* neededentries, char* errmsg)
+{
+	int res;
+	YDLL_CALL_ENTER(trcGetMetrics);
+	res = yapiGetMetrics_internal(entries, maxentries, neededentries, errmsg);
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
+int YAPI_FUNCTION_EXPORT yapiGetMetricsText(char* buffer, int buffersize, int* fullsize, char* errmsg)
+{
+	int res;
+	YDLL_CALL_ENTER(trcGetMetricsText);
+	res = yapiGetMetricsText_internal(buffer, buffersize, fullsize, errmsg);
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
+void YAPI_FUNCTION_EXPORT yapiResetMetrics(void)
+{
+	YDLL_CALL_ENTER(trcResetMetrics);
+	ymetricsReset();
+	YDLL_CALL_LEAVEVOID();
+}
+
+// called around every user callback: not traced to keep them cheap
+u64 YAPI_FUNCTION_EXPORT yapiGetMetricsClock(void)
+{
+	return ymetricsTime();
+}
+
+void YAPI_FUNCTION_EXPORT yapiRecordCallback(YAPI_FUNCTION fundescr, u64 start_us)
+{
+	yapiRecordCallback_internal(fundescr, start_us);
+}
+
+void YAPI_FUNCTION_EXPORT yapiRecordEventQueue(u32 depth)
+{
+	ymetricsEventQueue(depth);
+}
+
 int YAPI_FUNCTION_EXPORT yapiCheckLogicalName(const char* name)
 {
 	int res;
@@ -5046,6 +6196,31 @@ void YAPI_FUNCTION_EXPORT yapiSetTraceFile(const char* file)
 	YDLL_CALL_LEAVEVOID();
 }
 
+YRETCODE YAPI_FUNCTION_EXPORT yapiStartTraceRecorder(const char* file, int sampling, char* errmsg)
+{
+	YRETCODE res;
+	YDLL_CALL_ENTER(trcStartTraceRecorder);
+	res = ytraceStart(file, sampling, errmsg);
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
+void YAPI_FUNCTION_EXPORT yapiStopTraceRecorder(void)
+{
+	YDLL_CALL_ENTER(trcStopTraceRecorder);
+	ytraceStop();
+	YDLL_CALL_LEAVEVOID();
+}
+
+int YAPI_FUNCTION_EXPORT yapiDecodeTraceFile(const char* tracefile, const char* textfile, char* errmsg)
+{
+	int res;
+	YDLL_CALL_ENTER(trcDecodeTraceFile);
+	res = ytraceDecode(tracefile, textfile, errmsg);
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
 YAPI_DEVICE YAPI_FUNCTION_EXPORT yapiGetDevice(const char* device_str, char* errmsg)
 {
 	YAPI_DEVICE res;
@@ -5073,6 +6248,15 @@ YRETCODE YAPI_FUNCTION_EXPORT yapiGetDeviceInfo(YAPI_DEVICE devdesc, yDeviceSt*
 	return res;
 }
 
+int YAPI_FUNCTION_EXPORT yapiIsDeviceTentative(YAPI_DEVICE devdesc, char* errmsg)
+{
+	int res;
+	YDLL_CALL_ENTER(trcIsDeviceTentative);
+	res = yapiIsDeviceTentative_internal(devdesc, errmsg);
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
 YRETCODE YAPI_FUNCTION_EXPORT yapiGetDevicePath(YAPI_DEVICE devdesc, char* rootdevice, char* request, int requestsize, int* neededsize, char* errmsg)
 {
 	YRETCODE res;
@@ -5318,6 +6502,24 @@ YRETCODE YAPI_FUNCTION_EXPORT yapiUpdateFirmwareEx(const char* serial, const cha
 	return res;
 }
 
+YRETCODE YAPI_FUNCTION_EXPORT yapiUpdateFirmwareSession(const char* serial, const char* firmwarePath, const char* settings, int force, int maxPerHub, char* msg)
+{
+	YRETCODE res;
+	YDLL_CALL_ENTER(trcUpdateFirmwareSession);
+	res = yapiUpdateFirmwareSession_internal(serial, firmwarePath, settings, force, maxPerHub, msg);
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
+YRETCODE YAPI_FUNCTION_EXPORT yapiGetFirmwareSessionProgress(const char* serial, char* msg)
+{
+	YRETCODE res;
+	YDLL_CALL_ENTER(trcGetFirmwareSessionProgress);
+	res = yapiGetFirmwareSessionProgress_internal(serial, msg);
+	YDLL_CALL_LEAVE(res);
+	return res;
+}
+
 
 YRETCODE YAPI_FUNCTION_EXPORT yapiGetSubdevices(const char* serial, char* buffer, int buffersize, int* fullsize, char* errmsg)
 {
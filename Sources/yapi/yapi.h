@@ -82,6 +82,10 @@ typedef void YAPI_FUNCTION_EXPORT(*yapiHubDiscoveryCallback)(const char* serial,
 
 typedef void YAPI_FUNCTION_EXPORT(*yapiDeviceLogCallback)(YAPI_FUNCTION fundescr, const char* line);
 
+// prototype of the per-hub callback of yapiRegisterHubs
+// status : YAPI_SUCCESS once the hub is usable, or an error code (errmsg tells why)
+typedef void YAPI_FUNCTION_EXPORT(*yapiRegisterHubCallback)(void* context, const char* url, YRETCODE status, const char* errmsg);
+
 
 /*****************************************************************************
  API FUNCTION DECLARATION
@@ -348,6 +352,43 @@ YRETCODE YAPI_FUNCTION_EXPORT yapiRegisterHub(const char* rooturl, char* errmsg)
 YRETCODE YAPI_FUNCTION_EXPORT yapiPreregisterHub(const char* rooturl, char* errmsg);
 
 
+/*****************************************************************************
+ Function:
+ int yapiRegisterHubs(const char **urls, int count, int mstimeout,
+                      yapiRegisterHubCallback callback, void *context, char *errmsg)
+
+ Description:
+ Register several network URLs at once. This is equivalent to calling
+ yapiRegisterHub on each URL, except that all hubs are contacted at the
+ same time: name resolution, connection, WebSocket handshake and
+ authentication run in parallel, and each hub is enumerated as soon as it
+ is connected. The callback is invoked once per URL, from the calling
+ thread, as soon as the hub is usable or has failed.
+
+ Parameters:
+ urls: an array of count network URLs, "usb" or "net" are also accepted
+ count: the number of URLs
+ mstimeout: the overall deadline in milliseconds, zero selects the
+            default network timeout
+ callback: the per-hub callback, or NULL
+ context: a pointer passed to the callback
+ errmsg: a pointer to a buffer of YOCTO_ERRMSG_LEN bytes to store any error message
+
+ Returns:
+ on ERROR   : error code
+ on SUCCESS : the number of hubs that are ready
+
+ Remarks:
+ The first enumerations of the hubs run one at a time, from the calling
+ thread: an enumeration already started at the deadline is completed.
+ As with yapiRegisterHub, a hub whose connection fails is unregistered.
+ A hub that is still connecting at the deadline is reported with
+ YAPI_TIMEOUT but stays registered, as with yapiPreregisterHub. A URL
+ listed twice is reported once.
+ ***************************************************************************/
+int YAPI_FUNCTION_EXPORT yapiRegisterHubs(const char** urls, int count, int mstimeout, yapiRegisterHubCallback callback, void* context, char* errmsg);
+
+
 /*****************************************************************************
  Function:
  YRETCODE yUnregisterHub(const char *rooturl)
@@ -387,6 +428,40 @@ void YAPI_FUNCTION_EXPORT yapiUnregisterHub(const char* url);
 YRETCODE YAPI_FUNCTION_EXPORT yapiUpdateDeviceList(u32 forceupdate, char* errmsg);
 
 
+/*****************************************************************************
+  Function:
+    void yapiSetNetDevListValidity(int sValidity)
+
+  Description:
+    Changes the period of the full enumeration of network hubs. Once a hub
+    has been enumerated, device arrivals, removals and name changes are
+    applied from its notification channel, and yapiUpdateDeviceList only
+    fetches the description of the devices that have been plugged in. The
+    full device list of the hub is reloaded after a reconnection, and every
+    sValidity seconds as a consistency check (60 by default). Hubs that do
+    not send keep-alive notifications are still enumerated every 10 seconds.
+
+  Parameters:
+    sValidity: the full enumeration period in seconds, 0 to reload the full
+               device list each time the hub is enumerated
+
+  Remarks:
+    Has no effect before the API has been initialized.
+ ***************************************************************************/
+void YAPI_FUNCTION_EXPORT yapiSetNetDevListValidity(int sValidity);
+
+
+/*****************************************************************************
+  Function:
+    int yapiGetNetDevListValidity(void)
+
+  Description:
+    Returns the period of the full enumeration of network hubs, in seconds
+    (see yapiSetNetDevListValidity).
+ ***************************************************************************/
+int YAPI_FUNCTION_EXPORT yapiGetNetDevListValidity(void);
+
+
 /*****************************************************************************
  Function:
  YRETCODE yapiHandleEvents(char *errmsg)
@@ -431,6 +506,185 @@ YRETCODE YAPI_FUNCTION_EXPORT yapiHandleEvents(char* errmsg);
 YRETCODE YAPI_FUNCTION_EXPORT yapiSleep(int duration_ms, char* errmsg);
 
 
+/*****************************************************************************
+ Function:
+ int yapiGetEventFd(char *errmsg)
+
+ Description:
+ Returns a file descriptor that becomes readable whenever events (USB
+ packets, network notifications, hub discoveries) are waiting to be
+ processed by yapiHandleEvents. This makes it possible to watch the library
+ from an external event loop (select, poll, epoll...) and to call
+ yapiHandleEvents only when needed. The descriptor is drained by
+ yapiHandleEvents and must not be read nor closed by the caller.
+
+ Parameters:
+ errmsg: a pointer to a buffer of YOCTO_ERRMSG_LEN bytes to store any error message
+
+ Returns:
+ on ERROR   : error code (YAPI_NOT_SUPPORTED on Windows)
+ on SUCCESS : the file descriptor
+
+ Remarks:
+ The descriptor remains valid until yapiFreeAPI is called.
+ ***************************************************************************/
+int YAPI_FUNCTION_EXPORT yapiGetEventFd(char* errmsg);
+
+
+/*****************************************************************************
+ Function:
+ int yapiWaitForEvents(int ms_timeout,char *errmsg)
+
+ Description:
+ Waits until events are waiting to be processed by yapiHandleEvents, or
+ until the timeout expires. Returns immediately if events are already
+ pending.
+
+ Parameters:
+ ms_timeout: the maximal waiting time in milliseconds, or -1 to wait forever
+ errmsg: a pointer to a buffer of YOCTO_ERRMSG_LEN bytes to store any error message
+
+ Returns:
+ on ERROR   : error code
+ on SUCCESS : 1 if events are pending, 0 if the timeout expired
+
+ Remarks:
+
+ ***************************************************************************/
+int YAPI_FUNCTION_EXPORT yapiWaitForEvents(int ms_timeout, char* errmsg);
+
+
+/*****************************************************************************
+ Function:
+ YRETCODE yapiSetRegistrySnapshot(const char *file, int autosaveSeconds, char *errmsg)
+
+ Description:
+ Enables a warm start of network hubs: the devices and functions known for
+ each network hub (white and yellow pages, last advertised values) are saved
+ to the given file by yapiFreeAPI, and reloaded from it when this function is
+ called. When a hub is registered, its saved devices are restored at once, so
+ that they can be resolved before the hub is reached. These entries are
+ reconciled with the actual device list by the first enumeration of the hub,
+ or dropped if a preregistered hub fails to connect. Until then, they are
+ reported as tentative by yapiIsDeviceTentative.
+
+ Parameters:
+ file: the full path of the snapshot file, or an empty string to disable
+       the snapshot. A missing file is created on the first save.
+ autosaveSeconds: if positive, the snapshot is also saved by
+       yapiUpdateDeviceList, at most once per this number of seconds
+ errmsg: a pointer to a buffer of YOCTO_ERRMSG_LEN bytes to store any error message
+
+ Returns:
+ on ERROR   : error code
+ on SUCCESS : YAPI_SUCCESS
+
+ Remarks:
+ Call this function before registering the hubs. Devices of hubs registered
+ with yapiPreregisterHub can be resolved immediately, and accessed as soon as
+ the hub is connected, while yapiRegisterHub still waits for the hub to
+ answer. USB devices are not part of the snapshot.
+ ***************************************************************************/
+YRETCODE YAPI_FUNCTION_EXPORT yapiSetRegistrySnapshot(const char* file, int autosaveSeconds, char* errmsg);
+
+
+/*****************************************************************************
+ Function:
+ YRETCODE yapiSaveRegistrySnapshot(char *errmsg)
+
+ Description:
+ Saves the registry snapshot immediately to the file set by
+ yapiSetRegistrySnapshot.
+
+ Parameters:
+ errmsg: a pointer to a buffer of YOCTO_ERRMSG_LEN bytes to store any error message
+
+ Returns:
+ on ERROR   : error code
+ on SUCCESS : YAPI_SUCCESS
+ ***************************************************************************/
+YRETCODE YAPI_FUNCTION_EXPORT yapiSaveRegistrySnapshot(char* errmsg);
+
+
+/*****************************************************************************
+ Function:
+ int yapiGetMetrics(yMetricsEntry *entries, int maxentries, int *neededentries, char *errmsg)
+
+ Description:
+ Copies the runtime metrics of the library: one YMETRICS_LIBRARY entry (event
+ queue depth), then one YMETRICS_HUB entry per registered hub and one
+ YMETRICS_DEVICE entry per device seen. Each entry holds request, error and
+ byte counters, notification counts, and latency histograms whose bucket
+ upper bounds (in microseconds) are listed in YMETRICS_BUCKET_BOUNDS. Hub
+ entries also count the WebSocket frames sent and the socket writes used
+ to send them, with the time frames waited in the output queue.
+
+ Parameters:
+ entries: an array of maxentries entries to fill
+ maxentries: the size of the entries array (may be 0)
+ neededentries: if not NULL, receives the number of entries available
+ errmsg: a pointer to a buffer of YOCTO_ERRMSG_LEN bytes to store any error message
+
+ Returns:
+ on ERROR   : error code
+ on SUCCESS : the number of entries copied
+
+ Remarks:
+ Metrics are always collected and cost a few counter updates per request.
+ ***************************************************************************/
+int YAPI_FUNCTION_EXPORT yapiGetMetrics(yMetricsEntry* entries, int maxentries, int* neededentries, char* errmsg);
+
+
+/*****************************************************************************
+ Function:
+ int yapiGetMetricsText(char *buffer, int buffersize, int *fullsize, char *errmsg)
+
+ Description:
+ Renders the runtime metrics in the Prometheus text exposition format, ready
+ to be served on a /metrics endpoint.
+
+ Parameters:
+ buffer: the buffer to fill with a null-terminated text
+ buffersize: the size of the buffer (may be 0)
+ fullsize: if not NULL, receives the length of the full text
+ errmsg: a pointer to a buffer of YOCTO_ERRMSG_LEN bytes to store any error message
+
+ Returns:
+ on ERROR   : error code
+ on SUCCESS : the number of characters copied, without the final null
+
+ Remarks:
+ ***************************************************************************/
+int YAPI_FUNCTION_EXPORT yapiGetMetricsText(char* buffer, int buffersize, int* fullsize, char* errmsg);
+
+
+/*****************************************************************************
+ Function:
+ void yapiResetMetrics(void)
+
+ Description:
+ Clears all the runtime metrics counters and histograms.
+ ***************************************************************************/
+void YAPI_FUNCTION_EXPORT yapiResetMetrics(void);
+
+
+/*****************************************************************************
+ Function:
+ u64 yapiGetMetricsClock(void)
+ void yapiRecordCallback(YAPI_FUNCTION fundescr, u64 start_us)
+ void yapiRecordEventQueue(u32 depth)
+
+ Description:
+ Hooks used by the language bindings, which run the user callbacks: the
+ first returns a microsecond clock, the second records the execution time
+ of a value or timed report callback started at start_us, and the third
+ records the number of events waiting to be dispatched.
+ ***************************************************************************/
+u64 YAPI_FUNCTION_EXPORT yapiGetMetricsClock(void);
+void YAPI_FUNCTION_EXPORT yapiRecordCallback(YAPI_FUNCTION fundescr, u64 start_us);
+void YAPI_FUNCTION_EXPORT yapiRecordEventQueue(u32 depth);
+
+
 /*****************************************************************************
  Function:
  u64 yGetTickCount()
@@ -503,6 +757,62 @@ u16 YAPI_FUNCTION_EXPORT yapiGetAPIVersion(const char** version, const char** ap
 void YAPI_FUNCTION_EXPORT yapiSetTraceFile(const char* file);
 
 
+/*****************************************************************************
+ Function:
+   YRETCODE yapiStartTraceRecorder(const char* file, int sampling, char* errmsg)
+
+ Description:
+   Starts recording low-level logs, requests and value callbacks as compact
+   binary records in the given file. Records are buffered per thread and
+   written by a background thread, so that tracing does not slow down
+   the traced code. While the recorder runs, low-level logs are no longer
+   written to the file set by yapiSetTraceFile.
+
+ Parameters:
+   file: the full path of the binary trace file to create
+   sampling: record one request and one value callback out of sampling,
+             1 to record them all
+   errmsg: a pointer to a buffer of YOCTO_ERRMSG_LEN bytes to store any error message
+
+ Returns:
+   on ERROR  : an error code
+   on SUCCESS: YAPI_SUCCESS
+
+ Remarks:
+   This function may be called before yInitAPI.
+ ***************************************************************************/
+YRETCODE YAPI_FUNCTION_EXPORT yapiStartTraceRecorder(const char* file, int sampling, char* errmsg);
+
+
+/*****************************************************************************
+ Function:
+   void yapiStopTraceRecorder(void)
+
+ Description:
+   Stops the trace recorder, after all pending records have been written.
+ ***************************************************************************/
+void YAPI_FUNCTION_EXPORT yapiStopTraceRecorder(void);
+
+
+/*****************************************************************************
+ Function:
+   int yapiDecodeTraceFile(const char* tracefile, const char* textfile, char* errmsg)
+
+ Description:
+   Converts a binary trace file produced by yapiStartTraceRecorder to text.
+
+ Parameters:
+   tracefile: the full path of the binary trace file
+   textfile: the full path of the text file to create
+   errmsg: a pointer to a buffer of YOCTO_ERRMSG_LEN bytes to store any error message
+
+ Returns:
+   on ERROR  : an error code
+   on SUCCESS: the number of records decoded
+ ***************************************************************************/
+int YAPI_FUNCTION_EXPORT yapiDecodeTraceFile(const char* tracefile, const char* textfile, char* errmsg);
+
+
 /*****************************************************************************
  Function:
    YAPI_DEVICE yGetDevice(const char *device_str,char *errmsg)
@@ -591,6 +901,28 @@ int YAPI_FUNCTION_EXPORT yapiGetAllDevices(YAPI_DEVICE* buffer, int maxsize, int
 YRETCODE YAPI_FUNCTION_EXPORT yapiGetDeviceInfo(YAPI_DEVICE devdesc, yDeviceSt* infos, char* errmsg);
 
 
+/*****************************************************************************
+  Function:
+   int yapiIsDeviceTentative(YAPI_DEVICE devdesc, char *errmsg)
+
+  Description:
+    Tells whether a device has only been restored from the registry snapshot
+    (see yapiSetRegistrySnapshot) and has not yet been confirmed by an
+    enumeration of its hub. The information of a tentative device may be
+    outdated, and the device may be gone.
+
+  Parameters:
+    devdesc: device object returned by yGetDevice or yGetAllDevices
+    errmsg:  a pointer to a buffer of YOCTO_ERRMSG_LEN bytes to store any error message
+
+  Returns:
+    on ERROR   : error code
+    on SUCCESS : 1 if the device is tentative, 0 otherwise
+
+ ***************************************************************************/
+int YAPI_FUNCTION_EXPORT yapiIsDeviceTentative(YAPI_DEVICE devdesc, char* errmsg);
+
+
 /*****************************************************************************
  Function:
    YRETCODE yapiGetDevicePath(YAPI_DEVICE devdesc, char *rootdevice, char *path, int pathsize, int *neededsize, char *errmsg);
@@ -1028,6 +1360,8 @@ YRETCODE YAPI_FUNCTION_EXPORT yapiCheckFirmware(const char* serial, const char*
 YRETCODE YAPI_FUNCTION_EXPORT yapiGetBootloaders(char* buffer, int buffersize, int* fullsize, char* errmsg);
 YRETCODE YAPI_FUNCTION_EXPORT yapiUpdateFirmware(const char* serial, const char* firmwarePath, const char* settings, int startUpdate, char* errmsg);
 YRETCODE YAPI_FUNCTION_EXPORT yapiUpdateFirmwareEx(const char* serial, const char* firmwarePath, const char* settings, int force, int startUpdate, char* errmsg);
+YRETCODE YAPI_FUNCTION_EXPORT yapiUpdateFirmwareSession(const char* serial, const char* firmwarePath, const char* settings, int force, int maxPerHub, char* errmsg);
+YRETCODE YAPI_FUNCTION_EXPORT yapiGetFirmwareSessionProgress(const char* serial, char* errmsg);
 
 int YAPI_FUNCTION_EXPORT yapiJsonDecodeString(const char* json_string, char* output);
 int YAPI_FUNCTION_EXPORT yapiJsonGetPath(const char* path, const char* json_data, int json_size, const char** result, char* errmsg);
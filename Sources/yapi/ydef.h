@@ -462,6 +462,43 @@ typedef struct
 	u8 beacon;
 } yDeviceSt;
 
+// runtime metrics (see yapiGetMetrics)
+#define YMETRICS_LIBRARY        0
+#define YMETRICS_HUB            1
+#define YMETRICS_DEVICE         2
+#define YMETRICS_HUB_LEN        64
+#define YMETRICS_NB_BUCKETS     20
+// upper bounds of the histogram buckets in microseconds, the last bucket has no bound
+#define YMETRICS_BUCKET_BOUNDS  {10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, \
+                                 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000}
+
+typedef struct
+{
+	u64 count;
+	u64 sumUs; // sum of the observed durations, in microseconds
+	u32 buckets[YMETRICS_NB_BUCKETS]; // observations per bucket (not cumulative)
+} yMetricsHistogram;
+
+typedef struct
+{
+	u8 kind; // YMETRICS_LIBRARY, YMETRICS_HUB or YMETRICS_DEVICE
+	char hub[YMETRICS_HUB_LEN]; // hub name, "usb" for local devices
+	char serial[YOCTO_SERIAL_LEN]; // device serial number (devices only)
+	u64 requests;
+	u64 requestErrors;
+	u64 bytesSent;
+	u64 bytesReceived;
+	yMetricsHistogram latency; // from request open to completion
+	u64 notifications;
+	u64 reconnects; // hubs only
+	yMetricsHistogram callbacks; // user callbacks execution time (devices only)
+	u32 queueDepth; // USB packet queue (devices) or pending events (library)
+	u32 queueMaxDepth;
+	u64 wsFrames; // WebSocket frames sent (hubs only)
+	u64 wsWrites; // socket writes used to send them, several frames are sent at once when possible (hubs only)
+	yMetricsHistogram wsQueueDelay; // time from the first frame queued to the socket write (hubs only)
+} yMetricsEntry;
+
 // definitions for USB protocl
 
 #ifndef C30
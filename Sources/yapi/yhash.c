@@ -918,7 +918,7 @@ int wpRegister(int devYdx, yStrRef serial, yStrRef logicalName, yStrRef productN
 	}
 	else
 	{
-		WP(hdl).flags &= ~YWP_MARK_FOR_UNREGISTER;
+		WP(hdl).flags &= ~(YWP_MARK_FOR_UNREGISTER | YWP_TENTATIVE);
 	}
 
 #ifdef DEBUG_WP
@@ -1038,6 +1038,54 @@ int wpMarkForUnregister(yStrRef serial)
 	return retval;
 }
 
+// flag a device restored from the registry snapshot, until wpRegister is
+// called again by an actual enumeration of its hub
+int wpMarkTentative(yStrRef serial)
+{
+	yBlkHdl hdl;
+	int retval = 0;
+
+	yEnterCriticalSection(&yWpMutex);
+	hdl = yWpListHead;
+	while (hdl != INVALID_BLK_HDL)
+	{
+		YASSERT(WP(hdl).blkId == YBLKID_WPENTRY);
+		if (WP(hdl).serial == serial)
+		{
+			WP(hdl).flags |= YWP_TENTATIVE;
+			retval = 1;
+			break;
+		}
+		hdl = WP(hdl).nextPtr;
+	}
+	yLeaveCriticalSection(&yWpMutex);
+
+	return retval;
+}
+
+// return 1 if the device is tentative, 0 if it is not, -1 if it is unknown
+int wpIsTentative(yStrRef serial)
+{
+	yBlkHdl hdl;
+	int res = -1;
+
+	yEnterCriticalSection(&yWpMutex);
+	hdl = yWpListHead;
+	while (hdl != INVALID_BLK_HDL)
+	{
+		YASSERT(WP(hdl).blkId == YBLKID_WPENTRY);
+		if (WP(hdl).serial == serial)
+		{
+			res = (WP(hdl).flags & YWP_TENTATIVE ? 1 : 0);
+			break;
+		}
+		hdl = WP(hdl).nextPtr;
+	}
+	yLeaveCriticalSection(&yWpMutex);
+
+	return res;
+}
+
 u16 wpEntryCount(void)
 {
 	return yBlkListLength(yWpListHead);
@@ -1433,6 +1481,12 @@ int ypRegister(yStrRef categ, yStrRef serial, yStrRef funcId, yStrRef funcName,
 			YP(prev).nextPtr = hdl;
 		}
 	}
+	else if (funClass >= 0 && funClass < YOCTO_N_BASECLASSES && YP(hdl).blkId != YBLKID_YPENTRY + funClass)
+	{
+		// entry created before its class was known
+		changed = 1;
+		YP(hdl).blkId = YBLKID_YPENTRY + funClass;
+	}
 	if (funcName != INVALID_HASH_IDX)
 	{
 		if (YP(hdl).funcName != funcName)
@@ -104,6 +104,7 @@ typedef struct
 } yWhitePageEntry;
 
 // WP entry flags
+#define YWP_TENTATIVE           0x04  // restored from the registry snapshot, not yet enumerated
 #define YWP_MARK_FOR_UNREGISTER 0x02
 #define YWP_BEACON_ON           0x01
 
@@ -184,6 +185,7 @@ extern char SerialNumberStr[YOCTO_SERIAL_LEN];
 extern yStrRef SerialRef;
 extern yBlkHdl yWpListHead;
 extern yBlkHdl yYpListHead;
+extern yCRITICAL_SECTION yYpMutex;
 
 #define YMAX_HUB_URL_DEEP           8
 #define YOCTO_HOSTNAME_NAME         (HASH_BUF_SIZE*2+2)
@@ -271,6 +273,8 @@ void wpAllowUnregisterEx(void);
 #define wpAllowUnregister()     wpAllowUnregisterEx()
 #endif
 int wpMarkForUnregister(yStrRef serial);
+int wpMarkTentative(yStrRef serial);
+int wpIsTentative(yStrRef serial);
 int wpGetDevYdx(yStrRef serial);
 YAPI_DEVICE wpSearchByNameHash(yStrRef strref);
 #ifndef MICROCHIP_API
@@ -56,6 +56,62 @@
 #endif
 #endif
 
+#if !defined(MICROCHIP_API) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define YJSON_USE_SSE2
+#include <emmintrin.h>
+#ifdef __AVX2__
+#define YJSON_USE_AVX2
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+static int yJsonCtz(unsigned mask)
+{
+	unsigned long idx;
+	_BitScanForward(&idx, mask);
+	return (int)idx;
+}
+#else
+#define yJsonCtz(mask) __builtin_ctz(mask)
+#endif
+#endif
+
+// Return a pointer to the first occurrence of character a or b in [src,end[,
+// or end if there is none. Long strings are scanned 16 (or 32) bytes at a time.
+static _FAR const char* yJsonScan(_FAR const char* src, _FAR const char* end, char a, char b)
+{
+#ifdef YJSON_USE_AVX2
+	if (end - src >= 32)
+	{
+		__m256i va = _mm256_set1_epi8(a);
+		__m256i vb = _mm256_set1_epi8(b);
+		while (end - src >= 32)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i*)src);
+			unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+			if (mask) return src + yJsonCtz(mask);
+			src += 32;
+		}
+	}
+#endif
+#ifdef YJSON_USE_SSE2
+	if (end - src >= 16)
+	{
+		__m128i va = _mm_set1_epi8(a);
+		__m128i vb = _mm_set1_epi8(b);
+		while (end - src >= 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)src);
+			unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+			if (mask) return src + yJsonCtz(mask);
+			src += 16;
+		}
+	}
+#endif
+	while (src < end && *src != a && *src != b) src++;
+	return src;
+}
+
 #ifdef DEBUG_JSON_PARSE
 const char* yJsonStateStr[] = {
     "YJSON_HTTP_START",       // about to parse HTTP header, up to first space before return code
@@ -225,6 +281,13 @@ skip:
 			res = YJSON_PARSE_AVAIL;
 			goto done;
 		case YJSON_PARSE_NUM: // parsing a number
+			if (j->skipdepth < j->depth)
+			{
+				// inside a skipped container, the value is dropped anyway
+				while (src < end && ((c = *src) == '-' || (c >= '0' && c <= '9'))) src++;
+				if (src >= end) goto done;
+				goto token_done;
+			}
 			while (src < end && pt < ept && ((c = *src) == '-' || (c >= '0' && c <= '9')))
 			{
 				*pt++ = c;
@@ -235,21 +298,31 @@ skip:
 			goto token_done;
 		case YJSON_PARSE_STRING: // parsing a quoted string
 		case YJSON_PARSE_STRINGCONT: // parsing the continuation of a quoted string
-			while (src < end && pt < ept && (c = *src) != '"' && c != '\\')
+			if (j->skipdepth < j->depth)
 			{
-				*pt++ = c;
-				src++;
+				// inside a skipped container: jump to the next quote or backslash
+				// without copying, and never split the string into chunks
+				src = yJsonScan(src, end, '"', '\\');
+				if (src >= end) goto done;
 			}
-			if (src >= end) goto done;
-			if (pt >= ept)
+			else
 			{
-				*pt = 0;
-				pt = j->token;
-				j->next = YJSON_PARSE_STRINGCONT;
-				res = YJSON_PARSE_AVAIL;
-				goto done;
+				_FAR const char* lim = (end - src > ept - pt ? src + (ept - pt) : end);
+				_FAR const char* stop = yJsonScan(src, lim, '"', '\\');
+				memcpy(pt, src, stop - src);
+				pt += stop - src;
+				src = stop;
+				if (src >= end) goto done;
+				if (pt >= ept)
+				{
+					*pt = 0;
+					pt = j->token;
+					j->next = YJSON_PARSE_STRINGCONT;
+					res = YJSON_PARSE_AVAIL;
+					goto done;
+				}
 			}
-			src++; // skip double-quote or backslash
+			c = *src++; // skip double-quote or backslash
 			if (c == '"') goto token_done;
 			if (st == YJSON_PARSE_STRING)
 			{
@@ -264,15 +337,19 @@ skip:
 		case YJSON_PARSE_STRINGCONTQ: // parsing the continuation of a quoted string, within quoted character
 			if (src >= end) goto done;
 			c = *src++;
-			switch (c)
+			// within a skipped container, the escaped character is simply dropped
+			if (j->skipdepth >= j->depth)
 			{
-			case 'r': *pt++ = '\r';
-				break;
-			case 'n': *pt++ = '\n';
-				break;
-			case 't': *pt++ = '\t';
-				break;
-			default: *pt++ = c;
+				switch (c)
+				{
+				case 'r': *pt++ = '\r';
+					break;
+				case 'n': *pt++ = '\n';
+					break;
+				case 't': *pt++ = '\t';
+					break;
+				default: *pt++ = c;
+				}
 			}
 			if (st == YJSON_PARSE_STRINGQ)
 			{
@@ -321,10 +398,12 @@ skip:
 			st = YJSON_PARSE_MEMBNAME;
 			// fall through
 		case YJSON_PARSE_MEMBNAME: // parsing a structure member name
-			while (src < end && pt < ept && (c = *src) != '"')
 			{
-				*pt++ = c;
-				src++;
+				_FAR const char* lim = (end - src > ept - pt ? src + (ept - pt) : end);
+				_FAR const char* stop = yJsonScan(src, lim, '"', '"');
+				memcpy(pt, src, stop - src);
+				pt += stop - src;
+				src = stop;
 			}
 			if (src >= end) goto done;
 			if (pt >= ept) goto push_error;
@@ -512,6 +512,7 @@ static void rd_callback(struct libusb_transfer *transfer)
     case LIBUSB_TRANSFER_COMPLETED:
 //HALLOG("%s:%d pkt_arrived (len=%d)\n",iface->serial,iface->ifaceno,transfer->actual_length);
         yPktQueuePushD2H(iface,&lintr->tmppkt,NULL);
+        ySignalPendingEvents();
         break;
     case LIBUSB_TRANSFER_ERROR:
         iface->ioError++;
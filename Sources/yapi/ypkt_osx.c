@@ -388,6 +388,7 @@ static void Handle_IOHIDDeviceIOHIDReportCallback(
 {
     yInterfaceSt *iface= (yInterfaceSt*) inContext;
     yPktQueuePushD2H(iface,&iface->tmprxpkt,NULL);
+    ySignalPendingEvents();
     memset(&iface->tmprxpkt,0xff,sizeof(USB_Packet));
 }
 
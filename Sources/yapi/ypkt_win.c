@@ -747,7 +747,7 @@ static void CloseReadHandles(yInterfaceSt* iface)
 				{
 					yPktQueuePushD2H(iface, &iface->tmpd2hpkt.pkt, NULL);
 				}
-				ySetEvent(&yContext->exitSleepEvent);
+				ySignalPendingEvents();
 			}
 			else
 			{
@@ -794,7 +794,7 @@ retry:
 	else
 	{
 		yPktQueuePushD2H(iface, &iface->tmpd2hpkt.pkt, NULL);
-		ySetEvent(&yContext->exitSleepEvent);
+		ySignalPendingEvents();
 		// TODO: add some kind of timeout to be able to send reset packet
 		// if device become crazy
 		retrycount++;
@@ -843,7 +843,7 @@ retry:
 		else
 		{
 			yPktQueuePushD2H(iface, &iface->tmpd2hpkt.pkt, NULL);
-			ySetEvent(&yContext->exitSleepEvent);
+			ySignalPendingEvents();
 		}
 		res = StartReadIO(iface, errmsg);
 		if (YISERR(res))
@@ -82,11 +82,15 @@ void yProgInit(void)
 	fctx.stepA = FLASH_DONE;
 	memset(&firm_dev, 0, sizeof(firm_dev));
 	yContext->fuCtx.global_progress = 100;
+	yContext->fuSessions = NULL;
+	yContext->fuFirmwares = NULL;
 	yInitializeCriticalSection(&fctx.cs);
+	yInitializeCriticalSection(&yContext->fuFirmwareCs);
 }
 
 void yProgFree(void)
 {
+	FUpdateContext* fu;
 	int fuPending;
 	do
 	{
@@ -99,6 +103,16 @@ void yProgFree(void)
 		{
 			fuPending = 1;
 		}
+		// a session thread still uses its context after reporting its final progress
+		for (fu = yContext->fuSessions; fu != NULL; fu = fu->next)
+		{
+			if ((fu->global_progress >= 0 && fu->global_progress < 100) || yThreadIsRunning(&fu->thread))
+			{
+				// sessions still waiting for their update slot give up
+				yThreadRequestEnd(&fu->thread);
+				fuPending = 1;
+			}
+		}
 		yLeaveCriticalSection(&fctx.cs);
 		if (fuPending)
 		{
@@ -113,6 +127,16 @@ void yProgFree(void)
 	yFree(yContext->fuCtx.firmwarePath);
 	if (yContext->fuCtx.settings)
 	yFree(yContext->fuCtx.settings);
+	while (yContext->fuSessions != NULL)
+	{
+		fu = yContext->fuSessions;
+		yContext->fuSessions = fu->next;
+		yFree(fu->serial);
+		yFree(fu->firmwarePath);
+		yFree(fu->settings);
+		yFree(fu);
+	}
+	yDeleteCriticalSection(&yContext->fuFirmwareCs);
 	yDeleteCriticalSection(&fctx.cs);
 	memset(&fctx, 0, sizeof(fctx));
 }
@@ -608,7 +632,7 @@ static void yGetFirmware(u32 ofs, u8* dst, u16 size)
 #define ulogChar(val) dbglog("%c",val)
 
 // report progress for Yoctolib
-#define setOsGlobalProgress(prog, msg) osProgLogProgressEx(__FILE_ID__,__LINE__, prog, msg)
+#define setOsGlobalProgress(fu, prog, msg) osProgLogProgressEx(fu, __FILE_ID__,__LINE__, prog, msg)
 #define uLogProgress(msg) yProgLogProgress(msg)
 
 
@@ -621,20 +645,20 @@ static void yProgLogProgress(const char* msg)
 }
 
 
-static void osProgLogProgressEx(const char* fileid, int line, int prog, const char* msg)
+static void osProgLogProgressEx(FUpdateContext* fu, const char* fileid, int line, int prog, const char* msg)
 {
 	yEnterCriticalSection(&fctx.cs);
 	if (prog != 0)
 	{
-		yContext->fuCtx.global_progress = prog;
+		fu->global_progress = prog;
 	}
 	if (msg != NULL && *msg != 0)
 	{
 #ifdef DEBUG_FIRMWARE
             dbglog("%s:%d:(%d%%) %s\n", fileid, line, prog, msg);
-            YSPRINTF(yContext->fuCtx.global_message, YOCTO_ERRMSG_LEN, "%s:%d:%s", fileid, line, msg);
+            YSPRINTF(fu->global_message, YOCTO_ERRMSG_LEN, "%s:%d:%s", fileid, line, msg);
 #else
-		YSTRCPY(yContext->fuCtx.global_message, YOCTO_ERRMSG_LEN, msg);
+		YSTRCPY(fu->global_message, YOCTO_ERRMSG_LEN, msg);
 #endif
 	}
 	yLeaveCriticalSection(&fctx.cs);
@@ -1646,6 +1670,7 @@ typedef enum
 
 typedef struct
 {
+	FUpdateContext* fu;
 	FLASH_HUB_CMD cmd;
 	const char* devserial;
 } ckReqHeadCtx;
@@ -1763,7 +1788,7 @@ static int checkRequestHeader(void* ctx_ptr, const char* buffer, u32 len, char*
 				}
 				while (yJsonParse(&j) == YJSON_PARSE_AVAIL && j.st != YJSON_PARSE_ARRAY)
 				{
-					setOsGlobalProgress(0, j.token);
+					setOsGlobalProgress(ctx->fu, 0, j.token);
 					YSTRCPY(lastmsg, YOCTO_ERRMSG_LEN, j.token);
 				}
 			}
@@ -1879,7 +1904,7 @@ typedef enum
 } FLASH_TYPE;
 
 
-static int sendHubFlashCmd(const char* hubserial, const char* subpath, const char* devserial, FLASH_HUB_CMD cmd, const char* args, char* errmsg)
+static int sendHubFlashCmd(FUpdateContext* fu, const char* hubserial, const char* subpath, FLASH_HUB_CMD cmd, const char* args, char* errmsg)
 {
 	char buffer[512];
 	const char* cmd_str;
@@ -1904,8 +1929,9 @@ static int sendHubFlashCmd(const char* hubserial, const char* subpath, const cha
 		return YERR(YAPI_INVALID_ARGUMENT);
 	}
 	YSPRINTF(buffer, 512, "GET %sflash.json?a=%s%s \r\n\r\n", subpath, cmd_str, args);
+	ctx.fu = fu;
 	ctx.cmd = cmd;
-	ctx.devserial = devserial;
+	ctx.devserial = fu->serial;
 	res = yapiHTTPRequestSyncStartEx_internal(&iohdl, 0, hubserial, buffer, YSTRLEN(buffer), &reply, &replysize, NULL, NULL, errmsg);
 	if (YISERR(res))
 	{
@@ -1976,9 +2002,201 @@ static int yDownloadFirmware(const char* url, u8** out_buffer, char* errmsg)
 }
 
 
+// Take a reference on a firmware file already loaded by another session
+static FUpdateFirmware* yFindSharedFirmware(const char* path)
+{
+	FUpdateFirmware* fw;
+
+	yEnterCriticalSection(&yContext->fuFirmwareCs);
+	for (fw = yContext->fuFirmwares; fw != NULL; fw = fw->next)
+	{
+		if (YSTRCMP(fw->path, path) == 0)
+		{
+			fw->refcount++;
+			break;
+		}
+	}
+	yLeaveCriticalSection(&yContext->fuFirmwareCs);
+	return fw;
+}
+
+// Load a firmware file, or take a reference on it if another update session
+// already loaded it. Returns the size of the firmware or an error code
+static int yGetSharedFirmware(const char* path, FUpdateFirmware** out, char* errmsg)
+{
+	FUpdateFirmware* fw;
+	u8* data = NULL;
+	int ofs, res;
+
+	fw = yFindSharedFirmware(path);
+	if (fw != NULL)
+	{
+		*out = fw;
+		return fw->len;
+	}
+	// the file is loaded without the lock, so that sessions using other
+	// files are not held by a slow download
+	ofs = isWebPath(path);
+	if (ofs < 0)
+	{
+		res = yLoadFirmwareFile(path, &data, errmsg);
+	}
+	else
+	{
+		res = yDownloadFirmware(path + ofs, &data, errmsg);
+	}
+	if (YISERR(res))
+	{
+		return res;
+	}
+	yEnterCriticalSection(&yContext->fuFirmwareCs);
+	// another session may have loaded the same file in the meantime
+	fw = yFindSharedFirmware(path);
+	if (fw != NULL)
+	{
+		yLeaveCriticalSection(&yContext->fuFirmwareCs);
+		yFree(data);
+		*out = fw;
+		return fw->len;
+	}
+	fw = yMalloc(sizeof(FUpdateFirmware));
+	memset(fw, 0, sizeof(FUpdateFirmware));
+	fw->path = YSTRDUP(path);
+	fw->data = data;
+	fw->len = res;
+	fw->refcount = 1;
+	fw->next = yContext->fuFirmwares;
+	yContext->fuFirmwares = fw;
+	*out = fw;
+	yLeaveCriticalSection(&yContext->fuFirmwareCs);
+	return res;
+}
+
+static void yReleaseSharedFirmware(FUpdateFirmware* fw)
+{
+	FUpdateFirmware** prev;
+
+	if (fw == NULL)
+	{
+		return;
+	}
+	yEnterCriticalSection(&yContext->fuFirmwareCs);
+	if (--fw->refcount == 0)
+	{
+		for (prev = &yContext->fuFirmwares; *prev != NULL; prev = &(*prev)->next)
+		{
+			if (*prev == fw)
+			{
+				*prev = fw->next;
+				break;
+			}
+		}
+		yFree(fw->path);
+		yFree(fw->data);
+		yFree(fw);
+	}
+	yLeaveCriticalSection(&yContext->fuFirmwareCs);
+}
+
+// Same checks as IsValidBynFile, but the MD5 of the file is only computed
+// by the first session using it
+static int yValidateSharedFirmware(FUpdateFirmware* fw, const char* serial, u16 flags, char* errmsg)
+{
+	const byn_head_multi* head = (const byn_head_multi*)fw->data;
+	HASH_SUM ctx;
+	u8 md5res[16];
+	int res;
+
+	res = ValidateBynCompat(head, fw->len, serial, flags, NULL, errmsg);
+	if (res != YAPI_SUCCESS || head->h.rev != BYN_REV_V6)
+	{
+		return res;
+	}
+	yEnterCriticalSection(&yContext->fuFirmwareCs);
+	if (fw->md5state == 0)
+	{
+		MD5Initialize(&ctx);
+		MD5AddData(&ctx, fw->data + BYN_MD5_OFS_V6, fw->len - BYN_MD5_OFS_V6);
+		MD5Calculate(&ctx, md5res);
+		fw->md5state = (memcmp(md5res, head->v6.md5chk, 16) ? YAPI_INVALID_ARGUMENT : 1);
+	}
+	res = fw->md5state;
+	yLeaveCriticalSection(&yContext->fuFirmwareCs);
+	if (res < 0)
+	{
+		return YERRMSG(YAPI_INVALID_ARGUMENT,"Invalid checksum");
+	}
+	return YAPI_SUCCESS;
+}
+
+// Wait until the session is allowed to update a device of the given hub.
+// Devices connected by USB (slot "usb") are always updated one at a time,
+// since the USB flash engine uses the global fctx. With engine set, wait
+// instead for the single firmware file and flash engine of the hub, which
+// are used from the upload of the firmware until the end of the flash.
+// Gives up when the session deadline is reached or the API is freed.
+static int yAcquireUpdateSlot(FUpdateContext* fu, const char* hubserial, int engine, char* errmsg)
+{
+	FUpdateContext* other;
+	int limit = (engine || YSTRCMP(hubserial, "usb") == 0 || fu->maxPerHub < 1 ? 1 : fu->maxPerHub);
+	int used, waiting = 0;
+
+	while (1)
+	{
+		yEnterCriticalSection(&fctx.cs);
+		if (engine)
+		{
+			used = (YSTRCMP(yContext->fuCtx.engine, hubserial) == 0 ? 1 : 0);
+		}
+		else
+		{
+			used = (YSTRCMP(yContext->fuCtx.slot, hubserial) == 0 ? 1 : 0);
+		}
+		for (other = yContext->fuSessions; other != NULL; other = other->next)
+		{
+			if (YSTRCMP(engine ? other->engine : other->slot, hubserial) == 0)
+			{
+				used++;
+			}
+		}
+		if (used < limit)
+		{
+			YSTRCPY(engine ? fu->engine : fu->slot, YOCTO_SERIAL_LEN, hubserial);
+			yLeaveCriticalSection(&fctx.cs);
+			return YAPI_SUCCESS;
+		}
+		yLeaveCriticalSection(&fctx.cs);
+		if (yThreadMustEnd(&fu->thread))
+		{
+			return YERRMSG(YAPI_IO_ERROR, "Firmware update cancelled");
+		}
+		if (yapiGetTickCount() >= fu->deadline)
+		{
+			return YERRMSG(YAPI_TIMEOUT, "Timeout while waiting for other updates on the same hub");
+		}
+		if (!waiting)
+		{
+			setOsGlobalProgress(fu, 0, "Waiting for other updates on the same hub");
+			waiting = 1;
+		}
+		yApproximateSleep(100);
+	}
+}
+
+static void yReleaseUpdateSlot(FUpdateContext* fu)
+{
+	yEnterCriticalSection(&fctx.cs);
+	fu->slot[0] = 0;
+	fu->engine[0] = 0;
+	yLeaveCriticalSection(&fctx.cs);
+}
+
+
 static void* yFirmwareUpdate_thread(void* ctx)
 {
 	yThread* thread = (yThread*)ctx;
+	FUpdateContext* fu = (FUpdateContext*)thread->ctx;
+	FUpdateFirmware* fw = NULL;
 	YAPI_DEVICE dev;
 	int res;
 	char errmsg[YOCTO_ERRMSG_LEN];
@@ -1993,7 +2211,7 @@ static void* yFirmwareUpdate_thread(void* ctx)
 	char hubserial[YOCTO_SERIAL_LEN];
 	char* reply = NULL;
 	int replysize = 0;
-	int ofs, i;
+	int i;
 	u64 timeout;
 	FLASH_TYPE type = FLASH_USB;
 	int online, found;
@@ -2003,44 +2221,30 @@ static void* yFirmwareUpdate_thread(void* ctx)
 	yThreadSignalStart(thread);
 
 	//1% -> 5%
-	setOsGlobalProgress(1, "Loading firmware");
-	ofs = isWebPath(yContext->fuCtx.firmwarePath);
-	if (ofs < 0)
-	{
-		res = yLoadFirmwareFile(yContext->fuCtx.firmwarePath, &fctx.firmware, errmsg);
-	}
-	else
-	{
-		res = yDownloadFirmware(yContext->fuCtx.firmwarePath + ofs, &fctx.firmware, errmsg);
-	}
+	setOsGlobalProgress(fu, 1, "Loading firmware");
+	res = yGetSharedFirmware(fu->firmwarePath, &fw, errmsg);
 	if (YISERR(res))
 	{
-		setOsGlobalProgress(res, errmsg);
+		setOsGlobalProgress(fu, res, errmsg);
 		goto exitthread;
 	}
-	fctx.len = res;
-	//copy firmware header into context variable (to have same behaviour as a device)
-	memcpy(&fctx.bynHead, fctx.firmware, sizeof(fctx.bynHead));
-	YSTRCPY(fctx.bynHead.h.serial, YOCTO_SERIAL_LEN, yContext->fuCtx.serial);
-
-
-	res = IsValidBynFile((const byn_head_multi *)fctx.firmware, fctx.len, yContext->fuCtx.serial, fctx.flags, errmsg);
+	res = yValidateSharedFirmware(fw, fu->serial, fu->flags, errmsg);
 	if (YISERR(res))
 	{
-		setOsGlobalProgress(res, errmsg);
+		setOsGlobalProgress(fu, res, errmsg);
 		goto exit_and_free;
 	}
 
 	//5% -> 10%
-	setOsGlobalProgress(5, "Enter firmware update mode");
-	dev = wpSearch(yContext->fuCtx.serial);
+	setOsGlobalProgress(fu, 5, "Enter firmware update mode");
+	dev = wpSearch(fu->serial);
 	if (dev != -1)
 	{
 		yUrlRef url;
 		int urlres = wpGetDeviceUrl(dev, hubserial, subpath, 256, NULL);
 		if (urlres < 0)
 		{
-			setOsGlobalProgress(YAPI_IO_ERROR, NULL);
+			setOsGlobalProgress(fu, YAPI_IO_ERROR, NULL);
 			goto exit_and_free;
 		}
 		url = wpGetDeviceUrlRef(dev);
@@ -2048,30 +2252,42 @@ static void* yFirmwareUpdate_thread(void* ctx)
 		{
 			// USB connected device -> reboot it in bootloader
 			type = FLASH_USB;
+			res = yAcquireUpdateSlot(fu, "usb", 0, errmsg);
+			if (res < 0)
+			{
+				setOsGlobalProgress(fu, res, errmsg);
+				goto exit_and_free;
+			}
 			YSPRINTF(buffer, sizeof(buffer), reboot_req, subpath);
 			res = yapiHTTPRequest(hubserial, buffer, replybuf, sizeof(replybuf), NULL, errmsg);
 			if (res < 0)
 			{
-				setOsGlobalProgress(res, errmsg);
+				setOsGlobalProgress(fu, res, errmsg);
 				goto exit_and_free;
 			}
 		}
 		else
 		{
-			res = sendHubFlashCmd(hubserial, subpath, yContext->fuCtx.serial, FLASH_HUB_AVAIL, "", NULL);
+			res = yAcquireUpdateSlot(fu, hubserial, 0, errmsg);
+			if (res < 0)
+			{
+				setOsGlobalProgress(fu, res, errmsg);
+				goto exit_and_free;
+			}
+			res = sendHubFlashCmd(fu, hubserial, subpath, FLASH_HUB_AVAIL, "", NULL);
 			if (res < 0 || YSTRNCMP(hubserial, "VIRTHUB", 7) == 0)
 			{
-				int is_shield = YSTRNCMP(yContext->fuCtx.serial, "YHUBSHL1", YOCTO_BASE_SERIAL_LEN) == 0;
+				int is_shield = YSTRNCMP(fu->serial, "YHUBSHL1", YOCTO_BASE_SERIAL_LEN) == 0;
 				res = yNetHubGetBootloaders(hubserial, bootloaders, errmsg);
 				if (res < 0)
 				{
-					setOsGlobalProgress(res, errmsg);
+					setOsGlobalProgress(fu, res, errmsg);
 					goto exit_and_free;
 				}
 				for (i = 0; i < res; i++)
 				{
 					p = bootloaders + YOCTO_SERIAL_LEN * i;
-					if (YSTRCMP(yContext->fuCtx.serial, p) == 0)
+					if (YSTRCMP(fu->serial, p) == 0)
 					{
 						break;
 					}
@@ -2082,7 +2298,7 @@ static void* yFirmwareUpdate_thread(void* ctx)
 					//...check if list is allready full..
 					if (res == 4)
 					{
-						setOsGlobalProgress(YAPI_IO_ERROR, "Too many devices in update mode");
+						setOsGlobalProgress(fu, YAPI_IO_ERROR, "Too many devices in update mode");
 						goto exit_and_free;
 					}
 					if (is_shield)
@@ -2093,19 +2309,19 @@ static void* yFirmwareUpdate_thread(void* ctx)
 							p = bootloaders + YOCTO_SERIAL_LEN * i;
 							if (YSTRNCMP(p, "YHUBSHL1", YOCTO_BASE_SERIAL_LEN) == 0)
 							{
-								setOsGlobalProgress(YAPI_IO_ERROR, "Only one YoctoHub-Shield is allowed in update mode");
+								setOsGlobalProgress(fu, YAPI_IO_ERROR, "Only one YoctoHub-Shield is allowed in update mode");
 								goto exit_and_free;
 							}
 						}
 					}
 
 					// ...must reboot in programtion
-					setOsGlobalProgress(8, "Reboot to firmware update mode");
+					setOsGlobalProgress(fu, 8, "Reboot to firmware update mode");
 					YSPRINTF(buffer, sizeof(buffer), reboot_req, subpath);
 					res = yapiHTTPRequest(hubserial, buffer, replybuf, sizeof(replybuf), NULL, errmsg);
 					if (res < 0)
 					{
-						setOsGlobalProgress(res, errmsg);
+						setOsGlobalProgress(fu, res, errmsg);
 						goto exit_and_free;
 					}
 					if (replybuf[0] != 'O' || replybuf[1] != 'K')
@@ -2124,15 +2340,15 @@ static void* yFirmwareUpdate_thread(void* ctx)
 	else
 	{
 		//no known device -> check if device is in bootloader
-		res = getBootloaderInfos(yContext->fuCtx.serial, hubserial, errmsg);
+		res = getBootloaderInfos(fu->serial, hubserial, errmsg);
 		if (res < 0)
 		{
-			setOsGlobalProgress(res, errmsg);
+			setOsGlobalProgress(fu, res, errmsg);
 			goto exit_and_free;
 		}
 		if (res == 0)
 		{
-			setOsGlobalProgress(YAPI_DEVICE_NOT_FOUND, "Bootloader not found");
+			setOsGlobalProgress(fu, YAPI_DEVICE_NOT_FOUND, "Bootloader not found");
 			goto exit_and_free;
 		}
 		if (YSTRCMP(hubserial, "usb") == 0)
@@ -2143,32 +2359,46 @@ static void* yFirmwareUpdate_thread(void* ctx)
 		{
 			type = FLASH_NET_SUBDEV;
 		}
+		res = yAcquireUpdateSlot(fu, hubserial, 0, errmsg);
+		if (res < 0)
+		{
+			setOsGlobalProgress(fu, res, errmsg);
+			goto exit_and_free;
+		}
 	}
 
 	//10% -> 40%
-	setOsGlobalProgress(10, "Send new firmware");
+	setOsGlobalProgress(fu, 10, "Send new firmware");
 	if (type != FLASH_USB)
 	{
+		// the hub has a single firmware file and flash engine, which this
+		// session holds until the end of the flash
+		res = yAcquireUpdateSlot(fu, hubserial, 1, errmsg);
+		if (res < 0)
+		{
+			setOsGlobalProgress(fu, res, errmsg);
+			goto exit_and_free;
+		}
 		// ensure flash engine is not busy
-		res = sendHubFlashCmd(hubserial, type == FLASH_NET_SELF ? subpath : "/", yContext->fuCtx.serial, FLASH_HUB_NOT_BUSY, "", errmsg);
+		res = sendHubFlashCmd(fu, hubserial, type == FLASH_NET_SELF ? subpath : "/", FLASH_HUB_NOT_BUSY, "", errmsg);
 		if (res < 1)
 		{
-			setOsGlobalProgress(res, errmsg);
+			setOsGlobalProgress(fu, res, errmsg);
 			goto exit_and_free;
 		}
 		// start firmware upload
 		// IP connected device -> upload the firmware to the Hub
-		res = upload(hubserial, type == FLASH_NET_SELF ? subpath : "/", "firmware", fctx.firmware, fctx.len, errmsg);
+		res = upload(hubserial, type == FLASH_NET_SELF ? subpath : "/", "firmware", fw->data, fw->len, errmsg);
 		if (res < 0)
 		{
-			setOsGlobalProgress(res, errmsg);
+			setOsGlobalProgress(fu, res, errmsg);
 			goto exit_and_free;
 		}
 		// verify that firmware is correctly uploaded
-		res = sendHubFlashCmd(hubserial, type == FLASH_NET_SELF ? subpath : "/", yContext->fuCtx.serial, FLASH_HUB_STATE, "", errmsg);
+		res = sendHubFlashCmd(fu, hubserial, type == FLASH_NET_SELF ? subpath : "/", FLASH_HUB_STATE, "", errmsg);
 		if (res < 2)
 		{
-			setOsGlobalProgress(res, errmsg);
+			setOsGlobalProgress(fu, res, errmsg);
 			goto exit_and_free;
 		}
 
@@ -2176,7 +2406,7 @@ static void* yFirmwareUpdate_thread(void* ctx)
 		{
 			const char *settingsOnly, *services;
 			u8* startupconf_data;
-			int settings_len = yapiJsonGetPath_internal("api", (char*)yContext->fuCtx.settings, yContext->fuCtx.settings_len, &settingsOnly, errmsg);
+			int settings_len = yapiJsonGetPath_internal("api", (char*)fu->settings, fu->settings_len, &settingsOnly, errmsg);
 			int service_len = yapiJsonGetPath_internal("services", settingsOnly, settings_len, &services, errmsg);
 			int startupconf_data_len;
 			if (service_len > 0)
@@ -2196,68 +2426,78 @@ static void* yFirmwareUpdate_thread(void* ctx)
 				startupconf_data = yMalloc(settings_len);
 				memcpy(startupconf_data, settingsOnly, settings_len);
 			}
-			setOsGlobalProgress(20,"Save startupConf.json");
+			setOsGlobalProgress(fu, 20,"Save startupConf.json");
 			// save settings
 			res = upload(hubserial, subpath, "startupConf.json", startupconf_data, startupconf_data_len, errmsg);
 			if (res < 0)
 			{
 				yFree(startupconf_data);
-				setOsGlobalProgress(res, errmsg);
+				setOsGlobalProgress(fu, res, errmsg);
 				goto exit_and_free;
 			}
-			setOsGlobalProgress(30,"Save firmwareConf");
+			setOsGlobalProgress(fu, 30,"Save firmwareConf");
 			res = upload(hubserial, subpath, "firmwareConf", startupconf_data, startupconf_data_len, errmsg);
 			yFree(startupconf_data);
 			if (res < 0)
 			{
-				setOsGlobalProgress(res, errmsg);
+				setOsGlobalProgress(fu, res, errmsg);
 				goto exit_and_free;
 			}
 		}
 	}
 
 	//40%-> 80%
-	fctx.progress = 0;
 	switch (type)
 	{
 	case FLASH_USB:
-		setOsGlobalProgress(40, "Flash firmware");
+		setOsGlobalProgress(fu, 40, "Flash firmware");
+		// the USB flash engine works on the global fctx, which is
+		// reserved to this session by the "usb" update slot
+		fctx.firmware = fw->data;
+		fctx.len = fw->len;
+		//copy firmware header into context variable (to have same behaviour as a device)
+		memcpy(&fctx.bynHead, fw->data, sizeof(fctx.bynHead));
+		YSTRCPY(fctx.bynHead.h.serial, YOCTO_SERIAL_LEN, fu->serial);
+		fctx.flags = fu->flags;
+		fctx.stepA = FLASH_FIND_DEV;
+		fctx.progress = 0;
 		fctx.timeout = ytime() + YPROG_BOOTLOADER_TIMEOUT;
 		do
 		{
 			u_flash_res = uFlashDevice();
 			if (u_flash_res != YPROG_DONE)
 			{
-				setOsGlobalProgress(40 + fctx.progress/2, fctx.errmsg);
+				setOsGlobalProgress(fu, 40 + fctx.progress/2, fctx.errmsg);
 				yApproximateSleep(1);
 			}
 		}
 		while (u_flash_res != YPROG_DONE);
+		fctx.firmware = NULL;
 		if (fctx.progress < 100)
 		{
-			setOsGlobalProgress(YAPI_IO_ERROR, fctx.errmsg);
+			setOsGlobalProgress(fu, YAPI_IO_ERROR, fctx.errmsg);
 			goto exit_and_free;
 		}
 		break;
 	case FLASH_NET_SELF:
-		setOsGlobalProgress(40, "Flash firmware");
+		setOsGlobalProgress(fu, 40, "Flash firmware");
 		// the hub itself -> reboot in autoflash mode
 		YSPRINTF(buffer, sizeof(buffer), reboot_hub, subpath);
 		res = yapiHTTPRequest(hubserial, buffer, replybuf, sizeof(replybuf), NULL, errmsg);
 		if (res < 0)
 		{
-			setOsGlobalProgress(res, errmsg);
+			setOsGlobalProgress(fu, res, errmsg);
 			goto exit_and_free;
 		}
 		for (i = 0; i < 8; i++)
 		{
-			setOsGlobalProgress(50 + i*5, "Flash firmware");
+			setOsGlobalProgress(fu, 50 + i*5, "Flash firmware");
 			yApproximateSleep(1000);
 		}
 		break;
 	case FLASH_NET_SUBDEV:
 		// verify that the device is in bootloader
-		setOsGlobalProgress(40, "Verify that the device is in update mode");
+		setOsGlobalProgress(fu, 40, "Verify that the device is in update mode");
 		timeout = yapiGetTickCount() + YPROG_BOOTLOADER_TIMEOUT;
 		found = 0;
 		while (!found && yapiGetTickCount() < timeout)
@@ -2265,7 +2505,7 @@ static void* yFirmwareUpdate_thread(void* ctx)
 			res = yNetHubGetBootloaders(hubserial, bootloaders, errmsg);
 			if (res < 0)
 			{
-				setOsGlobalProgress(res, errmsg);
+				setOsGlobalProgress(fu, res, errmsg);
 				goto exit_and_free;
 			}
 			else if (res > 0)
@@ -2273,7 +2513,7 @@ static void* yFirmwareUpdate_thread(void* ctx)
 				for (i = 0; i < res; i++)
 				{
 					p = bootloaders + YOCTO_SERIAL_LEN * i;
-					if (YSTRCMP(yContext->fuCtx.serial, p) == 0)
+					if (YSTRCMP(fu->serial, p) == 0)
 					{
 						found = 1;
 						break;
@@ -2285,23 +2525,28 @@ static void* yFirmwareUpdate_thread(void* ctx)
 		}
 		if (!found)
 		{
-			setOsGlobalProgress(YAPI_IO_ERROR, "Hub did not detect bootloader");
+			setOsGlobalProgress(fu, YAPI_IO_ERROR, "Hub did not detect bootloader");
 			goto exit_and_free;
 		}
 		//start flash
-		setOsGlobalProgress(50, "Flash firmware");
-		YSPRINTF(buffer, sizeof(buffer), "&s=%s", yContext->fuCtx.serial);
-		res = sendHubFlashCmd(hubserial, "/", yContext->fuCtx.serial, FLASH_HUB_FLASH, buffer, errmsg);
+		setOsGlobalProgress(fu, 50, "Flash firmware");
+		YSPRINTF(buffer, sizeof(buffer), "&s=%s", fu->serial);
+		res = sendHubFlashCmd(fu, hubserial, "/", FLASH_HUB_FLASH, buffer, errmsg);
 		if (res < 0)
 		{
-			setOsGlobalProgress(res, errmsg);
+			setOsGlobalProgress(fu, res, errmsg);
 			goto exit_and_free;
 		}
 		break;
 	}
 
+	// other sessions may now use the flash engine of the hub
+	yEnterCriticalSection(&fctx.cs);
+	fu->engine[0] = 0;
+	yLeaveCriticalSection(&fctx.cs);
+
 	//90%-> 98%
-	setOsGlobalProgress(90, "Wait for the device to restart");
+	setOsGlobalProgress(fu, 90, "Wait for the device to restart");
 	online = 0;
 	timeout = yapiGetTickCount() + 60000;
 	do
@@ -2311,10 +2556,10 @@ static void* yFirmwareUpdate_thread(void* ctx)
 		res = yapiUpdateDeviceList(1, errmsg);
 		if (res < 0 && type != FLASH_NET_SELF)
 		{
-			setOsGlobalProgress(res, errmsg);
+			setOsGlobalProgress(fu, res, errmsg);
 			goto exit_and_free;
 		}
-		dev = wpSearch(yContext->fuCtx.serial);
+		dev = wpSearch(fu->serial);
 		if (dev != -1)
 		{
 			wpGetDeviceUrl(dev, hubserial, subpath, 256, NULL);
@@ -2338,20 +2583,17 @@ static void* yFirmwareUpdate_thread(void* ctx)
 
 	if (online)
 	{
-		setOsGlobalProgress(100, "Firmware updated");
+		setOsGlobalProgress(fu, 100, "Firmware updated");
 	}
 	else
 	{
-		setOsGlobalProgress(-1, "Device did not reboot correctly");
+		setOsGlobalProgress(fu, -1, "Device did not reboot correctly");
 	}
 
 exit_and_free:
 
-	if (fctx.firmware)
-	{
-		yFree(fctx.firmware);
-		fctx.firmware = NULL;
-	}
+	yReleaseUpdateSlot(fu);
+	yReleaseSharedFirmware(fw);
 
 exitthread:
 	yThreadSignalEnd(thread);
@@ -2371,16 +2613,14 @@ static int yStartFirmwareUpdate(const char* serial, const char* firmwarePath, co
 	yContext->fuCtx.firmwarePath = YSTRDUP(firmwarePath);
 	yContext->fuCtx.settings = (u8*)YSTRDUP(settings);
 	yContext->fuCtx.settings_len = YSTRLEN(settings);
-	fctx.firmware = NULL;
-	fctx.len = 0;
-	fctx.flags = flags;
-	fctx.stepA = FLASH_FIND_DEV;
-	YSTRNCPY(fctx.bynHead.h.serial, YOCTO_SERIAL_LEN, serial, YOCTO_SERIAL_LEN - 1);
+	yContext->fuCtx.flags = flags;
+	yContext->fuCtx.maxPerHub = 1;
+	yContext->fuCtx.deadline = yapiGetTickCount() + YPROG_SESSION_TIMEOUT;
 	yContext->fuCtx.global_progress = 0;
 	YSTRCPY(msg, FLASH_ERRMSG_LEN, "Firmware update started");
 	memset(&yContext->fuCtx.thread, 0, sizeof(yThread));
 	//yThreadCreate will not create a new thread if there is already one running
-	if (yThreadCreate(&yContext->fuCtx.thread, yFirmwareUpdate_thread, NULL) < 0)
+	if (yThreadCreate(&yContext->fuCtx.thread, yFirmwareUpdate_thread, &yContext->fuCtx) < 0)
 	{
 		yContext->fuCtx.serial = NULL;
 		YSTRCPY(msg, FLASH_ERRMSG_LEN, "Unable to start helper thread");
@@ -2688,4 +2928,104 @@ YRETCODE yapiUpdateFirmware_internal(const char* serial, const char* firmwarePat
 	return res;
 }
 
+// Start the update of a device in a session of its own, so that several
+// devices can be updated at the same time. At most maxPerHub devices of a
+// given hub, and a single device connected by USB, are updated at once. The
+// firmware upload and flash of the devices of a hub are always serialized.
+YRETCODE yapiUpdateFirmwareSession_internal(const char* serial, const char* firmwarePath, const char* settings, int force, int maxPerHub, char* msg)
+{
+	FUpdateContext* fu;
+	YRETCODE res = YAPI_SUCCESS;
+
+	while (1)
+	{
+		yEnterCriticalSection(&fctx.cs);
+		for (fu = yContext->fuSessions; fu != NULL; fu = fu->next)
+		{
+			if (YSTRCMP(fu->serial, serial) == 0)
+			{
+				break;
+			}
+		}
+		if (fu != NULL && fu->global_progress >= 0 && fu->global_progress < 100)
+		{
+			YSTRCPY(msg, FLASH_ERRMSG_LEN, "Last firmware update is not finished");
+			yLeaveCriticalSection(&fctx.cs);
+			return YAPI_SUCCESS;
+		}
+		if (fu == NULL || !yThreadIsRunning(&fu->thread))
+		{
+			break;
+		}
+		// the previous thread has reported its result but still uses the
+		// context on its exit path, wait for it before reusing the context
+		yLeaveCriticalSection(&fctx.cs);
+		yApproximateSleep(1);
+	}
+	if (fu == NULL)
+	{
+		fu = yMalloc(sizeof(FUpdateContext));
+		memset(fu, 0, sizeof(FUpdateContext));
+		fu->next = yContext->fuSessions;
+		yContext->fuSessions = fu;
+	}
+	else
+	{
+		// reuse the context of the previous update of this device
+		yFree(fu->serial);
+		yFree(fu->firmwarePath);
+		yFree(fu->settings);
+	}
+	fu->serial = YSTRDUP(serial);
+	fu->firmwarePath = YSTRDUP(firmwarePath);
+	fu->settings = (u8*)YSTRDUP(settings);
+	fu->settings_len = YSTRLEN(settings);
+	fu->flags = (force ? YPROG_FORCE_FW_UPDATE : 0);
+	fu->maxPerHub = maxPerHub;
+	fu->slot[0] = 0;
+	fu->engine[0] = 0;
+	fu->deadline = yapiGetTickCount() + YPROG_SESSION_TIMEOUT;
+	fu->global_progress = 0;
+	YSTRCPY(fu->global_message, YOCTO_ERRMSG_LEN, "Firmware update started");
+	YSTRCPY(msg, FLASH_ERRMSG_LEN, fu->global_message);
+	memset(&fu->thread, 0, sizeof(yThread));
+	if (yThreadCreate(&fu->thread, yFirmwareUpdate_thread, fu) < 0)
+	{
+		fu->global_progress = YAPI_IO_ERROR;
+		YSTRCPY(fu->global_message, YOCTO_ERRMSG_LEN, "Unable to start helper thread");
+		YSTRCPY(msg, FLASH_ERRMSG_LEN, fu->global_message);
+		res = YAPI_IO_ERROR;
+	}
+	yLeaveCriticalSection(&fctx.cs);
+	return res;
+}
+
+// Return the progress of the update session of a device (see yapiUpdateFirmware)
+YRETCODE yapiGetFirmwareSessionProgress_internal(const char* serial, char* msg)
+{
+	FUpdateContext* fu;
+	YRETCODE res;
+
+	yEnterCriticalSection(&fctx.cs);
+	for (fu = yContext->fuSessions; fu != NULL; fu = fu->next)
+	{
+		if (YSTRCMP(fu->serial, serial) == 0)
+		{
+			break;
+		}
+	}
+	if (fu == NULL)
+	{
+		YSTRCPY(msg, FLASH_ERRMSG_LEN, "No firmware update pending");
+		res = YAPI_INVALID_ARGUMENT;
+	}
+	else
+	{
+		YSTRCPY(msg, FLASH_ERRMSG_LEN, fu->global_message);
+		res = fu->global_progress;
+	}
+	yLeaveCriticalSection(&fctx.cs);
+	return res;
+}
+
 #endif
@@ -274,6 +274,7 @@ typedef enum
 #define ZONE_VERIF_TIMEOUT        4000u
 #define FLASH_SUBDEV_TIMEOUT     59000u
 #define YPROG_BOOTLOADER_TIMEOUT 20000u
+#define YPROG_SESSION_TIMEOUT    1800000u // an update session waits at most this long for its hub
 #define YPROG_FORCE_FW_UPDATE    1u
 
 #ifdef MICROCHIP_API
@@ -336,6 +337,8 @@ void yProgInit(void);
 void yProgFree(void);
 YRETCODE yapiCheckFirmware_internal(const char* serial, const char* rev, u32 flags, const char* path, char* buffer, int buffersize, int* fullsize, char* errmsg);
 YRETCODE yapiUpdateFirmware_internal(const char* serial, const char* firmwarePath, const char* settings, int force, int startUpdate, char* msg);
+YRETCODE yapiUpdateFirmwareSession_internal(const char* serial, const char* firmwarePath, const char* settings, int force, int maxPerHub, char* msg);
+YRETCODE yapiGetFirmwareSessionProgress_internal(const char* serial, char* msg);
 #endif
 
 
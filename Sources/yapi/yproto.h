@@ -521,6 +521,7 @@ typedef struct
 	pktItem* first;
 	pktItem* last;
 	int count;
+	int maxCount;
 	u64 totalPush;
 	u64 totalPop;
 	YRETCODE status;
@@ -678,6 +679,8 @@ typedef struct
 	YUSBIO hdl;
 	yapiRequestAsyncCallback callback;
 	void* context;
+	u64 metricsStart;
+	u32 metricsSent;
 } USB_HDL;
 
 #define NB_MAX_STARTUP_RETRY   5u
@@ -745,6 +748,13 @@ typedef enum
 //#define NETH_F_SEND_PING_NOTIFICATION   2
 
 #define NET_HUB_NOT_CONNECTION_TIMEOUT   (6*1024)
+#define NET_HUB_MAX_PENDING_DEVS         32
+#define NET_HUB_MAX_IDLE_SKT             16   // keep-alive connections kept open per HTTP hub
+#define NET_HUB_IDLE_SKT_TIMEOUT         5000 // idle keep-alive connections are closed after this delay (in ms)
+#define NET_HUB_DEFAULT_DEVLIST_VALIDITY 60 // full enumeration period (in s) when notifications are trusted
+#define WS_OUTQ_SIZE                     4096 // WebSocket frames written to the hub in a single send
+#define WS_INBUF_SIZE                    8192 // WebSocket data read from the hub in a single recv
+#define WS_MAX_REPLY_HINT                (4*1024*1024) // reply buffer allocated at once from a Content-Length
 
 typedef struct _HTTPNetHubSt
 {
@@ -760,6 +770,10 @@ typedef struct _HTTPNetHubSt
 	char* s_opaque;
 	u8 s_ha1[16]; // computed when realm is received if pwd is not NULL
 	u32 nc; // reset each time a new nonce is received
+	// idle keep-alive connections shared by all requests to the hub, most recent last (require mutex access)
+	int nbIdleSkt;
+	YSOCKET idleSkt[NET_HUB_MAX_IDLE_SKT];
+	u64 idleSince[NET_HUB_MAX_IDLE_SKT];
 } HTTPNetHub;
 
 
@@ -796,7 +810,10 @@ typedef struct _WSNetHubSt
 	yStrRef pass;
 	int s_next_async_id;
 	YSOCKET skt;
-	yFifoBuf mainfifo;
+	// incoming data is read straight into inbuf, and frames are decoded in place
+	u8* inbuf;
+	int inhead; // first byte not yet consumed
+	int intail; // end of the received data
 	u64 bws_open_tm;
 	u64 bws_timeout_tm;
 	u64 bws_read_tm;
@@ -806,8 +823,12 @@ typedef struct _WSNetHubSt
 	u32 tcpMaxWindowSize;
 	u32 uploadRate;
 	WSChanSt chan[MAX_ASYNC_TCPCHAN];
-	u8* fifo_buffer;
 	struct _RequestSt* openRequests;
+	// encoded frames waiting to be sent, only used by ws_thread (see ws_flushFrames)
+	u8 outq[WS_OUTQ_SIZE];
+	int outqlen;
+	int outqframes;
+	u64 outqstart; // ymetricsTime() when the first frame was queued
 } WSNetHub;
 
 
@@ -832,6 +853,15 @@ typedef struct _HubSt
 	u64 lastAttempt; // time of the last connection attempt (in ms)
 	u64 attemptDelay; // delay until next attemps (in ms)
 	u64 devListExpires;
+	u64 devListFullExpires; // time of the next full enumeration, as a consistency check
+	u64 snapshotExpires; // devices restored from the registry snapshot are kept until then
+	u32 connCount; // incremented each time the notification channel is established
+	u32 enumConnCount; // value of connCount at the last full enumeration
+	// device arrivals announced by notifications, applied by the next enumeration (protected by access)
+	int nbPendingDevs;
+	int pendingOverflow;
+	yStrRef pendingDevs[NET_HUB_MAX_PENDING_DEVS];
+	u8 pendingDevYdx[NET_HUB_MAX_PENDING_DEVS];
 	u8 devYdxMap[ALLOC_YDX_PER_HUB]; // maps hub's internal devYdx to our WP devYdx //fixme:
 	int errcode; // in case an error occured
 	char errmsg[YOCTO_ERRMSG_LEN];
@@ -844,12 +874,12 @@ typedef struct _HubSt
 
 #define TCPREQ_KEEPALIVE       1
 #define TCPREQ_IN_USE          2
+#define TCPREQ_REUSED          4 // the request has been sent on a keep-alive connection
 
 
 typedef struct _HTTPReqSt
 {
 	YSOCKET skt; // socket used to talk to the device
-	YSOCKET reuseskt; // socket to reuse for next query, when keepalive is true
 } HTTPReqSt;
 
 typedef struct _WSReqSt
@@ -863,6 +893,8 @@ typedef struct _WSReqSt
 	int requestpos; // the pos of the request that need to be sent
 	u64 first_write_tm;
 	u64 last_write_tm;
+	int replyHint; // reply size announced by a Content-Length header, 0 until the header is received, -1 if none
+	int replyReceived; // reply bytes received so far, including the ones already read
 } WSReqSt;
 
 typedef enum
@@ -908,22 +940,42 @@ typedef struct _RequestSt
 	void* progressCtx;
 	HTTPReqSt http;
 	WSReqSt ws;
+	yStrRef metricsSerial; // device addressed by the request, for ymetricsRequest
+	u64 metricsStart;
+	u32 metricsSent;
 } RequestSt;
 
 #define SETUPED_IFACE_CACHE_SIZE 128
 
 
-typedef struct
+// firmware file loaded once and shared by all update sessions using it
+typedef struct _FUpdateFirmware
+{
+	char* path;
+	u8* data;
+	int len;
+	int refcount;
+	int md5state; // 0:not verified yet 1:valid <0:invalid checksum
+	struct _FUpdateFirmware* next;
+} FUpdateFirmware;
+
+typedef struct _FUpdateContext
 {
 	char* serial;
 	char* firmwarePath;
 	u8* settings;
 	int settings_len;
+	u16 flags;
+	int maxPerHub; // number of sessions allowed to update devices of the same hub at once
 	yThread thread;
 	int global_progress; //-1:error 0-99:working 100:success
 	char global_message[YOCTO_ERRMSG_LEN]; // the last message or the error
 	const char* fileid;
 	int line;
+	char slot[YOCTO_SERIAL_LEN]; // hub serial (or "usb") of the update slot held, empty if none
+	char engine[YOCTO_SERIAL_LEN]; // hub serial of the flash engine held, empty if none
+	u64 deadline; // the session gives up waiting for its hub after this tick
+	struct _FUpdateContext* next; // next concurrent update session
 } FUpdateContext;
 
 
@@ -953,6 +1005,11 @@ typedef struct
 	yCRITICAL_SECTION updateDev_cs;
 	yCRITICAL_SECTION handleEv_cs;
 	yEvent exitSleepEvent;
+	// set when events are waiting for yapiHandleEvents (see ySignalPendingEvents)
+	volatile int eventPending;
+#ifndef WINDOWS_API
+	int eventPipe[2];
+#endif
 	// global inforation on all devices
 	yCRITICAL_SECTION generic_cs;
 	yGenericDeviceSt generic_infos[ALLOC_YDX_PER_HUB];
@@ -968,6 +1025,13 @@ typedef struct
 	u32 io_counter;
 	// network discovery info
 	HubSt* nethub[NBMAX_NET_HUB];
+	// registry snapshot (see yapiSetRegistrySnapshot), protected by updateDev_cs
+	char* snapshotFile;
+	char* snapshotData;
+	int snapshotSize;
+	u32 snapshotInterval; // autosave period in ms, 0 to save only in yapiFreeAPI
+	u64 snapshotNextSave;
+	u32 devListValidity; // full enumeration period of network hubs in ms (see yapiSetNetDevListValidity)
 	RequestSt* tcpreq[ALLOC_YDX_PER_HUB]; // indexed by our own DevYdx
 	yRawNotificationCb rawNotificationCb;
 	yRawReportCb rawReportCb;
@@ -987,6 +1051,9 @@ typedef struct
 	yapiHubDiscoveryCallback hubDiscoveryCallback;
 	// Programing api
 	FUpdateContext fuCtx;
+	FUpdateContext* fuSessions; // concurrent update sessions, protected by fctx.cs
+	FUpdateFirmware* fuFirmwares; // shared firmware files, protected by fuFirmwareCs
+	yCRITICAL_SECTION fuFirmwareCs;
 	// OS specifics variables
 	yInterfaceSt* setupedIfaceCache[SETUPED_IFACE_CACHE_SIZE];
 #if defined(WINDOWS_API)
@@ -1016,6 +1083,66 @@ typedef struct
 #define TRACEFILE_NAMELEN  512
 
 extern char ytracefile[];
+
+/*****************************************************************
+ * Binary trace recorder
+ *
+ * Each thread appends compact records to its own lock-free ring,
+ * a background thread writes them to the trace file. The records
+ * are turned back into text by ytraceDecode.
+*****************************************************************/
+
+#define YTRACE_LOG          1   // dbglog message, args[0]=line
+#define YTRACE_REQ_START    2   // args[0]=request id, data=device and request line
+#define YTRACE_REQ_DATA     3   // args[0]=request id, args[1]=bytes received
+#define YTRACE_REQ_END      4   // args[0]=request id, args[1]=result or reply size, args[2]=duration [ms], data=errmsg
+#define YTRACE_VALUE        5   // args[0]=function descriptor, data=value
+#define YTRACE_TIMEDREPORT  6   // args[0]=function descriptor, args[1..2]=device time [s,ms], data=report
+#define YTRACE_DROPPED      7   // args[0]=ring slot, args[1]=records lost because the ring was full
+
+typedef struct
+{
+	u16 size; // record size, header included
+	u8 type;
+	u8 reserved;
+	u16 thread;
+	u16 reserved2;
+	u64 time;
+	s32 args[3];
+} yTraceRecordHdr;
+
+extern volatile int ytraceRunning;
+
+int ytraceStart(const char* file, int sampling, char* errmsg);
+void ytraceStop(void);
+int ytraceDecode(const char* tracefile, const char* textfile, char* errmsg);
+int ytraceSample(void);
+void ytraceRecord(int type, s32 arg0, s32 arg1, s32 arg2, const char* data, int len);
+int ytraceReqStart(const char* device, const char* request, int reqlen);
+void ytraceReqEnd(int id, int res, int size, const char* errmsg, u64 start_tm);
+
+/*****************************************************************
+ * Runtime metrics registry
+ *
+ * Always-enabled counters and histograms per hub and per device,
+ * read by yapiGetMetrics and rendered by yapiGetMetricsText.
+*****************************************************************/
+
+#define YMETRICS_MAX_DEVICES    ALLOC_YDX_PER_HUB
+#define YMETRICS_USB_SLOT       NBMAX_NET_HUB   // pseudo-hub slot for USB devices
+
+void ymetricsInit(void);
+void ymetricsFree(void);
+void ymetricsReset(void);
+u64 ymetricsTime(void);
+void ymetricsRequest(yStrRef serial, u64 start_us, u32 sent, u32 received, int errcode);
+void ymetricsNotification(yStrRef serial);
+void ymetricsCallback(yStrRef serial, u64 duration_us);
+void ymetricsReconnect(HubSt* hub);
+void ymetricsWsFlush(HubSt* hub, u32 frames, u64 delay_us);
+void ymetricsEventQueue(u32 depth);
+int ymetricsGet(yMetricsEntry* entries, int maxentries);
+int ymetricsRender(char** text);
 extern yContextSt* yContext;
 
 YRETCODE yapiPullDeviceLogEx(int devydx);
@@ -1103,5 +1230,6 @@ YRETCODE yapiHTTPRequestSyncStartEx_internal(YIOHDL* iohdl, int tcpchan, const c
 YRETCODE yapiHTTPRequestSyncDone_internal(YIOHDL* iohdl, char* errmsg);
 void yFunctionUpdate(YAPI_FUNCTION fundescr, const char* value);
 void yFunctionTimedUpdate(YAPI_FUNCTION fundescr, double deviceTime, const u8* report, u32 len);
+void ySignalPendingEvents(void);
 int yapiJsonGetPath_internal(const char* path, const char* json_data, int json_size, const char** output, char* errmsg);
 #endif
@@ -230,7 +230,12 @@ int vdbglogf(const char* fileid, int line, const char* fmt, va_list args)
     printf("%s", buffer);
 #endif
 
-	if (ytracefile[0])
+	if (ytraceRunning)
+	{
+		// the recorder writes the message from its own thread
+		ytraceRecord(YTRACE_LOG, line, 0, 0, buffer, len);
+	}
+	else if (ytracefile[0])
 	{
 		FILE* f;
 		if (YFOPEN(&f,ytracefile,"a+") != 0)
@@ -256,6 +261,1002 @@ int dbglogf(const char* fileid, int line, const char* fmt,...)
 }
 
 
+/*****************************************************************************
+  Binary trace recorder
+ ***************************************************************************/
+
+#define YTRACE_RING_SIZE    (64*1024) // must be a power of 2
+#define YTRACE_MAX_RINGS    64        // concurrent threads beyond share one locked ring
+#define YTRACE_MAX_DATA     256
+#define YTRACE_FILE_MAGIC   "YTRACE1\n"
+
+typedef struct
+{
+	u8 data[YTRACE_RING_SIZE];
+	volatile u32 head; // only moved by the producer thread
+	volatile u32 tail; // only moved by the writer thread
+	u32 dropped;
+	u32 dropReported;
+	u32 sampleCount;
+	u32 reqCount;
+	volatile int owned; // set while a live thread records into the ring
+} yTraceRing;
+
+volatile int ytraceRunning = 0;
+static int ytraceSampling = 1;
+static FILE* ytraceFile = NULL;
+static yThread ytraceThread;
+static int ytraceCsReady = 0;
+static yCRITICAL_SECTION ytraceCs;
+// rings are never freed, since a producer may still be writing when the
+// recorder is stopped; they are reused when it is started again
+static yTraceRing* volatile ytraceRings[YTRACE_MAX_RINGS + 1];
+// ring slot of the current thread plus one, the slot is given back when the thread ends
+static yThreadKey ytraceSlotKey;
+
+static void YTHREAD_EXIT_CALLBACK ytraceThreadExit(void* value)
+{
+	int slot = (int)((u8*)value - (u8*)NULL) - 1;
+
+	if (slot >= 0 && slot < YTRACE_MAX_RINGS)
+	{
+		// records left in the ring are still drained by the writer thread
+		yEnterCriticalSection(&ytraceCs);
+		ytraceRings[slot]->owned = 0;
+		yLeaveCriticalSection(&ytraceCs);
+	}
+}
+
+// Returns the ring of the current thread, *shared is set when the thread
+// uses the shared ring, which must be written under ytraceCs
+static yTraceRing* ytraceGetRing(int* thread, int* shared)
+{
+	yTraceRing* ring;
+	int slot;
+
+	*thread = yThreadIndex();
+	slot = (int)((u8*)yThreadKeyGet(&ytraceSlotKey) - (u8*)NULL) - 1;
+	if (slot < 0)
+	{
+		yEnterCriticalSection(&ytraceCs);
+		for (slot = 0; slot < YTRACE_MAX_RINGS; slot++)
+		{
+			if (ytraceRings[slot] == NULL || !ytraceRings[slot]->owned)
+			{
+				break;
+			}
+		}
+		if (ytraceRings[slot] == NULL)
+		{
+			ring = (yTraceRing*)yMalloc(sizeof(yTraceRing));
+			memset(ring, 0, sizeof(yTraceRing));
+			yMemoryBarrier();
+			ytraceRings[slot] = ring;
+		}
+		if (slot < YTRACE_MAX_RINGS)
+		{
+			ytraceRings[slot]->owned = 1;
+			yThreadKeySet(&ytraceSlotKey, (u8*)NULL + slot + 1);
+		}
+		yLeaveCriticalSection(&ytraceCs);
+	}
+	*shared = (slot >= YTRACE_MAX_RINGS);
+	return ytraceRings[slot];
+}
+
+static void ytraceRingWrite(yTraceRing* ring, u32 pos, const u8* data, u32 len)
+{
+	u32 ofs = pos & (YTRACE_RING_SIZE - 1);
+	u32 part = YTRACE_RING_SIZE - ofs;
+
+	if (part >= len)
+	{
+		memcpy(ring->data + ofs, data, len);
+	}
+	else
+	{
+		memcpy(ring->data + ofs, data, part);
+		memcpy(ring->data, data + part, len - part);
+	}
+}
+
+static void ytraceRingPush(yTraceRing* ring, yTraceRecordHdr* hdr, const char* data, int len)
+{
+	u32 head, tail;
+
+	head = ring->head;
+	tail = ring->tail;
+	if (YTRACE_RING_SIZE - (head - tail) < hdr->size)
+	{
+		ring->dropped++;
+		return;
+	}
+	ytraceRingWrite(ring, head, (const u8*)hdr, sizeof(yTraceRecordHdr));
+	if (len > 0)
+	{
+		ytraceRingWrite(ring, head + sizeof(yTraceRecordHdr), (const u8*)data, len);
+	}
+	// the record must be complete before the writer thread can see it
+	yMemoryBarrier();
+	ring->head = head + hdr->size;
+}
+
+void ytraceRecord(int type, s32 arg0, s32 arg1, s32 arg2, const char* data, int len)
+{
+	yTraceRecordHdr hdr;
+	yTraceRing* ring;
+	int thread, shared;
+
+	if (!ytraceRunning)
+	{
+		return;
+	}
+	if (data == NULL || len < 0)
+	{
+		len = 0;
+	}
+	else if (len > YTRACE_MAX_DATA)
+	{
+		len = YTRACE_MAX_DATA;
+	}
+	ring = ytraceGetRing(&thread, &shared);
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.size = (u16)(sizeof(yTraceRecordHdr) + len);
+	hdr.type = (u8)type;
+	hdr.thread = (u16)thread;
+	hdr.time = yapiGetTickCount();
+	hdr.args[0] = arg0;
+	hdr.args[1] = arg1;
+	hdr.args[2] = arg2;
+	if (shared)
+	{
+		yEnterCriticalSection(&ytraceCs);
+		ytraceRingPush(ring, &hdr, data, len);
+		yLeaveCriticalSection(&ytraceCs);
+	}
+	else
+	{
+		ytraceRingPush(ring, &hdr, data, len);
+	}
+}
+
+// Returns true when the current event is part of the sample to record
+int ytraceSample(void)
+{
+	yTraceRing* ring;
+	int thread, shared;
+	u32 count;
+
+	if (!ytraceRunning)
+	{
+		return 0;
+	}
+	if (ytraceSampling <= 1)
+	{
+		return 1;
+	}
+	ring = ytraceGetRing(&thread, &shared);
+	if (shared)
+	{
+		yEnterCriticalSection(&ytraceCs);
+	}
+	count = ring->sampleCount++;
+	if (shared)
+	{
+		yLeaveCriticalSection(&ytraceCs);
+	}
+	return (count % ytraceSampling) == 0;
+}
+
+// Records the start of a request if it is sampled, and returns its id (0 if not recorded)
+int ytraceReqStart(const char* device, const char* request, int reqlen)
+{
+	char buffer[YTRACE_MAX_DATA];
+	yTraceRing* ring;
+	int thread, shared, len, i, id;
+
+	if (!ytraceSample())
+	{
+		return 0;
+	}
+	ring = ytraceGetRing(&thread, &shared);
+	if (shared)
+	{
+		yEnterCriticalSection(&ytraceCs);
+	}
+	id = ((thread & 0x7ff) << 20) | (++ring->reqCount & 0xfffff);
+	if (id == 0)
+	{
+		id = ++ring->reqCount;
+	}
+	if (shared)
+	{
+		yLeaveCriticalSection(&ytraceCs);
+	}
+	len = YSPRINTF(buffer, YTRACE_MAX_DATA, "%s ", device ? device : "");
+	if (len < 0)
+	{
+		len = 0;
+	}
+	// only keep the request line
+	for (i = 0; i < reqlen && len < YTRACE_MAX_DATA && request[i] != '\r' && request[i] != '\n'; i++)
+	{
+		buffer[len++] = request[i];
+	}
+	ytraceRecord(YTRACE_REQ_START, id, reqlen, 0, buffer, len);
+	return id;
+}
+
+void ytraceReqEnd(int id, int res, int size, const char* errmsg, u64 start_tm)
+{
+	if (id == 0)
+	{
+		return;
+	}
+	if (YISERR(res))
+	{
+		ytraceRecord(YTRACE_REQ_END, id, res, (s32)(yapiGetTickCount() - start_tm), errmsg, errmsg ? YSTRLEN(errmsg) : 0);
+	}
+	else
+	{
+		ytraceRecord(YTRACE_REQ_END, id, size, (s32)(yapiGetTickCount() - start_tm), NULL, 0);
+	}
+}
+
+static int ytraceDrain(void)
+{
+	yTraceRecordHdr hdr;
+	yTraceRing* ring;
+	u32 head, tail, ofs, len, part, total = 0;
+	int i;
+
+	for (i = 0; i <= YTRACE_MAX_RINGS; i++)
+	{
+		ring = ytraceRings[i];
+		if (ring == NULL)
+		{
+			continue;
+		}
+		head = ring->head;
+		yMemoryBarrier();
+		tail = ring->tail;
+		len = head - tail;
+		if (len > 0)
+		{
+			ofs = tail & (YTRACE_RING_SIZE - 1);
+			part = YTRACE_RING_SIZE - ofs;
+			if (part >= len)
+			{
+				fwrite(ring->data + ofs, 1, len, ytraceFile);
+			}
+			else
+			{
+				fwrite(ring->data + ofs, 1, part, ytraceFile);
+				fwrite(ring->data, 1, len - part, ytraceFile);
+			}
+			yMemoryBarrier();
+			ring->tail = head;
+			total += len;
+		}
+		if (ring->dropped != ring->dropReported)
+		{
+			memset(&hdr, 0, sizeof(hdr));
+			hdr.size = sizeof(yTraceRecordHdr);
+			hdr.type = YTRACE_DROPPED;
+			hdr.time = yapiGetTickCount();
+			hdr.args[0] = i;
+			hdr.args[1] = (s32)(ring->dropped - ring->dropReported);
+			ring->dropReported += hdr.args[1];
+			fwrite(&hdr, 1, sizeof(hdr), ytraceFile);
+			total += sizeof(hdr);
+		}
+	}
+	if (total > 0)
+	{
+		fflush(ytraceFile);
+	}
+	return total;
+}
+
+static void* ytraceWriterThread(void* ctx)
+{
+	yThread* thread = (yThread*)ctx;
+
+	yThreadSignalStart(thread);
+	while (!yThreadMustEnd(thread))
+	{
+		if (ytraceDrain() == 0)
+		{
+			yApproximateSleep(10);
+		}
+	}
+	yThreadSignalEnd(thread);
+	return NULL;
+}
+
+int ytraceStart(const char* file, int sampling, char* errmsg)
+{
+	int i;
+
+	if (ytraceRunning)
+	{
+		return YERRMSG(YAPI_INVALID_ARGUMENT, "Trace recorder already started");
+	}
+	if (!ytraceCsReady)
+	{
+		yInitializeCriticalSection(&ytraceCs);
+		if (yThreadKeyCreate(&ytraceSlotKey, ytraceThreadExit) < 0)
+		{
+			yDeleteCriticalSection(&ytraceCs);
+			return YERRMSG(YAPI_IO_ERROR, "Unable to allocate trace thread slot");
+		}
+		ytraceCsReady = 1;
+	}
+	if (YFOPEN(&ytraceFile, file, "wb") != 0)
+	{
+		ytraceFile = NULL;
+		return YERRMSG(YAPI_IO_ERROR, "Unable to create trace file");
+	}
+	fwrite(YTRACE_FILE_MAGIC, 1, 8, ytraceFile);
+	// discard anything left from a previous run
+	for (i = 0; i <= YTRACE_MAX_RINGS; i++)
+	{
+		if (ytraceRings[i] != NULL)
+		{
+			ytraceRings[i]->tail = ytraceRings[i]->head;
+			ytraceRings[i]->dropReported = ytraceRings[i]->dropped;
+		}
+	}
+	ytraceSampling = (sampling < 1 ? 1 : sampling);
+	memset(&ytraceThread, 0, sizeof(ytraceThread));
+	if (yThreadCreate(&ytraceThread, ytraceWriterThread, NULL) < 0)
+	{
+		fclose(ytraceFile);
+		ytraceFile = NULL;
+		return YERRMSG(YAPI_IO_ERROR, "Unable to start trace writer thread");
+	}
+	yMemoryBarrier();
+	ytraceRunning = 1;
+	return YAPI_SUCCESS;
+}
+
+void ytraceStop(void)
+{
+	if (!ytraceRunning)
+	{
+		return;
+	}
+	ytraceRunning = 0;
+	yThreadRequestEnd(&ytraceThread);
+	while (yThreadIsRunning(&ytraceThread))
+	{
+		yApproximateSleep(5);
+	}
+	// records pushed before the recorder was stopped
+	ytraceDrain();
+	fclose(ytraceFile);
+	ytraceFile = NULL;
+}
+
+static const char* ytraceTypeName(int type)
+{
+	switch (type)
+	{
+	case YTRACE_LOG:
+		return "LOG";
+	case YTRACE_REQ_START:
+		return "REQ";
+	case YTRACE_REQ_DATA:
+		return "DATA";
+	case YTRACE_REQ_END:
+		return "END";
+	case YTRACE_VALUE:
+		return "VAL";
+	case YTRACE_TIMEDREPORT:
+		return "TREP";
+	case YTRACE_DROPPED:
+		return "DROP";
+	}
+	return "???";
+}
+
+int ytraceDecode(const char* tracefile, const char* textfile, char* errmsg)
+{
+	yTraceRecordHdr hdr;
+	u8 data[YTRACE_MAX_DATA + 1];
+	char magic[8];
+	FILE *in, *out;
+	u64 basetime = 0;
+	int len, i, count = 0;
+
+	if (YFOPEN(&in, tracefile, "rb") != 0)
+	{
+		return YERRMSG(YAPI_IO_ERROR, "Unable to open trace file");
+	}
+	if (fread(magic, 1, 8, in) != 8 || memcmp(magic, YTRACE_FILE_MAGIC, 8) != 0)
+	{
+		fclose(in);
+		return YERRMSG(YAPI_INVALID_ARGUMENT, "Not a trace file");
+	}
+	if (YFOPEN(&out, textfile, "w") != 0)
+	{
+		fclose(in);
+		return YERRMSG(YAPI_IO_ERROR, "Unable to create text file");
+	}
+	while (fread(&hdr, 1, sizeof(hdr), in) == sizeof(hdr))
+	{
+		len = hdr.size - (int)sizeof(hdr);
+		if (len < 0 || len > YTRACE_MAX_DATA || (len > 0 && fread(data, 1, len, in) != (size_t)len))
+		{
+			fprintf(out, "truncated trace\n");
+			break;
+		}
+		data[len] = 0;
+		if (basetime == 0)
+		{
+			basetime = hdr.time;
+		}
+		fprintf(out, "%8" FMTu64 " [%d] %-4s ", hdr.time - basetime, hdr.thread, ytraceTypeName(hdr.type));
+		switch (hdr.type)
+		{
+		case YTRACE_LOG:
+			// dbglog messages already end with a newline
+			fprintf(out, "%s", (char*)data);
+			if (len == 0 || data[len - 1] != '\n')
+			{
+				fprintf(out, "\n");
+			}
+			break;
+		case YTRACE_REQ_START:
+			fprintf(out, "#%x %s (%d bytes)\n", hdr.args[0], (char*)data, hdr.args[1]);
+			break;
+		case YTRACE_REQ_DATA:
+			fprintf(out, "#%x %d bytes\n", hdr.args[0], hdr.args[1]);
+			break;
+		case YTRACE_REQ_END:
+			if (YISERR(hdr.args[1]))
+			{
+				fprintf(out, "#%x error %d: %s (%d ms)\n", hdr.args[0], hdr.args[1], (char*)data, hdr.args[2]);
+			}
+			else
+			{
+				fprintf(out, "#%x %d bytes (%d ms)\n", hdr.args[0], hdr.args[1], hdr.args[2]);
+			}
+			break;
+		case YTRACE_VALUE:
+			fprintf(out, "fun %x = %s\n", hdr.args[0], (char*)data);
+			break;
+		case YTRACE_TIMEDREPORT:
+			fprintf(out, "fun %x at %d.%03d:", hdr.args[0], hdr.args[1], hdr.args[2]);
+			for (i = 0; i < len; i++)
+			{
+				fprintf(out, " %02x", data[i]);
+			}
+			fprintf(out, "\n");
+			break;
+		case YTRACE_DROPPED:
+			fprintf(out, "%d records lost by thread ring %d\n", hdr.args[1], hdr.args[0]);
+			break;
+		default:
+			fprintf(out, "%d %d %d\n", hdr.args[0], hdr.args[1], hdr.args[2]);
+			break;
+		}
+		count++;
+	}
+	fclose(out);
+	fclose(in);
+	return count;
+}
+
+
+/*****************************************************************************
+  Runtime metrics registry
+ ***************************************************************************/
+
+static yCRITICAL_SECTION ymetricsCS;
+static int ymetricsReady = 0;
+static const u32 ymetricsBounds[YMETRICS_NB_BUCKETS - 1] = YMETRICS_BUCKET_BOUNDS;
+static yMetricsEntry ymetricsLib;
+static yMetricsEntry ymetricsHubs[NBMAX_NET_HUB + 1];
+static HubSt* ymetricsHubPtr[NBMAX_NET_HUB];
+// devices are stored in an open-addressing table indexed by serial
+static yMetricsEntry ymetricsDevs[YMETRICS_MAX_DEVICES];
+static yStrRef ymetricsDevRef[YMETRICS_MAX_DEVICES];
+static int ymetricsDevHub[YMETRICS_MAX_DEVICES];
+
+
+void ymetricsReset(void)
+{
+	int i;
+
+	if (!ymetricsReady)
+		return;
+	yEnterCriticalSection(&ymetricsCS);
+	memset(&ymetricsLib, 0, sizeof(ymetricsLib));
+	memset(ymetricsHubs, 0, sizeof(ymetricsHubs));
+	memset(ymetricsHubPtr, 0, sizeof(ymetricsHubPtr));
+	memset(ymetricsDevs, 0, sizeof(ymetricsDevs));
+	ymetricsLib.kind = YMETRICS_LIBRARY;
+	for (i = 0; i <= NBMAX_NET_HUB; i++)
+	{
+		ymetricsHubs[i].kind = YMETRICS_HUB;
+	}
+	YSTRCPY(ymetricsHubs[YMETRICS_USB_SLOT].hub, YMETRICS_HUB_LEN, "usb");
+	for (i = 0; i < YMETRICS_MAX_DEVICES; i++)
+	{
+		ymetricsDevRef[i] = INVALID_HASH_IDX;
+		ymetricsDevHub[i] = -1;
+	}
+	yLeaveCriticalSection(&ymetricsCS);
+}
+
+void ymetricsInit(void)
+{
+	if (ymetricsReady)
+		return;
+	yInitializeCriticalSection(&ymetricsCS);
+	ymetricsReady = 1;
+	ymetricsReset();
+}
+
+void ymetricsFree(void)
+{
+	if (!ymetricsReady)
+		return;
+	ymetricsReady = 0;
+	yDeleteCriticalSection(&ymetricsCS);
+}
+
+// microsecond clock used for all durations
+u64 ymetricsTime(void)
+{
+#ifdef WINDOWS_API
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (freq.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&freq);
+	}
+	QueryPerformanceCounter(&now);
+	return (u64)(now.QuadPart / freq.QuadPart) * 1000000u + (u64)(now.QuadPart % freq.QuadPart) * 1000000u / freq.QuadPart;
+#else
+	struct timeval tim;
+
+	gettimeofday(&tim, NULL);
+	return (u64)tim.tv_sec * 1000000u + tim.tv_usec;
+#endif
+}
+
+static void ymetricsObserve(yMetricsHistogram* h, u64 duration_us)
+{
+	int i;
+
+	for (i = 0; i < YMETRICS_NB_BUCKETS - 1 && duration_us > ymetricsBounds[i]; i++);
+	h->buckets[i]++;
+	h->count++;
+	h->sumUs += duration_us;
+}
+
+// find the hub slot serving a device, -1 if not yet known (must be called without ymetricsCS)
+static int ymetricsFindHub(yStrRef serial, HubSt** hubptr)
+{
+	yUrlRef url = wpGetDeviceUrlRef(serial);
+	int i;
+
+	*hubptr = NULL;
+	if (url == INVALID_HASH_IDX)
+		return -1;
+	if (yHashGetUrlPort(url, NULL, NULL, NULL, NULL, NULL) == USB_URL)
+		return YMETRICS_USB_SLOT;
+	for (i = 0; i < NBMAX_NET_HUB; i++)
+	{
+		if (yContext->nethub[i] && yHashSameHub(yContext->nethub[i]->url, url))
+		{
+			*hubptr = yContext->nethub[i];
+			return i;
+		}
+	}
+	return -1;
+}
+
+// (re)bind a hub slot to a hub, must be called with ymetricsCS
+static void ymetricsBindHub(int slot, HubSt* hub)
+{
+	if (slot < 0 || slot >= NBMAX_NET_HUB || ymetricsHubPtr[slot] == hub)
+		return;
+	memset(&ymetricsHubs[slot], 0, sizeof(yMetricsEntry));
+	ymetricsHubs[slot].kind = YMETRICS_HUB;
+	if (hub->name)
+	{
+		YSTRNCPY(ymetricsHubs[slot].hub, YMETRICS_HUB_LEN, hub->name, YMETRICS_HUB_LEN - 1);
+	}
+	ymetricsHubPtr[slot] = hub;
+}
+
+// returns the device slot of a serial, allocating it if needed, with ymetricsCS taken
+static int ymetricsEnterDev(yStrRef serial)
+{
+	int i, slot, hubslot;
+	HubSt* hub;
+
+	if (!ymetricsReady || serial == INVALID_HASH_IDX)
+		return -1;
+	yEnterCriticalSection(&ymetricsCS);
+	slot = (u16)serial % YMETRICS_MAX_DEVICES;
+	for (i = 0; i < YMETRICS_MAX_DEVICES; i++)
+	{
+		if (ymetricsDevRef[slot] == serial)
+			break;
+		if (ymetricsDevRef[slot] == INVALID_HASH_IDX)
+		{
+			ymetricsDevRef[slot] = serial;
+			ymetricsDevs[slot].kind = YMETRICS_DEVICE;
+			yHashGetStr(serial, ymetricsDevs[slot].serial, YOCTO_SERIAL_LEN);
+			break;
+		}
+		slot = (slot + 1) % YMETRICS_MAX_DEVICES;
+	}
+	if (i == YMETRICS_MAX_DEVICES)
+	{
+		yLeaveCriticalSection(&ymetricsCS);
+		return -1;
+	}
+	if (ymetricsDevHub[slot] < 0)
+	{
+		// the white pages must not be searched while holding ymetricsCS
+		yLeaveCriticalSection(&ymetricsCS);
+		hubslot = ymetricsFindHub(serial, &hub);
+		yEnterCriticalSection(&ymetricsCS);
+		if (hubslot >= 0 && ymetricsDevHub[slot] < 0)
+		{
+			if (hub)
+			{
+				ymetricsBindHub(hubslot, hub);
+			}
+			ymetricsDevHub[slot] = hubslot;
+			YSTRCPY(ymetricsDevs[slot].hub, YMETRICS_HUB_LEN, ymetricsHubs[hubslot].hub);
+		}
+	}
+	return slot;
+}
+
+static void ymetricsAddRequest(yMetricsEntry* e, u64 duration_us, u32 sent, u32 received, int errcode)
+{
+	e->requests++;
+	if (YISERR(errcode))
+	{
+		e->requestErrors++;
+	}
+	e->bytesSent += sent;
+	e->bytesReceived += received;
+	ymetricsObserve(&e->latency, duration_us);
+}
+
+void ymetricsRequest(yStrRef serial, u64 start_us, u32 sent, u32 received, int errcode)
+{
+	u64 now = ymetricsTime();
+	u64 duration = (now > start_us ? now - start_us : 0);
+	int slot = ymetricsEnterDev(serial);
+
+	if (slot < 0)
+		return;
+	ymetricsAddRequest(&ymetricsDevs[slot], duration, sent, received, errcode);
+	if (ymetricsDevHub[slot] >= 0)
+	{
+		ymetricsAddRequest(&ymetricsHubs[ymetricsDevHub[slot]], duration, sent, received, errcode);
+	}
+	yLeaveCriticalSection(&ymetricsCS);
+}
+
+void ymetricsNotification(yStrRef serial)
+{
+	int slot = ymetricsEnterDev(serial);
+
+	if (slot < 0)
+		return;
+	ymetricsDevs[slot].notifications++;
+	if (ymetricsDevHub[slot] >= 0)
+	{
+		ymetricsHubs[ymetricsDevHub[slot]].notifications++;
+	}
+	yLeaveCriticalSection(&ymetricsCS);
+}
+
+void ymetricsCallback(yStrRef serial, u64 duration_us)
+{
+	int slot = ymetricsEnterDev(serial);
+
+	if (slot < 0)
+		return;
+	ymetricsObserve(&ymetricsDevs[slot].callbacks, duration_us);
+	yLeaveCriticalSection(&ymetricsCS);
+}
+
+void ymetricsReconnect(HubSt* hub)
+{
+	int i;
+
+	if (!ymetricsReady || yContext == NULL)
+		return;
+	for (i = 0; i < NBMAX_NET_HUB; i++)
+	{
+		if (yContext->nethub[i] == hub)
+			break;
+	}
+	if (i == NBMAX_NET_HUB)
+		return;
+	yEnterCriticalSection(&ymetricsCS);
+	ymetricsBindHub(i, hub);
+	ymetricsHubs[i].reconnects++;
+	yLeaveCriticalSection(&ymetricsCS);
+}
+
+// account a write of the WebSocket output queue of a hub
+void ymetricsWsFlush(HubSt* hub, u32 frames, u64 delay_us)
+{
+	int i;
+
+	if (!ymetricsReady || yContext == NULL)
+		return;
+	for (i = 0; i < NBMAX_NET_HUB; i++)
+	{
+		if (yContext->nethub[i] == hub)
+			break;
+	}
+	if (i == NBMAX_NET_HUB)
+		return;
+	yEnterCriticalSection(&ymetricsCS);
+	ymetricsBindHub(i, hub);
+	ymetricsHubs[i].wsFrames += frames;
+	ymetricsHubs[i].wsWrites++;
+	ymetricsObserve(&ymetricsHubs[i].wsQueueDelay, delay_us);
+	yLeaveCriticalSection(&ymetricsCS);
+}
+
+void ymetricsEventQueue(u32 depth)
+{
+	if (!ymetricsReady)
+		return;
+	yEnterCriticalSection(&ymetricsCS);
+	ymetricsLib.queueDepth = depth;
+	if (depth > ymetricsLib.queueMaxDepth)
+	{
+		ymetricsLib.queueMaxDepth = depth;
+	}
+	yLeaveCriticalSection(&ymetricsCS);
+}
+
+// copy the library entry, then the active hubs and devices. Returns the number of entries available
+int ymetricsGet(yMetricsEntry* entries, int maxentries)
+{
+	int i, count = 0;
+	yPrivDeviceSt* p;
+
+	if (!ymetricsReady)
+		return 0;
+	// USB packet queues are sampled when read
+	if (yContext)
+	{
+		yEnterCriticalSection(&yContext->enum_cs);
+		for (p = yContext->devs; p; p = p->next)
+		{
+			yStrRef serial = yHashTestStr(p->infos.serial);
+			int slot = (p->dStatus == YDEV_WORKING ? ymetricsEnterDev(serial) : -1);
+			if (slot >= 0)
+			{
+				ymetricsDevs[slot].queueDepth = p->iface.rxQueue.count;
+				ymetricsDevs[slot].queueMaxDepth = p->iface.rxQueue.maxCount;
+				yLeaveCriticalSection(&ymetricsCS);
+			}
+		}
+		yLeaveCriticalSection(&yContext->enum_cs);
+	}
+	yEnterCriticalSection(&ymetricsCS);
+	if (count < maxentries)
+	{
+		entries[count] = ymetricsLib;
+	}
+	count++;
+	for (i = 0; i <= NBMAX_NET_HUB; i++)
+	{
+		if (ymetricsHubs[i].hub[0] == 0)
+			continue;
+		if (i == YMETRICS_USB_SLOT && ymetricsHubs[i].requests == 0 && ymetricsHubs[i].notifications == 0)
+			continue;
+		if (count < maxentries)
+		{
+			entries[count] = ymetricsHubs[i];
+		}
+		count++;
+	}
+	for (i = 0; i < YMETRICS_MAX_DEVICES; i++)
+	{
+		if (ymetricsDevRef[i] == INVALID_HASH_IDX)
+			continue;
+		if (count < maxentries)
+		{
+			entries[count] = ymetricsDevs[i];
+		}
+		count++;
+	}
+	yLeaveCriticalSection(&ymetricsCS);
+	return count;
+}
+
+
+typedef struct
+{
+	char* buf;
+	int len;
+	int size;
+} yMetricsText;
+
+static void ymtPrintf(yMetricsText* t, const char* fmt, ...)
+{
+	va_list args;
+	int len;
+
+	// a single line never exceeds 512 bytes
+	if (t->size - t->len < 512)
+	{
+		char* newbuf;
+		t->size = (t->size < 4096 ? 4096 : t->size * 2);
+		newbuf = (char*)yMalloc(t->size);
+		if (t->len)
+		{
+			memcpy(newbuf, t->buf, t->len);
+		}
+		if (t->buf)
+		{
+			yFree(t->buf);
+		}
+		t->buf = newbuf;
+	}
+	va_start(args, fmt);
+	len = YVSPRINTF(t->buf + t->len, t->size - t->len, fmt, args);
+	va_end(args);
+	if (len > 0)
+	{
+		t->len += len;
+	}
+}
+
+static void ymtLabels(yMetricsText* t, const yMetricsEntry* e)
+{
+	if (e->kind == YMETRICS_DEVICE)
+	{
+		ymtPrintf(t, "{hub=\"%s\",serial=\"%s\"", e->hub, e->serial);
+	}
+	else
+	{
+		ymtPrintf(t, "{hub=\"%s\"", e->hub);
+	}
+}
+
+static void ymtHeader(yMetricsText* t, const char* prefix, const char* name, const char* type, const char* help)
+{
+	ymtPrintf(t, "# HELP yapi_%s_%s %s\n# TYPE yapi_%s_%s %s\n", prefix, name, help, prefix, name, type);
+}
+
+#define YMT_COUNTER(NAME, FIELD, HELP) \
+	do { \
+		ymtHeader(&t, prefix, NAME, "counter", HELP); \
+		for (i = 0; i < count; i++) \
+		{ \
+			if (entries[i].kind != kind) continue; \
+			ymtPrintf(&t, "yapi_%s_%s", prefix, NAME); \
+			ymtLabels(&t, &entries[i]); \
+			ymtPrintf(&t, "} %" FMTu64 "\n", entries[i].FIELD); \
+		} \
+	} while (0)
+
+static void ymtHistogram(yMetricsText* t, const char* prefix, const char* name, const char* help, int kind, yMetricsEntry* entries, int count, int histofs)
+{
+	int i, b;
+
+	ymtHeader(t, prefix, name, "histogram", help);
+	for (i = 0; i < count; i++)
+	{
+		yMetricsHistogram* h = (yMetricsHistogram*)((u8*)&entries[i] + histofs);
+		u64 cumul = 0;
+		if (entries[i].kind != kind)
+			continue;
+		for (b = 0; b < YMETRICS_NB_BUCKETS; b++)
+		{
+			cumul += h->buckets[b];
+			ymtPrintf(t, "yapi_%s_%s_bucket", prefix, name);
+			ymtLabels(t, &entries[i]);
+			if (b < YMETRICS_NB_BUCKETS - 1)
+			{
+				ymtPrintf(t, ",le=\"%u.%06u\"} %" FMTu64 "\n", ymetricsBounds[b] / 1000000, ymetricsBounds[b] % 1000000, cumul);
+			}
+			else
+			{
+				ymtPrintf(t, ",le=\"+Inf\"} %" FMTu64 "\n", cumul);
+			}
+		}
+		ymtPrintf(t, "yapi_%s_%s_sum", prefix, name);
+		ymtLabels(t, &entries[i]);
+		ymtPrintf(t, "} %u.%06u\n", (u32)(h->sumUs / 1000000), (u32)(h->sumUs % 1000000));
+		ymtPrintf(t, "yapi_%s_%s_count", prefix, name);
+		ymtLabels(t, &entries[i]);
+		ymtPrintf(t, "} %" FMTu64 "\n", h->count);
+	}
+}
+
+// render all metrics in Prometheus text exposition format, returns the text length
+int ymetricsRender(char** text)
+{
+	yMetricsText t;
+	yMetricsEntry* entries;
+	int i, count, kind, pass;
+	const char* prefix;
+
+	memset(&t, 0, sizeof(t));
+	*text = NULL;
+	count = ymetricsGet(NULL, 0);
+	if (count == 0)
+		return 0;
+	entries = (yMetricsEntry*)yMalloc(count * sizeof(yMetricsEntry));
+	i = ymetricsGet(entries, count);
+	if (i < count)
+	{
+		count = i;
+	}
+	ymtPrintf(&t, "# HELP yapi_event_queue_depth Events waiting to be processed by HandleEvents.\n"
+	              "# TYPE yapi_event_queue_depth gauge\nyapi_event_queue_depth %u\n", entries[0].queueDepth);
+	ymtPrintf(&t, "# HELP yapi_event_queue_max_depth Largest number of events seen waiting for HandleEvents.\n"
+	              "# TYPE yapi_event_queue_max_depth gauge\nyapi_event_queue_max_depth %u\n", entries[0].queueMaxDepth);
+	for (pass = 0; pass < 2; pass++)
+	{
+		kind = (pass == 0 ? YMETRICS_HUB : YMETRICS_DEVICE);
+		prefix = (pass == 0 ? "hub" : "device");
+		YMT_COUNTER("requests_total", requests, "Requests completed.");
+		YMT_COUNTER("request_errors_total", requestErrors, "Requests completed with an error.");
+		YMT_COUNTER("sent_bytes_total", bytesSent, "Request bytes sent.");
+		YMT_COUNTER("received_bytes_total", bytesReceived, "Reply bytes received.");
+		YMT_COUNTER("notifications_total", notifications, "Value and timed report notifications received.");
+		ymtHistogram(&t, prefix, "request_duration_seconds", "Time from request open to completion.", kind, entries, count,
+		             (int)((u8*)&entries[0].latency - (u8*)&entries[0]));
+		if (pass == 0)
+		{
+			YMT_COUNTER("reconnects_total", reconnects, "Connection retries to the hub.");
+			YMT_COUNTER("ws_frames_total", wsFrames, "WebSocket frames sent to the hub.");
+			YMT_COUNTER("ws_writes_total", wsWrites, "Socket writes used to send the WebSocket frames.");
+			ymtHistogram(&t, prefix, "ws_queue_delay_seconds", "Time from the first WebSocket frame queued to the socket write.", kind, entries, count,
+			             (int)((u8*)&entries[0].wsQueueDelay - (u8*)&entries[0]));
+		}
+		else
+		{
+			ymtHistogram(&t, prefix, "callback_duration_seconds", "Execution time of user value and timed report callbacks.", kind, entries, count,
+			             (int)((u8*)&entries[0].callbacks - (u8*)&entries[0]));
+			ymtHeader(&t, prefix, "usb_queue_depth", "gauge", "USB packets waiting in the device receive queue.");
+			for (i = 0; i < count; i++)
+			{
+				if (entries[i].kind != kind || entries[i].queueMaxDepth == 0)
+					continue;
+				ymtPrintf(&t, "yapi_device_usb_queue_depth");
+				ymtLabels(&t, &entries[i]);
+				ymtPrintf(&t, "} %u\n", entries[i].queueDepth);
+			}
+			ymtHeader(&t, prefix, "usb_queue_max_depth", "gauge", "Largest number of USB packets seen in the device receive queue.");
+			for (i = 0; i < count; i++)
+			{
+				if (entries[i].kind != kind || entries[i].queueMaxDepth == 0)
+					continue;
+				ymtPrintf(&t, "yapi_device_usb_queue_max_depth");
+				ymtLabels(&t, &entries[i]);
+				ymtPrintf(&t, "} %u\n", entries[i].queueMaxDepth);
+			}
+		}
+	}
+	yFree(entries);
+	*text = t.buf;
+	return t.len;
+}
+
+
 #ifdef __BORLANDC__
 #pragma argsused
 int sprintf_s(char *buffer,size_t sizeOfBuffer,const char *format,...)
@@ -1013,6 +2014,10 @@ static YRETCODE yPktQueuePushEx(pktQueue* q, const USB_Packet* pkt, char* errmsg
 			//dbglog("%X:yPktQueuePush a pkt\n",q);
 		}
 		q->count++;
+		if (q->count > q->maxCount)
+		{
+			q->maxCount = q->count;
+		}
 		q->totalPush++;
 	}
 	ySetEvent(&q->notEmptyEvent);
@@ -2708,6 +3713,7 @@ int yUsbIdle(void)
 							}
 							// since we empty the fifo at each request we can use yPeekContinuousFifo
 							len = yPeekContinuousFifo(&p->http_fifo, &ptr, 0);
+							ymetricsRequest(yHashTestStr(p->infos.serial), p->pendingIO.metricsStart, p->pendingIO.metricsSent, len, YAPI_SUCCESS);
 							p->pendingIO.callback(p->pendingIO.context, ptr, len, YAPI_SUCCESS, NULL);
 							yFifoEmpty(&p->http_fifo);
 							p->httpstate = YHTTP_CLOSED;
@@ -2800,6 +3806,7 @@ int yUsbOpen(YIOHDL_internal* ioghdl, const char* device, char* errmsg)
 	p->pendingIO.hdl = ioghdl->hdl = ++(yContext->io_counter);
 	yLeaveCriticalSection(&yContext->io_cs);
 	p->pendingIO.timeout = YIO_DEFAULT_USB_TIMEOUT + yapiGetTickCount();
+	p->pendingIO.metricsStart = ymetricsTime();
 	res = devPauseIO(PUSH_LOCATION p, errmsg);
 	YPERF_LEAVE(yUsbOpen);
 	return res;
@@ -2885,6 +3892,7 @@ int yUsbWrite(YIOHDL_internal* ioghdl, const char* buffer, int writelen, char* e
 			return res;
 		}
 	}
+	p->pendingIO.metricsSent += totalsend;
 
 	res = devPauseIO(PUSH_LOCATION p, errmsg);
 	if (res == YAPI_SUCCESS)
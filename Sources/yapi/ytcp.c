@@ -905,6 +905,97 @@ static int yTcpCheckReqTimeout(struct _RequestSt* req, char* errmsg)
 *******************************************************************************/
 
 
+// Takes the most recently used idle connection of the hub that is still
+// open, or returns INVALID_SOCKET. Connections that have been idle for too
+// long are closed, since the hub may drop them at any time.
+static YSOCKET yHTTPPoolGet(HubSt* hub)
+{
+	YSOCKET skt;
+	u64 since;
+
+	for (;;)
+	{
+		yEnterCriticalSection(&hub->access);
+		if (hub->http.nbIdleSkt == 0)
+		{
+			yLeaveCriticalSection(&hub->access);
+			return INVALID_SOCKET;
+		}
+		hub->http.nbIdleSkt--;
+		skt = hub->http.idleSkt[hub->http.nbIdleSkt];
+		since = hub->http.idleSince[hub->http.nbIdleSkt];
+		yLeaveCriticalSection(&hub->access);
+		if (yapiGetTickCount() - since >= NET_HUB_IDLE_SKT_TIMEOUT)
+		{
+			yTcpClose(skt);
+		}
+		else if (yTcpCheckSocketStillValid(skt, NULL) == 1)
+		{
+			// the socket has been closed otherwise
+			return skt;
+		}
+	}
+}
+
+// Gives back a keep-alive connection once its reply has been received
+static void yHTTPPoolPut(HubSt* hub, YSOCKET skt)
+{
+	YSOCKET oldest = INVALID_SOCKET;
+	int n;
+
+	yEnterCriticalSection(&hub->access);
+	n = hub->http.nbIdleSkt;
+	if (n == NET_HUB_MAX_IDLE_SKT)
+	{
+		oldest = hub->http.idleSkt[0];
+		n--;
+		memmove(hub->http.idleSkt, hub->http.idleSkt + 1, n * sizeof(YSOCKET));
+		memmove(hub->http.idleSince, hub->http.idleSince + 1, n * sizeof(u64));
+	}
+	hub->http.idleSkt[n] = skt;
+	hub->http.idleSince[n] = yapiGetTickCount();
+	hub->http.nbIdleSkt = n + 1;
+	yLeaveCriticalSection(&hub->access);
+	if (oldest != INVALID_SOCKET)
+	{
+		yTcpClose(oldest);
+	}
+}
+
+void yHTTPPoolFlush(HubSt* hub)
+{
+	int i;
+
+	yEnterCriticalSection(&hub->access);
+	for (i = 0; i < hub->http.nbIdleSkt; i++)
+	{
+		yTcpClose(hub->http.idleSkt[i]);
+	}
+	hub->http.nbIdleSkt = 0;
+	yLeaveCriticalSection(&hub->access);
+}
+
+// Tells if the request can be sent again when its connection has been
+// dropped: hub commands are GET requests with parameters, so only plain
+// GET requests without any query string are safe to repeat.
+static int yHTTPReqCanResend(struct _RequestSt* req)
+{
+	const char* p;
+
+	if (YSTRNCMP(req->headerbuf, "GET ", 4) != 0)
+	{
+		return 0;
+	}
+	for (p = req->headerbuf + 4; *p && *p != ' ' && *p != '\r'; p++)
+	{
+		if (*p == '?')
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
 // access mutex taken by caller
 static int yHTTPOpenReqEx(struct _RequestSt* req, u64 mstimout, char* errmsg)
 {
@@ -934,7 +1025,7 @@ static int yHTTPOpenReqEx(struct _RequestSt* req, u64 mstimout, char* errmsg)
 		TCPLOG("yTcpOpenReqEx error%p[%x]\n", req, req->http.skt);
 		return res;
 	}
-	TCPLOG("yTcpOpenReqEx %p [%x:%x %d]\n", req, req->http.skt, req->http.reuseskt, mstimout);
+	TCPLOG("yTcpOpenReqEx %p [%x %d]\n", req, req->http.skt, mstimout);
 
 	req->replypos = -1; // not ready to consume until header found
 	req->replysize = 0;
@@ -942,14 +1033,12 @@ static int yHTTPOpenReqEx(struct _RequestSt* req, u64 mstimout, char* errmsg)
 	req->errcode = YAPI_SUCCESS;
 
 
-	if (req->http.reuseskt != INVALID_SOCKET && (res = yTcpCheckSocketStillValid(req->http.reuseskt, NULL)) == 1)
+	// reuse a keep-alive connection to the hub if any, whatever the device
+	req->http.skt = yHTTPPoolGet(req->hub);
+	req->flags |= TCPREQ_REUSED;
+	if (req->http.skt == INVALID_SOCKET)
 	{
-		req->http.skt = req->http.reuseskt;
-		req->http.reuseskt = INVALID_SOCKET;
-	}
-	else
-	{
-		req->http.reuseskt = INVALID_SOCKET;
+		req->flags &= ~TCPREQ_REUSED;
 		res = yTcpOpen(&req->http.skt, ip, port, mstimout, errmsg);
 		if (YISERR(res))
 		{
@@ -1059,10 +1148,12 @@ static void yHTTPCloseReqEx(struct _RequestSt* req, int canReuseSocket)
 		u8* ptr = req->replybuf + req->replypos;
 		if (req->errcode == YAPI_NO_MORE_DATA)
 		{
+			ymetricsRequest(req->metricsSerial, req->metricsStart, req->metricsSent, len, YAPI_SUCCESS);
 			req->callback(req->context, ptr, len, YAPI_SUCCESS, "");
 		}
 		else
 		{
+			ymetricsRequest(req->metricsSerial, req->metricsStart, req->metricsSent, len, req->errcode);
 			req->callback(req->context, ptr, len, req->errcode, req->errmsg);
 		}
 		req->callback = NULL;
@@ -1074,7 +1165,7 @@ static void yHTTPCloseReqEx(struct _RequestSt* req, int canReuseSocket)
 	{
 		if (canReuseSocket)
 		{
-			req->http.reuseskt = req->http.skt;
+			yHTTPPoolPut(req->hub, req->http.skt);
 		}
 		else
 		{
@@ -1172,7 +1263,31 @@ static int yHTTPMultiSelectReq(struct _RequestSt** reqs, int size, u64 ms, WakeU
 				//dbglog("check %x:%x:%X\n", check, check2, size);
 
 				req->read_tm = yapiGetTickCount();
-				if (res < 0)
+				if (res < 0 && req->replysize == 0 && (req->flags & TCPREQ_REUSED))
+				{
+					// the hub has dropped the idle connection, so have probably the
+					// other idle ones
+					TCPLOG("yHTTPSelectReq %p[%x] keep-alive connection dropped\n",req,req->http.skt);
+					yTcpClose(req->http.skt);
+					req->http.skt = INVALID_SOCKET;
+					yHTTPPoolFlush(req->hub);
+					if (yHTTPReqCanResend(req))
+					{
+						// send it again on a new one
+						req->errcode = yHTTPOpenReqEx(req, req->timeout_tm, req->errmsg);
+					}
+					else
+					{
+						// the hub may have executed the command before closing
+						req->replypos = 0;
+						req->errcode = YERRMSGTO(YAPI_IO_ERROR, "Keep-alive connection closed by the hub before the reply", req->errmsg);
+					}
+					if (YISERR(req->errcode))
+					{
+						yHTTPCloseReqEx(req, 0);
+					}
+				}
+				else if (res < 0)
 				{
 					// any connection closed by peer ends up with YAPI_NO_MORE_DATA
 					req->replypos = 0;
@@ -1317,9 +1432,15 @@ static int yWSOpenReqEx(struct _RequestSt* req, int tcpchan, u64 mstimeout, char
 		yLeaveCriticalSection(&hub->access);
 	}
 	req->ws.channel = tcpchan;
+	req->ws.replyHint = 0;
+	req->ws.replyReceived = 0;
 	req->timeout_tm = mstimeout;
 	//WSLOG("req(%s:%p): open req chan=%d timeout=%dms asyncId=%d\n", req->hub->name, req, tcpchan, (int)mstimeout, req->ws.asyncId);
 	YASSERT(tcpchan < MAX_ASYNC_TCPCHAN);
+	// the request must be open before the WS thread can send it: a local
+	// hub may reply before we return to yReqOpen
+	yResetEvent(&req->finished);
+	req->state = REQ_OPEN;
 	yEnterCriticalSection(&hub->ws.chan[tcpchan].access);
 	req->ws.next = NULL; // just in case
 	if (hub->ws.chan[tcpchan].requests)
@@ -1337,7 +1458,10 @@ static int yWSOpenReqEx(struct _RequestSt* req, int tcpchan, u64 mstimeout, char
 	}
 	yLeaveCriticalSection(&hub->ws.chan[tcpchan].access);
 	req->write_tm = yapiGetTickCount();
-	return yDringWakeUpSocket(&hub->wuce, 1, errmsg);
+	// the request is queued and will complete (and call its callback) even
+	// if the WS thread cannot be woken up right now, so it is not an error
+	yDringWakeUpSocket(&hub->wuce, 1, errmsg);
+	return YAPI_SUCCESS;
 }
 
 
@@ -1376,10 +1500,12 @@ static void yWSCloseReqEx(struct _RequestSt* req, int takeCS)
 		ptr = req->replybuf + req->replypos;
 		if (req->errcode == YAPI_NO_MORE_DATA)
 		{
+			ymetricsRequest(req->metricsSerial, req->metricsStart, req->metricsSent, len, YAPI_SUCCESS);
 			req->callback(req->context, ptr, len, YAPI_SUCCESS, "");
 		}
 		else
 		{
+			ymetricsRequest(req->metricsSerial, req->metricsStart, req->metricsSent, len, req->errcode);
 			req->callback(req->context, ptr, len, req->errcode, req->errmsg);
 		}
 		req->callback = NULL;
@@ -1467,7 +1593,7 @@ static void dumpTCPReq(const char *fileid, int lineno, struct _RequestSt *req)
         case PROTO_WEBSOCKET: proto ="PROTO_WEBSOCKET"; break;
         default: proto ="unk"; break;
     }
-    dbglog("proto=%s socket=%x (reuse=%x) flags=%x\n", proto, req->http.skt, req->http.reuseskt, req->flags);
+    dbglog("proto=%s socket=%x flags=%x\n", proto, req->http.skt, req->flags);
     dbglog("time open=%"FMTx64" last read=%"FMTx64" last write=%"FMTx64"  timeout=%"FMTx64"\n", req->open_tm, req->read_tm, req->write_tm, req->timeout_tm);
     dbglog("readed=%d (readpos=%d)\n", req->replysize, req->replysize);
     dbglog("callback=%p context=%p\n", req->callback, req->context);
@@ -1497,11 +1623,11 @@ struct _RequestSt* yReqAlloc(struct _HubSt* hub)
 	yInitializeCriticalSection(&req->access);
 	yCreateManualEvent(&req->finished, 1);
 	req->hub = hub;
+	req->metricsSerial = INVALID_HASH_IDX;
 	switch (req->proto)
 	{
 	case PROTO_AUTO:
 	case PROTO_HTTP:
-		req->http.reuseskt = INVALID_SOCKET;
 		req->http.skt = INVALID_SOCKET;
 		break;
 	case PROTO_WEBSOCKET:
@@ -1613,6 +1739,8 @@ int yReqOpen(struct _RequestSt* req, int wait_for_start, int tcpchan, const char
 	req->progressCtx = progress_ctx;
 	req->read_tm = req->write_tm = req->open_tm = yapiGetTickCount();
 	req->timeout_tm = mstimeout;
+	req->metricsStart = ymetricsTime();
+	req->metricsSent = reqlen + req->bodysize;
 
 
 	// Really build and send the request
@@ -1628,8 +1756,11 @@ int yReqOpen(struct _RequestSt* req, int wait_for_start, int tcpchan, const char
 	{
 		req->errmsg[0] = '\0';
 		req->flags |= TCPREQ_IN_USE;
-		yResetEvent(&req->finished);
-		req->state = REQ_OPEN;
+		if (req->proto == PROTO_AUTO || req->proto == PROTO_HTTP)
+		{
+			yResetEvent(&req->finished);
+			req->state = REQ_OPEN;
+		}
 	}
 
 	yLeaveCriticalSection(&req->access);
@@ -1809,10 +1940,6 @@ void yReqFree(struct _RequestSt* req)
 		{
 			yTcpClose(req->http.skt);
 		}
-		if (req->http.reuseskt != INVALID_SOCKET)
-		{
-			yTcpClose(req->http.reuseskt);
-		}
 	}
 	else
 	{
@@ -1847,6 +1974,11 @@ int yReqHasPending(struct _HubSt* hub)
 	else
 	{
 		int tcpchan;
+		// channel locks only exist while the base socket is open
+		if (hub->state != NET_HUB_ESTABLISHED)
+		{
+			return 0;
+		}
 		for (tcpchan = 0; tcpchan < MAX_ASYNC_TCPCHAN; tcpchan++)
 		{
 			yEnterCriticalSection(&hub->ws.chan[tcpchan].access);
@@ -2037,6 +2169,56 @@ static int VerifyWebsocketKey(const char* data, u16 hdrlen, const char* referenc
 #define WS_MAX_DATA_LEN  124
 
 
+/*
+*   write all queued frames to the hub in a single send
+*/
+static int ws_flushFrames(HubSt* hub, char* errmsg)
+{
+	int res;
+#ifdef DEBUG_SLOW_TCP
+    u64 start = yapiGetTickCount();
+#endif
+
+	if (hub->ws.outqlen == 0)
+	{
+		return YAPI_SUCCESS;
+	}
+	res = yTcpWrite(hub->ws.skt, (char*)hub->ws.outq, hub->ws.outqlen, errmsg);
+#ifdef DEBUG_SLOW_TCP
+    u64 delta = yapiGetTickCount() - start;
+    if (delta > 10) {
+        dbglog("WS: yTcpWrite took %"FMTu64"ms (%d frames, %d bytes, res=%d)\n", delta, hub->ws.outqframes, hub->ws.outqlen, res);
+    }
+#endif
+	if (!YISERR(res))
+	{
+		ymetricsWsFlush(hub, hub->ws.outqframes, ymetricsTime() - hub->ws.outqstart);
+	}
+	hub->ws.outqlen = 0;
+	hub->ws.outqframes = 0;
+	return res;
+}
+
+/*
+*   append an encoded frame to the output queue, which is written by
+*   ws_flushFrames before ws_thread waits for the socket again
+*/
+static int ws_queueFrame(HubSt* hub, const u8* frame, int len, char* errmsg)
+{
+	if (hub->ws.outqlen + len > WS_OUTQ_SIZE)
+	{
+		YPROPERR(ws_flushFrames(hub, errmsg));
+	}
+	if (hub->ws.outqlen == 0)
+	{
+		hub->ws.outqstart = ymetricsTime();
+	}
+	memcpy(hub->ws.outq + hub->ws.outqlen, frame, len);
+	hub->ws.outqlen += len;
+	hub->ws.outqframes++;
+	return YAPI_SUCCESS;
+}
+
 /*
 *   send Websocket frame for a hub
 */
@@ -2047,10 +2229,6 @@ static int ws_sendFrame(HubSt* hub, int stream, int tcpchan, const u8* data, int
 	int i;
 	WSStreamHead strym;
 	u8* p = (u8*)buffer_32;
-#ifdef DEBUG_SLOW_TCP
-    u64 start = yapiGetTickCount();
-#endif
-	int tcp_write_res;
 
 	YASSERT(datalen <= WS_MAX_DATA_LEN);
 #ifdef DEBUG_WEBSOCKET
@@ -2083,14 +2261,7 @@ static int ws_sendFrame(HubSt* hub, int stream, int tcpchan, const u8* data, int
 			buffer_32[i + 2] ^= mask;
 		}
 	}
-	tcp_write_res = yTcpWrite(hub->ws.skt, (char*)p, datalen + 7, errmsg);
-#ifdef DEBUG_SLOW_TCP
-    u64 delta = yapiGetTickCount() - start;
-    if (delta > 10) {
-        dbglog("WS: yTcpWrite took %"FMTu64"ms (stream=%d chan=%d res=%d)\n", delta, strym.stream, strym.tcpchan, tcp_write_res);
-    }
-#endif
-	return tcp_write_res;
+	return ws_queueFrame(hub, p, datalen + 7, errmsg);
 }
 
 /*
@@ -2127,22 +2298,93 @@ static int ws_sendAuthenticationMeta(HubSt* hub, char* errmsg)
 	return ws_sendFrame(hub,YSTREAM_META, 0, (const u8*)&meta_out, USB_META_WS_AUTHENTICATION_SIZE, errmsg);
 }
 
+// Looks for the Content-Length of the reply once its header has been
+// received, so that the reply buffer can be sized at once
+static void ws_parseReplyHint(RequestSt* req, int newlen)
+{
+	const char* p = (const char*)req->replybuf;
+	int len = req->replysize;
+	int start = req->replysize - newlen - 3;
+	int i, hdrlen = 0;
+
+	if (start < 0)
+	{
+		start = 0;
+	}
+	for (i = start; i + 4 <= len; i++)
+	{
+		if (p[i] == '\r' && p[i + 1] == '\n' && p[i + 2] == '\r' && p[i + 3] == '\n')
+		{
+			hdrlen = i + 4;
+			break;
+		}
+	}
+	if (hdrlen == 0)
+	{
+		// header not yet complete, give up if it is unexpectedly long
+		if (req->ws.replyReceived >= 2048 || req->ws.replyReceived > req->replysize)
+		{
+			req->ws.replyHint = -1;
+		}
+		return;
+	}
+	req->ws.replyHint = -1;
+	if (req->ws.replyReceived > req->replysize)
+	{
+		// the beginning of the reply has already been read
+		return;
+	}
+	for (i = 0; i + 16 < hdrlen; i++)
+	{
+		if (p[i] == '\n' && YSTRNICMP(p + i + 1, "Content-Length:", 15) == 0)
+		{
+			int contentlen = atoi(p + i + 16);
+			if (contentlen > 0)
+			{
+				// do not trust the header for more than a few MB, the buffer
+				// keeps growing geometrically beyond
+				if (contentlen > WS_MAX_REPLY_HINT)
+				{
+					contentlen = WS_MAX_REPLY_HINT;
+				}
+				req->ws.replyHint = hdrlen + contentlen;
+			}
+			break;
+		}
+	}
+}
+
 static void ws_appendTCPData(RequestSt* req, u8* buffer, int pktlen, int isClose)
 {
 	if (pktlen)
 	{
 		if (req->replybufsize < req->replysize + pktlen)
 		{
+			// grow geometrically, or at once to the announced reply size
 			u8* newbuff;
-			req->replybufsize <<= 1;
-			newbuff = yMalloc(req->replybufsize);
+			int newsize = req->replybufsize << 1;
+			if (req->ws.replyHint > 0 && newsize < req->replysize + req->ws.replyHint - req->ws.replyReceived)
+			{
+				newsize = req->replysize + req->ws.replyHint - req->ws.replyReceived;
+			}
+			if (newsize < req->replysize + pktlen)
+			{
+				newsize = req->replysize + pktlen;
+			}
+			newbuff = yMalloc(newsize);
 			memcpy(newbuff, req->replybuf, req->replysize);
 			yFree(req->replybuf);
 			req->replybuf = newbuff;
+			req->replybufsize = newsize;
 		}
 
 		memcpy(req->replybuf + req->replysize, buffer, pktlen);
 		req->replysize += pktlen;
+		req->ws.replyReceived += pktlen;
+		if (req->ws.replyHint == 0)
+		{
+			ws_parseReplyHint(req, pktlen);
+		}
 	}
 	req->read_tm = yapiGetTickCount();
 	if (isClose)
@@ -2151,8 +2393,12 @@ static void ws_appendTCPData(RequestSt* req, u8* buffer, int pktlen, int isClose
 		ySetEvent(&req->finished);
 		if (req->callback != NULL)
 		{
-			// async request are automaticaly closed
+			// async request are automaticaly closed. yReqOpen holds req->access
+			// until it has finished with the request, so close it under the same
+			// lock before releasing it
+			yEnterCriticalSection(&req->access);
 			yWSCloseReqEx(req, 0);
+			yLeaveCriticalSection(&req->access);
 			yReqFree(req);
 		}
 	}
@@ -2193,6 +2439,7 @@ static int ws_parseIncommingFrame(HubSt* hub, u8* buffer, int pktlen, char* errm
 #endif
 			yPushFifo(&hub->not_fifo, buffer, pktlen);
 			while (handleNetNotification(hub));
+			ySignalPendingEvents();
 		}
 		break;
 	case YSTREAM_EMPTY:
@@ -2323,6 +2570,7 @@ static int ws_parseIncommingFrame(HubSt* hub, u8* buffer, int pktlen, char* errm
 					{
 						hub->ws.base_state = WS_BASE_CONNECTED;
 						hub->state = NET_HUB_ESTABLISHED;
+						hub->connCount++;
 						hub->retryCount = 0;
 						hub->attemptDelay = 500;
 						WSLOG("hub(%s): connected as %s\n", hub->name, user);
@@ -2339,6 +2587,7 @@ static int ws_parseIncommingFrame(HubSt* hub, u8* buffer, int pktlen, char* errm
 					{
 						hub->ws.base_state = WS_BASE_CONNECTED;
 						hub->state = NET_HUB_ESTABLISHED;
+						hub->connCount++;
 						hub->retryCount = 0;
 						hub->attemptDelay = 500;
 						WSLOG("hub(%s): connected\n",hub->name);
@@ -2649,7 +2898,7 @@ static int ws_openBaseSocket(struct _WSNetHubSt* hub, yUrlRef url, const char* r
 	u16 port;
 	yAsbUrlProto proto;
 	yStrRef user, pass;
-	int res, tcpchan;
+	int res, tcpchan, len;
 
 	memset(hub, 0, sizeof(WSNetHub));
 	hub->skt = INVALID_SOCKET;
@@ -2674,6 +2923,12 @@ static int ws_openBaseSocket(struct _WSNetHubSt* hub, yUrlRef url, const char* r
 	{
 		return YERRMSG(YAPI_IO_ERROR, "not a websocket url");
 	}
+	// the upgrade request is written from outq in a single send
+	hub->websocket_key_len = GenereateWebSockeyKey((u8*)request, request_len, hub->websocket_key);
+	if (request_len + YSTRLEN(ws_header_start) + hub->websocket_key_len + YSTRLEN(ws_header_end) > WS_OUTQ_SIZE)
+	{
+		return YERRMSG(YAPI_INVALID_ARGUMENT, "websocket request too long");
+	}
 
 	res = yTcpOpen(&hub->skt, ip, port, mstimout, errmsg);
 	if (YISERR(res))
@@ -2687,17 +2942,17 @@ static int ws_openBaseSocket(struct _WSNetHubSt* hub, yUrlRef url, const char* r
 	hub->bws_timeout_tm = mstimout;
 	hub->user = user;
 	hub->pass = pass;
-	//write header
-
-
-	res = yTcpWrite(hub->skt, request, request_len, errmsg);
-	if (YISERR(res))
-	{
-		yTcpClose(hub->skt);
-		hub->skt = INVALID_SOCKET;
-		return res;
-	}
-	res = yTcpWrite(hub->skt, ws_header_start, YSTRLEN(ws_header_start), errmsg);
+	//write header in a single send
+	len = 0;
+	memcpy(hub->outq + len, request, request_len);
+	len += request_len;
+	memcpy(hub->outq + len, ws_header_start, YSTRLEN(ws_header_start));
+	len += YSTRLEN(ws_header_start);
+	memcpy(hub->outq + len, hub->websocket_key, hub->websocket_key_len);
+	len += hub->websocket_key_len;
+	memcpy(hub->outq + len, ws_header_end, YSTRLEN(ws_header_end));
+	len += YSTRLEN(ws_header_end);
+	res = yTcpWrite(hub->skt, (char*)hub->outq, len, errmsg);
 	if (YISERR(res))
 	{
 		yTcpClose(hub->skt);
@@ -2705,25 +2960,7 @@ static int ws_openBaseSocket(struct _WSNetHubSt* hub, yUrlRef url, const char* r
 		return res;
 	}
 
-	hub->websocket_key_len = GenereateWebSockeyKey((u8*)request, request_len, hub->websocket_key);
-	res = yTcpWrite(hub->skt, hub->websocket_key, hub->websocket_key_len, errmsg);
-	if (YISERR(res))
-	{
-		yTcpClose(hub->skt);
-		hub->skt = INVALID_SOCKET;
-		return res;
-	}
-
-	res = yTcpWrite(hub->skt, ws_header_end, YSTRLEN(ws_header_end), errmsg);
-	if (YISERR(res))
-	{
-		yTcpClose(hub->skt);
-		hub->skt = INVALID_SOCKET;
-		return res;
-	}
-
-	hub->fifo_buffer = yMalloc(2048);
-	yFifoInit(&hub->mainfifo, hub->fifo_buffer, 2048);
+	hub->inbuf = yMalloc(WS_INBUF_SIZE);
 	for (tcpchan = 0; tcpchan < MAX_ASYNC_TCPCHAN; tcpchan++)
 	{
 		yInitializeCriticalSection(&hub->chan[tcpchan].access);
@@ -2744,8 +2981,40 @@ static void ws_closeBaseSocket(struct _WSNetHubSt* base_req)
 	{
 		yDeleteCriticalSection(&base_req->chan[tcpchan].access);
 	}
-	yFifoCleanup(&base_req->mainfifo);
-	yFree(base_req->fifo_buffer);
+	yFree(base_req->inbuf);
+	base_req->inbuf = NULL;
+}
+
+
+/*
+*   returns the position of a pattern in the incoming data not yet consumed, or -1
+*/
+static int ws_seekInput(struct _WSNetHubSt* base_req, const char* pattern, int len)
+{
+	const u8* p = base_req->inbuf + base_req->inhead;
+	int avail = base_req->intail - base_req->inhead;
+	int i;
+
+	for (i = 0; i + len <= avail; i++)
+	{
+		if (p[i] == (u8)pattern[0] && memcmp(p + i, pattern, len) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+*   consumes incoming data, copying it to buffer if not NULL
+*/
+static void ws_popInput(struct _WSNetHubSt* base_req, u8* buffer, int len)
+{
+	if (buffer)
+	{
+		memcpy(buffer, base_req->inbuf + base_req->inhead, len);
+	}
+	base_req->inhead += len;
 }
 
 
@@ -2807,19 +3076,26 @@ static int ws_thread_select(struct _WSNetHubSt* base_req, u64 ms, WakeUpSocket*
 		}
 		if (FD_ISSET(base_req->skt, &fds))
 		{
-			int avail = yFifoGetFree(&base_req->mainfifo);
+			int avail;
 			int readed = 0;
-			if (avail)
+			// move the beginning of an incomplete frame back to the start of
+			// the buffer, everything before has been consumed
+			if (base_req->inhead > 0)
 			{
-				u8 buffer[2048];
-				if (avail > 2048)
+				base_req->intail -= base_req->inhead;
+				if (base_req->intail > 0)
 				{
-					avail = 2048;
+					memmove(base_req->inbuf, base_req->inbuf + base_req->inhead, base_req->intail);
 				}
-				readed = yTcpRead(base_req->skt, buffer, avail, errmsg);
+				base_req->inhead = 0;
+			}
+			avail = WS_INBUF_SIZE - base_req->intail;
+			if (avail)
+			{
+				readed = yTcpRead(base_req->skt, base_req->inbuf + base_req->intail, avail, errmsg);
 				if (readed > 0)
 				{
-					yPushFifo(&base_req->mainfifo, buffer, readed);
+					base_req->intail += readed;
 				}
 			}
 			return readed;
@@ -2835,6 +3111,7 @@ static void ws_threadUpdateRetryCount(HubSt* hub)
 	if (hub->attemptDelay > 8000)
 		hub->attemptDelay = 8000;
 	hub->retryCount++;
+	ymetricsReconnect(hub);
 #ifdef DEBUG_WEBSOCKET
     dbglog("hub(%s): IO error on ws_thread:(%d) %s\n", hub->name, hub->errcode, hub->errmsg);
     dbglog("hub(%s): retry in %dms (%d retries)\n", hub->name, hub->attemptDelay, hub->retryCount);
@@ -2928,20 +3205,21 @@ void* ws_thread(void* ctx)
 			if (res > 0)
 			{
 				int need_more_data = 0;
-				int avail, rw;
+				int avail;
 				int hdrlen;
+				u8 *frame, *payload;
 				u32 mask;
 				int websocket_ok = 0;
 				int pktlen;
 				do
 				{
-					u16 pos;
+					int pos;
 					//something to handle;
 					switch (hub->ws.base_state)
 					{
 					case WS_BASE_HEADER_SENT:
-						pos = ySeekFifo(&hub->ws.mainfifo, (const u8*)"\r\n\r\n", 4, 0, 0, 0);
-						if (pos == 0xffff)
+						pos = ws_seekInput(&hub->ws, "\r\n\r\n", 4);
+						if (pos < 0)
 						{
 							if ((u64)(yapiGetTickCount() - hub->lastAttempt) > WS_CONNEXION_TIMEOUT)
 							{
@@ -2960,8 +3238,8 @@ void* ws_thread(void* ctx)
 							hub->state = NET_HUB_TOCLOSE;
 							break;
 						}
-						pos = ySeekFifo(&hub->ws.mainfifo, (const u8*)"\r\n", 2, 0, 0, 0);
-						yPopFifo(&hub->ws.mainfifo, (u8*)buffer, pos + 2);
+						pos = ws_seekInput(&hub->ws, "\r\n", 2);
+						ws_popInput(&hub->ws, (u8*)buffer, pos + 2);
 						if (YSTRNCMP(buffer, "HTTP/1.1 ", 9) != 0)
 						{
 							res = YERRMSG(YAPI_IO_ERROR, "Bad reply header");
@@ -2978,10 +3256,10 @@ void* ws_thread(void* ctx)
 							break;
 						}
 						websocket_ok = 0;
-						pos = ySeekFifo(&hub->ws.mainfifo, (const u8*)"\r\n", 2, 0, 0, 0);
+						pos = ws_seekInput(&hub->ws, "\r\n", 2);
 						while (pos != 0)
 						{
-							yPopFifo(&hub->ws.mainfifo, (u8*)buffer, pos + 2);
+							ws_popInput(&hub->ws, (u8*)buffer, pos + 2);
 							if (pos > 22 && YSTRNICMP(buffer, "Sec-WebSocket-Accept: ", 22) == 0)
 							{
 								if (!VerifyWebsocketKey(buffer + 22, pos, hub->ws.websocket_key, hub->ws.websocket_key_len))
@@ -3001,9 +3279,9 @@ void* ws_thread(void* ctx)
 								res = YERR(YAPI_TIMEOUT);
 								break;
 							}
-							pos = ySeekFifo(&hub->ws.mainfifo, (const u8*)"\r\n", 2, 0, 0, 0);
+							pos = ws_seekInput(&hub->ws, "\r\n", 2);
 						}
-						yPopFifo(&hub->ws.mainfifo, NULL, 2);
+						ws_popInput(&hub->ws, NULL, 2);
 						if (websocket_ok)
 						{
 							hub->ws.base_state = WS_BASE_SOCKET_UPGRADED;
@@ -3020,15 +3298,15 @@ void* ws_thread(void* ctx)
 					case WS_BASE_AUTHENTICATING:
 					case WS_BASE_CONNECTED:
 
-						avail = yFifoGetUsed(&hub->ws.mainfifo);
+						avail = hub->ws.intail - hub->ws.inhead;
 						if (avail < 2)
 						{
 							need_more_data = 1;
 							break;
 						}
-						rw = (avail < 7 ? avail : 7);
-						yPeekFifo(&hub->ws.mainfifo, header, rw, 0);
-						pktlen = header[1] & 0x7f;
+						// the frame is decoded where it has been received
+						frame = hub->ws.inbuf + hub->ws.inhead;
+						pktlen = frame[1] & 0x7f;
 						if (pktlen > 125)
 						{
 							// Unsupported long frame, drop all incoming data (probably 1+ frame(s))
@@ -3036,7 +3314,7 @@ void* ws_thread(void* ctx)
 							break;
 						}
 
-						if (header[1] & 0x80)
+						if (frame[1] & 0x80)
 						{
 							// masked frame
 							hdrlen = 6;
@@ -3045,7 +3323,7 @@ void* ws_thread(void* ctx)
 								need_more_data = 1;
 								break;
 							}
-							memcpy(&mask, header + 2, sizeof(u32));
+							memcpy(&mask, frame + 2, sizeof(u32));
 						}
 						else
 						{
@@ -3058,11 +3336,12 @@ void* ws_thread(void* ctx)
 							}
 							mask = 0;
 						}
+						hub->ws.inhead += hdrlen + pktlen;
 
-						if ((header[0] & 0x7f) != 0x02)
+						if ((frame[0] & 0x7f) != 0x02)
 						{
 							// Non-data frame
-							if (header[0] == 0x88)
+							if (frame[0] == 0x88)
 							{
 								//if (USBTCPIsPutReady(sock) < 8) return;
 								// websocket close, reply with a close
@@ -3072,7 +3351,12 @@ void* ws_thread(void* ctx)
 								memcpy(header + 2, &mask, sizeof(u32));
 								header[6] = 0x03 ^ ((u8 *)&mask)[0];
 								header[7] = 0xe8 ^ ((u8 *)&mask)[1];
-								res = yTcpWrite(hub->ws.skt, (char*)header, 8, errmsg);
+								// after the frames already queued
+								res = ws_queueFrame(hub, header, 8, errmsg);
+								if (!YISERR(res))
+								{
+									res = ws_flushFrames(hub, errmsg);
+								}
 								if (YISERR(res))
 								{
 									break;
@@ -3085,40 +3369,47 @@ void* ws_thread(void* ctx)
 							else
 							{
 								// unhandled packet
-								dbglog("unhandled packet:%x%x\n", header[0], header[1]);
+								dbglog("unhandled packet:%x%x\n", frame[0], frame[1]);
 							}
-							yPopFifo(&hub->ws.mainfifo, NULL, hdrlen + pktlen);
 							break;
 						}
-						// drop frame header
-						yPopFifo(&hub->ws.mainfifo, NULL, hdrlen);
-						// append
-						yPopFifo(&hub->ws.mainfifo, (u8*)buffer + buffer_ofs, pktlen);
+						payload = frame + hdrlen;
 						if (mask)
 						{
 							int i;
-							for (i = 0; i < (pktlen + 1 + 3) >> 2; i++)
+							for (i = 0; i < pktlen; i++)
 							{
-								buffer[buffer_ofs + i] ^= mask;
+								payload[i] ^= ((u8*)&mask)[i & 3];
 							}
 						}
 
-						if (header[0] == 0x02)
+						if (frame[0] == 0x02 || buffer_ofs > 0)
 						{
-							//  fragmented binary frame
-							WSStreamHead strym;
-							strym.encaps = buffer[buffer_ofs];
-							if (strym.stream == YSTREAM_META)
+							// fragmented binary frames are gathered in a separate buffer
+							if (buffer_ofs + pktlen > (int)sizeof(buffer))
 							{
-								// unsupported fragmented META stream, should never happen
-								dbglog("Warning:fragmented META\n");
+								res = YERRMSG(YAPI_IO_ERROR, "Fragmented websocket frame too long");
 								break;
 							}
-							buffer_ofs += pktlen;
-							break;
+							memcpy(buffer + buffer_ofs, payload, pktlen);
+							if (frame[0] == 0x02)
+							{
+								WSStreamHead strym;
+								strym.encaps = buffer[buffer_ofs];
+								if (strym.stream == YSTREAM_META)
+								{
+									// unsupported fragmented META stream, should never happen
+									dbglog("Warning:fragmented META\n");
+									break;
+								}
+								buffer_ofs += pktlen;
+								break;
+							}
+							payload = (u8*)buffer;
+							pktlen += buffer_ofs;
 						}
 
-						res = ws_parseIncommingFrame(hub, (u8*)buffer, buffer_ofs + pktlen, errmsg);
+						res = ws_parseIncommingFrame(hub, payload, pktlen, errmsg);
 						if (YISERR(res))
 						{
 							WSLOG("hub(%s) ws_parseIncommingFrame error %d:%s\n", hub->name, res, errmsg);
@@ -3140,6 +3431,16 @@ void* ws_thread(void* ctx)
 					WSLOG("hub(%s) ws_processRequests error %d:%s\n", hub->name, res, errmsg);
 				}
 			}
+			if (!YISERR(res))
+			{
+				// send at once the frames queued while handling incoming
+				// frames and pending requests
+				res = ws_flushFrames(hub, errmsg);
+				if (YISERR(res))
+				{
+					WSLOG("hub(%s) ws_flushFrames error %d:%s\n", hub->name, res, errmsg);
+				}
+			}
 
 			if (YISERR(res))
 			{
@@ -119,6 +119,7 @@ int yReqRead(struct _RequestSt* rcoreq, u8* buffer, int len);
 void yReqClose(struct _RequestSt* tcpreq);
 void yReqFree(struct _RequestSt* tcpreq);
 int yReqHasPending(struct _HubSt* hub);
+void yHTTPPoolFlush(struct _HubSt* hub);
 
 
 void* ws_thread(void* ctx);
@@ -44,7 +44,7 @@
 #ifdef WINDOWS_API
 
 static DWORD yTlsBucket = TLS_OUT_OF_INDEXES;
-static DWORD yNextThreadIdx = 1;
+static volatile LONG yNextThreadIdx = 0;
 
 void yCreateEvent(yEvent* event)
 {
@@ -137,9 +137,8 @@ int yThreadIndex(void)
 	tls_ptr = TlsGetValue(yTlsBucket);
 	if (tls_ptr == 0)
 	{
-		// tiny risk of race condition, but thread idx is only
-		// used for debug log purposes and is not sensitive
-		DWORD res = yNextThreadIdx++;
+		// indexes also tell threads apart in traces, they must be unique
+		DWORD res = (DWORD)yAtomicIncrement(&yNextThreadIdx);
 		TlsSetValue(yTlsBucket, ((u8*)NULL) + res);
 		return res;
 	}
@@ -149,6 +148,55 @@ int yThreadIndex(void)
 	}
 }
 
+// Fiber local storage calls a callback when a thread ends, but it is only
+// available since Vista: older systems get a plain TLS slot without callback
+typedef DWORD (WINAPI *yFlsAllocFn)(yThreadExitCallback callback);
+typedef PVOID (WINAPI *yFlsGetValueFn)(DWORD index);
+typedef BOOL (WINAPI *yFlsSetValueFn)(DWORD index, PVOID value);
+static yFlsGetValueFn yFlsGetValue = NULL;
+static yFlsSetValueFn yFlsSetValue = NULL;
+
+int yThreadKeyCreate(yThreadKey* key, yThreadExitCallback callback)
+{
+	HMODULE kernel = GetModuleHandleA("kernel32.dll");
+	yFlsAllocFn flsAlloc = NULL;
+
+	if (kernel != NULL)
+	{
+		flsAlloc = (yFlsAllocFn)GetProcAddress(kernel, "FlsAlloc");
+		yFlsGetValue = (yFlsGetValueFn)GetProcAddress(kernel, "FlsGetValue");
+		yFlsSetValue = (yFlsSetValueFn)GetProcAddress(kernel, "FlsSetValue");
+	}
+	if (flsAlloc != NULL && yFlsGetValue != NULL && yFlsSetValue != NULL)
+	{
+		key->index = flsAlloc(callback);
+		key->useFls = 1;
+	}
+	else
+	{
+		key->index = TlsAlloc();
+		key->useFls = 0;
+	}
+	return (key->index == 0xFFFFFFFF ? -1 : 0);
+}
+
+void* yThreadKeyGet(yThreadKey* key)
+{
+	return (key->useFls ? yFlsGetValue(key->index) : TlsGetValue(key->index));
+}
+
+void yThreadKeySet(yThreadKey* key, void* value)
+{
+	if (key->useFls)
+	{
+		yFlsSetValue(key->index, value);
+	}
+	else
+	{
+		TlsSetValue(key->index, value);
+	}
+}
+
 #else
 #include <sys/time.h>
 #include <pthread.h>
@@ -156,7 +204,7 @@ int yThreadIndex(void)
 
 static pthread_once_t yInitKeyOnce = PTHREAD_ONCE_INIT;
 static pthread_key_t yTsdKey;
-static unsigned yNextThreadIdx = 1;
+static unsigned yNextThreadIdx = 0;
 
 static void initTsdKey()
 {
@@ -259,7 +307,9 @@ static void    yReleaseDetachedThreadEx(osThread *th_hdl)
 
 static int yWaitEndThread(osThread *th)
 {
-    return pthread_join(*th, NULL);
+    // threads are created detached: joining one that has already
+    // exited reads its released descriptor
+    return 0;
 }
 
 
@@ -275,14 +325,28 @@ int    yThreadIndex(void)
     pthread_once(&yInitKeyOnce, initTsdKey);
     res = (int)((u8 *)pthread_getspecific(yTsdKey) - (u8 *)NULL);
     if (!res) {
-// tiny risk of race condition, but thread idx is only
-// used for debug log purposes and is not sensitive
-        res = yNextThreadIdx++;
+        // indexes also tell threads apart in traces, they must be unique
+        res = (int)yAtomicIncrement(&yNextThreadIdx);
         pthread_setspecific(yTsdKey, (void*)((u8 *)NULL + res));
     }
     return res;
 }
 
+int yThreadKeyCreate(yThreadKey *key, yThreadExitCallback callback)
+{
+    return (pthread_key_create(key, callback) == 0 ? 0 : -1);
+}
+
+void* yThreadKeyGet(yThreadKey *key)
+{
+    return pthread_getspecific(*key);
+}
+
+void yThreadKeySet(yThreadKey *key, void *value)
+{
+    pthread_setspecific(*key, value);
+}
+
 #endif
 
 
@@ -67,6 +67,10 @@ typedef struct {
 
 #endif
 
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
 void yCreateEvent(yEvent* ev);
 void yCreateManualEvent(yEvent* event, int initialState);
 void ySetEvent(yEvent* ev);
@@ -101,9 +105,26 @@ typedef struct
 	osThread th;
 } yThread;
 
-#ifdef  __cplusplus
-extern "C" {
+/*********************************************************************
+ * THREAD-LOCAL VALUE, WITH A CALLBACK WHEN THE THREAD ENDS
+ *********************************************************************/
+#ifdef WINDOWS_API
+#define YTHREAD_EXIT_CALLBACK   WINAPI
+typedef struct
+{
+	DWORD index;
+	int useFls;
+} yThreadKey;
+#else
+#define YTHREAD_EXIT_CALLBACK
+typedef pthread_key_t yThreadKey;
 #endif
+// called with the value of each thread that ends while its value is not NULL
+typedef void (YTHREAD_EXIT_CALLBACK *yThreadExitCallback)(void* value);
+
+int yThreadKeyCreate(yThreadKey* key, yThreadExitCallback callback);
+void* yThreadKeyGet(yThreadKey* key);
+void yThreadKeySet(yThreadKey* key, void* value);
 
 int yCreateDetachedThread(void* (*fun)(void*), void* arg);
 
@@ -120,4 +141,20 @@ int yThreadIndex(void);
 }
 #endif
 
+// full memory barrier, used to publish data between lock-free producer and consumer
+#ifdef WINDOWS_API
+#define yMemoryBarrier()    MemoryBarrier()
+#else
+#define yMemoryBarrier()    __sync_synchronize()
+#endif
+
+// atomic increment/decrement of an int, returning the new value
+#ifdef WINDOWS_API
+#define yAtomicIncrement(ptr)   InterlockedIncrement((volatile LONG*)(ptr))
+#define yAtomicDecrement(ptr)   InterlockedDecrement((volatile LONG*)(ptr))
+#else
+#define yAtomicIncrement(ptr)   __sync_add_and_fetch((ptr), 1)
+#define yAtomicDecrement(ptr)   __sync_sub_and_fetch((ptr), 1)
+#endif
+
 #endif
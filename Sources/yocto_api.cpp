@@ -57,6 +57,7 @@
 #include <time.h>
 #include <stdarg.h>
 #include <math.h>
+#include <algorithm>
 #include "yapi/yproto.h"
 
 static yCRITICAL_SECTION _updateDeviceList_CS;
@@ -104,6 +105,77 @@ vector<string> _strsplit(const string& str, char delimiter)
 }
 
 
+// Size of the first arena block of a JSON document, larger documents
+// get larger blocks so that the number of blocks stays small
+#define YJSON_ARENA_MIN_BLOCK   4096
+#define YJSON_ARENA_ALIGN       8
+// Objects with at least this many keys get a key index
+#define YJSON_KEY_INDEX_MIN     16
+
+// Allocation header, used to tell arena nodes from heap nodes on delete.
+// An arena node holds a reference on its document from allocation to
+// delete, so that the header is still readable after the destructor
+typedef union
+{
+	YJSONDocument* arenaDoc;
+	double align;
+} YJSONAllocHeader;
+
+
+YJSONDocument::YJSONDocument(const string& src) : _blockUsed(0), _blockSize(0), _arenaSize(0), _refcount(1), _src(src)
+{
+}
+
+YJSONDocument::YJSONDocument(const char* src, int len) : _blockUsed(0), _blockSize(0), _arenaSize(0), _refcount(1), _src(src, len)
+{
+}
+
+YJSONDocument::~YJSONDocument()
+{
+	for (unsigned i = 0; i < _blocks.size(); i++)
+	{
+		::operator delete(_blocks[i]);
+	}
+	_blocks.clear();
+}
+
+// nodes of a document can be shared between threads (e.g. a device cache)
+void YJSONDocument::acquire(void)
+{
+	yAtomicIncrement(&_refcount);
+}
+
+void YJSONDocument::release(void)
+{
+	if (yAtomicDecrement(&_refcount) == 0)
+	{
+		delete this;
+	}
+}
+
+void* YJSONDocument::allocate(size_t size)
+{
+	size = (size + YJSON_ARENA_ALIGN - 1) & ~(size_t)(YJSON_ARENA_ALIGN - 1);
+	if (_blocks.size() == 0 || _blockUsed + size > _blockSize)
+	{
+		// a node takes roughly as much memory as the text it is parsed from
+		size_t blocksize = (_blockSize > 0 ? 2 * _blockSize : _src.length() + YJSON_ARENA_MIN_BLOCK);
+		if (blocksize < size)
+		{
+			blocksize = size;
+		}
+		char* block = (char*)::operator new(blocksize);
+		_blocks.push_back(block);
+		_blockSize = blocksize;
+		_blockUsed = 0;
+		_arenaSize += blocksize;
+	}
+	void* res = _blocks.back() + _blockUsed;
+	_blockUsed += size;
+	return res;
+}
+
+
 YJSONContent* YJSONContent::ParseJson(const string& data, int start, int stop)
 {
 	int cur_pos = YJSONContent::SkipGarbage(data, start, stop);
@@ -124,26 +196,44 @@ YJSONContent* YJSONContent::ParseJson(const string& data, int start, int stop)
 	{
 		res = new YJSONNumber(data, start, stop);
 	}
-	res->parse();
+	try
+	{
+		res->parse();
+	}
+	catch (std::exception&)
+	{
+		delete res;
+		throw;
+	}
 	return res;
 }
 
-YJSONContent::YJSONContent(const string& data, int start, int stop, YJSONType type)
+YJSONContent::YJSONContent(const string& data, int start, int stop, YJSONType type) :
+	_doc(new YJSONDocument(data)), _data(_doc->_src), _data_len(0)
+{
+	_data_start = start;
+	_data_boundary = stop;
+	_type = type;
+}
+
+YJSONContent::YJSONContent(YJSONDocument* doc, int start, int stop, YJSONType type) :
+	_doc(doc), _data(doc->_src), _data_len(0)
 {
-	_data = data;
+	_doc->acquire();
 	_data_start = start;
 	_data_boundary = stop;
 	_type = type;
 }
 
-YJSONContent::YJSONContent(YJSONType type)
+YJSONContent::YJSONContent(YJSONType type) :
+	_doc(new YJSONDocument("")), _data(_doc->_src), _data_start(0), _data_len(0), _data_boundary(0)
 {
-	_data = "";//todo: check not null
+	_type = type;
 }
 
-YJSONContent::YJSONContent(YJSONContent* ref)
+YJSONContent::YJSONContent(YJSONContent* ref) : _doc(ref->_doc), _data(ref->_doc->_src)
 {
-	_data = ref->_data;
+	_doc->acquire();
 	_data_start = ref->_data_start;
 	_data_boundary = ref->_data_boundary;
 	_data_len = ref->_data_len;
@@ -153,7 +243,48 @@ YJSONContent::YJSONContent(YJSONContent* ref)
 
 YJSONContent::~YJSONContent()
 {
-	_data = "";
+	_doc->release();
+}
+
+void* YJSONContent::operator new(size_t size)
+{
+	YJSONAllocHeader* hdr = (YJSONAllocHeader*)::operator new(sizeof(YJSONAllocHeader) + size);
+	hdr->arenaDoc = NULL;
+	return hdr + 1;
+}
+
+void* YJSONContent::operator new(size_t size, YJSONDocument* doc)
+{
+	YJSONAllocHeader* hdr = (YJSONAllocHeader*)doc->allocate(sizeof(YJSONAllocHeader) + size);
+	doc->acquire();
+	hdr->arenaDoc = doc;
+	return hdr + 1;
+}
+
+void YJSONContent::operator delete(void* ptr)
+{
+	if (ptr == NULL)
+	{
+		return;
+	}
+	// arena nodes are freed together with their document: drop the
+	// reference taken at allocation, which may free the arena itself
+	YJSONAllocHeader* hdr = (YJSONAllocHeader*)ptr - 1;
+	YJSONDocument* doc = hdr->arenaDoc;
+	if (doc == NULL)
+	{
+		::operator delete(hdr);
+	}
+	else
+	{
+		doc->release();
+	}
+}
+
+void YJSONContent::operator delete(void* ptr, YJSONDocument* doc)
+{
+	// only called if a constructor throws, memory is owned by the arena
+	doc->release();
 }
 
 YJSONType YJSONContent::getJSONType()
@@ -195,6 +326,10 @@ YJSONArray::YJSONArray(const string& data, int start, int stop) : YJSONContent(d
 {
 }
 
+YJSONArray::YJSONArray(YJSONDocument* doc, int start, int stop) : YJSONContent(doc, start, stop, ARRAY)
+{
+}
+
 
 YJSONArray::YJSONArray() : YJSONContent(ARRAY)
 {
@@ -269,40 +404,40 @@ int YJSONArray::parse()
 		case JWAITFORDATA:
 			if (sti == '{')
 			{
-				YJSONObject* jobj = new YJSONObject(_data, cur_pos, _data_boundary);
+				YJSONObject* jobj = new(_doc) YJSONObject(_doc, cur_pos, _data_boundary);
+				_arrayValue.push_back(jobj);
 				int len = jobj->parse();
 				cur_pos += len;
-				_arrayValue.push_back(jobj);
 				state = JWAITFORNEXTARRAYITEM;
 				//cur_pos is already incremented
 				continue;
 			}
 			else if (sti == '[')
 			{
-				YJSONArray* jobj = new YJSONArray(_data, cur_pos, _data_boundary);
+				YJSONArray* jobj = new(_doc) YJSONArray(_doc, cur_pos, _data_boundary);
+				_arrayValue.push_back(jobj);
 				int len = jobj->parse();
 				cur_pos += len;
-				_arrayValue.push_back(jobj);
 				state = JWAITFORNEXTARRAYITEM;
 				//cur_pos is already incremented
 				continue;
 			}
 			else if (sti == '"')
 			{
-				YJSONString* jobj = new YJSONString(_data, cur_pos, _data_boundary);
+				YJSONString* jobj = new(_doc) YJSONString(_doc, cur_pos, _data_boundary);
+				_arrayValue.push_back(jobj);
 				int len = jobj->parse();
 				cur_pos += len;
-				_arrayValue.push_back(jobj);
 				state = JWAITFORNEXTARRAYITEM;
 				//cur_pos is already incremented
 				continue;
 			}
 			else if (sti == '-' || (sti >= '0' && sti <= '9'))
 			{
-				YJSONNumber* jobj = new YJSONNumber(_data, cur_pos, _data_boundary);
+				YJSONNumber* jobj = new(_doc) YJSONNumber(_doc, cur_pos, _data_boundary);
+				_arrayValue.push_back(jobj);
 				int len = jobj->parse();
 				cur_pos += len;
-				_arrayValue.push_back(jobj);
 				state = JWAITFORNEXTARRAYITEM;
 				//cur_pos is already incremented
 				continue;
@@ -418,17 +553,24 @@ string YJSONArray::toString()
 }
 
 
-YJSONString::YJSONString(const string& data, int start, int stop) : YJSONContent(data, start, stop, STRING)
+YJSONString::YJSONString(const string& data, int start, int stop) : YJSONContent(data, start, stop, STRING), _str_start(0), _str_len(0), _inDoc(false)
+{
+}
+
+YJSONString::YJSONString(YJSONDocument* doc, int start, int stop) : YJSONContent(doc, start, stop, STRING), _str_start(0), _str_len(0), _inDoc(false)
 {
 }
 
-YJSONString::YJSONString() : YJSONContent(STRING)
+YJSONString::YJSONString() : YJSONContent(STRING), _str_start(0), _str_len(0), _inDoc(false)
 {
 }
 
 YJSONString::YJSONString(YJSONString* ref) : YJSONContent(ref)
 {
 	_stringValue = ref->_stringValue;
+	_str_start = ref->_str_start;
+	_str_len = ref->_str_len;
+	_inDoc = ref->_inDoc;
 }
 
 int YJSONString::parse()
@@ -442,6 +584,7 @@ int YJSONString::parse()
 	}
 	cur_pos++;
 	int str_start = cur_pos;
+	bool escaped = false;
 	Tjstate state = JWAITFORSTRINGVALUE;
 
 	while (cur_pos < _data_boundary)
@@ -454,12 +597,24 @@ int YJSONString::parse()
 			{
 				value += _data.substr(str_start, cur_pos - str_start);
 				str_start = cur_pos;
+				escaped = true;
 				state = JWAITFORSTRINGVALUE_ESC;
 			}
 			else if (sti == '"')
 			{
-				value += _data.substr(str_start, cur_pos - str_start);
-				_stringValue = value;
+				if (escaped)
+				{
+					value += _data.substr(str_start, cur_pos - str_start);
+					_stringValue = value;
+					_inDoc = false;
+				}
+				else
+				{
+					// plain string: keep a reference into the document
+					_str_start = str_start;
+					_str_len = cur_pos - str_start;
+					_inDoc = true;
+				}
 				_data_len = (cur_pos + 1) - _data_start;
 				return _data_len;
 			}
@@ -484,7 +639,8 @@ int YJSONString::parse()
 string YJSONString::toJSON()
 {
 	string res = "\"";
-	const char* c = _stringValue.c_str();
+	string value = this->getString();
+	const char* c = value.c_str();
 	while (*c)
 	{
 		switch (*c)
@@ -525,17 +681,22 @@ string YJSONString::toJSON()
 
 string YJSONString::getString()
 {
+	if (_inDoc)
+	{
+		return _data.substr(_str_start, _str_len);
+	}
 	return _stringValue;
 }
 
 string YJSONString::toString()
 {
-	return _stringValue;
+	return this->getString();
 }
 
 void YJSONString::setContent(const string& value)
 {
 	_stringValue = value;
+	_inDoc = false;
 }
 
 
@@ -543,6 +704,10 @@ YJSONNumber::YJSONNumber(const string& data, int start, int stop) : YJSONContent
 {
 }
 
+YJSONNumber::YJSONNumber(YJSONDocument* doc, int start, int stop) : YJSONContent(doc, start, stop, NUMBER), _intValue(0), _doubleValue(0), _isFloat(false)
+{
+}
+
 YJSONNumber::YJSONNumber(YJSONNumber* ref) : YJSONContent(ref)
 {
 	_intValue = ref->_intValue;
@@ -569,20 +734,19 @@ int YJSONNumber::parse()
 		sti = _data[cur_pos];
 		if (sti == '.' && _isFloat == false)
 		{
-			string int_part = _data.substr(start, cur_pos - start);
-			_intValue = atoi((int_part).c_str());
+			_intValue = atoi(_data.c_str() + start);
 			_isFloat = true;
 		}
 		else if (sti < '0' || sti > '9')
 		{
-			string numberpart = _data.substr(start, cur_pos - start);
+			// convert in place, digits are always followed by a delimiter
 			if (_isFloat)
 			{
-				_doubleValue = atof((numberpart).c_str());
+				_doubleValue = atof(_data.c_str() + start);
 			}
 			else
 			{
-				_intValue = atoi((numberpart).c_str());
+				_intValue = atoi(_data.c_str() + start);
 			}
 			if (neg)
 			{
@@ -637,34 +801,37 @@ string YJSONNumber::toString()
 }
 
 
-YJSONObject::YJSONObject(const string& data) : YJSONContent(data, 0, (int)data.length(), OBJECT)
+YJSONObject::YJSONObject(const string& data) : YJSONContent(data, 0, (int)data.length(), OBJECT), _lazyRef(NULL), _lastIdx(0)
 {
 }
 
-YJSONObject::YJSONObject(const string& data, int start, int len) : YJSONContent(data, start, len, OBJECT)
+YJSONObject::YJSONObject(const string& data, int start, int len) : YJSONContent(data, start, len, OBJECT), _lazyRef(NULL), _lastIdx(0)
 {
 }
 
-YJSONObject::YJSONObject(YJSONObject* ref) : YJSONContent(ref)
+YJSONObject::YJSONObject(YJSONDocument* doc, int start, int len) : YJSONContent(doc, start, len, OBJECT), _lazyRef(NULL), _lastIdx(0)
+{
+}
+
+YJSONObject::YJSONObject(YJSONObject* ref) : YJSONContent(ref), _lazyRef(NULL), _lastIdx(0)
 {
 	for (unsigned i = 0; i < ref->_keys.size(); i++)
 	{
-		string key = ref->_keys[i];
-		_keys.push_back(key);
-		YJSONType type = ref->_parsed[key]->getJSONType();
+		YJSONContent* item = ref->valueAt(i);
+		YJSONType type = item->getJSONType();
 		switch (type)
 		{
 		case ARRAY:
-			_parsed[key] = new YJSONArray((YJSONArray*)ref->_parsed[key]);
+			put(ref->_keys[i], new YJSONArray((YJSONArray*)item));
 			break;
 		case NUMBER:
-			_parsed[key] = new YJSONNumber((YJSONNumber*)ref->_parsed[key]);
+			put(ref->_keys[i], new YJSONNumber((YJSONNumber*)item));
 			break;
 		case STRING:
-			_parsed[key] = new YJSONString((YJSONString*)ref->_parsed[key]);
+			put(ref->_keys[i], new YJSONString((YJSONString*)item));
 			break;
 		case OBJECT:
-			_parsed[key] = new YJSONObject((YJSONObject*)ref->_parsed[key]);
+			put(ref->_keys[i], new YJSONObject((YJSONObject*)item));
 			break;
 		}
 	}
@@ -673,14 +840,88 @@ YJSONObject::YJSONObject(YJSONObject* ref) : YJSONContent(ref)
 YJSONObject::~YJSONObject()
 {
 	//printf("relase YJSONObject\n");
-	for (unsigned i = 0; i < _keys.size(); i++)
+	for (unsigned i = 0; i < _values.size(); i++)
 	{
-		delete _parsed[_keys[i]];
+		delete _values[i];
 	}
-	_parsed.clear();
+	_values.clear();
 	_keys.clear();
 }
 
+// Attributes are usually looked up in the order in which they appear in the
+// object (has() then get*() on the same key, then the next attribute), so the
+// search starts at the last key found and wraps around
+int YJSONObject::indexOf(const char* key, int keylen)
+{
+	int nkeys = (int)_keys.size();
+	int idx = _lastIdx;
+	if (!_keyIndex.empty())
+	{
+		std::map<string, int>::const_iterator it = _keyIndex.find(string(key, keylen));
+		if (it == _keyIndex.end())
+		{
+			return -1;
+		}
+		_lastIdx = it->second;
+		return it->second;
+	}
+	for (int i = 0; i < nkeys; i++, idx++)
+	{
+		if (idx >= nkeys)
+		{
+			idx = 0;
+		}
+		const string& name = _keys[idx];
+		if ((int)name.length() == keylen && memcmp(name.data(), key, keylen) == 0)
+		{
+			_lastIdx = idx;
+			return idx;
+		}
+	}
+	return -1;
+}
+
+int YJSONObject::indexOf(const string& key)
+{
+	return indexOf(key.data(), (int)key.length());
+}
+
+// Appends a new key, and indexes the keys of large objects so that looking
+// for duplicates while building them does not become quadratic
+void YJSONObject::addKey(const string& key)
+{
+	_keys.push_back(key);
+	if (_keys.size() < YJSON_KEY_INDEX_MIN)
+	{
+		return;
+	}
+	if (_keyIndex.empty())
+	{
+		for (unsigned i = 0; i < _keys.size(); i++)
+		{
+			_keyIndex[_keys[i]] = (int)i;
+		}
+	}
+	else
+	{
+		_keyIndex[key] = (int)_keys.size() - 1;
+	}
+}
+
+void YJSONObject::put(const string& key, YJSONContent* value)
+{
+	int idx = indexOf(key);
+	if (idx >= 0)
+	{
+		// duplicate key: the last value wins
+		delete _values[idx];
+		_values[idx] = value;
+		return;
+	}
+	addKey(key);
+	_values.push_back(value);
+}
+
 int YJSONObject::parse()
 {
 	string current_name = "";
@@ -748,44 +989,40 @@ int YJSONObject::parse()
 		case JWAITFORDATA:
 			if (sti == '{')
 			{
-				YJSONObject* jobj = new YJSONObject(_data, cur_pos, _data_boundary);
+				YJSONObject* jobj = new(_doc) YJSONObject(_doc, cur_pos, _data_boundary);
+				put(current_name, jobj);
 				int len = jobj->parse();
 				cur_pos += len;
-				_parsed[current_name] = jobj;
-				_keys.push_back(current_name);
 				state = JWAITFORNEXTSTRUCTMEMBER;
 				//cur_pos is already incremented
 				continue;
 			}
 			else if (sti == '[')
 			{
-				YJSONArray* jobj = new YJSONArray(_data, cur_pos, _data_boundary);
+				YJSONArray* jobj = new(_doc) YJSONArray(_doc, cur_pos, _data_boundary);
+				put(current_name, jobj);
 				int len = jobj->parse();
 				cur_pos += len;
-				_parsed[current_name] = jobj;
-				_keys.push_back(current_name);
 				state = JWAITFORNEXTSTRUCTMEMBER;
 				//cur_pos is already incremented
 				continue;
 			}
 			else if (sti == '"')
 			{
-				YJSONString* jobj = new YJSONString(_data, cur_pos, _data_boundary);
+				YJSONString* jobj = new(_doc) YJSONString(_doc, cur_pos, _data_boundary);
+				put(current_name, jobj);
 				int len = jobj->parse();
 				cur_pos += len;
-				_parsed[current_name] = jobj;
-				_keys.push_back(current_name);
 				state = JWAITFORNEXTSTRUCTMEMBER;
 				//cur_pos is already incremented
 				continue;
 			}
 			else if (sti == '-' || (sti >= '0' && sti <= '9'))
 			{
-				YJSONNumber* jobj = new YJSONNumber(_data, cur_pos, _data_boundary);
+				YJSONNumber* jobj = new(_doc) YJSONNumber(_doc, cur_pos, _data_boundary);
+				put(current_name, jobj);
 				int len = jobj->parse();
 				cur_pos += len;
-				_parsed[current_name] = jobj;
-				_keys.push_back(current_name);
 				state = JWAITFORNEXTSTRUCTMEMBER;
 				//cur_pos is already incremented
 				continue;
@@ -824,72 +1061,104 @@ int YJSONObject::parse()
 
 bool YJSONObject::has(const string& key)
 {
-	if (_parsed.find(key) == _parsed.end())
-	{
-		return false;
-	}
-	else
-	{
-		return true;
-	}
+	return indexOf(key) >= 0;
+}
+
+bool YJSONObject::has(const char* key)
+{
+	return indexOf(key, (int)strlen(key)) >= 0;
 }
 
 YJSONObject* YJSONObject::getYJSONObject(const string& key)
 {
-	return (YJSONObject*)_parsed[key];
+	return (YJSONObject*)get(key);
+}
+
+YJSONObject* YJSONObject::getYJSONObject(const char* key)
+{
+	return (YJSONObject*)get(key);
 }
 
 YJSONString* YJSONObject::getYJSONString(const string& key)
 {
-	return (YJSONString*)_parsed[key];
+	return (YJSONString*)get(key);
 }
 
 YJSONArray* YJSONObject::getYJSONArray(const string& key)
 {
-	return (YJSONArray*)_parsed[key];
+	return (YJSONArray*)get(key);
 }
 
 vector<string> YJSONObject::keys()
 {
-	vector<string> v;
-	for (map<string, YJSONContent*>::iterator it = _parsed.begin(); it != _parsed.end(); ++it)
-	{
-		v.push_back(it->first);
-	}
+	// keep returning keys in sorted order, as before the flat key table
+	vector<string> v = _keys;
+	std::sort(v.begin(), v.end());
 	return v;
 }
 
 YJSONNumber* YJSONObject::getYJSONNumber(const string& key)
 {
-	return (YJSONNumber*)_parsed[key];
+	return (YJSONNumber*)get(key);
 }
 
 string YJSONObject::getString(const string& key)
 {
-	YJSONString* ystr = (YJSONString*)_parsed[key];
+	YJSONString* ystr = (YJSONString*)get(key);
+	return ystr->getString();
+}
+
+string YJSONObject::getString(const char* key)
+{
+	YJSONString* ystr = (YJSONString*)get(key);
 	return ystr->getString();
 }
 
 int YJSONObject::getInt(const string& key)
 {
-	YJSONNumber* yint = (YJSONNumber*)_parsed[key];
+	YJSONNumber* yint = (YJSONNumber*)get(key);
+	return yint->getInt();
+}
+
+int YJSONObject::getInt(const char* key)
+{
+	YJSONNumber* yint = (YJSONNumber*)get(key);
 	return yint->getInt();
 }
 
 YJSONContent* YJSONObject::get(const string& key)
 {
-	return _parsed[key];
+	int idx = indexOf(key);
+	return (idx >= 0 ? valueAt(idx) : NULL);
+}
+
+YJSONContent* YJSONObject::get(const char* key)
+{
+	int idx = indexOf(key, (int)strlen(key));
+	return (idx >= 0 ? valueAt(idx) : NULL);
 }
 
 long YJSONObject::getLong(const string& key)
 {
-	YJSONNumber* yint = (YJSONNumber*)_parsed[key];
+	YJSONNumber* yint = (YJSONNumber*)get(key);
+	return yint->getLong();
+}
+
+long YJSONObject::getLong(const char* key)
+{
+	YJSONNumber* yint = (YJSONNumber*)get(key);
 	return yint->getLong();
 }
 
 double YJSONObject::getDouble(const string& key)
 {
-	YJSONNumber* yint = (YJSONNumber*)_parsed[key];
+	YJSONNumber* yint = (YJSONNumber*)get(key);
+	return yint->getDouble();
+}
+
+double YJSONObject::getDouble(const char* key)
+{
+	YJSONNumber* yint = (YJSONNumber*)get(key);
 	return yint->getDouble();
 }
 
@@ -901,7 +1170,7 @@ string YJSONObject::toJSON()
 	for (i = 0; i < _keys.size(); i++)
 	{
 		string key = _keys[i];
-		YJSONContent* subContent = _parsed[key];
+		YJSONContent* subContent = valueAt(i);
 		string subres = subContent->toJSON();
 		res += sep;
 		res += '"';
@@ -922,7 +1191,7 @@ string YJSONObject::toString()
 	for (i = 0; i < _keys.size(); i++)
 	{
 		string key = _keys[i];
-		YJSONContent* subContent = _parsed[key];
+		YJSONContent* subContent = valueAt(i);
 		string subres = subContent->toString();
 		res += sep;
 		res += '"';
@@ -942,14 +1211,21 @@ void YJSONObject::parseWithRef(YJSONObject* reference)
 	{
 		try
 		{
-			YJSONArray* yzon = new YJSONArray(_data, _data_start, _data_boundary);
-			yzon->parse();
-			convert(reference, yzon);
-			delete yzon;
+			YJSONArray yzon(_doc, _data_start, _data_boundary);
+			yzon.parse();
+			convert(reference, &yzon);
 			return;
 		}
 		catch (std::exception)
 		{
+			// drop any partial conversion before parsing as plain JSON
+			for (unsigned i = 0; i < _values.size(); i++)
+			{
+				delete _values[i];
+			}
+			_values.clear();
+			_keys.clear();
+			_keyIndex.clear();
 		}
 	}
 	this->parse();
@@ -969,26 +1245,24 @@ void YJSONObject::convert(YJSONObject* reference, YJSONArray* newArray)
 			switch (type)
 			{
 			case ARRAY:
-				_parsed[key] = new YJSONArray((YJSONArray*)item);
+				put(key, new YJSONArray((YJSONArray*)item));
 				break;
 			case NUMBER:
-				_parsed[key] = new YJSONNumber((YJSONNumber*)item);
+				put(key, new YJSONNumber((YJSONNumber*)item));
 				break;
 			case STRING:
-				_parsed[key] = new YJSONString((YJSONString*)item);
+				put(key, new YJSONString((YJSONString*)item));
 				break;
 			case OBJECT:
-				_parsed[key] = new YJSONObject((YJSONObject*)item);
+				put(key, new YJSONObject((YJSONObject*)item));
 				break;
 			}
-			_keys.push_back(key);
 		}
 		else if (type == ARRAY && reference_item->getJSONType() == OBJECT)
 		{
-			YJSONObject* jobj = new YJSONObject(item->_data, item->_data_start, reference_item->_data_boundary);
+			YJSONObject* jobj = new YJSONObject(item->_doc, item->_data_start, reference_item->_data_boundary);
+			put(key, jobj);
 			jobj->convert((YJSONObject*)reference_item, (YJSONArray*)item);
-			_parsed[key] = jobj;
-			_keys.push_back(key);
 		}
 		else
 		{
@@ -1002,105 +1276,338 @@ string YJSONObject::getKeyFromIdx(int i)
 	return _keys[i];
 }
 
-
-// YDataStream constructor for the new datalogger
-YDataStream::YDataStream(YFunction* parent, YDataSet& dataset, const vector<int>& encoded)
-{
-	_parent = parent;
-	this->_initFromDataSet(&dataset, encoded);
-}
-
-YDataStream::~YDataStream()
-{
-	_columnNames.clear();
-	_calpar.clear();
-	_calraw.clear();
-	_calref.clear();
-	_values.clear();
-}
-
-// YDataSet constructor, when instantiated directly by a function
-YDataSet::YDataSet(YFunction* parent, const string& functionId, const string& unit, s64 startTime, s64 endTime)
-{
-	_parent = parent;
-	_functionId = functionId;
-	_unit = unit;
-	_startTime = startTime;
-	_endTime = endTime;
-	_summary = YMeasure(0, 0, 0, 0, 0);
-	_progress = -1;
-}
-
-// YDataSet constructor for the new datalogger
-YDataSet::YDataSet(YFunction* parent)
-{
-	_parent = parent;
-	_startTime = 0;
-	_endTime = 0;
-	_summary = YMeasure(0, 0, 0, 0, 0);
-}
-
-// YDataSet parser for stream list
-int YDataSet::_parse(const string& json)
+// Returns the position right after the JSON value starting at cur_pos,
+// without building any node (strings and nested structures are skipped)
+int YJSONObject::skipValue(int cur_pos)
 {
-	yJsonStateMachine j;
-	double summaryMinVal = DBL_MAX;
-	double summaryMaxVal = -DBL_MAX;
-	double summaryTotalTime = 0;
-	double summaryTotalAvg = 0;
+	const char* data = _data.data();
+	int depth = 0;
 
-
-	// Parse JSON data
-	j.src = json.c_str();
-	j.end = j.src + strlen(j.src);
-	j.st = YJSON_START;
-	if (yJsonParse(&j) != YJSON_PARSE_AVAIL || j.st != YJSON_PARSE_STRUCT)
-	{
-		return YAPI_NOT_SUPPORTED;
-	}
-	while (yJsonParse(&j) == YJSON_PARSE_AVAIL && j.st == YJSON_PARSE_MEMBNAME)
+	while (cur_pos < _data_boundary)
 	{
-		if (!strcmp(j.token, "id"))
+		char sti = data[cur_pos];
+		if (sti == '"')
 		{
-			if (yJsonParse(&j) != YJSON_PARSE_AVAIL)
+			cur_pos++;
+			while (cur_pos < _data_boundary && data[cur_pos] != '"')
 			{
-				return YAPI_NOT_SUPPORTED;
+				if (data[cur_pos] == '\\')
+				{
+					cur_pos++;
+				}
+				cur_pos++;
 			}
-			_functionId = _parent->_parseString(j);
-		}
-		else if (!strcmp(j.token, "unit"))
-		{
-			if (yJsonParse(&j) != YJSON_PARSE_AVAIL)
+			if (cur_pos >= _data_boundary)
 			{
-				return YAPI_NOT_SUPPORTED;
+				break;
 			}
-			_unit = _parent->_parseString(j);
-		}
-		else if (!strcmp(j.token, "calib"))
-		{
-			if (yJsonParse(&j) != YJSON_PARSE_AVAIL)
+			if (depth == 0)
 			{
-				return YAPI_NOT_SUPPORTED;
+				return cur_pos + 1;
 			}
-			_calib = YAPI::_decodeFloats(_parent->_parseString(j));
-			_calib[0] = _calib[0] / 1000;
 		}
-		else if (!strcmp(j.token, "cal"))
+		else if (sti == '{' || sti == '[')
 		{
-			if (yJsonParse(&j) != YJSON_PARSE_AVAIL)
+			depth++;
+		}
+		else if (sti == '}' || sti == ']')
+		{
+			if (depth == 0)
 			{
-				return YAPI_NOT_SUPPORTED;
+				// end of enclosing structure, after a number
+				return cur_pos;
 			}
-			if (_calib.size() == 0)
+			if (--depth == 0)
 			{
-				_calib = YAPI::_decodeWords(_parent->_parseString(j));
+				return cur_pos + 1;
 			}
 		}
-		else if (!strcmp(j.token, "streams"))
+		else if (depth == 0 && (sti == ',' || sti == ' ' || sti == '\n' || sti == '\r'))
 		{
-			YDataStream* stream;
-			s64 streamEndTime, endTime = 0;
-			s64 streamStartTime, startTime = 0x7fffffff;
+			return cur_pos;
+		}
+		cur_pos++;
+	}
+	throw YAPI_Exception(YAPI_IO_ERROR, FormatError("unexpected end of data", cur_pos));
+}
+
+// Indexes the top-level members without parsing their values. Each value
+// is parsed the first time it is accessed. When the content is a compact
+// array (reply to api.json?fw=...), member names are taken from the
+// reference object, which must remain valid as long as this object.
+int YJSONObject::parseLazy(YJSONObject* reference)
+{
+	int cur_pos = SkipGarbage(_data, _data_start, _data_boundary);
+
+	if (_data.length() <= (unsigned)cur_pos || (_data[cur_pos] != '{' && _data[cur_pos] != '['))
+	{
+		throw YAPI_Exception(YAPI_IO_ERROR, FormatError("Opening braces was expected", cur_pos));
+	}
+	bool compact = (_data[cur_pos] == '[');
+	if (compact && reference == NULL)
+	{
+		throw YAPI_Exception(YAPI_IO_ERROR, FormatError("Unable to convert yzon struct", cur_pos));
+	}
+	_lazyRef = (compact ? reference : NULL);
+	cur_pos++;
+	Tjstate state = (compact ? JWAITFORDATA : JWAITFORNAME);
+	string current_name;
+	int name_start = cur_pos;
+	int count = 0;
+
+	while (cur_pos < _data_boundary)
+	{
+		char sti = _data[cur_pos];
+		if (sti == ' ' || sti == '\n' || sti == '\r')
+		{
+			cur_pos++;
+			continue;
+		}
+		switch (state)
+		{
+		case JWAITFORNAME:
+			if (sti == '"')
+			{
+				name_start = cur_pos + 1;
+				cur_pos = (int)_data.find('"', name_start);
+				if (cur_pos < 0 || cur_pos >= _data_boundary)
+				{
+					throw YAPI_Exception(YAPI_IO_ERROR, FormatError("unexpected end of data", name_start));
+				}
+				current_name = _data.substr(name_start, cur_pos - name_start);
+				state = JWAITFORCOLON;
+			}
+			else if (sti == '}' && count == 0)
+			{
+				_data_len = cur_pos + 1 - _data_start;
+				return _data_len;
+			}
+			else
+			{
+				throw YAPI_Exception(YAPI_IO_ERROR, FormatError("invalid char: was expecting \"", cur_pos));
+			}
+			break;
+		case JWAITFORCOLON:
+			if (sti != ':')
+			{
+				throw YAPI_Exception(YAPI_IO_ERROR, FormatError("invalid char: was expecting :", cur_pos));
+			}
+			state = JWAITFORDATA;
+			break;
+		case JWAITFORDATA:
+			if (compact)
+			{
+				if (sti == ']' && count == 0)
+				{
+					_data_len = cur_pos + 1 - _data_start;
+					return _data_len;
+				}
+				if (count >= (int)reference->_keys.size())
+				{
+					throw YAPI_Exception(YAPI_IO_ERROR, "Unable to convert yzon struct");
+				}
+				current_name = reference->_keys[count];
+			}
+			{
+				int idx = indexOf(current_name);
+				if (idx < 0)
+				{
+					addKey(current_name);
+					_values.push_back(NULL);
+					_lazyPos.push_back(cur_pos);
+				}
+				else
+				{
+					// duplicate key: the last value wins
+					delete _values[idx];
+					_values[idx] = NULL;
+					_lazyPos[idx] = cur_pos;
+				}
+			}
+			count++;
+			cur_pos = skipValue(cur_pos);
+			state = JWAITFORNEXTSTRUCTMEMBER;
+			continue;
+		case JWAITFORNEXTSTRUCTMEMBER:
+			if (sti == ',')
+			{
+				state = (compact ? JWAITFORDATA : JWAITFORNAME);
+			}
+			else if (sti == (compact ? ']' : '}'))
+			{
+				_data_len = cur_pos + 1 - _data_start;
+				return _data_len;
+			}
+			else
+			{
+				throw YAPI_Exception(YAPI_IO_ERROR, FormatError("invalid char: was expecting ,", cur_pos));
+			}
+			break;
+		default:
+			throw YAPI_Exception(YAPI_IO_ERROR, FormatError("invalid state for YJSONObject", cur_pos));
+		}
+		cur_pos++;
+	}
+	throw YAPI_Exception(YAPI_IO_ERROR, FormatError("unexpected end of data", cur_pos));
+}
+
+// Returns the value of a member, parsing it first if it has been indexed lazily
+YJSONContent* YJSONObject::valueAt(int idx)
+{
+	if (_values[idx] != NULL || idx >= (int)_lazyPos.size())
+	{
+		return _values[idx];
+	}
+	int cur_pos = _lazyPos[idx];
+	char sti = _data[cur_pos];
+	YJSONContent* reference_item = (_lazyRef ? _lazyRef->get(_keys[idx]) : NULL);
+	YJSONContent* item;
+	if (reference_item && sti == '[' && reference_item->getJSONType() == OBJECT)
+	{
+		// compact object: values are listed in the order of the reference keys
+		item = new(_doc) YJSONObject(_doc, cur_pos, _data_boundary);
+	}
+	else if (sti == '{')
+	{
+		item = new(_doc) YJSONObject(_doc, cur_pos, _data_boundary);
+	}
+	else if (sti == '[')
+	{
+		item = new(_doc) YJSONArray(_doc, cur_pos, _data_boundary);
+	}
+	else if (sti == '"')
+	{
+		item = new(_doc) YJSONString(_doc, cur_pos, _data_boundary);
+	}
+	else
+	{
+		item = new(_doc) YJSONNumber(_doc, cur_pos, _data_boundary);
+	}
+	try
+	{
+		if (reference_item && sti == '[' && reference_item->getJSONType() == OBJECT)
+		{
+			YJSONArray yzon(_doc, cur_pos, _data_boundary);
+			yzon.parse();
+			((YJSONObject*)item)->convert((YJSONObject*)reference_item, &yzon);
+		}
+		else
+		{
+			item->parse();
+			if (reference_item && reference_item->getJSONType() != item->getJSONType())
+			{
+				throw YAPI_Exception(YAPI_IO_ERROR, "Unable to convert yzon struct");
+			}
+		}
+	}
+	catch (std::exception&)
+	{
+		delete item;
+		throw;
+	}
+	_values[idx] = item;
+	return item;
+}
+
+
+// YDataStream constructor for the new datalogger
+YDataStream::YDataStream(YFunction* parent, YDataSet& dataset, const vector<int>& encoded)
+{
+	_parent = parent;
+	this->_initFromDataSet(&dataset, encoded);
+}
+
+YDataStream::~YDataStream()
+{
+	_columnNames.clear();
+	_calpar.clear();
+	_calraw.clear();
+	_calref.clear();
+	_values.clear();
+}
+
+// YDataSet constructor, when instantiated directly by a function
+YDataSet::YDataSet(YFunction* parent, const string& functionId, const string& unit, s64 startTime, s64 endTime)
+{
+	_parent = parent;
+	_functionId = functionId;
+	_unit = unit;
+	_startTime = startTime;
+	_endTime = endTime;
+	_summary = YMeasure(0, 0, 0, 0, 0);
+	_progress = -1;
+}
+
+// YDataSet constructor for the new datalogger
+YDataSet::YDataSet(YFunction* parent)
+{
+	_parent = parent;
+	_startTime = 0;
+	_endTime = 0;
+	_summary = YMeasure(0, 0, 0, 0, 0);
+}
+
+// YDataSet parser for stream list
+int YDataSet::_parse(const string& json)
+{
+	yJsonStateMachine j;
+	double summaryMinVal = DBL_MAX;
+	double summaryMaxVal = -DBL_MAX;
+	double summaryTotalTime = 0;
+	double summaryTotalAvg = 0;
+
+
+	// Parse JSON data
+	j.src = json.c_str();
+	j.end = j.src + strlen(j.src);
+	j.st = YJSON_START;
+	if (yJsonParse(&j) != YJSON_PARSE_AVAIL || j.st != YJSON_PARSE_STRUCT)
+	{
+		return YAPI_NOT_SUPPORTED;
+	}
+	while (yJsonParse(&j) == YJSON_PARSE_AVAIL && j.st == YJSON_PARSE_MEMBNAME)
+	{
+		if (!strcmp(j.token, "id"))
+		{
+			if (yJsonParse(&j) != YJSON_PARSE_AVAIL)
+			{
+				return YAPI_NOT_SUPPORTED;
+			}
+			_functionId = _parent->_parseString(j);
+		}
+		else if (!strcmp(j.token, "unit"))
+		{
+			if (yJsonParse(&j) != YJSON_PARSE_AVAIL)
+			{
+				return YAPI_NOT_SUPPORTED;
+			}
+			_unit = _parent->_parseString(j);
+		}
+		else if (!strcmp(j.token, "calib"))
+		{
+			if (yJsonParse(&j) != YJSON_PARSE_AVAIL)
+			{
+				return YAPI_NOT_SUPPORTED;
+			}
+			_calib = YAPI::_decodeFloats(_parent->_parseString(j));
+			_calib[0] = _calib[0] / 1000;
+		}
+		else if (!strcmp(j.token, "cal"))
+		{
+			if (yJsonParse(&j) != YJSON_PARSE_AVAIL)
+			{
+				return YAPI_NOT_SUPPORTED;
+			}
+			if (_calib.size() == 0)
+			{
+				_calib = YAPI::_decodeWords(_parent->_parseString(j));
+			}
+		}
+		else if (!strcmp(j.token, "streams"))
+		{
+			YDataStream* stream;
+			s64 streamEndTime, endTime = 0;
+			s64 streamStartTime, startTime = 0x7fffffff;
 			_streams = vector<YDataStream*>();
 			_preview = vector<YMeasure>();
 			_measures = vector<YMeasure>();
@@ -1425,53 +1932,331 @@ int YFirmwareUpdate::startUpdate(void)
 //--- (end of generated code: YFirmwareUpdate implementation)
 
 
-//--- (generated code: YDataStream implementation)
-// static attributes
+YWorkerPool::YWorkerPool() : _run(NULL), _ctx(NULL), _jobCount(0), _nextJob(0), _threads(NULL), _running(0)
+{
+	yInitializeCriticalSection(&_lock);
+	yCreateManualEvent(&_idle, 1);
+}
 
+YWorkerPool::~YWorkerPool()
+{
+	wait();
+	yCloseEvent(&_idle);
+	yDeleteCriticalSection(&_lock);
+}
 
-int YDataStream::_initFromDataSet(YDataSet* dataset, vector<int> encoded)
+void* YWorkerPool::_workerThread(void* ctx)
 {
-	int val = 0;
-	int i = 0;
-	int maxpos = 0;
-	int iRaw = 0;
-	int iRef = 0;
-	double fRaw = 0.0;
-	double fRef = 0.0;
-	double duration_float = 0.0;
-	vector<int> iCalib;
-	// decode sequence header to extract data
-	_runNo = encoded[0] + (((encoded[1]) << (16)));
-	_utcStamp = encoded[2] + (((encoded[3]) << (16)));
-	val = encoded[4];
-	_isAvg = (((val) & (0x100)) == 0);
-	_samplesPerHour = ((val) & (0xff));
-	if (((val) & (0x100)) != 0)
-	{
-		_samplesPerHour = _samplesPerHour * 3600;
-	}
-	else
+	yThread* thread = (yThread*)ctx;
+	YWorkerPool* pool = (YWorkerPool*)thread->ctx;
+	unsigned idx;
+	bool last;
+
+	yThreadSignalStart(thread);
+	while (!yThreadMustEnd(thread))
 	{
-		if (((val) & (0x200)) != 0)
+		yEnterCriticalSection(&pool->_lock);
+		idx = pool->_nextJob++;
+		yLeaveCriticalSection(&pool->_lock);
+		if (idx >= pool->_jobCount)
 		{
-			_samplesPerHour = _samplesPerHour * 60;
+			break;
 		}
+		pool->_run(pool->_ctx, idx);
 	}
-	val = encoded[5];
-	if (val > 32767)
-	{
-		val = val - 65536;
-	}
-	_decimals = val;
-	_offset = val;
-	_scale = encoded[6];
-	_isScal = (_scale != 0);
-	_isScal32 = ((int)encoded.size() >= 14);
-	val = encoded[7];
-	_isClosed = (val != 0xffff);
-	if (val == 0xffff)
+	yThreadSignalEnd(thread);
+	// the pool may be destroyed as soon as the last thread has set the event
+	yEnterCriticalSection(&pool->_lock);
+	last = (--pool->_running == 0);
+	yLeaveCriticalSection(&pool->_lock);
+	if (last)
 	{
-		val = 0;
+		ySetEvent(&pool->_idle);
+	}
+	return NULL;
+}
+
+int YWorkerPool::start(int maxThreads, unsigned jobCount, JobFunction run, void* ctx)
+{
+	int count, i;
+	bool idle;
+
+	wait();
+	_run = run;
+	_ctx = ctx;
+	_jobCount = jobCount;
+	_nextJob = 0;
+	count = (int)(jobCount < (unsigned)maxThreads ? jobCount : (unsigned)maxThreads);
+	if (count <= 0)
+	{
+		return 0;
+	}
+	_threads = new yThread[count];
+	memset(_threads, 0, sizeof(yThread) * count);
+	// count all the threads as running first, so that the first ones to exit
+	// cannot signal the end while others are still being created
+	yResetEvent(&_idle);
+	yEnterCriticalSection(&_lock);
+	_running = count;
+	yLeaveCriticalSection(&_lock);
+	for (i = 0; i < count; i++)
+	{
+		if (yThreadCreate(&_threads[i], _workerThread, this) < 0)
+		{
+			// the threads already started will process all the jobs
+			break;
+		}
+	}
+	if (i < count)
+	{
+		yEnterCriticalSection(&_lock);
+		_running -= count - i;
+		idle = (_running == 0);
+		yLeaveCriticalSection(&_lock);
+		if (idle)
+		{
+			ySetEvent(&_idle);
+		}
+	}
+	return i;
+}
+
+bool YWorkerPool::isRunning(void)
+{
+	bool running;
+	yEnterCriticalSection(&_lock);
+	running = (_running > 0);
+	yLeaveCriticalSection(&_lock);
+	return running;
+}
+
+void YWorkerPool::wait(void)
+{
+	if (_threads == NULL)
+	{
+		return;
+	}
+	yWaitForEvent(&_idle, -1);
+	delete[] _threads;
+	_threads = NULL;
+}
+
+
+// Time given to a flashed module to come back online before its settings
+// restore is reported as failed
+#define Y_FU_ONLINE_TIMEOUT     60000
+
+YFirmwareUpdateScheduler::YFirmwareUpdateScheduler(int maxPerHub) : _maxPerHub(maxPerHub)
+{
+}
+
+void YFirmwareUpdateScheduler::addDevice(const string& serial, const string& path, const string& settings, bool force)
+{
+	Job& job = _jobs.add(serial);
+	job.path = path;
+	job.settings = settings;
+	job.force = force;
+	job.started = false;
+	job.progress = 0;
+	job.message = "waiting";
+	job.flashedAt = 0;
+	job.onlineSince = 0;
+}
+
+// Same steps as YFirmwareUpdate::_processMore, for one module of the plan
+void YFirmwareUpdateScheduler::_processJob(Job& job)
+{
+	char errmsg[YOCTO_ERRMSG_LEN];
+	int res;
+
+	if (job.progress < 0 || job.progress >= 100)
+	{
+		return;
+	}
+	if (!job.started)
+	{
+		if (job.settings.length() >= 6 && job.settings.substr(0, 6) == "error:")
+		{
+			job.progress = -1;
+			job.message = job.settings.substr(6);
+			return;
+		}
+		res = yapiUpdateFirmwareSession(job.serial.c_str(), job.path.c_str(), job.settings.c_str(), job.force ? 1 : 0, _maxPerHub, errmsg);
+		job.started = true;
+	}
+	else
+	{
+		res = yapiGetFirmwareSessionProgress(job.serial.c_str(), errmsg);
+	}
+	if (res < 0)
+	{
+		job.progress = res;
+		job.message = string(errmsg);
+		return;
+	}
+	if (res < 100)
+	{
+		job.progress = (res * 9) / 10;
+		job.message = string(errmsg);
+		return;
+	}
+	if (job.settings.length() == 0)
+	{
+		job.progress = 100;
+		job.message = "success";
+		return;
+	}
+	// the module has been flashed, restore its settings once it is back online
+	job.message = "restoring settings";
+	try
+	{
+		YModule* m = YModule::FindModule(job.serial + ".module");
+		u64 now = yapiGetTickCount();
+		if (job.flashedAt == 0)
+		{
+			job.flashedAt = now;
+		}
+		if (!m->isOnline())
+		{
+			if (now >= job.flashedAt + Y_FU_ONLINE_TIMEOUT)
+			{
+				job.progress = YAPI_DEVICE_NOT_FOUND;
+				job.message = "module did not come back online, settings not restored";
+			}
+			return;
+		}
+		if (job.onlineSince == 0)
+		{
+			job.onlineSince = now;
+		}
+		// give YoctoHubs some time to restart their network services
+		if (m->get_productName().substr(0, 8) == "YoctoHub" && now < job.onlineSince + 5000)
+		{
+			job.progress = 90 + (int)((now - job.onlineSince) / 1000);
+			return;
+		}
+		m->set_allSettingsAndFiles(job.settings);
+		m->saveToFlash();
+		job.settings = "";
+		job.progress = 100;
+		job.message = "success";
+	}
+	catch (YAPI_Exception& ex)
+	{
+		job.progress = ex.errorType;
+		job.message = ex.what();
+	}
+}
+
+int YFirmwareUpdateScheduler::start(void)
+{
+	for (unsigned i = 0; i < _jobs.size(); i++)
+	{
+		if (_jobs[i].progress >= 100 || (_jobs[i].started && _jobs[i].progress >= 0))
+		{
+			// never reflash a module that has been updated, nor restart a running update
+			continue;
+		}
+		// restart failed updates
+		_jobs[i].progress = 0;
+		_jobs[i].started = false;
+		_jobs[i].flashedAt = 0;
+		_jobs[i].onlineSince = 0;
+		_processJob(_jobs[i]);
+	}
+	return get_globalProgress();
+}
+
+int YFirmwareUpdateScheduler::processMore(void)
+{
+	for (unsigned i = 0; i < _jobs.size(); i++)
+	{
+		if (_jobs[i].started)
+		{
+			_processJob(_jobs[i]);
+		}
+	}
+	return get_globalProgress();
+}
+
+bool YFirmwareUpdateScheduler::isDone(void)
+{
+	return _jobs.isDone();
+}
+
+vector<string> YFirmwareUpdateScheduler::get_serials(void)
+{
+	return _jobs.serials();
+}
+
+int YFirmwareUpdateScheduler::get_progress(const string& serial)
+{
+	return _jobs.progress(serial);
+}
+
+string YFirmwareUpdateScheduler::get_progressMessage(const string& serial)
+{
+	return _jobs.message(serial);
+}
+
+int YFirmwareUpdateScheduler::get_globalProgress(void)
+{
+	return _jobs.globalProgress();
+}
+
+int YFirmwareUpdateScheduler::get_errorCount(void)
+{
+	return _jobs.errorCount();
+}
+
+
+//--- (generated code: YDataStream implementation)
+// static attributes
+
+
+int YDataStream::_initFromDataSet(YDataSet* dataset, vector<int> encoded)
+{
+	int val = 0;
+	int i = 0;
+	int maxpos = 0;
+	int iRaw = 0;
+	int iRef = 0;
+	double fRaw = 0.0;
+	double fRef = 0.0;
+	double duration_float = 0.0;
+	vector<int> iCalib;
+	// decode sequence header to extract data
+	_runNo = encoded[0] + (((encoded[1]) << (16)));
+	_utcStamp = encoded[2] + (((encoded[3]) << (16)));
+	val = encoded[4];
+	_isAvg = (((val) & (0x100)) == 0);
+	_samplesPerHour = ((val) & (0xff));
+	if (((val) & (0x100)) != 0)
+	{
+		_samplesPerHour = _samplesPerHour * 3600;
+	}
+	else
+	{
+		if (((val) & (0x200)) != 0)
+		{
+			_samplesPerHour = _samplesPerHour * 60;
+		}
+	}
+	val = encoded[5];
+	if (val > 32767)
+	{
+		val = val - 65536;
+	}
+	_decimals = val;
+	_offset = val;
+	_scale = encoded[6];
+	_isScal = (_scale != 0);
+	_isScal32 = ((int)encoded.size() >= 14);
+	val = encoded[7];
+	_isClosed = (val != 0xffff);
+	if (val == 0xffff)
+	{
+		val = 0;
 	}
 	_nRows = val;
 	duration_float = _nRows * 3600 / _samplesPerHour;
@@ -1578,18 +2363,23 @@ int YDataStream::_initFromDataSet(YDataSet* dataset, vector<int> encoded)
 	return 0;
 }
 
-int YDataStream::_parseStream(string sdata)
+int YDataStream::_parseStream(const string& sdata)
+{
+	return this->_parseStream(sdata.data(), (int)sdata.size());
+}
+
+int YDataStream::_parseStream(const char* sdata, int len)
 {
 	int idx = 0;
 	vector<int> udat;
 	vector<double> dat;
-	if ((int)(sdata).size() == 0)
+	if (len == 0)
 	{
 		_nRows = 0;
 		return YAPI_SUCCESS;
 	}
 
-	udat = YAPI::_decodeWords(_parent->_json_get_string(sdata));
+	udat = YAPI::_decodeWords(_parent->_json_get_string(sdata, len));
 	_values.clear();
 	idx = 0;
 	if (_isAvg)
@@ -1650,9 +2440,20 @@ string YDataStream::_get_url(void)
 	return url;
 }
 
+// The stream is decoded from the reply buffer, which can be large
 int YDataStream::loadStream(void)
 {
-	return this->_parseStream(_parent->_download(this->_get_url()));
+	YHTTPReply reply;
+	int res;
+
+	res = _parent->_download(this->_get_url(), reply);
+	if (YISERR(res))
+	{
+		_values.clear();
+		_nRows = 0;
+		return res;
+	}
+	return this->_parseStream(reply.body(), reply.bodySize());
 }
 
 double YDataStream::_decodeVal(int w)
@@ -2346,92 +3147,1248 @@ vector<YMeasure> YDataSet::get_measuresAt(YMeasure measure)
 	stream = NULL;
 	for (unsigned ii = 0; ii < _streams.size(); ii++)
 	{
-		if (_streams[ii]->get_startTimeUTC() == startUtc)
+		if (_streams[ii]->get_startTimeUTC() == startUtc)
+		{
+			stream = _streams[ii];
+		}
+	}
+	if (stream == NULL)
+	{
+		return measures;
+	}
+	dataRows = stream->get_dataRows();
+	if ((int)dataRows.size() == 0)
+	{
+		return measures;
+	}
+	tim = (double)stream->get_startTimeUTC();
+	itv = stream->get_dataSamplesInterval();
+	if (tim < itv)
+	{
+		tim = itv;
+	}
+	nCols = (int)dataRows[0].size();
+	minCol = 0;
+	if (nCols > 2)
+	{
+		avgCol = 1;
+	}
+	else
+	{
+		avgCol = 0;
+	}
+	if (nCols > 2)
+	{
+		maxCol = 2;
+	}
+	else
+	{
+		maxCol = 0;
+	}
+
+	for (unsigned ii = 0; ii < dataRows.size(); ii++)
+	{
+		if ((tim >= _startTime) && ((_endTime == 0) || (tim <= _endTime)))
+		{
+			measures.push_back(YMeasure(tim - itv, tim,
+			                            dataRows[ii][minCol],
+			                            dataRows[ii][avgCol], dataRows[ii][maxCol]));
+		}
+		tim = tim + itv;
+	}
+	return measures;
+}
+
+/**
+ * Returns all measured values currently available for this DataSet,
+ * as a list of YMeasure objects. Each item includes:
+ * - the start of the measure time interval
+ * - the end of the measure time interval
+ * - the minimal value observed during the time interval
+ * - the average value observed during the time interval
+ * - the maximal value observed during the time interval
+ *
+ * Before calling this method, you should call loadMore()
+ * to load data from the device. You may have to call loadMore()
+ * several time until all rows are loaded, but you can start
+ * looking at available data rows before the load is complete.
+ *
+ * The oldest measures are always loaded first, and the most
+ * recent measures will be loaded last. As a result, timestamps
+ * are normally sorted in ascending order within the measure table,
+ * unless there was an unexpected adjustment of the datalogger UTC
+ * clock.
+ *
+ * @return a table of records, where each record depicts the
+ *         measured value for a given time interval
+ *
+ * On failure, throws an exception or returns an empty array.
+ */
+vector<YMeasure> YDataSet::get_measures(void)
+{
+	return _measures;
+}
+
+//--- (end of generated code: YDataSet implementation)
+
+
+#ifdef WINDOWS_API
+#define yCaptureSeek(f, ofs)        _fseeki64((f), (__int64)(ofs), SEEK_SET)
+#else
+#define yCaptureSeek(f, ofs)        fseeko((f), (off_t)(ofs), SEEK_SET)
+#endif
+#define yCaptureAlign(size)         (((u64)(size) + Y_CAPTURE_RECORD_ALIGN - 1) & ~(u64)(Y_CAPTURE_RECORD_ALIGN - 1))
+
+static void yCapturePut16(u8* p, u16 val)
+{
+	p[0] = (u8)val;
+	p[1] = (u8)(val >> 8);
+}
+
+static void yCapturePut32(u8* p, u32 val)
+{
+	yCapturePut16(p, (u16)val);
+	yCapturePut16(p + 2, (u16)(val >> 16));
+}
+
+static void yCapturePut64(u8* p, u64 val)
+{
+	yCapturePut32(p, (u32)val);
+	yCapturePut32(p + 4, (u32)(val >> 32));
+}
+
+static u16 yCaptureGet16(const u8* p)
+{
+	return (u16)(p[0] | (p[1] << 8));
+}
+
+static u32 yCaptureGet32(const u8* p)
+{
+	return yCaptureGet16(p) | ((u32)yCaptureGet16(p + 2) << 16);
+}
+
+static u64 yCaptureGet64(const u8* p)
+{
+	return yCaptureGet32(p) | ((u64)yCaptureGet32(p + 4) << 32);
+}
+
+
+YMessageCapture::YMessageCapture(YFunction* port, const string& path, s64 maxSize, int startPos):
+	_port(port), _path(path), _capacity(0), _maxWait(500), _file(NULL), _rxptr(startPos),
+	_head(0), _tail(0), _recordCount(0), _totalRecords(0), _startUTC(0), _startTick(0),
+	_lastErrorType(YAPI_SUCCESS), _lastErrorMsg("")
+{
+	memset(&_thread, 0, sizeof(_thread));
+	if (maxSize > Y_CAPTURE_HEADER_SIZE)
+	{
+		_capacity = (u64)(maxSize - Y_CAPTURE_HEADER_SIZE) & ~(u64)(Y_CAPTURE_RECORD_ALIGN - 1);
+	}
+	yInitializeCriticalSection(&_lock);
+}
+
+YMessageCapture::~YMessageCapture()
+{
+	this->stop();
+	yDeleteCriticalSection(&_lock);
+}
+
+int YMessageCapture::_writeHeader(void)
+{
+	u8 hdr[Y_CAPTURE_HEADER_SIZE];
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, "YCAP", 4);
+	yCapturePut16(hdr + 4, 1);
+	yCapturePut16(hdr + 6, Y_CAPTURE_HEADER_SIZE);
+	yCapturePut32(hdr + 8, Y_CAPTURE_RECORD_ALIGN);
+	yCapturePut32(hdr + 12, _capacity > 0 ? 1 : 0);
+	yCapturePut64(hdr + 16, _capacity);
+	yCapturePut64(hdr + 24, _head);
+	yCapturePut64(hdr + 32, _tail);
+	yCapturePut64(hdr + 40, _recordCount);
+	yCapturePut64(hdr + 48, _totalRecords);
+	yCapturePut64(hdr + 56, (u64)_startUTC);
+	if (yCaptureSeek(_file, 0) != 0 || fwrite(hdr, 1, sizeof(hdr), _file) != sizeof(hdr))
+	{
+		return YAPI_IO_ERROR;
+	}
+	return YAPI_SUCCESS;
+}
+
+// Returns the space used by the record at a given offset, or 0 if the writer wrapped there
+int YMessageCapture::_readRecordSize(u64 offset, u64& recsize)
+{
+	u8 buf[4];
+	u32 len;
+
+	recsize = 0;
+	if (offset + Y_CAPTURE_RECORD_HEAD_SIZE > _capacity)
+	{
+		return YAPI_SUCCESS;
+	}
+	if (yCaptureSeek(_file, Y_CAPTURE_HEADER_SIZE + offset) != 0 || fread(buf, 1, 4, _file) != 4)
+	{
+		return YAPI_IO_ERROR;
+	}
+	len = yCaptureGet32(buf);
+	if (len != Y_CAPTURE_WRAP_MARKER)
+	{
+		recsize = yCaptureAlign(Y_CAPTURE_RECORD_HEAD_SIZE + len);
+	}
+	return YAPI_SUCCESS;
+}
+
+// Drops the oldest records until the ring area [start,stop[ is free
+int YMessageCapture::_evict(u64 start, u64 stop)
+{
+	u64 recsize;
+
+	while (_recordCount > 0 && _tail >= start && _tail < stop)
+	{
+		if (YISERR(_readRecordSize(_tail, recsize)))
+		{
+			return YAPI_IO_ERROR;
+		}
+		if (recsize == 0)
+		{
+			if (_tail == 0)
+			{
+				return YAPI_IO_ERROR; // corrupted ring, should never happen
+			}
+			_tail = 0;
+			continue;
+		}
+		_tail += recsize;
+		_recordCount--;
+		if (_tail + Y_CAPTURE_RECORD_HEAD_SIZE > _capacity)
+		{
+			// no room left for a record after this one, the next record is at the start
+			_tail = 0;
+		}
+	}
+	return YAPI_SUCCESS;
+}
+
+int YMessageCapture::_appendRecord(int direction, u32 devStamp, const string& payload)
+{
+	u8 head[Y_CAPTURE_RECORD_HEAD_SIZE];
+	u8 padding[Y_CAPTURE_RECORD_ALIGN];
+	u64 len = payload.size();
+	u64 recsize;
+	s64 hostUTC;
+
+	if (_capacity > 0 && Y_CAPTURE_RECORD_HEAD_SIZE + len > _capacity / 2)
+	{
+		// never let a single record take over the whole ring
+		len = _capacity / 2 - Y_CAPTURE_RECORD_HEAD_SIZE;
+	}
+	recsize = yCaptureAlign(Y_CAPTURE_RECORD_HEAD_SIZE + len);
+	if (_capacity > 0)
+	{
+		if (_head + recsize > _capacity)
+		{
+			if (YISERR(_evict(_head, _capacity)))
+			{
+				return YAPI_IO_ERROR;
+			}
+			if (_head + Y_CAPTURE_RECORD_HEAD_SIZE <= _capacity)
+			{
+				memset(head, 0, sizeof(head));
+				yCapturePut32(head, Y_CAPTURE_WRAP_MARKER);
+				if (yCaptureSeek(_file, Y_CAPTURE_HEADER_SIZE + _head) != 0 ||
+					fwrite(head, 1, sizeof(head), _file) != sizeof(head))
+				{
+					return YAPI_IO_ERROR;
+				}
+			}
+			_head = 0;
+		}
+		if (YISERR(_evict(_head, _head + recsize)))
+		{
+			return YAPI_IO_ERROR;
+		}
+	}
+	hostUTC = _startUTC + (s64)(yapiGetTickCount() - _startTick);
+	memset(head, 0, sizeof(head));
+	yCapturePut32(head, (u32)len);
+	head[4] = (u8)direction;
+	yCapturePut32(head + 8, devStamp);
+	yCapturePut32(head + 12, (u32)_totalRecords);
+	yCapturePut64(head + 16, (u64)hostUTC);
+	memset(padding, 0, sizeof(padding));
+	if (yCaptureSeek(_file, Y_CAPTURE_HEADER_SIZE + _head) != 0 ||
+		fwrite(head, 1, sizeof(head), _file) != sizeof(head) ||
+		fwrite(payload.data(), 1, (size_t)len, _file) != len ||
+		fwrite(padding, 1, (size_t)(recsize - Y_CAPTURE_RECORD_HEAD_SIZE - len), _file) != recsize - Y_CAPTURE_RECORD_HEAD_SIZE - len)
+	{
+		return YAPI_IO_ERROR;
+	}
+	if (_recordCount == 0)
+	{
+		_tail = _head;
+	}
+	_head += recsize;
+	_recordCount++;
+	_totalRecords++;
+	return YAPI_SUCCESS;
+}
+
+int YMessageCapture::_pullMessages(void)
+{
+	string url;
+	string msgbin;
+	string errmsg;
+	YHTTPReply reply;
+	YJSONContent* json = NULL;
+	YJSONArray* msgarr;
+	int msglen = 0;
+	int idx = 0;
+	int res;
+
+	// the port object belongs to the application: only the serial number and
+	// device path resolved by start() are used from this thread
+	yEnterCriticalSection(&_lock);
+	url = YapiWrapper::ysprintf("rxmsg.json?pos=%d&maxw=%d&t=0", _rxptr, _maxWait);
+	yLeaveCriticalSection(&_lock);
+	res = YapiWrapper::deviceRequest(_serial, _subpath, "GET /" + url + " HTTP/1.1\r\n\r\n", reply, errmsg);
+	if (!YISERR(res))
+	{
+		msgbin = reply.bodyString();
+		reply.release();
+		try
+		{
+			json = YJSONContent::ParseJson(msgbin, 0, (int)msgbin.size());
+			if (json->getJSONType() != ARRAY)
+			{
+				res = YAPI_IO_ERROR;
+				errmsg = "JSON structure expected";
+			}
+		}
+		catch (std::exception&)
+		{
+			res = YAPI_IO_ERROR;
+			errmsg = "Invalid rxmsg.json reply";
+		}
+	}
+	if (YISERR(res))
+	{
+		if (json != NULL)
+		{
+			delete json;
+		}
+		yEnterCriticalSection(&_lock);
+		_lastErrorType = res;
+		_lastErrorMsg = errmsg;
+		yLeaveCriticalSection(&_lock);
+		return res;
+	}
+	msgarr = (YJSONArray*)json;
+	msglen = msgarr->length();
+	if (msglen == 0)
+	{
+		delete json;
+		return YAPI_SUCCESS;
+	}
+	// last element of array is the new position
+	msglen = msglen - 1;
+	yEnterCriticalSection(&_lock);
+	for (idx = 0; idx < msglen && !YISERR(res); idx++)
+	{
+		YJSONContent* item = msgarr->get(idx);
+		string msg;
+		u32 devStamp = 0;
+		int dir = Y_CAPTURE_DIR_RX;
+
+		if (item->getJSONType() == OBJECT)
+		{
+			// timestamped record: {"t":<ms>,"m":"<direction><message>"}
+			YJSONObject* rec = (YJSONObject*)item;
+			if (!rec->has("m"))
+			{
+				continue;
+			}
+			if (rec->has("t") && rec->get("t")->getJSONType() == NUMBER)
+			{
+				devStamp = (u32)rec->getLong("t");
+			}
+			msg = rec->getString("m");
+			if (msg.size() > 0 && (msg[0] == '<' || msg[0] == '>'))
+			{
+				dir = (msg[0] == '<' ? Y_CAPTURE_DIR_TX : Y_CAPTURE_DIR_RX);
+				msg = msg.substr(1);
+			}
+		}
+		else if (item->getJSONType() == STRING)
+		{
+			msg = msgarr->getString(idx);
+		}
+		else
+		{
+			continue;
+		}
+		res = _appendRecord(dir, devStamp, msg);
+	}
+	if (!YISERR(res))
+	{
+		if (msgarr->get(msglen)->getJSONType() == NUMBER)
+		{
+			_rxptr = (int)msgarr->getLong(msglen);
+		}
+		else
+		{
+			_rxptr = atoi(msgarr->getString(msglen).c_str());
+		}
+		res = _writeHeader();
+		fflush(_file);
+	}
+	if (YISERR(res))
+	{
+		_lastErrorType = res;
+		_lastErrorMsg = "Unable to write capture file " + _path;
+	}
+	yLeaveCriticalSection(&_lock);
+	delete json;
+	return res;
+}
+
+void* YMessageCapture::_captureThread(void* ctx)
+{
+	yThread* thread = (yThread*)ctx;
+	YMessageCapture* capture = (YMessageCapture*)thread->ctx;
+	u64 timeref;
+	int maxWait;
+
+	yThreadSignalStart(thread);
+	while (!yThreadMustEnd(thread))
+	{
+		if (YISERR(capture->_pullMessages()))
+		{
+			// device unreachable: retry later without hammering the hub,
+			// but no longer than a polling request would take
+			yEnterCriticalSection(&capture->_lock);
+			maxWait = capture->_maxWait;
+			yLeaveCriticalSection(&capture->_lock);
+			timeref = yapiGetTickCount();
+			while (!yThreadMustEnd(thread) && yapiGetTickCount() - timeref < (u64)maxWait)
+			{
+				yySleep(10);
+			}
+		}
+	}
+	yThreadSignalEnd(thread);
+	return NULL;
+}
+
+int YMessageCapture::start(string& errmsg)
+{
+	string hwid;
+	int res;
+
+	if (yThreadIsRunning(&_thread))
+	{
+		return YAPI_SUCCESS;
+	}
+	// resolve the device in the caller thread: the capture thread never uses
+	// the port object, which belongs to the application
+	try
+	{
+		hwid = _port->get_hardwareId();
+	}
+	catch (YAPI_Exception& ex)
+	{
+		errmsg = ex.what();
+		return ex.errorType;
+	}
+	if (hwid == YAPI_INVALID_STRING)
+	{
+		errmsg = _port->get_errorMessage();
+		return _port->get_errorType();
+	}
+	_serial = hwid.substr(0, hwid.find('.'));
+	res = YapiWrapper::getDevicePath(_serial, _subpath, errmsg);
+	if (YISERR(res))
+	{
+		return res;
+	}
+	_file = fopen(_path.c_str(), "w+b");
+	if (_file == NULL)
+	{
+		errmsg = "Unable to create capture file " + _path;
+		return YAPI_IO_ERROR;
+	}
+	_head = 0;
+	_tail = 0;
+	_recordCount = 0;
+	_totalRecords = 0;
+	_startUTC = (s64)time(NULL) * 1000;
+	_startTick = yapiGetTickCount();
+	_lastErrorType = YAPI_SUCCESS;
+	_lastErrorMsg = "";
+	memset(&_thread, 0, sizeof(_thread));
+	if (YISERR(_writeHeader()) || yThreadCreate(&_thread, _captureThread, this) < 0)
+	{
+		fclose(_file);
+		_file = NULL;
+		errmsg = "Unable to start capture on " + _path;
+		return YAPI_IO_ERROR;
+	}
+	return YAPI_SUCCESS;
+}
+
+void YMessageCapture::stop(void)
+{
+	if (_thread.st != YTHREAD_NOT_STARTED)
+	{
+		// the thread checks the request between two polls, so it ends once its
+		// pending request (at most maxWait, or the TCP timeout) has completed.
+		// It is never cancelled, since it may hold _lock or the device I/O slot
+		yThreadRequestEnd(&_thread);
+		while (yThreadIsRunning(&_thread))
+		{
+			yySleep(10);
+		}
+		memset(&_thread, 0, sizeof(_thread));
+	}
+	yEnterCriticalSection(&_lock);
+	if (_file != NULL)
+	{
+		_writeHeader();
+		fclose(_file);
+		_file = NULL;
+	}
+	yLeaveCriticalSection(&_lock);
+}
+
+int YMessageCapture::Start(YMessageCapture*& capture, YFunction* port, const string& path, s64 maxSize, int startPos, string& errmsg)
+{
+	int res;
+
+	YMessageCapture::Stop(capture);
+	capture = new YMessageCapture(port, path, maxSize, startPos);
+	res = capture->start(errmsg);
+	if (YISERR(res))
+	{
+		delete capture;
+		capture = NULL;
+	}
+	return res;
+}
+
+void YMessageCapture::Stop(YMessageCapture*& capture)
+{
+	if (capture != NULL)
+	{
+		capture->stop();
+		delete capture;
+		capture = NULL;
+	}
+}
+
+void YMessageCapture::set_maxWait(int maxWait)
+{
+	yEnterCriticalSection(&_lock);
+	_maxWait = (maxWait > 0 ? maxWait : 1);
+	yLeaveCriticalSection(&_lock);
+}
+
+bool YMessageCapture::isRunning(void)
+{
+	return yThreadIsRunning(&_thread) != 0;
+}
+
+s64 YMessageCapture::get_recordCount(void)
+{
+	s64 res;
+
+	yEnterCriticalSection(&_lock);
+	res = (s64)_recordCount;
+	yLeaveCriticalSection(&_lock);
+	return res;
+}
+
+s64 YMessageCapture::get_totalRecords(void)
+{
+	s64 res;
+
+	yEnterCriticalSection(&_lock);
+	res = (s64)_totalRecords;
+	yLeaveCriticalSection(&_lock);
+	return res;
+}
+
+int YMessageCapture::get_streamPosition(void)
+{
+	int res;
+
+	yEnterCriticalSection(&_lock);
+	res = _rxptr;
+	yLeaveCriticalSection(&_lock);
+	return res;
+}
+
+int YMessageCapture::get_errorType(void)
+{
+	int res;
+
+	yEnterCriticalSection(&_lock);
+	res = _lastErrorType;
+	yLeaveCriticalSection(&_lock);
+	return res;
+}
+
+string YMessageCapture::get_errorMessage(void)
+{
+	string res;
+
+	yEnterCriticalSection(&_lock);
+	res = _lastErrorMsg;
+	yLeaveCriticalSection(&_lock);
+	return res;
+}
+
+
+YMessageCaptureReader::YMessageCaptureReader():
+	_file(NULL), _capacity(0), _pos(0), _remaining(0), _recordCount(0), _startUTC(0)
+{
+}
+
+YMessageCaptureReader::~YMessageCaptureReader()
+{
+	this->close();
+}
+
+int YMessageCaptureReader::open(const string& path, string& errmsg)
+{
+	u8 hdr[Y_CAPTURE_HEADER_SIZE];
+
+	this->close();
+	_file = fopen(path.c_str(), "rb");
+	if (_file == NULL)
+	{
+		errmsg = "Unable to open capture file " + path;
+		return YAPI_FILE_NOT_FOUND;
+	}
+	if (fread(hdr, 1, sizeof(hdr), _file) != sizeof(hdr) || memcmp(hdr, "YCAP", 4) != 0 ||
+		yCaptureGet16(hdr + 4) != 1 || yCaptureGet16(hdr + 6) != Y_CAPTURE_HEADER_SIZE)
+	{
+		this->close();
+		errmsg = "Invalid capture file " + path;
+		return YAPI_INVALID_ARGUMENT;
+	}
+	_capacity = yCaptureGet64(hdr + 16);
+	_pos = yCaptureGet64(hdr + 32);
+	_recordCount = yCaptureGet64(hdr + 40);
+	_startUTC = (s64)yCaptureGet64(hdr + 56);
+	_remaining = _recordCount;
+	return YAPI_SUCCESS;
+}
+
+bool YMessageCaptureReader::next(YCaptureRecord& record)
+{
+	u8 head[Y_CAPTURE_RECORD_HEAD_SIZE];
+	u32 len;
+	int wraps = 0;
+
+	while (_file != NULL && _remaining > 0 && wraps < 2)
+	{
+		if (_capacity > 0 && _pos + Y_CAPTURE_RECORD_HEAD_SIZE > _capacity)
+		{
+			_pos = 0;
+			wraps++;
+			continue;
+		}
+		if (yCaptureSeek(_file, Y_CAPTURE_HEADER_SIZE + _pos) != 0 || fread(head, 1, sizeof(head), _file) != sizeof(head))
+		{
+			break;
+		}
+		len = yCaptureGet32(head);
+		if (len == Y_CAPTURE_WRAP_MARKER)
+		{
+			_pos = 0;
+			wraps++;
+			continue;
+		}
+		if (_capacity > 0 && _pos + Y_CAPTURE_RECORD_HEAD_SIZE + len > _capacity)
+		{
+			break;
+		}
+		record.direction = head[4];
+		record.devStamp = yCaptureGet32(head + 8);
+		record.seqNo = yCaptureGet32(head + 12);
+		record.hostUTC = (s64)yCaptureGet64(head + 16);
+		record.payload.resize(len);
+		if (len > 0 && fread(&record.payload[0], 1, len, _file) != len)
+		{
+			break;
+		}
+		_pos += yCaptureAlign(Y_CAPTURE_RECORD_HEAD_SIZE + len);
+		_remaining--;
+		return true;
+	}
+	_remaining = 0;
+	return false;
+}
+
+void YMessageCaptureReader::close(void)
+{
+	if (_file != NULL)
+	{
+		fclose(_file);
+		_file = NULL;
+	}
+	_remaining = 0;
+}
+
+s64 YMessageCaptureReader::get_recordCount(void)
+{
+	return (s64)_recordCount;
+}
+
+s64 YMessageCaptureReader::get_startUTC(void)
+{
+	return _startUTC;
+}
+
+
+// Attributes that are never restored (read-only, volatile or security-related),
+// used by both YModule::set_allSettings() and YSettingsSync
+static const char* ySettingsSkippedAttrs[] = {
+	"firmwareRelease", "usbCurrent", "upTime", "persistentSettings", "adminPassword", "userPassword",
+	"rebootCountdown", "advertisedValue", "poeCurrent", "readiness", "ipAddress", "subnetMask", "router",
+	"linkQuality", "ssid", "channel", "security", "message", "currentValue", "currentRawValue",
+	"currentRunIndex", "pulseTimer", "lastTimePressed", "lastTimeReleased", "filesCount", "freeSpace",
+	"timeUTC", "rtcTime", "unixTime", "dateTime", "rawValue", "lastMsg", "delayedPulseTimer", "rxCount",
+	"txCount", "msgCount", NULL
+};
+
+static bool ySettingsIsSkipped(const string& attr)
+{
+	const char** skip = ySettingsSkippedAttrs;
+	while (*skip && attr != *skip)
+	{
+		skip++;
+	}
+	return (*skip != NULL);
+}
+
+YSettingsSync::YSettingsSync(int maxThreads) : _maxThreads(maxThreads > 0 ? maxThreads : 1), _dryRun(false)
+{
+}
+
+YSettingsSync::~YSettingsSync()
+{
+	wait();
+}
+
+void YSettingsSync::addBackup(const string& serial)
+{
+	if (_jobs.find(serial) >= 0)
+	{
+		return;
+	}
+	Job& job = _jobs.add(serial);
+	job.restore = false;
+	job.module = NULL;
+	job.progress = 0;
+	job.message = "waiting";
+}
+
+void YSettingsSync::addRestore(const string& serial, const string& settings)
+{
+	addBackup(serial);
+	Job& job = _jobs.add(serial);
+	job.restore = true;
+	job.settings = settings;
+}
+
+void YSettingsSync::set_dryRun(bool dryRun)
+{
+	_dryRun = dryRun;
+}
+
+void YSettingsSync::_setProgress(Job& job, int done, int total)
+{
+	_jobs.setProgress(job, (total > 0 ? done * 99 / total : 0),
+	                  (job.restore ? (_dryRun ? "comparing settings" : "restoring settings") : "reading settings"));
+}
+
+int YSettingsSync::_get(Job& job, const string& url, string& body, string& errmsg)
+{
+	YHTTPReply reply;
+	int res;
+
+	res = YapiWrapper::deviceRequest(job.serial, job.subpath, "GET /" + url + " HTTP/1.1\r\n\r\n", reply, errmsg);
+	if (YISERR(res))
+	{
+		return res;
+	}
+	body = reply.bodyString();
+	return YAPI_SUCCESS;
+}
+
+// Same as YFunction::_upload, but usable from a worker thread
+int YSettingsSync::_upload(Job& job, const string& name, const string& data, string& errmsg)
+{
+	string request, boundary;
+	YHTTPReply reply;
+
+	string body = "Content-Disposition: form-data; name=\"" + name + "\"; filename=\"api\"\r\n" +
+		"Content-Type: application/octet-stream\r\n" +
+		"Content-Transfer-Encoding: binary\r\n\r\n" + data;
+	do
+	{
+		boundary = YapiWrapper::ysprintf("Zz%06xzZ", rand() & 0xffffff);
+	}
+	while (body.find(boundary) != string::npos);
+	request = "POST /upload.html HTTP/1.1\r\nContent-Type: multipart/form-data; boundary=" + boundary + "\r\n";
+	request += "\r\n--" + boundary + "\r\n" + body + "\r\n--" + boundary + "--\r\n";
+	return YapiWrapper::deviceRequest(job.serial, job.subpath, request, reply, errmsg);
+}
+
+// Produces the same document as YModule::get_allSettings(), but reads the firmware
+// release from api.json instead of loading the module function
+int YSettingsSync::_backupJob(Job& job, string& errmsg)
+{
+	YModule* m = job.module;
+	string api, ext_settings, sep, item, t_type, id, json, name, data;
+	vector<string> filelist;
+	bool hasFiles = false;
+	int fwrel, done = 1, total;
+	int res;
+
+	res = _get(job, "api.json", api, errmsg);
+	if (YISERR(res))
+	{
+		return res;
+	}
+	if (api.size() == 0)
+	{
+		errmsg = "empty api.json";
+		return YAPI_IO_ERROR;
+	}
+	for (unsigned i = 0; i < job.functions.size() && !hasFiles; i++)
+	{
+		hasFiles = (job.functions[i] == "files");
+	}
+	if (hasFiles)
+	{
+		res = _get(job, "files.json?a=dir&f=", json, errmsg);
+		if (YISERR(res))
+		{
+			return res;
+		}
+		filelist = m->_json_get_array(json);
+		done++;
+	}
+	fwrel = atoi(m->_decode_json_string(m->_get_json_path(api, "module|firmwareRelease")).c_str());
+	total = done + (int)filelist.size() + (fwrel > 9000 ? 2 * (int)job.temperatures.size() : 0);
+	_setProgress(job, done, total);
+
+	ext_settings = ", \"extras\":[";
+	if (fwrel > 9000)
+	{
+		for (unsigned i = 0; i < job.temperatures.size(); i++)
+		{
+			res = _get(job, YapiWrapper::ysprintf("api/%s/sensorType", job.temperatures[i].c_str()), t_type, errmsg);
+			if (YISERR(res))
+			{
+				return res;
+			}
+			_setProgress(job, ++done, total);
+			if (t_type == "RES_NTC")
+			{
+				id = job.temperatures[i].substr(11);
+				res = _get(job, YapiWrapper::ysprintf("extra.json?page=%s", id.c_str()), data, errmsg);
+				if (YISERR(res))
+				{
+					return res;
+				}
+				if (data.size() == 0)
+				{
+					errmsg = "empty thermistor table";
+					return YAPI_IO_ERROR;
+				}
+				item = YapiWrapper::ysprintf("%s{\"fid\":\"%s\", \"json\":%s}\n", sep.c_str(), job.temperatures[i].c_str(), data.c_str());
+				ext_settings += item;
+				sep = ",";
+			}
+			_setProgress(job, ++done, total);
+		}
+	}
+	ext_settings += "],\n\"files\":[";
+	sep = "";
+	for (unsigned i = 0; i < filelist.size(); i++)
+	{
+		name = m->_json_get_key(filelist[i], "name");
+		if (name.length() > 0 && name != "startupConf.json")
+		{
+			res = _get(job, m->_escapeAttr(name), data, errmsg);
+			if (YISERR(res))
+			{
+				return res;
+			}
+			item = YapiWrapper::ysprintf("%s{\"name\":\"%s\", \"data\":\"%s\"}\n", sep.c_str(), name.c_str(), YAPI::_bin2HexStr(data).c_str());
+			ext_settings += item;
+			sep = ",";
+		}
+		_setProgress(job, ++done, total);
+	}
+	_jobs.lock();
+	job.settings = "{ \"api\":" + api + ext_settings + "]}";
+	_jobs.unlock();
+	return YAPI_SUCCESS;
+}
+
+// Computes once the list of requests needed to restore the settings, with the same
+// rules as YModule::set_allSettingsAndFiles(). Attribute values are looked up by
+// path instead of scanning both flattened lists for every attribute.
+int YSettingsSync::_planChanges(Job& job, const string& settings, vector<Step>& plan, string& errmsg)
+{
+	YModule* m = job.module;
+	string api, extras, files, actual, each, jpath, fun, attr, newval, oldval, url;
+	vector<string> list, values, restoreLast;
+	std::map<string, string> oldSettings, curSettings;
+	std::map<string, string>::iterator it;
+	Step step;
+	size_t pos;
+	bool hasFiles = false;
+	int res;
+
+	for (unsigned i = 0; i < job.functions.size() && !hasFiles; i++)
+	{
+		hasFiles = (job.functions[i] == "files");
+	}
+	api = m->_get_json_path(settings, "api");
+	if (api == "")
+	{
+		// plain api.json backup, without extras nor files
+		api = settings;
+		hasFiles = false;
+	}
+	else
+	{
+		extras = m->_get_json_path(settings, "extras");
+		files = m->_get_json_path(settings, "files");
+	}
+
+	// thermistor tables first, as set_extraSettings()
+	list = (extras == "" ? vector<string>() : m->_json_get_array(extras));
+	for (unsigned i = 0; i < list.size(); i++)
+	{
+		fun = m->_decode_json_string(m->_get_json_path(list[i], "fid"));
+		if (std::find(job.functions.begin(), job.functions.end(), fun) == job.functions.end())
+		{
+			continue;
+		}
+		step.url = "api/" + fun + ".json?command=Z";
+		plan.push_back(step);
+		values = m->_json_get_array(m->_get_json_path(list[i], "json"));
+		for (unsigned j = 0; j + 1 < values.size(); j += 2)
+		{
+			step.url = YapiWrapper::ysprintf("api/%s/.json?command=m%s:%s", fun.c_str(), values[j].c_str(), values[j + 1].c_str());
+			plan.push_back(step);
+		}
+	}
+
+	// attribute diff, as set_allSettings()
+	list = m->_json_get_array(m->_flattenJsonStruct(api));
+	for (unsigned i = 0; i < list.size(); i++)
+	{
+		each = m->_json_get_string(list[i]);
+		pos = each.find('=');
+		if (pos == string::npos || pos == 0)
+		{
+			errmsg = "Invalid settings";
+			return YAPI_INVALID_ARGUMENT;
+		}
+		oldSettings.insert(std::make_pair(each.substr(0, pos), each.substr(pos + 1)));
+	}
+	res = _get(job, "api.json", actual, errmsg);
+	if (YISERR(res))
+	{
+		return res;
+	}
+	list = m->_json_get_array(m->_flattenJsonStruct(actual));
+	values.clear();
+	for (unsigned i = 0; i < list.size(); i++)
+	{
+		each = m->_json_get_string(list[i]);
+		pos = each.find('=');
+		if (pos == string::npos || pos == 0)
+		{
+			errmsg = "Invalid settings";
+			return YAPI_INVALID_ARGUMENT;
+		}
+		jpath = each.substr(0, pos);
+		curSettings.insert(std::make_pair(jpath, each.substr(pos + 1)));
+		values.push_back(jpath);
+	}
+	for (unsigned i = 0; i < values.size(); i++)
+	{
+		jpath = values[i];
+		pos = jpath.find('/');
+		if (pos == string::npos)
+		{
+			continue;
+		}
+		fun = jpath.substr(0, pos);
+		attr = jpath.substr(pos + 1);
+		if (fun == "services")
+		{
+			continue;
+		}
+		it = oldSettings.find(jpath);
+		if (ySettingsIsSkipped(attr) || it == oldSettings.end())
+		{
+			continue;
+		}
+		oldval = it->second;
+		newval = curSettings[jpath];
+		if (newval == oldval)
+		{
+			continue;
+		}
+		if (attr == "calibrationParam")
+		{
+			newval = m->calibConvert(oldval, newval, curSettings[fun + "/unit"], curSettings[fun + "/sensorType"]);
+			step.url = "api/" + fun + ".json?" + attr + "=" + m->_escapeAttr(newval);
+			plan.push_back(step);
+		}
+		else
+		{
+			url = "api/" + fun + ".json?" + attr + "=" + m->_escapeAttr(oldval);
+			if (attr == "resolution")
+			{
+				restoreLast.push_back(url);
+			}
+			else
+			{
+				step.url = url;
+				plan.push_back(step);
+			}
+		}
+	}
+	for (unsigned i = 0; i < restoreLast.size(); i++)
+	{
+		step.url = restoreLast[i];
+		plan.push_back(step);
+	}
+
+	// uploaded files last, as set_allSettingsAndFiles()
+	if (hasFiles)
+	{
+		step.url = "files.json?a=format";
+		plan.push_back(step);
+		list = (files == "" ? vector<string>() : m->_json_get_array(files));
+		for (unsigned i = 0; i < list.size(); i++)
 		{
-			stream = _streams[ii];
+			step.url = "";
+			step.name = m->_decode_json_string(m->_get_json_path(list[i], "name"));
+			step.data = YAPI::_hexStr2Bin(m->_decode_json_string(m->_get_json_path(list[i], "data")));
+			plan.push_back(step);
 		}
 	}
-	if (stream == NULL)
+	return YAPI_SUCCESS;
+}
+
+int YSettingsSync::_restoreJob(Job& job, string& errmsg)
+{
+	vector<Step> plan;
+	vector<string> changes;
+	string reply;
+	int res;
+
+	res = _planChanges(job, job.settings, plan, errmsg);
+	if (YISERR(res))
 	{
-		return measures;
+		return res;
 	}
-	dataRows = stream->get_dataRows();
-	if ((int)dataRows.size() == 0)
+	for (unsigned i = 0; i < plan.size(); i++)
 	{
-		return measures;
+		changes.push_back(plan[i].url != "" ? plan[i].url :
+		                  YapiWrapper::ysprintf("upload %s (%d bytes)", plan[i].name.c_str(), (int)plan[i].data.size()));
 	}
-	tim = (double)stream->get_startTimeUTC();
-	itv = stream->get_dataSamplesInterval();
-	if (tim < itv)
+	_jobs.lock();
+	job.changes = changes;
+	_jobs.unlock();
+	if (_dryRun)
 	{
-		tim = itv;
+		return YAPI_SUCCESS;
 	}
-	nCols = (int)dataRows[0].size();
-	minCol = 0;
-	if (nCols > 2)
+	for (unsigned i = 0; i < plan.size(); i++)
 	{
-		avgCol = 1;
+		_setProgress(job, (int)i + 1, (int)plan.size() + 1);
+		if (plan[i].url == "")
+		{
+			res = _upload(job, plan[i].name, plan[i].data, errmsg);
+		}
+		else
+		{
+			res = _get(job, plan[i].url, reply, errmsg);
+			if (!YISERR(res) && plan[i].url == "files.json?a=format" &&
+				job.module->_decode_json_string(job.module->_get_json_path(reply, "res")) != "ok")
+			{
+				errmsg = "format failed";
+				res = YAPI_IO_ERROR;
+			}
+		}
+		if (YISERR(res))
+		{
+			return res;
+		}
 	}
-	else
+	return YAPI_SUCCESS;
+}
+
+void YSettingsSync::_runJob(void* ctx, unsigned idx)
+{
+	YSettingsSync* sync = (YSettingsSync*)ctx;
+	Job& job = sync->_jobs[idx];
+	string errmsg;
+	int res;
+
+	if (job.progress != 0)
 	{
-		avgCol = 0;
+		// the module could not be resolved by start()
+		return;
 	}
-	if (nCols > 2)
+	try
 	{
-		maxCol = 2;
+		res = (job.restore ? sync->_restoreJob(job, errmsg) : sync->_backupJob(job, errmsg));
+	}
+	catch (YAPI_Exception& ex)
+	{
+		res = ex.errorType;
+		errmsg = ex.what();
+	}
+	if (YISERR(res))
+	{
+		sync->_jobs.setProgress(job, res, errmsg);
 	}
 	else
 	{
-		maxCol = 0;
+		sync->_jobs.setProgress(job, 100, "success");
 	}
+}
 
-	for (unsigned ii = 0; ii < dataRows.size(); ii++)
+int YSettingsSync::start(string& errmsg)
+{
+	int res;
+
+	if (_pool.isRunning())
 	{
-		if ((tim >= _startTime) && ((_endTime == 0) || (tim <= _endTime)))
+		errmsg = "Settings synchronization already started";
+		return YAPI_INVALID_ARGUMENT;
+	}
+	// resolve the devices and their functions in the caller thread, where
+	// the device list may safely be updated
+	for (unsigned i = 0; i < _jobs.size(); i++)
+	{
+		Job& job = _jobs[i];
+		job.progress = 0;
+		job.message = "waiting";
+		job.changes.clear();
+		if (!job.restore)
 		{
-			measures.push_back(YMeasure(tim - itv, tim,
-			                            dataRows[ii][minCol],
-			                            dataRows[ii][avgCol], dataRows[ii][maxCol]));
+			job.settings = "";
+		}
+		res = YapiWrapper::getDevicePath(job.serial, job.subpath, job.message);
+		if (YISERR(res))
+		{
+			job.progress = res;
+			continue;
+		}
+		job.module = YModule::FindModule(job.serial + ".module");
+		job.functions.clear();
+		try
+		{
+			int count = job.module->functionCount();
+			for (int f = 0; f < count; f++)
+			{
+				job.functions.push_back(job.module->functionId(f));
+			}
+			job.temperatures = job.module->get_functionIds("Temperature");
+		}
+		catch (YAPI_Exception& ex)
+		{
+			job.progress = ex.errorType;
+			job.message = ex.what();
 		}
-		tim = tim + itv;
 	}
-	return measures;
+	if (_jobs.size() > 0 && _pool.start(_maxThreads, _jobs.size(), _runJob, this) <= 0)
+	{
+		errmsg = "Unable to start worker threads";
+		return YAPI_IO_ERROR;
+	}
+	return YAPI_SUCCESS;
 }
 
-/**
- * Returns all measured values currently available for this DataSet,
- * as a list of YMeasure objects. Each item includes:
- * - the start of the measure time interval
- * - the end of the measure time interval
- * - the minimal value observed during the time interval
- * - the average value observed during the time interval
- * - the maximal value observed during the time interval
- *
- * Before calling this method, you should call loadMore()
- * to load data from the device. You may have to call loadMore()
- * several time until all rows are loaded, but you can start
- * looking at available data rows before the load is complete.
- *
- * The oldest measures are always loaded first, and the most
- * recent measures will be loaded last. As a result, timestamps
- * are normally sorted in ascending order within the measure table,
- * unless there was an unexpected adjustment of the datalogger UTC
- * clock.
- *
- * @return a table of records, where each record depicts the
- *         measured value for a given time interval
- *
- * On failure, throws an exception or returns an empty array.
- */
-vector<YMeasure> YDataSet::get_measures(void)
+void YSettingsSync::wait(void)
 {
-	return _measures;
+	_pool.wait();
 }
 
-//--- (end of generated code: YDataSet implementation)
+bool YSettingsSync::isDone(void)
+{
+	return _jobs.isDone();
+}
+
+int YSettingsSync::get_globalProgress(void)
+{
+	return _jobs.globalProgress();
+}
+
+int YSettingsSync::get_errorCount(void)
+{
+	return _jobs.errorCount();
+}
+
+vector<string> YSettingsSync::get_serials(void)
+{
+	return _jobs.serials();
+}
+
+int YSettingsSync::get_progress(const string& serial)
+{
+	return _jobs.progress(serial);
+}
+
+string YSettingsSync::get_progressMessage(const string& serial)
+{
+	return _jobs.message(serial);
+}
+
+string YSettingsSync::get_settings(const string& serial)
+{
+	string res;
+	int idx = _jobs.find(serial);
+	_jobs.lock();
+	if (idx >= 0 && !_jobs[idx].restore)
+	{
+		res = _jobs[idx].settings;
+	}
+	_jobs.unlock();
+	return res;
+}
+
+vector<string> YSettingsSync::get_changes(const string& serial)
+{
+	vector<string> res;
+	int idx = _jobs.find(serial);
+	_jobs.lock();
+	if (idx >= 0)
+	{
+		res = _jobs[idx].changes;
+	}
+	_jobs.unlock();
+	return res;
+}
 
 
-std::map<string, YFunction*> YFunction::_cache;
+vector<YFunction::CacheEntry> YFunction::_cache;
+int YFunction::_cacheCount = 0;
+vector<string> YFunction::_cacheClasses;
+vector<std::pair<const char*, int> > YFunction::_cacheClassPtrs;
 
 
 // Constructor is protected. Use the device-specific factory function to instantiate
@@ -2459,28 +4416,192 @@ YFunction::~YFunction()
 }
 
 
+// FNV-1a hash of a function name, combined with the class id
+static u32 yFunctionCacheHash(int classId, const string& func)
+{
+	u32 h = 2166136261u ^ (u32)classId;
+	for (size_t i = 0; i < func.length(); i++)
+	{
+		h = (h ^ (u8)func[i]) * 16777619u;
+	}
+	return h;
+}
+
+// Class names are usually passed as string literals by the FindXxx functions,
+// so the id found for a pointer is remembered. The name is still compared with
+// the interned one, so that a reused buffer never maps to a stale class
+int YFunction::_CacheClassId(const char* classname, bool isLiteral)
+{
+	unsigned i;
+	unsigned slot = 0;
+	if (isLiteral)
+	{
+		for (slot = 0; slot < _cacheClassPtrs.size(); slot++)
+		{
+			if (_cacheClassPtrs[slot].first == classname)
+			{
+				i = (unsigned)_cacheClassPtrs[slot].second;
+				if (_cacheClasses[i] == classname)
+				{
+					return (int)i;
+				}
+				break;
+			}
+		}
+	}
+	for (i = 0; i < _cacheClasses.size(); i++)
+	{
+		if (_cacheClasses[i] == classname)
+		{
+			break;
+		}
+	}
+	if (i == _cacheClasses.size())
+	{
+		_cacheClasses.push_back(classname);
+	}
+	if (isLiteral)
+	{
+		if (slot < _cacheClassPtrs.size())
+		{
+			_cacheClassPtrs[slot].second = (int)i;
+		}
+		else
+		{
+			_cacheClassPtrs.push_back(std::make_pair(classname, (int)i));
+		}
+	}
+	return (int)i;
+}
+
+// Returns the slot holding the function, or the free slot where it belongs
+int YFunction::_CacheLookup(int classId, u32 hash, const string& func)
+{
+	int mask = (int)_cache.size() - 1;
+	int idx = (int)(hash & mask);
+	while (_cache[idx].obj != NULL)
+	{
+		const CacheEntry& entry = _cache[idx];
+		if (entry.hash == hash && entry.classId == classId && entry.obj->_func == func)
+		{
+			break;
+		}
+		idx = (idx + 1) & mask;
+	}
+	return idx;
+}
+
+void YFunction::_CacheGrow(void)
+{
+	vector<CacheEntry> old;
+	old.swap(_cache);
+	CacheEntry empty = {0, 0, NULL};
+	_cache.assign(old.size() ? 2 * old.size() : 64, empty);
+	int mask = (int)_cache.size() - 1;
+	for (unsigned i = 0; i < old.size(); i++)
+	{
+		if (old[i].obj != NULL)
+		{
+			int idx = (int)(old[i].hash & mask);
+			while (_cache[idx].obj != NULL)
+			{
+				idx = (idx + 1) & mask;
+			}
+			_cache[idx] = old[i];
+		}
+	}
+}
+
 // function cache methods
+YFunction* YFunction::_FindFromCache(int classId, const string& func)
+{
+	if (_cacheCount == 0)
+	{
+		return NULL;
+	}
+	return _cache[_CacheLookup(classId, yFunctionCacheHash(classId, func), func)].obj;
+}
+
 YFunction* YFunction::_FindFromCache(const string& classname, const string& func)
 {
-	if (_cache.find(classname + "_" + func) != _cache.end())
-		return _cache[classname + "_" + func];
-	return NULL;
+	return _FindFromCache(_CacheClassId(classname.c_str(), false), func);
+}
+
+YFunction* YFunction::_FindFromCache(const char* classname, const string& func)
+{
+	return _FindFromCache(_CacheClassId(classname, true), func);
+}
+
+void YFunction::_AddToCache(int classId, const string& func, YFunction* obj)
+{
+	// keep the load factor below 1/2
+	if (2 * (_cacheCount + 1) > (int)_cache.size())
+	{
+		_CacheGrow();
+	}
+	u32 hash = yFunctionCacheHash(classId, func);
+	int idx = _CacheLookup(classId, hash, func);
+	if (_cache[idx].obj == NULL)
+	{
+		_cacheCount++;
+	}
+	_cache[idx].hash = hash;
+	_cache[idx].classId = classId;
+	_cache[idx].obj = obj;
 }
 
 void YFunction::_AddToCache(const string& classname, const string& func, YFunction* obj)
 {
-	_cache[classname + "_" + func] = obj;
+	_AddToCache(_CacheClassId(classname.c_str(), false), func, obj);
+}
+
+void YFunction::_AddToCache(const char* classname, const string& func, YFunction* obj)
+{
+	_AddToCache(_CacheClassId(classname, true), func, obj);
 }
 
 void YFunction::_ClearCache()
 {
-	for (std::map<string, YFunction*>::iterator cache_iterator = _cache.begin();
-	     cache_iterator != _cache.end(); ++cache_iterator)
+	for (unsigned i = 0; i < _cache.size(); i++)
+	{
+		if (_cache[i].obj != NULL)
+		{
+			delete _cache[i].obj;
+		}
+	}
+	_cache = vector<CacheEntry>();
+	_cacheCount = 0;
+	// the callback lists only hold pointers to the objects deleted above
+	_FunctionCallbacks.clear();
+	_TimedReportCallbackList.clear();
+	// class names may come from a library that is about to be unloaded
+	_cacheClassPtrs.clear();
+}
+
+vector<string> YFunction::_GetHardwareIdsByClass(const string& className)
+{
+	vector<YFUN_DESCR> v_fundescr;
+	vector<string> res;
+	string errmsg;
+
+	if (YISERR(YapiWrapper::getFunctionsByClass(className, 0, v_fundescr, sizeof(YFUN_DESCR), errmsg)))
+	{
+		return res;
+	}
+	res.reserve(v_fundescr.size());
+	for (unsigned i = 0; i < v_fundescr.size(); i++)
 	{
-		delete cache_iterator->second;
+		char serial[YOCTO_SERIAL_LEN];
+		char funcId[YOCTO_FUNCTION_LEN];
+		char errbuf[YOCTO_ERRMSG_LEN];
+		YDEV_DESCR devdescr;
+		if (YISERR(yapiGetFunctionInfo(v_fundescr[i], &devdescr, serial, funcId, NULL, NULL, errbuf)))
+		{
+			continue;
+		}
+		res.push_back(string(serial) + "." + funcId);
 	}
-	_cache.clear();
-	_cache = std::map<string, YFunction*>();
+	return res;
 }
 
 
@@ -2966,10 +5087,15 @@ string YFunction::_json_get_key(const string& json, const string& key)
 }
 
 string YFunction::_json_get_string(const string& json)
+{
+	return _json_get_string(json.data(), (int)json.size());
+}
+
+string YFunction::_json_get_string(const char* json, int len)
 {
 	yJsonStateMachine j;
-	j.src = json.c_str();
-	j.end = j.src + strlen(j.src);
+	j.src = json;
+	j.end = j.src + len;
 	j.st = YJSON_START;
 	if (yJsonParse(&j) != YJSON_PARSE_AVAIL || j.st != YJSON_PARSE_STRING)
 	{
@@ -3202,10 +5328,10 @@ YRETCODE YFunction::_setAttr(string attrname, string newvalue)
 
 
 // Method used to send http request to the device (not the function)
-string YFunction::_requestEx(int channel, const string& request, yapiRequestProgressCallback callback, void* context)
+YRETCODE YFunction::_requestEx(int channel, const string& request, YHTTPReply& reply, yapiRequestProgressCallback callback, void* context)
 {
 	YDevice* dev;
-	string errmsg, buffer;
+	string errmsg;
 	int res;
 
 
@@ -3214,9 +5340,9 @@ string YFunction::_requestEx(int channel, const string& request, yapiRequestProg
 	if (YISERR(res))
 	{
 		_throw((YRETCODE)res, errmsg);
-		return YAPI_INVALID_STRING;
+		return (YRETCODE)res;
 	}
-	res = dev->HTTPRequest(channel, request, buffer, callback, context, errmsg);
+	res = dev->HTTPRequest(channel, request, reply, callback, context, errmsg);
 	if (YISERR(res))
 	{
 		// Check if an update of the device list does notb solve the issue
@@ -3224,24 +5350,33 @@ string YFunction::_requestEx(int channel, const string& request, yapiRequestProg
 		if (YISERR(res))
 		{
 			this->_throw((YRETCODE)res, errmsg);
-			return YAPI_INVALID_STRING;
+			return (YRETCODE)res;
 		}
-		res = dev->HTTPRequest(channel, request, buffer, callback, context, errmsg);
+		res = dev->HTTPRequest(channel, request, reply, callback, context, errmsg);
 		if (YISERR(res))
 		{
 			this->_throw((YRETCODE)res, errmsg);
-			return YAPI_INVALID_STRING;
+			return (YRETCODE)res;
 		}
 	}
-	if (0 != buffer.find("OK\r\n"))
+	if (!reply._isSuccess())
 	{
-		if (0 != buffer.find("HTTP/1.1 200 OK\r\n"))
-		{
-			this->_throw(YAPI_IO_ERROR, "http request failed");
-			return YAPI_INVALID_STRING;
-		}
+		reply.release();
+		this->_throw(YAPI_IO_ERROR, "http request failed");
+		return YAPI_IO_ERROR;
+	}
+	return YAPI_SUCCESS;
+}
+
+string YFunction::_requestEx(int channel, const string& request, yapiRequestProgressCallback callback, void* context)
+{
+	YHTTPReply reply;
+
+	if (YISERR(_requestEx(channel, request, reply, callback, context)))
+	{
+		return YAPI_INVALID_STRING;
 	}
-	return buffer;
+	return string(reply.data(), reply.size());
 }
 
 string YFunction::_request(const string& request)
@@ -3251,30 +5386,43 @@ string YFunction::_request(const string& request)
 
 
 // Method used to send http request to the device (not the function)
-string YFunction::_download(const string& url)
+YRETCODE YFunction::_download(const string& url, YHTTPReply& reply)
 {
-	string request, buffer;
-	size_t found;
+	YRETCODE res;
 
-	request = "GET /" + url + " HTTP/1.1\r\n\r\n";
-	buffer = this->_request(request);
-	found = buffer.find("\r\n\r\n");
-	if (string::npos == found)
+	res = this->_requestEx(0, "GET /" + url + " HTTP/1.1\r\n\r\n", reply, NULL, NULL);
+	if (YISERR(res))
+	{
+		return res;
+	}
+	if (!reply._skipHeader())
 	{
+		reply.release();
 		this->_throw(YAPI_IO_ERROR, "http request failed");
-		return YAPI_INVALID_STRING;
+		return YAPI_IO_ERROR;
 	}
+	return YAPI_SUCCESS;
+}
 
-	return buffer.substr(found + 4);
+string YFunction::_download(const string& url)
+{
+	YHTTPReply reply;
+
+	if (YISERR(this->_download(url, reply)))
+	{
+		return YAPI_INVALID_STRING;
+	}
+	return reply.bodyString();
 }
 
 
 // Method used to upload a file to the device
 YRETCODE YFunction::_uploadWithProgress(const string& path, const string& content, yapiRequestProgressCallback callback, void* context)
 {
-	string request, buffer;
+	string request;
 	string boundary;
-	size_t found;
+	YHTTPReply reply;
+	YRETCODE res;
 
 	request = "POST /upload.html HTTP/1.1\r\n";
 	string body = "Content-Disposition: form-data; name=\"" + path + "\"; filename=\"api\"\r\n" +
@@ -3287,9 +5435,12 @@ YRETCODE YFunction::_uploadWithProgress(const string& path, const string& conten
 	while (body.find(boundary) != string::npos);
 	request += "Content-Type: multipart/form-data; boundary=" + boundary + "\r\n";
 	request += "\r\n--" + boundary + "\r\n" + body + "\r\n--" + boundary + "--\r\n";
-	buffer = this->_requestEx(0, request, callback, context);
-	found = buffer.find("\r\n\r\n");
-	if (string::npos == found)
+	res = this->_requestEx(0, request, reply, callback, context);
+	if (YISERR(res))
+	{
+		return res;
+	}
+	if (!reply._skipHeader())
 	{
 		this->_throw(YAPI_IO_ERROR, "http request failed");
 		return YAPI_IO_ERROR;
@@ -3545,7 +5696,7 @@ bool YFunction::isOnline(void)
 
 YRETCODE YFunction::_load_unsafe(int msValidity)
 {
-	YJSONObject *j, *node;
+	YJSONObject* node;
 	YDevice* dev;
 	string errmsg;
 	YFUN_DESCR fundescr;
@@ -3554,20 +5705,13 @@ YRETCODE YFunction::_load_unsafe(int msValidity)
 	char serial[YOCTO_SERIAL_LEN];
 	char funcId[YOCTO_FUNCTION_LEN];
 
-	// Resolve our reference to our device, load REST API
+	// Resolve our reference to our device
 	res = _getDevice(dev, errmsg);
 	if (YISERR(res))
 	{
 		_throw((YRETCODE)res, errmsg);
 		return (YRETCODE)res;
 	}
-	res = dev->requestAPI(j, errmsg);
-	if (YISERR(res))
-	{
-		_throw((YRETCODE)res, errmsg);
-		return (YRETCODE)res;
-	}
-
 	// Get our function Id
 	fundescr = YapiWrapper::getFunction(_className, _func, errmsg);
 	if (YISERR(fundescr))
@@ -3581,21 +5725,28 @@ YRETCODE YFunction::_load_unsafe(int msValidity)
 		_throw((YRETCODE)res, errbuf);
 		return (YRETCODE)res;
 	}
+
+	// Load REST API, only our own function is parsed
+	res = dev->requestFunctionAPI(funcId, node, errmsg);
+	if (YISERR(res))
+	{
+		_throw((YRETCODE)res, errmsg);
+		return (YRETCODE)res;
+	}
 	_cacheExpiration = yapiGetTickCount() + msValidity;
 	_serial = serial;
 	_funId = funcId;
 	_hwId = _serial + '.' + _funId;
-
 	try
 	{
-		node = j->getYJSONObject(funcId);
+		_parse(node);
 	}
-	catch (std::exception ex)
+	catch (std::exception)
 	{
-		_throw(YAPI_IO_ERROR, "unexpected JSON structure: missing function " + _funId);
-		return YAPI_IO_ERROR;
+		dev->releaseFunctionAPI();
+		throw;
 	}
-	_parse(node);
+	dev->releaseFunctionAPI();
 	return YAPI_SUCCESS;
 }
 
@@ -3797,7 +5948,7 @@ void YFunction::_UpdateTimedReportCallbackList(YFunction* func, bool add)
 // This is the internal device cache object
 vector<YDevice*> YDevice::_devCache;
 
-YDevice::YDevice(YDEV_DESCR devdesc): _devdescr(devdesc), _cacheStamp(0), _cacheJson(NULL), _subpath(NULL)
+YDevice::YDevice(YDEV_DESCR devdesc): _devdescr(devdesc), _cacheStamp(0), _cacheJson(NULL), _refJson(NULL), _subpath(NULL), _replyHeld(false)
 {
 	yInitializeCriticalSection(&_lock);
 };
@@ -3863,39 +6014,131 @@ YRETCODE YDevice::HTTPRequestPrepare(const string& request, string& fullrequest,
 }
 
 
-YRETCODE YDevice::HTTPRequest_unsafe(int channel, const string& request, string& buffer, yapiRequestProgressCallback callback, void* context, string& errmsg)
+YHTTPReply::YHTTPReply() : _iohdl(), _open(false), _data(""), _size(0), _bodyStart(0), _lockedDev(NULL)
+{
+}
+
+YHTTPReply::~YHTTPReply()
+{
+	release();
+}
+
+void YHTTPReply::_attach(YIOHDL& iohdl, const char* data, int size)
+{
+	release();
+	_iohdl = iohdl;
+	_open = true;
+	if (data != NULL && size > 0)
+	{
+		_data = data;
+		_size = size;
+	}
+}
+
+bool YHTTPReply::_isSuccess(void) const
+{
+	if (_size >= 4 && !memcmp(_data, "OK\r\n", 4))
+	{
+		return true;
+	}
+	return (_size >= 17 && !memcmp(_data, "HTTP/1.1 200 OK\r\n", 17));
+}
+
+void YHTTPReply::_holdDevice(YDevice* dev)
+{
+	_lockedDev = dev;
+}
+
+bool YHTTPReply::_skipHeader(void)
+{
+	const char* p = _data;
+	const char* end;
+
+	if (_size < 4)
+	{
+		return false;
+	}
+	end = _data + _size - 3;
+	while (p < end)
+	{
+		p = (const char*)memchr(p, '\r', end - p);
+		if (p == NULL)
+		{
+			break;
+		}
+		if (p[1] == '\n' && p[2] == '\r' && p[3] == '\n')
+		{
+			_bodyStart = (int)(p + 4 - _data);
+			return true;
+		}
+		p++;
+	}
+	return false;
+}
+
+void YHTTPReply::release(void)
+{
+	char errbuff[YOCTO_ERRMSG_LEN];
+
+	if (_open)
+	{
+		_open = false;
+		yapiHTTPRequestSyncDone(&_iohdl, errbuff);
+	}
+	_data = "";
+	_size = 0;
+	_bodyStart = 0;
+	if (_lockedDev != NULL)
+	{
+		YDevice* dev = _lockedDev;
+		_lockedDev = NULL;
+		dev->_releaseReply();
+	}
+}
+
+
+YRETCODE YDevice::HTTPRequest_unsafe(int channel, const string& request, YHTTPReply& reply, yapiRequestProgressCallback callback, void* context, string& errmsg)
 {
 	char errbuff[YOCTO_ERRMSG_LEN] = "";
 	YRETCODE res;
 	YIOHDL iohdl;
 	string fullrequest;
-	char* reply;
+	char* replybuf = NULL;
 	int replysize = 0;
 
+	reply.release();
+	if (_replyHeld)
+	{
+		// the I/O slot is still used by a reply of this thread, waiting for it would never end
+		errmsg = "Previous reply from this device has not been released";
+		return YAPI_INVALID_ARGUMENT;
+	}
 	if (YISERR(res = HTTPRequestPrepare(request, fullrequest, errbuff)))
 	{
 		errmsg = (string)errbuff;
 		return res;
 	}
-	if (YISERR(res = yapiHTTPRequestSyncStartOutOfBand(&iohdl, channel, _rootdevice, fullrequest.data(), (int)fullrequest.size(), &reply, &replysize, callback, context, errbuff)))
+	if (YISERR(res = yapiHTTPRequestSyncStartOutOfBand(&iohdl, channel, _rootdevice, fullrequest.data(), (int)fullrequest.size(), &replybuf, &replysize, callback, context, errbuff)))
 	{
 		errmsg = (string)errbuff;
 		return res;
 	}
-	if (replysize > 0 && reply != NULL)
-	{
-		buffer = string(reply, replysize);
-	}
-	else
-	{
-		buffer = "";
-	}
-	if (YISERR(res = yapiHTTPRequestSyncDone(&iohdl, errbuff)))
+	reply._attach(iohdl, replybuf, replysize);
+	return YAPI_SUCCESS;
+}
+
+
+YRETCODE YDevice::HTTPRequest_unsafe(int channel, const string& request, string& buffer, yapiRequestProgressCallback callback, void* context, string& errmsg)
+{
+	YHTTPReply reply;
+	YRETCODE res;
+
+	res = HTTPRequest_unsafe(channel, request, reply, callback, context, errmsg);
+	if (YISERR(res))
 	{
-		errmsg = (string)errbuff;
 		return res;
 	}
-
+	buffer.assign(reply.data(), reply.size());
 	return YAPI_SUCCESS;
 }
 
@@ -3941,12 +6184,53 @@ YRETCODE YDevice::HTTPRequest(int channel, const string& request, string& buffer
 }
 
 
+// The reply is still held by the library when this method returns, so the device
+// lock is kept until the reply is released: other threads wait for the lock
+// instead of waiting for the I/O slot while holding it
+YRETCODE YDevice::HTTPRequest(int channel, const string& request, YHTTPReply& reply, yapiRequestProgressCallback callback, void* context, string& errmsg)
+{
+	YRETCODE res;
+	int locked = 0;
+	int i;
+
+	for (i = 0; !locked && i < 5; i++)
+	{
+		locked = yTryEnterCriticalSection(&_lock);
+		if (!locked)
+		{
+			yApproximateSleep(50);
+		}
+	}
+	if (!locked)
+	{
+		yEnterCriticalSection(&_lock);
+	}
+	res = HTTPRequest_unsafe(channel, request, reply, callback, context, errmsg);
+	if (YISERR(res))
+	{
+		yLeaveCriticalSection(&_lock);
+		return res;
+	}
+	_replyHeld = true;
+	reply._holdDevice(this);
+	return res;
+}
+
+// called by YHTTPReply::release() for a reply returned by HTTPRequest()
+void YDevice::_releaseReply(void)
+{
+	_replyHeld = false;
+	yLeaveCriticalSection(&_lock);
+}
+
+
 YRETCODE YDevice::requestAPI(YJSONObject*& apires, string& errmsg)
 {
 	yJsonStateMachine j;
-	string rootdev, buffer;
+	YHTTPReply reply;
+	YJSONDocument* doc;
 	string request = "GET /api.json \r\n\r\n";
-	string json_str;
+	int json_len;
 	int res;
 
 	yEnterCriticalSection(&_lock);
@@ -3958,16 +6242,25 @@ YRETCODE YDevice::requestAPI(YJSONObject*& apires, string& errmsg)
 		yLeaveCriticalSection(&_lock);
 		return YAPI_SUCCESS;
 	}
-	if (_cacheJson == NULL)
+	if (_refJson == NULL)
 	{
 		request = "GET /api.json \r\n\r\n";
 	}
 	else
 	{
-		request = "GET /api.json?fw=" + _cacheJson->getYJSONObject("module")->getString("firmwareRelease") + " \r\n\r\n";
+		try
+		{
+			request = "GET /api.json?fw=" + _refJson->getYJSONObject("module")->getString("firmwareRelease") + " \r\n\r\n";
+		}
+		catch (std::exception)
+		{
+			// reference cannot be used, ask for a full reply
+			clearJsonCache();
+			request = "GET /api.json \r\n\r\n";
+		}
 	}
 	// send request, without HTTP/1.1 suffix to get light headers
-	res = this->HTTPRequest_unsafe(0, request, buffer, NULL, NULL, errmsg);
+	res = this->HTTPRequest_unsafe(0, request, reply, NULL, NULL, errmsg);
 	if (YISERR(res))
 	{
 		yLeaveCriticalSection(&_lock);
@@ -3979,7 +6272,7 @@ YRETCODE YDevice::requestAPI(YJSONObject*& apires, string& errmsg)
 		}
 		yEnterCriticalSection(&_lock);
 		// send request, without HTTP/1.1 suffix to get light headers
-		res = this->HTTPRequest_unsafe(0, request, buffer, NULL, NULL, errmsg);
+		res = this->HTTPRequest_unsafe(0, request, reply, NULL, NULL, errmsg);
 		if (YISERR(res))
 		{
 			yLeaveCriticalSection(&_lock);
@@ -3988,8 +6281,8 @@ YRETCODE YDevice::requestAPI(YJSONObject*& apires, string& errmsg)
 	}
 
 	// Parse HTTP header
-	j.src = buffer.data();
-	j.end = j.src + buffer.size();
+	j.src = reply.data();
+	j.end = j.src + reply.size();
 	j.st = YJSON_HTTP_START;
 	if (yJsonParse(&j) != YJSON_PARSE_AVAIL || j.st != YJSON_HTTP_READ_CODE)
 	{
@@ -4018,28 +6311,41 @@ YRETCODE YDevice::requestAPI(YJSONObject*& apires, string& errmsg)
 	// we know for sure that the last character parsed was a '{' or '['
 	do j.src--;
 	while (j.src[0] != '{' && j.src[0] != '[');
-	json_str = string(j.src);
+	// the document is built straight from the library buffer
+	json_len = (int)(j.end - j.src);
+	doc = new YJSONDocument(j.src, json_len);
+	reply.release();
+	// only index the functions, each one is parsed when first needed
+	bool compact = (doc->_src[0] == '[');
+	apires = new YJSONObject(doc, 0, json_len);
+	doc->release();
 	try
 	{
-		apires = new YJSONObject(json_str, 0, (int)json_str.length());
-		apires->parseWithRef(_cacheJson);
+		apires->parseLazy(compact ? _refJson : NULL);
 	}
 	catch (std::exception ex)
 	{
+		delete apires;
+		apires = NULL;
 		errmsg = "unexpected JSON structure: " + string(ex.what());
-		if (_cacheJson)
-		{
-			delete _cacheJson;
-			_cacheJson = NULL;
-		}
+		clearJsonCache();
 		yLeaveCriticalSection(&_lock);
 		return YAPI_IO_ERROR;
 	}
-	// store result in cache
-	if (_cacheJson)
+	// store result in cache, a full reply becomes the new reference
+	// used to expand the compact replies to api.json?fw=...
+	if (_cacheJson && _cacheJson != _refJson)
 	{
 		delete _cacheJson;
 	}
+	if (!compact)
+	{
+		if (_refJson)
+		{
+			delete _refJson;
+		}
+		_refJson = apires;
+	}
 	_cacheJson = apires;
 	_cacheStamp = yapiGetTickCount() + YAPI::DefaultCacheValidity;
 	yLeaveCriticalSection(&_lock);
@@ -4048,16 +6354,68 @@ YRETCODE YDevice::requestAPI(YJSONObject*& apires, string& errmsg)
 }
 
 
+// Loads the API of the device and returns the JSON node of one function.
+// The node is shared by all the callers and is parsed on first access, so the
+// device lock is kept until the caller is done with it
+YRETCODE YDevice::requestFunctionAPI(const string& funcId, YJSONObject*& node, string& errmsg)
+{
+	YJSONObject* apires;
+	YRETCODE res = this->requestAPI(apires, errmsg);
+	if (YISERR(res))
+	{
+		return res;
+	}
+	yEnterCriticalSection(&_lock);
+	node = NULL;
+	try
+	{
+		if (_cacheJson != NULL)
+		{
+			apires = _cacheJson;
+		}
+		node = apires->getYJSONObject(funcId);
+	}
+	catch (std::exception ex)
+	{
+		errmsg = "unexpected JSON structure: " + string(ex.what());
+		yLeaveCriticalSection(&_lock);
+		return YAPI_IO_ERROR;
+	}
+	if (node == NULL)
+	{
+		yLeaveCriticalSection(&_lock);
+		errmsg = "unexpected JSON structure: missing function " + funcId;
+		return YAPI_IO_ERROR;
+	}
+	return YAPI_SUCCESS;
+}
+
+void YDevice::releaseFunctionAPI(void)
+{
+	yLeaveCriticalSection(&_lock);
+}
+
+// must be called with the device lock held
+void YDevice::clearJsonCache(void)
+{
+	if (_cacheJson && _cacheJson != _refJson)
+	{
+		delete _cacheJson;
+	}
+	if (_refJson)
+	{
+		delete _refJson;
+	}
+	_cacheJson = NULL;
+	_refJson = NULL;
+}
+
 void YDevice::clearCache(bool clearSubpath)
 {
 	yEnterCriticalSection(&_lock);
 	_cacheStamp = 0;
 	if (clearSubpath)
-		if (_cacheJson)
-		{
-			delete _cacheJson;
-			_cacheJson = NULL;
-		}
+		clearJsonCache();
 	if (_subpath)
 	{
 		delete _subpath;
@@ -4238,6 +6596,12 @@ void YAPI::_yapiFunctionTimedReportCallbackFwd(YAPI_FUNCTION fundesc, double tim
 	}
 }
 
+void YAPI::_yapiRegisterHubCallbackFwd(void* context, const char* url, YRETCODE status, const char* errmsg)
+{
+	YRegisterHubCallback callback = *(YRegisterHubCallback*)context;
+	callback(string(url), status, string(errmsg));
+}
+
 void YAPI::_yapiHubDiscoveryCallbackFwd(const char* serial, const char* url)
 {
 	yapiGlobalEvent ev;
@@ -4320,7 +6684,7 @@ yCalibrationHandler YAPI::_getCalibrationHandler(int calibType)
 
 
 // Parse an array of u16 encoded in a base64-like string with memory-based compresssion
-vector<int> YAPI::_decodeWords(string sdat)
+vector<int> YAPI::_decodeWords(const string& sdat)
 {
 	vector<int> udat;
 
@@ -4364,7 +6728,7 @@ vector<int> YAPI::_decodeWords(string sdat)
 }
 
 // Parse a list of floats and return them as an array of fixed-point 1/1000 numbers
-vector<int> YAPI::_decodeFloats(string sdat)
+vector<int> YAPI::_decodeFloats(const string& sdat)
 {
 	vector<int> idat;
 
@@ -4707,6 +7071,37 @@ YRETCODE YAPI::TriggerHubDiscovery(string& errmsg)
 	return YAPI_SUCCESS;
 }
 
+YRETCODE YAPI::StartTraceRecorder(const string& file, int sampling, string& errmsg)
+{
+	char errbuf[YOCTO_ERRMSG_LEN];
+	YRETCODE res;
+
+	res = yapiStartTraceRecorder(file.c_str(), sampling, errbuf);
+	if (YISERR(res))
+	{
+		errmsg = errbuf;
+	}
+	return res;
+}
+
+void YAPI::StopTraceRecorder(void)
+{
+	yapiStopTraceRecorder();
+}
+
+int YAPI::DecodeTraceFile(const string& tracefile, const string& textfile, string& errmsg)
+{
+	char errbuf[YOCTO_ERRMSG_LEN];
+	int res;
+
+	res = yapiDecodeTraceFile(tracefile.c_str(), textfile.c_str(), errbuf);
+	if (YISERR(res))
+	{
+		errmsg = errbuf;
+	}
+	return res;
+}
+
 
 // Register a new value calibration handler for a given calibration type
 //
@@ -4873,6 +7268,49 @@ YRETCODE YAPI::PreregisterHub(const string& url, string& errmsg)
 	return res;
 }
 
+/**
+ * Registers several hubs at once. This function has the same purpose as
+ * calling RegisterHub() on each URL, but all hubs are contacted at the same
+ * time, so that the hubs that are down do not delay the others. The
+ * callback is invoked once per URL, from the calling thread, as soon as
+ * the hub is usable or has failed. A hub that is still connecting at the
+ * deadline is reported with YAPI_TIMEOUT, and stays registered as with
+ * PreregisterHub().
+ *
+ * @param urls : the root URLs of the hubs to monitor, "usb" is also accepted
+ * @param mstimeout : the overall deadline, in milliseconds (0 for the
+ *         default network timeout)
+ * @param callback : the function invoked with the outcome of each hub,
+ *         or NULL
+ * @param errmsg : a string passed by reference to receive any error message.
+ *
+ * @return the number of hubs that are ready.
+ *
+ * On failure, throws an exception or returns a negative error code.
+ */
+int YAPI::RegisterHubs(const vector<string>& urls, int mstimeout, YRegisterHubCallback callback, string& errmsg)
+{
+	char errbuf[YOCTO_ERRMSG_LEN];
+	vector<const char*> curls;
+	int res;
+	if (!YAPI::_apiInitialized)
+	{
+		res = YAPI::InitAPI(0, errmsg);
+		if (YISERR(res)) return res;
+	}
+	for (size_t i = 0; i < urls.size(); i++)
+	{
+		curls.push_back(urls[i].c_str());
+	}
+	res = yapiRegisterHubs(curls.empty() ? NULL : &curls[0], (int)curls.size(), mstimeout,
+	                       callback ? YAPI::_yapiRegisterHubCallbackFwd : NULL, &callback, errbuf);
+	if (YISERR(res))
+	{
+		errmsg = errbuf;
+	}
+	return res;
+}
+
 /**
  * Setup the Yoctopuce library to no more use modules connected on a previously
  * registered machine with RegisterHub.
@@ -4968,6 +7406,41 @@ YRETCODE YAPI::UpdateDeviceList(string& errmsg)
 	return YAPI_SUCCESS;
 }
 
+/**
+ * Modifies the delay between each full enumeration of the network hubs.
+ * Once a hub has been enumerated, module arrivals, removals and name
+ * changes are applied from its notification channel, and UpdateDeviceList
+ * only loads the description of the modules that have just been plugged.
+ * The full device list of the hub is reloaded after a reconnection, and
+ * at this period as a consistency check (60 seconds by default).
+ * Increasing this delay reduces the network traffic, which is useful for
+ * hubs reached over metered links. Hubs that do not send keep-alive
+ * notifications are still enumerated every 10 seconds.
+ * This parameter does not affect modules connected by USB.
+ *
+ * @param deviceListValidity : number of seconds between each full
+ *         enumeration, or 0 to reload the full list at each enumeration.
+ */
+void YAPI::SetDeviceListValidity(int deviceListValidity)
+{
+	if (!YAPI::_apiInitialized)
+	{
+		string errmsg;
+		if (YISERR(YAPI::InitAPI(0, errmsg))) return;
+	}
+	yapiSetNetDevListValidity(deviceListValidity);
+}
+
+/**
+ * Returns the delay between each full enumeration of the network hubs.
+ *
+ * @return the number of seconds between each full enumeration.
+ */
+int YAPI::GetDeviceListValidity(void)
+{
+	return yapiGetNetDevListValidity();
+}
+
 /**
  * Maintains the device-to-library communication channel.
  * If your program includes significant loops, you may want to include
@@ -4998,12 +7471,16 @@ YRETCODE YAPI::HandleEvents(string& errmsg)
 		yLeaveCriticalSection(&_handleEvent_CS);
 		return res;
 	}
+	yapiLockFunctionCallBack(NULL);
+	yapiRecordEventQueue((u32)_data_events.size());
+	yapiUnlockFunctionCallBack(NULL);
 	// pop data event and call user callback
 	while (!_data_events.empty())
 	{
 		yapiDataEvent ev;
 		YSensor* sensor;
 		vector<int> report;
+		u64 start;
 
 		yapiLockFunctionCallBack(NULL);
 		if (_data_events.empty())
@@ -5017,14 +7494,18 @@ YRETCODE YAPI::HandleEvents(string& errmsg)
 		switch (ev.type)
 		{
 		case YAPI_FUN_VALUE:
+			start = yapiGetMetricsClock();
 			ev.fun->_invokeValueCallback((string)ev.value);
+			yapiRecordCallback(ev.fun->get_functionDescriptor(), start);
 			break;
 		case YAPI_FUN_TIMEDREPORT:
 			if (ev.report[0] <= 2)
 			{
 				sensor = ev.sensor;
 				report.assign(ev.report, ev.report + ev.len);
+				start = yapiGetMetricsClock();
 				sensor->_invokeTimedReportCallback(sensor->_decodeTimedReport(ev.timestamp, report));
+				yapiRecordCallback(sensor->get_functionDescriptor(), start);
 			}
 			break;
 		case YAPI_FUN_REFRESH:
@@ -5070,13 +7551,17 @@ YRETCODE YAPI::Sleep(unsigned ms_duration, string& errmsg)
 			errmsg = errbuf;
 			return res;
 		}
-		if (waituntil > YAPI::GetTickCount())
+		u64 now = YAPI::GetTickCount();
+		if (waituntil > now)
 		{
-			res = yapiSleep(2, errbuf);
-			if (YISERR(res))
+			// wake up as soon as something arrives, but still give the
+			// library a chance to handle its timeouts from time to time
+			u64 wait = waituntil - now;
+			int wres = yapiWaitForEvents(wait > 50 ? 50 : (int)wait, errbuf);
+			if (YISERR(wres))
 			{
 				errmsg = errbuf;
-				return res;
+				return (YRETCODE)wres;
 			}
 		}
 	}
@@ -5085,6 +7570,173 @@ YRETCODE YAPI::Sleep(unsigned ms_duration, string& errmsg)
 	return YAPI_SUCCESS;
 }
 
+int YAPI::WaitForEvents(int ms_timeout, string& errmsg)
+{
+	char errbuf[YOCTO_ERRMSG_LEN];
+	int res;
+
+	if (!_data_events.empty())
+	{
+		return 1;
+	}
+	res = yapiWaitForEvents(ms_timeout, errbuf);
+	if (YISERR(res))
+	{
+		errmsg = errbuf;
+	}
+	return res;
+}
+
+int YAPI::GetEventFd(string& errmsg)
+{
+	char errbuf[YOCTO_ERRMSG_LEN];
+	int res;
+
+	res = yapiGetEventFd(errbuf);
+	if (YISERR(res))
+	{
+		errmsg = errbuf;
+	}
+	return res;
+}
+
+/**
+ * Returns the runtime metrics of the library in the Prometheus text
+ * exposition format: per hub and per device request counts, errors,
+ * transferred bytes, latency histograms, notification counts, callback
+ * execution times and event queue depth. The returned text can be served
+ * as is on a /metrics endpoint.
+ *
+ * @param errmsg : a string passed by reference to receive any error message.
+ *
+ * @return the metrics text, or an empty string on error.
+ */
+string YAPI::GetMetricsText(string& errmsg)
+{
+	char errbuf[YOCTO_ERRMSG_LEN];
+	int res, fullsize = 0;
+	vector<char> buffer;
+
+	res = yapiGetMetricsText(NULL, 0, &fullsize, errbuf);
+	if (YISERR(res))
+	{
+		errmsg = errbuf;
+		return "";
+	}
+	// leave room for entries appearing in between
+	buffer.resize(fullsize + 4096);
+	res = yapiGetMetricsText(&buffer[0], (int)buffer.size(), &fullsize, errbuf);
+	if (YISERR(res))
+	{
+		errmsg = errbuf;
+		return "";
+	}
+	return string(&buffer[0], res);
+}
+
+/**
+ * Returns the raw runtime metrics entries of the library: one library wide
+ * entry, then one entry per hub and one entry per device.
+ *
+ * @param entries : a vector filled with the metrics entries.
+ * @param errmsg : a string passed by reference to receive any error message.
+ *
+ * @return the number of entries, or a negative error code.
+ */
+int YAPI::GetMetrics(vector<yMetricsEntry>& entries, string& errmsg)
+{
+	char errbuf[YOCTO_ERRMSG_LEN];
+	int res, needed = 0;
+
+	entries.clear();
+	res = yapiGetMetrics(NULL, 0, &needed, errbuf);
+	while (!YISERR(res) && needed > (int)entries.size())
+	{
+		entries.resize(needed);
+		res = yapiGetMetrics(&entries[0], needed, &needed, errbuf);
+	}
+	if (YISERR(res))
+	{
+		entries.clear();
+		errmsg = errbuf;
+		return res;
+	}
+	entries.resize(res);
+	return res;
+}
+
+/**
+ * Clears all the runtime metrics counters and histograms.
+ */
+void YAPI::ResetMetrics(void)
+{
+	yapiResetMetrics();
+}
+
+/**
+ * Enables a warm start of network hubs. The devices and functions known
+ * for each network hub, with their last advertised values, are saved to
+ * the given file by FreeAPI and reloaded by this function. When a hub is
+ * registered, its saved devices are restored at once, so that FindXxx()
+ * resolves them before the hub has been reached. They are reconciled
+ * with the actual device list by the first enumeration of the hub, or
+ * dropped if a preregistered hub fails to connect.
+ *
+ * Call this function before registering the hubs. Hubs registered with
+ * PreregisterHub can be used immediately, while RegisterHub still waits
+ * for the hub to answer.
+ *
+ * @param file : the path of the snapshot file, or an empty string to disable
+ *         the snapshot. A missing file is created on the first save.
+ * @param autosaveSeconds : if positive, the snapshot is also saved by
+ *         UpdateDeviceList, at most once per this number of seconds.
+ * @param errmsg : a string passed by reference to receive any error message.
+ *
+ * @return YAPI_SUCCESS when the call succeeds.
+ *
+ * On failure returns a negative error code.
+ */
+YRETCODE YAPI::SetRegistrySnapshot(const string& file, int autosaveSeconds, string& errmsg)
+{
+	char errbuf[YOCTO_ERRMSG_LEN];
+	YRETCODE res;
+
+	if (!YAPI::_apiInitialized)
+	{
+		res = YAPI::InitAPI(0, errmsg);
+		if (YISERR(res)) return res;
+	}
+	res = yapiSetRegistrySnapshot(file.c_str(), autosaveSeconds, errbuf);
+	if (YISERR(res))
+	{
+		errmsg = errbuf;
+	}
+	return res;
+}
+
+/**
+ * Saves the registry snapshot immediately to the file set by
+ * SetRegistrySnapshot.
+ *
+ * @param errmsg : a string passed by reference to receive any error message.
+ *
+ * @return YAPI_SUCCESS when the call succeeds.
+ *
+ * On failure returns a negative error code.
+ */
+YRETCODE YAPI::SaveRegistrySnapshot(string& errmsg)
+{
+	char errbuf[YOCTO_ERRMSG_LEN];
+	YRETCODE res;
+
+	res = yapiSaveRegistrySnapshot(errbuf);
+	if (YISERR(res))
+	{
+		errmsg = errbuf;
+	}
+	return res;
+}
+
 /**
  * Returns the current value of a monotone millisecond-based time counter.
  * This counter can be used to compute delays in relation with
@@ -5355,6 +8007,57 @@ YRETCODE YapiWrapper::handleEvents(string& errmsg)
 }
 
 
+YRETCODE YapiWrapper::getDevicePath(const string& serial, string& subpath, string& errmsg)
+{
+	char errbuf[YOCTO_ERRMSG_LEN];
+	char rootdevice[YOCTO_SERIAL_LEN];
+	char path[256];
+	YAPI_DEVICE devdescr;
+	YRETCODE res;
+
+	devdescr = yapiGetDevice(serial.c_str(), errbuf);
+	res = (YISERR(devdescr) ? (YRETCODE)devdescr : yapiGetDevicePath(devdescr, rootdevice, path, sizeof(path), NULL, errbuf));
+	if (YISERR(res))
+	{
+		errmsg = string(errbuf);
+		return res;
+	}
+	subpath = string(path);
+	return YAPI_SUCCESS;
+}
+
+// The request starts with a path relative to the device ("GET /api.json"), to which
+// the subpath returned by getDevicePath() is added. The reply is only returned on
+// success, with its body located.
+YRETCODE YapiWrapper::deviceRequest(const string& serial, const string& subpath, const string& request, YHTTPReply& reply, string& errmsg)
+{
+	char errbuf[YOCTO_ERRMSG_LEN];
+	YIOHDL iohdl;
+	char* data = NULL;
+	int datasize = 0;
+	string fullrequest;
+	size_t pos;
+	YRETCODE res;
+
+	pos = request.find('/');
+	fullrequest = request.substr(0, pos) + subpath + request.substr(pos + 1);
+	res = yapiHTTPRequestSyncStartEx(&iohdl, serial.c_str(), fullrequest.data(), (int)fullrequest.size(), &data, &datasize, errbuf);
+	if (YISERR(res))
+	{
+		errmsg = string(errbuf);
+		return res;
+	}
+	reply._attach(iohdl, data, datasize);
+	if (!reply._isSuccess() || !reply._skipHeader())
+	{
+		reply.release();
+		errmsg = "http request failed";
+		return YAPI_IO_ERROR;
+	}
+	return YAPI_SUCCESS;
+}
+
+
 string YapiWrapper::ysprintf(const char* fmt, ...)
 {
 	va_list args;
@@ -6948,155 +9651,7 @@ int YModule::set_allSettings(string settings)
 		fun = (njpath).substr(0, cpos);
 		cpos = cpos + 1;
 		attr = (njpath).substr(cpos, leng - cpos);
-		do_update = true;
-		if (fun == "services")
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "firmwareRelease"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "usbCurrent"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "upTime"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "persistentSettings"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "adminPassword"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "userPassword"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "rebootCountdown"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "advertisedValue"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "poeCurrent"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "readiness"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "ipAddress"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "subnetMask"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "router"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "linkQuality"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "ssid"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "channel"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "security"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "message"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "currentValue"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "currentRawValue"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "currentRunIndex"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "pulseTimer"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "lastTimePressed"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "lastTimeReleased"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "filesCount"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "freeSpace"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "timeUTC"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "rtcTime"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "unixTime"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "dateTime"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "rawValue"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "lastMsg"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "delayedPulseTimer"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "rxCount"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "txCount"))
-		{
-			do_update = false;
-		}
-		if ((do_update) && (attr == "msgCount"))
-		{
-			do_update = false;
-		}
+		do_update = (fun != "services" && !ySettingsIsSkipped(attr));
 		if (do_update)
 		{
 			do_update = false;
@@ -42,6 +42,8 @@
 
 #include "yapi/ydef.h"
 #include "yapi/yjson.h"
+#include "yapi/ythread.h"
+#include <cstdio>
 #include <string>
 #include <vector>
 #include <queue>
@@ -170,6 +172,9 @@ typedef void (*yDeviceUpdateCallback)(YModule* module);
 /// prototype of the Hub discoverycallback
 typedef void (*YHubDiscoveryCallback)(const string& serial, const string& url);
 
+/// prototype of the per-hub callback of RegisterHubs
+typedef void (*YRegisterHubCallback)(const string& url, YRETCODE status, const string& errmsg);
+
 
 /// prototype of the value calibration handlers
 typedef vector<double> floatArr;
@@ -286,16 +291,45 @@ typedef enum
 
 class YJSONObject;
 
+// Source document shared by all the nodes parsed from it. Nodes only keep
+// offsets into the document buffer, and the nodes created while parsing are
+// allocated from the document arena. The document is released when the last
+// node referencing it is deleted.
+class YJSONDocument
+{
+	vector<char*> _blocks;
+	size_t _blockUsed;
+	size_t _blockSize;
+	size_t _arenaSize;
+	int _refcount;
+public:
+	const string _src;
+
+	YJSONDocument(const string& src);
+	YJSONDocument(const char* src, int len);
+	~YJSONDocument();
+	void acquire(void);
+	void release(void);
+	void* allocate(size_t size);
+
+	size_t get_arenaSize(void)
+	{
+		return _arenaSize;
+	}
+};
+
 class YJSONContent
 {
 public:
-	string _data;
+	YJSONDocument* _doc;
+	const string& _data;
 	int _data_start;
 	int _data_len;
 	int _data_boundary;
 	YJSONType _type;
 	static YJSONContent* ParseJson(const string& data, int start, int stop);
 	YJSONContent(const string& data, int start, int stop, YJSONType type);
+	YJSONContent(YJSONDocument* doc, int start, int stop, YJSONType type);
 	YJSONContent(YJSONContent* ref);
 	YJSONContent(YJSONType type);
 	virtual ~YJSONContent();
@@ -305,6 +339,11 @@ public:
 	string FormatError(const string& errmsg, int cur_pos);
 	virtual string toJSON() =0;
 	virtual string toString() =0;
+	// nodes created by the parser are allocated in the document arena
+	static void* operator new(size_t size);
+	static void* operator new(size_t size, YJSONDocument* doc);
+	static void operator delete(void* ptr);
+	static void operator delete(void* ptr, YJSONDocument* doc);
 };
 
 class YJSONArray : public YJSONContent
@@ -312,6 +351,7 @@ class YJSONArray : public YJSONContent
 	vector<YJSONContent*> _arrayValue;
 public:
 	YJSONArray(const string& data, int start, int stop);
+	YJSONArray(YJSONDocument* doc, int start, int stop);
 	YJSONArray(const string& data);
 	YJSONArray(YJSONArray* ref);
 	YJSONArray();
@@ -331,9 +371,14 @@ public:
 
 class YJSONString : public YJSONContent
 {
+	// strings without escape sequences are not copied out of the document
 	string _stringValue;
+	int _str_start;
+	int _str_len;
+	bool _inDoc;
 public:
 	YJSONString(const string& data, int start, int stop);
+	YJSONString(YJSONDocument* doc, int start, int stop);
 	YJSONString(YJSONString* ref);
 	YJSONString();
 
@@ -356,6 +401,7 @@ class YJSONNumber : public YJSONContent
 	bool _isFloat;
 public:
 	YJSONNumber(const string& data, int start, int stop);
+	YJSONNumber(YJSONDocument* doc, int start, int stop);
 	YJSONNumber(YJSONNumber* ref);
 
 	virtual ~YJSONNumber()
@@ -373,30 +419,53 @@ public:
 
 class YJSONObject : public YJSONContent
 {
-	map<string, YJSONContent*> _parsed;
+	// flat key table: objects are small, a linear search beats a map,
+	// except for large objects which also get a key index
 	vector<string> _keys;
+	vector<YJSONContent*> _values;
+	std::map<string, int> _keyIndex;
+	// lazy mode: offset of each value not parsed yet, and compact reference
+	vector<int> _lazyPos;
+	YJSONObject* _lazyRef;
+	// index of the last key found, where the next lookup starts
+	int _lastIdx;
 	void convert(YJSONObject* reference, YJSONArray* newArray);
+	int indexOf(const char* key, int keylen);
+	int indexOf(const string& key);
+	void addKey(const string& key);
+	void put(const string& key, YJSONContent* value);
+	YJSONContent* valueAt(int idx);
+	int skipValue(int cur_pos);
 public:
 	YJSONObject(const string& data);
 	YJSONObject(const string& data, int start, int len);
+	YJSONObject(YJSONDocument* doc, int start, int len);
 	YJSONObject(YJSONObject* ref);
 	virtual ~YJSONObject();
 
 	virtual int parse();
 	bool has(const string& key);
+	bool has(const char* key);
 	YJSONObject* getYJSONObject(const string& key);
+	YJSONObject* getYJSONObject(const char* key);
 	YJSONString* getYJSONString(const string& key);
 	YJSONArray* getYJSONArray(const string& key);
 	vector<string> keys();
 	YJSONNumber* getYJSONNumber(const string& key);
 	string getString(const string& key);
+	string getString(const char* key);
 	int getInt(const string& key);
+	int getInt(const char* key);
 	YJSONContent* get(const string& key);
+	YJSONContent* get(const char* key);
 	long getLong(const string& key);
+	long getLong(const char* key);
 	double getDouble(const string& key);
+	double getDouble(const char* key);
 	virtual string toJSON();
 	virtual string toString();
 	void parseWithRef(YJSONObject* reference);
+	int parseLazy(YJSONObject* reference);
 	string getKeyFromIdx(int i);
 };
 
@@ -423,14 +492,15 @@ private:
 	static void _yapiDeviceLogCallbackFwd(YDEV_DESCR devdesc, const char* line);
 	static void _yapiFunctionTimedReportCallbackFwd(YAPI_FUNCTION fundesc, double timestamp, const u8* bytes, u32 len);
 	static void _yapiHubDiscoveryCallbackFwd(const char* serial, const char* url);
+	static void _yapiRegisterHubCallbackFwd(void* context, const char* url, YRETCODE status, const char* errmsg);
 
 public:
 	static void _yapiFunctionUpdateCallbackFwd(YFUN_DESCR fundesc, const char* value);
 	static double _decimalToDouble(s16 val);
 	static s16 _doubleToDecimal(double val);
 	static yCalibrationHandler _getCalibrationHandler(int calibType);
-	static vector<int> _decodeWords(string s);
-	static vector<int> _decodeFloats(string sdat);
+	static vector<int> _decodeWords(const string& s);
+	static vector<int> _decodeFloats(const string& sdat);
 	static string _bin2HexStr(const string& data);
 	static string _hexStr2Bin(const string& str);
 	static string _flattenJsonStruct(string jsonbuffer);
@@ -597,6 +667,41 @@ public:
 	 */
 	static YRETCODE TriggerHubDiscovery(string& errmsg);
 
+	/**
+	 * Starts recording low-level traces (library logs, requests and value
+	 * callbacks) as compact binary records. The records are buffered per thread
+	 * and written to the file by a background thread, so that tracing can be
+	 * enabled on a production system. Use DecodeTraceFile to read the result.
+	 *
+	 * @param file : the path of the binary trace file to create
+	 * @param sampling : record one request and one value callback out of sampling,
+	 *         1 to record them all
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return YAPI_SUCCESS when the call succeeds.
+	 *
+	 * On failure returns a negative error code.
+	 */
+	static YRETCODE StartTraceRecorder(const string& file, int sampling, string& errmsg);
+
+	/**
+	 * Stops the trace recorder, after all pending records have been written.
+	 */
+	static void StopTraceRecorder(void);
+
+	/**
+	 * Converts a binary trace file produced by StartTraceRecorder to text.
+	 *
+	 * @param tracefile : the path of the binary trace file
+	 * @param textfile : the path of the text file to create
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return the number of records decoded.
+	 *
+	 * On failure returns a negative error code.
+	 */
+	static int DecodeTraceFile(const string& tracefile, const string& textfile, string& errmsg);
+
 
 	static void RegisterDeviceChangeCallback(yDeviceUpdateCallback changeCallback);
 
@@ -687,6 +792,28 @@ public:
 	 */
 	static YRETCODE PreregisterHub(const string& url, string& errmsg);
 
+	/**
+	 * Registers several hubs at once. This function has the same purpose as
+	 * calling RegisterHub() on each URL, but all hubs are contacted at the same
+	 * time, so that the hubs that are down do not delay the others. The
+	 * callback is invoked once per URL, from the calling thread, as soon as
+	 * the hub is usable or has failed. A hub that is still connecting at the
+	 * deadline is reported with YAPI_TIMEOUT, and stays registered as with
+	 * PreregisterHub().
+	 *
+	 * @param urls : the root URLs of the hubs to monitor, "usb" is also accepted
+	 * @param mstimeout : the overall deadline, in milliseconds (0 for the
+	 *         default network timeout)
+	 * @param callback : the function invoked with the outcome of each hub,
+	 *         or NULL
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return the number of hubs that are ready.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	static int RegisterHubs(const vector<string>& urls, int mstimeout, YRegisterHubCallback callback, string& errmsg);
+
 	/**
 	 * Setup the Yoctopuce library to no more use modules connected on a previously
 	 * registered machine with RegisterHub.
@@ -712,6 +839,28 @@ public:
 	 * On failure, throws an exception or returns a negative error code.
 	 */
 	static YRETCODE UpdateDeviceList(string& errmsg);
+	/**
+	 * Modifies the delay between each full enumeration of the network hubs.
+	 * Once a hub has been enumerated, module arrivals, removals and name
+	 * changes are applied from its notification channel, and UpdateDeviceList
+	 * only loads the description of the modules that have just been plugged.
+	 * The full device list of the hub is reloaded after a reconnection, and
+	 * at this period as a consistency check (60 seconds by default).
+	 * Increasing this delay reduces the network traffic, which is useful for
+	 * hubs reached over metered links. Hubs that do not send keep-alive
+	 * notifications are still enumerated every 10 seconds.
+	 * This parameter does not affect modules connected by USB.
+	 *
+	 * @param deviceListValidity : number of seconds between each full
+	 *         enumeration, or 0 to reload the full list at each enumeration.
+	 */
+	static void SetDeviceListValidity(int deviceListValidity);
+	/**
+	 * Returns the delay between each full enumeration of the network hubs.
+	 *
+	 * @return the number of seconds between each full enumeration.
+	 */
+	static int GetDeviceListValidity(void);
 	/**
 	 * Maintains the device-to-library communication channel.
 	 * If your program includes significant loops, you may want to include
@@ -750,6 +899,96 @@ public:
 	 * On failure, throws an exception or returns a negative error code.
 	 */
 	static YRETCODE Sleep(unsigned ms_duration, string& errmsg);
+	/**
+	 * Waits until events sent by the modules are waiting to be processed by
+	 * HandleEvents, or until the timeout expires. This makes it possible to
+	 * call HandleEvents only when needed instead of polling it.
+	 *
+	 * @param ms_timeout : the maximal waiting time in milliseconds,
+	 *         or -1 to wait forever.
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return 1 if events are pending, 0 if the timeout expired.
+	 *
+	 * On failure returns a negative error code.
+	 */
+	static int WaitForEvents(int ms_timeout, string& errmsg);
+	/**
+	 * Returns a file descriptor that becomes readable whenever events sent
+	 * by the modules are waiting to be processed by HandleEvents, for use
+	 * in an external event loop (select, poll, epoll...). The descriptor is
+	 * drained by HandleEvents and must not be read nor closed by the caller.
+	 * Plug and hub discovery callbacks are still invoked by UpdateDeviceList.
+	 *
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return the file descriptor.
+	 *
+	 * On failure returns a negative error code (YAPI_NOT_SUPPORTED on Windows).
+	 */
+	static int GetEventFd(string& errmsg);
+	/**
+	 * Returns the runtime metrics of the library in the Prometheus text
+	 * exposition format: per hub and per device request counts, errors,
+	 * transferred bytes, latency histograms, notification counts, callback
+	 * execution times and event queue depth. The returned text can be served
+	 * as is on a /metrics endpoint.
+	 *
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return the metrics text, or an empty string on error.
+	 */
+	static string GetMetricsText(string& errmsg);
+	/**
+	 * Returns the raw runtime metrics entries of the library: one library wide
+	 * entry, then one entry per hub and one entry per device.
+	 *
+	 * @param entries : a vector filled with the metrics entries.
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return the number of entries, or a negative error code.
+	 */
+	static int GetMetrics(vector<yMetricsEntry>& entries, string& errmsg);
+	/**
+	 * Clears all the runtime metrics counters and histograms.
+	 */
+	static void ResetMetrics(void);
+	/**
+	 * Enables a warm start of network hubs. The devices and functions known
+	 * for each network hub, with their last advertised values, are saved to
+	 * the given file by FreeAPI and reloaded by this function. When a hub is
+	 * registered, its saved devices are restored at once, so that FindXxx()
+	 * resolves them before the hub has been reached. They are reconciled
+	 * with the actual device list by the first enumeration of the hub, or
+	 * dropped if a preregistered hub fails to connect.
+	 *
+	 * Call this function before registering the hubs. Devices of hubs
+	 * registered with PreregisterHub can be resolved immediately, and
+	 * accessed as soon as the hub is connected, while RegisterHub still
+	 * waits for the hub to answer.
+	 *
+	 * @param file : the path of the snapshot file, or an empty string to disable
+	 *         the snapshot. A missing file is created on the first save.
+	 * @param autosaveSeconds : if positive, the snapshot is also saved by
+	 *         UpdateDeviceList, at most once per this number of seconds.
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return YAPI_SUCCESS when the call succeeds.
+	 *
+	 * On failure returns a negative error code.
+	 */
+	static YRETCODE SetRegistrySnapshot(const string& file, int autosaveSeconds, string& errmsg);
+	/**
+	 * Saves the registry snapshot immediately to the file set by
+	 * SetRegistrySnapshot.
+	 *
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return YAPI_SUCCESS when the call succeeds.
+	 *
+	 * On failure returns a negative error code.
+	 */
+	static YRETCODE SaveRegistrySnapshot(string& errmsg);
 	/**
 	 * Returns the current value of a monotone millisecond-based time counter.
 	 * This counter can be used to compute delays in relation with
@@ -773,6 +1012,8 @@ public:
 };
 
 
+class YHTTPReply;
+
 // Wrappers to yapi low-level API
 class YapiWrapper
 {
@@ -791,6 +1032,10 @@ public:
 	static YRETCODE updateDeviceList(bool forceupdate, string& errmsg);
 	static YRETCODE handleEvents(string& errmsg);
 	static string ysprintf(const char* fmt, ...);
+	// requests sent through the I/O slot of the device itself rather than the one
+	// of its hub, so that worker threads can reach several modules of a hub at once
+	static YRETCODE getDevicePath(const string& serial, string& subpath, string& errmsg);
+	static YRETCODE deviceRequest(const string& serial, const string& subpath, const string& request, YHTTPReply& reply, string& errmsg);
 };
 
 
@@ -904,6 +1149,324 @@ public:
 };
 
 
+//
+// YJobList Class (used internally)
+//
+// Jobs of the classes that process many modules at once, one job per serial
+// number. Job must have serial, progress and message members, progress being
+// in the range 0 to 100, or a negative error code once the job has failed.
+// Worker threads update the jobs while holding the list lock.
+//
+template <class Job>
+class YJobList
+{
+	vector<Job> _jobs;
+	yCRITICAL_SECTION _lock;
+	// not copyable, the jobs may be in use by worker threads
+	YJobList(const YJobList&);
+	YJobList& operator=(const YJobList&);
+
+public:
+	YJobList()
+	{
+		yInitializeCriticalSection(&_lock);
+	}
+
+	~YJobList()
+	{
+		yDeleteCriticalSection(&_lock);
+	}
+
+	void lock(void)
+	{
+		yEnterCriticalSection(&_lock);
+	}
+
+	void unlock(void)
+	{
+		yLeaveCriticalSection(&_lock);
+	}
+
+	unsigned size(void) const
+	{
+		return (unsigned)_jobs.size();
+	}
+
+	Job& operator[](unsigned idx)
+	{
+		return _jobs[idx];
+	}
+
+	int find(const string& serial) const
+	{
+		for (unsigned i = 0; i < _jobs.size(); i++)
+		{
+			if (_jobs[i].serial == serial)
+			{
+				return (int)i;
+			}
+		}
+		return -1;
+	}
+
+	// returns the job of a module, appending a new one if there is none yet
+	Job& add(const string& serial)
+	{
+		int idx = find(serial);
+		if (idx < 0)
+		{
+			idx = (int)_jobs.size();
+			_jobs.push_back(Job());
+			_jobs[idx].serial = serial;
+		}
+		return _jobs[idx];
+	}
+
+	void setProgress(Job& job, int progress, const string& message)
+	{
+		yEnterCriticalSection(&_lock);
+		job.progress = progress;
+		job.message = message;
+		yLeaveCriticalSection(&_lock);
+	}
+
+	// true when every job has either succeeded or failed
+	bool isDone(void)
+	{
+		bool done = true;
+		yEnterCriticalSection(&_lock);
+		for (unsigned i = 0; i < _jobs.size() && done; i++)
+		{
+			done = (_jobs[i].progress < 0 || _jobs[i].progress >= 100);
+		}
+		yLeaveCriticalSection(&_lock);
+		return done;
+	}
+
+	// mean progress of all jobs, failed ones counting as completed
+	int globalProgress(void)
+	{
+		int total = 0;
+		if (_jobs.size() == 0)
+		{
+			return 100;
+		}
+		yEnterCriticalSection(&_lock);
+		for (unsigned i = 0; i < _jobs.size(); i++)
+		{
+			total += (_jobs[i].progress < 0 ? 100 : _jobs[i].progress);
+		}
+		yLeaveCriticalSection(&_lock);
+		return total / (int)_jobs.size();
+	}
+
+	int errorCount(void)
+	{
+		int count = 0;
+		yEnterCriticalSection(&_lock);
+		for (unsigned i = 0; i < _jobs.size(); i++)
+		{
+			if (_jobs[i].progress < 0)
+			{
+				count++;
+			}
+		}
+		yLeaveCriticalSection(&_lock);
+		return count;
+	}
+
+	vector<string> serials(void) const
+	{
+		vector<string> res;
+		for (unsigned i = 0; i < _jobs.size(); i++)
+		{
+			res.push_back(_jobs[i].serial);
+		}
+		return res;
+	}
+
+	int progress(const string& serial)
+	{
+		int res = YAPI_INVALID_ARGUMENT;
+		int idx = find(serial);
+		yEnterCriticalSection(&_lock);
+		if (idx >= 0)
+		{
+			res = _jobs[idx].progress;
+		}
+		yLeaveCriticalSection(&_lock);
+		return res;
+	}
+
+	string message(const string& serial)
+	{
+		string res = "unknown module";
+		int idx = find(serial);
+		yEnterCriticalSection(&_lock);
+		if (idx >= 0)
+		{
+			res = _jobs[idx].message;
+		}
+		yLeaveCriticalSection(&_lock);
+		return res;
+	}
+};
+
+//
+// YWorkerPool Class (used internally)
+//
+// Runs a set of jobs on a few worker threads, each thread taking the next job
+// until none is left.
+//
+class YOCTO_CLASS_EXPORT YWorkerPool
+{
+public:
+	typedef void (*JobFunction)(void* ctx, unsigned idx);
+
+private:
+	JobFunction _run;
+	void* _ctx;
+	unsigned _jobCount;
+	unsigned _nextJob;
+	yThread* _threads;
+	int _running;
+	yCRITICAL_SECTION _lock;
+	yEvent _idle;
+	// not copyable, the threads refer to the pool
+	YWorkerPool(const YWorkerPool&);
+	YWorkerPool& operator=(const YWorkerPool&);
+	static void* _workerThread(void* ctx);
+
+public:
+	YWorkerPool();
+	// waits for the threads still running
+	~YWorkerPool();
+
+	// Starts up to maxThreads threads calling run(ctx, idx) for each job index,
+	// after waiting for the end of the previous run. Returns the number of threads
+	// started: when none could be started, no job is run.
+	int start(int maxThreads, unsigned jobCount, JobFunction run, void* ctx);
+
+	// true while some threads are still running
+	bool isRunning(void);
+
+	// waits until every thread has exited
+	void wait(void);
+};
+
+
+/**
+ * YFirmwareUpdateScheduler Class: rolling firmware update of many modules
+ *
+ * The YFirmwareUpdateScheduler class updates the firmware of a set of modules
+ * concurrently. Each module is updated in a background session of its own;
+ * modules connected to the same YoctoHub are updated a few at a time, and
+ * modules connected by USB are updated one after the other. Each firmware
+ * file is loaded and checked only once, whatever the number of modules using it.
+ */
+class YOCTO_CLASS_EXPORT YFirmwareUpdateScheduler
+{
+protected:
+	typedef struct
+	{
+		string serial;
+		string path;
+		string settings;
+		bool force;
+		bool started;
+		int progress;
+		string message;
+		u64 flashedAt;
+		u64 onlineSince;
+	} Job;
+
+	YJobList<Job> _jobs;
+	int _maxPerHub;
+
+	void _processJob(Job& job);
+
+public:
+	/**
+	 * Creates an empty scheduler.
+	 *
+	 * @param maxPerHub : the maximal number of modules of a single YoctoHub that
+	 *         are updated at the same time. The hub has a single flash engine, so
+	 *         only their reboots and restarts overlap: the firmware uploads and
+	 *         flashes are still done one at a time
+	 */
+	YFirmwareUpdateScheduler(int maxPerHub = 1);
+
+	/**
+	 * Adds a module to the update plan. The update only starts with start().
+	 *
+	 * @param serial : the serial number of the module to update
+	 * @param path : the path of the .byn file to use
+	 * @param settings : the settings to restore after the update (as returned
+	 *         by get_allSettings()), or an empty string
+	 * @param force : true to force the firmware update even if some prerequisites
+	 *         appear not to be met
+	 */
+	void addDevice(const string& serial, const string& path, const string& settings = "", bool force = false);
+
+	/**
+	 * Starts the update of all the modules of the plan, in background. The
+	 * progress must then be polled with processMore() until isDone() is true.
+	 * Calling it again restarts the failed updates only.
+	 *
+	 * @return the global progress, as returned by get_globalProgress().
+	 */
+	int start(void);
+
+	/**
+	 * Updates the progress of every module, and restores the settings of the
+	 * modules that have been flashed.
+	 *
+	 * @return the global progress, as returned by get_globalProgress().
+	 */
+	int processMore(void);
+
+	/**
+	 * Returns true when the update of every module has either succeeded or failed.
+	 */
+	bool isDone(void);
+
+	/**
+	 * Returns the serial numbers of all the modules of the plan.
+	 */
+	vector<string> get_serials(void);
+
+	/**
+	 * Returns the progress of the update of a module.
+	 *
+	 * @param serial : the serial number of the module
+	 *
+	 * @return an integer in the range 0 to 100 (percentage of completion),
+	 *         or a negative error code in case of failure.
+	 */
+	int get_progress(const string& serial);
+
+	/**
+	 * Returns the last progress message of the update of a module, or the
+	 * error message if the update failed.
+	 *
+	 * @param serial : the serial number of the module
+	 */
+	string get_progressMessage(const string& serial);
+
+	/**
+	 * Returns the mean progress of all the modules, failed updates counting as completed.
+	 *
+	 * @return an integer in the range 0 to 100.
+	 */
+	int get_globalProgress(void);
+
+	/**
+	 * Returns the number of modules for which the update failed.
+	 */
+	int get_errorCount(void);
+};
+
+
 //--- (generated code: YDataStream declaration)
 /**
  * YDataStream Class: Unformatted data sequence
@@ -972,7 +1535,10 @@ public:
 
 	virtual int _initFromDataSet(YDataSet* dataset, vector<int> encoded);
 
-	virtual int _parseStream(string sdata);
+	virtual int _parseStream(const string& sdata);
+
+	// same as above, straight from a reply buffer
+	int _parseStream(const char* sdata, int len);
 
 	virtual string _get_url(void);
 
@@ -1476,6 +2042,244 @@ public:
 	//--- (end of generated code: YDataSet accessors declaration)
 };
 
+
+//
+// Message capture files
+//
+// A capture file starts with a fixed 64-byte header, followed by a data area made of
+// 8-byte aligned records. All integers are stored little-endian, so that the file can
+// be memory-mapped and walked directly by external tools:
+//
+//  header: "YCAP" | u16 version | u16 headerSize | u32 recordAlign | u32 flags |
+//          u64 capacity | u64 head | u64 tail | u64 recordCount | u64 totalRecords | s64 startUTC
+//  record: u32 payloadLen | u8 direction | u8 flags | u16 reserved | u32 devStamp | u32 seqNo |
+//          s64 hostUTC | payload (padded to 8 bytes)
+//
+// When capacity is non-zero, the data area is used as a ring buffer: head and tail are
+// offsets relative to the data area, and a record with payloadLen 0xFFFFFFFF marks the
+// point where the writer wrapped around to the start of the data area.
+//
+#define Y_CAPTURE_HEADER_SIZE       64
+#define Y_CAPTURE_RECORD_HEAD_SIZE  24
+#define Y_CAPTURE_RECORD_ALIGN      8
+#define Y_CAPTURE_WRAP_MARKER       0xFFFFFFFFu
+#define Y_CAPTURE_DIR_RX            0
+#define Y_CAPTURE_DIR_TX            1
+
+// One record read back from a capture file
+typedef struct
+{
+	int direction; // Y_CAPTURE_DIR_RX or Y_CAPTURE_DIR_TX
+	u32 devStamp; // device timestamp in [ms], if provided by the device
+	u32 seqNo; // record sequence number since the capture was started
+	s64 hostUTC; // host reception time, in [ms] since the epoch
+	string payload; // message as reported by the device (hexadecimal for binary protocols)
+} YCaptureRecord;
+
+//
+// YMessageCapture Class: continuous background capture of messages exchanged by
+// a serial-like port (YSerialPort, YSpiPort) into a timestamped capture file.
+//
+// The capture runs in its own thread and polls the device message buffer using
+// long-polling requests, so that no message is lost as long as the device buffer
+// does not overflow between two requests.
+//
+class YOCTO_CLASS_EXPORT YMessageCapture
+{
+private:
+	YFunction* _port;
+	string _serial;
+	string _subpath;
+	string _path;
+	u64 _capacity;
+	int _maxWait;
+	FILE* _file;
+	yThread _thread;
+	yCRITICAL_SECTION _lock;
+	int _rxptr;
+	u64 _head;
+	u64 _tail;
+	u64 _recordCount;
+	u64 _totalRecords;
+	s64 _startUTC;
+	u64 _startTick;
+	int _lastErrorType;
+	string _lastErrorMsg;
+
+	int _writeHeader(void);
+	int _readRecordSize(u64 offset, u64& recsize);
+	int _evict(u64 start, u64 stop);
+	int _appendRecord(int direction, u32 devStamp, const string& payload);
+	int _pullMessages(void);
+	static void* _captureThread(void* ctx);
+
+public:
+	YMessageCapture(YFunction* port, const string& path, s64 maxSize, int startPos);
+	~YMessageCapture();
+
+	/**
+	 * Opens the capture file and starts the background capture thread.
+	 *
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return YAPI_SUCCESS when the call succeeds.
+	 *
+	 * On failure returns a negative error code.
+	 */
+	int start(string& errmsg);
+
+	/**
+	 * Stops the background capture thread and closes the capture file.
+	 * Messages already stored in the file remain available.
+	 */
+	void stop(void);
+
+	// Replaces the capture held by a port object with a new capture of that port,
+	// as done by startCapture(). On failure, capture is left NULL.
+	static int Start(YMessageCapture*& capture, YFunction* port, const string& path, s64 maxSize, int startPos, string& errmsg);
+
+	// Stops and deletes the capture held by a port object, if any, as done by stopCapture()
+	static void Stop(YMessageCapture*& capture);
+
+	/**
+	 * Changes the maximum time the device may hold each polling request
+	 * while waiting for new messages (default is 500 ms). Smaller values
+	 * make stop() more reactive at the cost of more requests on idle lines.
+	 *
+	 * @param maxWait : the maximum waiting time, in milliseconds
+	 */
+	void set_maxWait(int maxWait);
+
+	bool isRunning(void);
+
+	// number of records currently stored in the capture file
+	s64 get_recordCount(void);
+
+	// number of records captured since start(), including overwritten ones
+	s64 get_totalRecords(void);
+
+	// absolute stream position of the next message to fetch from the device
+	int get_streamPosition(void);
+
+	int get_errorType(void);
+	string get_errorMessage(void);
+};
+
+//
+// YMessageCaptureReader Class: sequential reader for capture files written by YMessageCapture.
+//
+// Records are read one by one through a small buffer, so that captures of any size can
+// be walked without loading them in memory. Reading a file that is still being written
+// gives a consistent snapshot of the records present when open() was called, as long
+// as the writer does not wrap over them in the meantime.
+//
+class YOCTO_CLASS_EXPORT YMessageCaptureReader
+{
+private:
+	FILE* _file;
+	u64 _capacity;
+	u64 _pos;
+	u64 _remaining;
+	u64 _recordCount;
+	s64 _startUTC;
+
+public:
+	YMessageCaptureReader();
+	~YMessageCaptureReader();
+
+	/**
+	 * Opens a capture file and positions the reader on the oldest record.
+	 *
+	 * @param path : the capture file to read
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return YAPI_SUCCESS when the call succeeds.
+	 *
+	 * On failure returns a negative error code.
+	 */
+	int open(const string& path, string& errmsg);
+
+	/**
+	 * Reads the next record from the capture file.
+	 *
+	 * @param record : a YCaptureRecord passed by reference to receive the record
+	 *
+	 * @return true if a record has been read, false at the end of the capture.
+	 */
+	bool next(YCaptureRecord& record);
+
+	void close(void);
+
+	// number of records present in the capture when it was opened
+	s64 get_recordCount(void);
+
+	// UTC time in [ms] when the capture was started
+	s64 get_startUTC(void);
+};
+
+//
+// YHTTPReply Class (used internally)
+//
+// Holds the reply of a synchronous HTTP request in the buffer of the low-level
+// library, until the object is released or destroyed. This avoids copying large
+// replies (logger.json, files) before they are parsed. The I/O slot of the device
+// remains busy as long as the reply is held, so the device lock is held as well:
+// other threads wait for the lock, and a new request sent to the same device by
+// the same thread fails until the reply is released.
+//
+
+class YDevice;
+
+class YOCTO_CLASS_EXPORT YHTTPReply
+{
+	YIOHDL _iohdl;
+	bool _open;
+	const char* _data;
+	int _size;
+	int _bodyStart;
+	YDevice* _lockedDev;
+	// not copyable, the buffer belongs to the pending request
+	YHTTPReply(const YHTTPReply&);
+	YHTTPReply& operator=(const YHTTPReply&);
+
+public:
+	YHTTPReply();
+	~YHTTPReply();
+	void _attach(YIOHDL& iohdl, const char* data, int size);
+	// keeps the device locked until the reply is released
+	void _holdDevice(YDevice* dev);
+	// true if the reply is a successful HTTP reply
+	bool _isSuccess(void) const;
+	// locates the body after the HTTP header, returns false if there is no header
+	bool _skipHeader(void);
+	void release(void);
+
+	const char* data(void) const
+	{
+		return _data;
+	}
+
+	int size(void) const
+	{
+		return _size;
+	}
+
+	const char* body(void) const
+	{
+		return _data + _bodyStart;
+	}
+
+	int bodySize(void) const
+	{
+		return _size - _bodyStart;
+	}
+
+	string bodyString(void) const
+	{
+		return string(_data + _bodyStart, _size - _bodyStart);
+	}
+};
+
 //
 // YDevice Class (used internally)
 //
@@ -1500,27 +2304,155 @@ private:
 	YDEV_DESCR _devdescr;
 	u64 _cacheStamp; // used only by requestAPI method
 	YJSONObject* _cacheJson; // used only by requestAPI method
+	YJSONObject* _refJson; // last full api.json, used to expand ?fw= replies
 	vector<YFUN_DESCR> _functions;
 	char _rootdevice[YOCTO_SERIAL_LEN];
 	char* _subpath;
 	yCRITICAL_SECTION _lock;
+	// a reply returned by HTTPRequest() still holds the I/O slot and the lock
+	bool _replyHeld;
 	// Constructor is private, use getDevice factory method
 	YDevice(YDEV_DESCR devdesc);
 	~YDevice();
 	YRETCODE HTTPRequestPrepare(const string& request, string& fullrequest, char* errbuff);
+	YRETCODE HTTPRequest_unsafe(int channel, const string& request, YHTTPReply& reply, yapiRequestProgressCallback progress_cb, void* progress_ctx, string& errmsg);
 	YRETCODE HTTPRequest_unsafe(int channel, const string& request, string& buffer, yapiRequestProgressCallback progress_cb, void* progress_ctx, string& errmsg);
+	void clearJsonCache(void);
 
 public:
 	static void ClearCache();
 	static YDevice* getDevice(YDEV_DESCR devdescr);
 	YRETCODE HTTPRequestAsync(int channel, const string& request, HTTPRequestCallback callback, void* context, string& errmsg);
+	YRETCODE HTTPRequest(int channel, const string& request, YHTTPReply& reply, yapiRequestProgressCallback progress_cb, void* progress_ctx, string& errmsg);
 	YRETCODE HTTPRequest(int channel, const string& request, string& buffer, yapiRequestProgressCallback progress_cb, void* progress_ctx, string& errmsg);
 	YRETCODE requestAPI(YJSONObject*& apires, string& errmsg);
+	void _releaseReply(void);
+	// on success, the device lock is held until releaseFunctionAPI() is called:
+	// the node belongs to the shared device cache, which parses it lazily
+	YRETCODE requestFunctionAPI(const string& funcId, YJSONObject*& node, string& errmsg);
+	void releaseFunctionAPI(void);
 	void clearCache(bool clearSubpath);
 	YRETCODE getFunctions(vector<YFUN_DESCR>** functions, string& errmsg);
 	string getHubSerial(void);
 };
 
+//
+// YSettingsSync Class: concurrent backup and restore of the settings of many modules
+//
+// Each module is handled by one of a few worker threads, so that the round trips
+// of different modules overlap. Backups produce the same document as
+// YModule::get_allSettings(); restores compute the list of attributes that differ
+// from the module in a single pass, and can be run in dry-run mode to only report
+// the requests that would be sent.
+//
+class YOCTO_CLASS_EXPORT YSettingsSync
+{
+private:
+	typedef struct
+	{
+		string url; // REST request, or empty for a file upload
+		string name; // uploaded file name
+		string data; // uploaded file content
+	} Step;
+
+	typedef struct
+	{
+		string serial;
+		bool restore;
+		string subpath;
+		YModule* module;
+		vector<string> functions;
+		vector<string> temperatures;
+		string settings;
+		vector<string> changes;
+		int progress;
+		string message;
+	} Job;
+
+	YJobList<Job> _jobs;
+	YWorkerPool _pool;
+	int _maxThreads;
+	bool _dryRun;
+
+	void _setProgress(Job& job, int done, int total);
+	int _get(Job& job, const string& url, string& body, string& errmsg);
+	int _upload(Job& job, const string& name, const string& data, string& errmsg);
+	int _backupJob(Job& job, string& errmsg);
+	int _planChanges(Job& job, const string& settings, vector<Step>& plan, string& errmsg);
+	int _restoreJob(Job& job, string& errmsg);
+	static void _runJob(void* ctx, unsigned idx);
+
+public:
+	YSettingsSync(int maxThreads = 8);
+	~YSettingsSync();
+
+	/**
+	 * Adds a module whose settings and files must be backed up. Modules
+	 * must be added before calling start().
+	 *
+	 * @param serial : the serial number of the module
+	 */
+	void addBackup(const string& serial);
+
+	/**
+	 * Adds a module whose settings and files must be restored. Modules
+	 * must be added before calling start(). As with set_allSettingsAndFiles(),
+	 * the settings are not saved to flash memory.
+	 *
+	 * @param serial : the serial number of the module
+	 * @param settings : the settings to restore, as returned by get_allSettings()
+	 */
+	void addRestore(const string& serial, const string& settings);
+
+	/**
+	 * Enables or disables dry-run mode. In dry-run mode, restores only read the
+	 * current settings of the modules and report the requests that would be sent,
+	 * through get_changes().
+	 *
+	 * @param dryRun : true to enable dry-run mode
+	 */
+	void set_dryRun(bool dryRun);
+
+	/**
+	 * Starts the worker threads. The progress can then be polled with
+	 * get_globalProgress() until isDone() is true.
+	 *
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return YAPI_SUCCESS when the call succeeds.
+	 *
+	 * On failure returns a negative error code.
+	 */
+	int start(string& errmsg);
+
+	/**
+	 * Waits until every module has been processed, and stops the worker threads.
+	 */
+	void wait(void);
+
+	// true when every module has either succeeded or failed
+	bool isDone(void);
+
+	// mean progress of all modules, failed ones counting as completed
+	int get_globalProgress(void);
+
+	int get_errorCount(void);
+
+	vector<string> get_serials(void);
+
+	// progress of a module (0 to 100), or a negative error code on failure
+	int get_progress(const string& serial);
+
+	// last progress message of a module, or its error message on failure
+	string get_progressMessage(const string& serial);
+
+	// settings of a module once its backup is completed
+	string get_settings(const string& serial);
+
+	// requests sent to a module by a restore (or that would be sent, in dry-run mode)
+	vector<string> get_changes(const string& serial);
+};
+
 //--- (generated code: YFunction declaration)
 /**
  * YFunction Class: Common function interface
@@ -1554,6 +2486,7 @@ protected:
 	yCRITICAL_SECTION _this_cs;
 	std::map<string, YDataStream*> _dataStreams;
 	void* _userData;
+	friend class YSettingsSync;
 	//--- (generated code: YFunction attributes)
 	// Attributes (function value cache)
 	string _logicalName;
@@ -1573,7 +2506,26 @@ protected:
 	// Constructor is protected, use yFindFunction factory function to instantiate
 	YFunction(const string& func);
 	//--- (end of generated code: YFunction attributes)
-	static std::map<string, YFunction*> _cache;
+
+	// function cache: open-addressing hash table keyed by (class id, name hash),
+	// the name itself is compared against the cached object
+	typedef struct
+	{
+		u32 hash;
+		int classId;
+		YFunction* obj;
+	} CacheEntry;
+
+	static vector<CacheEntry> _cache;
+	static int _cacheCount;
+	// interned class names, and the class literals already resolved to an id
+	static vector<string> _cacheClasses;
+	static vector<std::pair<const char*, int> > _cacheClassPtrs;
+	static int _CacheClassId(const char* classname, bool isLiteral);
+	static int _CacheLookup(int classId, u32 hash, const string& func);
+	static void _CacheGrow(void);
+	static YFunction* _FindFromCache(int classId, const string& func);
+	static void _AddToCache(int classId, const string& func, YFunction* obj);
 
 
 	// Method used to retrieve our unique function descriptor (may trigger a hub scan)
@@ -1599,7 +2551,12 @@ protected:
 
 	// function cache methods
 	static YFunction* _FindFromCache(const string& classname, const string& func);
+	static YFunction* _FindFromCache(const char* classname, const string& func);
 	static void _AddToCache(const string& classname, const string& func, YFunction* obj);
+	static void _AddToCache(const char* classname, const string& func, YFunction* obj);
+
+	// Method used to list the hardware ids of all functions of a class in one query
+	static vector<string> _GetHardwareIdsByClass(const string& className);
 
 public:
 	virtual ~YFunction();
@@ -1607,6 +2564,29 @@ public:
 	// clear cache of all YFunction object (use only on YAPI::FreeAPI)
 	static void _ClearCache(void);
 
+	/**
+	 * Retrieves all the functions of a given class that are currently reachable,
+	 * using a single query of the function directory instead of successive calls
+	 * to nextXxx().
+	 *
+	 * @param className : the name of the function class, for instance "Temperature"
+	 * @param finder : the factory function of that class, for instance YTemperature::FindTemperature
+	 *
+	 * @return a vector of objects, empty if no such function is currently reachable.
+	 */
+	template <class T>
+	static vector<T*> FindAllByClass(const string& className, T* (*finder)(string))
+	{
+		vector<string> hwids = _GetHardwareIdsByClass(className);
+		vector<T*> res;
+		res.reserve(hwids.size());
+		for (unsigned i = 0; i < hwids.size(); i++)
+		{
+			res.push_back(finder(hwids[i]));
+		}
+		return res;
+	}
+
 	// Method used to throw exceptions or save error type/message
 	void _throw(YRETCODE errType, string errMsg);
 
@@ -1615,6 +2595,10 @@ public:
 	string _requestEx(int tcpchan, const string& request, yapiRequestProgressCallback callback, void* context);
 	string _download(const string& url);
 
+	// Same as above, but the reply is left in the library buffer
+	YRETCODE _requestEx(int tcpchan, const string& request, YHTTPReply& reply, yapiRequestProgressCallback callback, void* context);
+	YRETCODE _download(const string& url, YHTTPReply& reply);
+
 	// Method used to upload a file to the device
 	YRETCODE _uploadWithProgress(const string& path, const string& content, yapiRequestProgressCallback callback, void* context);
 	YRETCODE _upload(const string& path, const string& content);
@@ -1622,6 +2606,7 @@ public:
 	// Method used to parse a string in JSON data (low-level)
 	string _json_get_key(const string& json, const string& data);
 	string _json_get_string(const string& json);
+	string _json_get_string(const char* json, int len);
 	vector<string> _json_get_array(const string& json);
 	string _get_json_path(const string& json, const string& path);
 	string _decode_json_string(const string& json);
@@ -1194,5 +1194,319 @@ YColorLedCluster* YColorLedCluster::FirstColorLedCluster(void)
 
 //--- (end of YColorLedCluster implementation)
 
+YLedAnimator::YLedAnimator(YColorLedCluster* cluster, int firstLed, int ledCount):
+	_cluster(cluster), _firstLed(firstLed), _ledCount(ledCount), _interval(1000 / Y_LEDANIM_DEFAULT_FPS),
+	_pendingStamp(0), _hasPending(false), _ackedValid(false), _framesSent(0), _framesDropped(0),
+	_ledsSent(0), _avgPeriod(0), _avgLatency(0), _lastSent(0), _lastErrorType(YAPI_SUCCESS), _lastErrorMsg("")
+{
+	memset(&_thread, 0, sizeof(_thread));
+	yCreateEvent(&_wakeup);
+	yCreateEvent(&_done);
+	yInitializeCriticalSection(&_lock);
+}
+
+YLedAnimator::~YLedAnimator()
+{
+	this->stop();
+	yCloseEvent(&_wakeup);
+	yCloseEvent(&_done);
+	yDeleteCriticalSection(&_lock);
+}
+
+// Sends the pending frame, if any. Returns 1 if a frame has been sent,
+// 0 if there was nothing to send, or a negative error code
+int YLedAnimator::_sendFrame(YColorLedCluster* cluster)
+{
+	vector<int> frame;
+	u64 stamp;
+	int res = YAPI_SUCCESS;
+	int sent = 0;
+
+	yEnterCriticalSection(&_lock);
+	if (!_hasPending)
+	{
+		yLeaveCriticalSection(&_lock);
+		return 0;
+	}
+	frame.swap(_pending);
+	stamp = _pendingStamp;
+	_hasPending = false;
+	bool valid = _ackedValid;
+	yLeaveCriticalSection(&_lock);
+
+	// upload each contiguous range of changed LEDs, merging close ranges
+	int idx = 0;
+	while (idx < _ledCount)
+	{
+		if (valid && frame[idx] == _acked[idx])
+		{
+			idx++;
+			continue;
+		}
+		int start = idx;
+		int last = idx;
+		while (++idx < _ledCount && idx - last <= Y_LEDANIM_MERGE_GAP)
+		{
+			if (!valid || frame[idx] != _acked[idx])
+			{
+				last = idx;
+			}
+		}
+		vector<int> range(frame.begin() + start, frame.begin() + last + 1);
+		try
+		{
+			res = cluster->set_rgbColorArray(_firstLed + start, range);
+		}
+		catch (YAPI_Exception& ex)
+		{
+			res = ex.errorType;
+		}
+		if (YISERR(res))
+		{
+			break;
+		}
+		sent += last + 1 - start;
+		idx = last + 1;
+	}
+
+	u64 now = yapiGetTickCount();
+	yEnterCriticalSection(&_lock);
+	if (YISERR(res))
+	{
+		// the device state is now unknown: resend the whole frame on next tick,
+		// unless a newer frame has been submitted in the meantime
+		_ackedValid = false;
+		if (!_hasPending)
+		{
+			_pending.swap(frame);
+			_pendingStamp = stamp;
+			_hasPending = true;
+		}
+		_lastErrorType = res;
+		_lastErrorMsg = cluster->get_errorMessage();
+		yLeaveCriticalSection(&_lock);
+		return res;
+	}
+	_acked.swap(frame);
+	// keep an invalidation requested while the frame was being sent
+	_ackedValid = (!valid || _ackedValid);
+	_framesSent++;
+	_ledsSent += sent;
+	_avgLatency = (_avgLatency * 7 + (int)(now - stamp)) / 8;
+	if (_lastSent != 0)
+	{
+		_avgPeriod = (_avgPeriod * 7 + (int)(now - _lastSent)) / 8;
+	}
+	_lastSent = now;
+	yLeaveCriticalSection(&_lock);
+	return 1;
+}
+
+void* YLedAnimator::_animThread(void* ctx)
+{
+	yThread* thread = (yThread*)ctx;
+	YLedAnimator* anim = (YLedAnimator*)thread->ctx;
+	YColorLedCluster* cluster;
+	u64 nextTick = yapiGetTickCount();
+	u64 now;
+
+	yThreadSignalStart(thread);
+	cluster = YColorLedCluster::FindColorLedCluster(anim->_hwid);
+	while (!yThreadMustEnd(thread))
+	{
+		if (YISERR(anim->_sendFrame(cluster)))
+		{
+			// device unreachable: retry later without hammering the hub
+			nextTick = yapiGetTickCount() + 500;
+		}
+		else
+		{
+			// when a frame took longer than the frame clock, do not try to catch up
+			yEnterCriticalSection(&anim->_lock);
+			nextTick += anim->_interval;
+			yLeaveCriticalSection(&anim->_lock);
+			u64 now = yapiGetTickCount();
+			if (nextTick < now)
+			{
+				nextTick = now;
+			}
+		}
+		now = yapiGetTickCount();
+		while (!yThreadMustEnd(thread) && now < nextTick)
+		{
+			yWaitForEvent(&anim->_wakeup, (int)(nextTick - now));
+			now = yapiGetTickCount();
+		}
+	}
+	yThreadSignalEnd(thread);
+	// last access to the animator, stop() may delete it right after
+	ySetEvent(&anim->_done);
+	return NULL;
+}
+
+int YLedAnimator::start(string& errmsg)
+{
+	if (yThreadIsRunning(&_thread))
+	{
+		return YAPI_SUCCESS;
+	}
+	if (_ledCount <= 0)
+	{
+		errmsg = "Invalid LED count";
+		return YAPI_INVALID_ARGUMENT;
+	}
+	// resolve the device in the caller thread, the animation thread
+	// uses its own object for the same function
+	try
+	{
+		_hwid = _cluster->get_hardwareId();
+	}
+	catch (YAPI_Exception& ex)
+	{
+		errmsg = ex.what();
+		return ex.errorType;
+	}
+	if (_hwid == YAPI_INVALID_STRING)
+	{
+		errmsg = _cluster->get_errorMessage();
+		return _cluster->get_errorType();
+	}
+	yEnterCriticalSection(&_lock);
+	_lastErrorType = YAPI_SUCCESS;
+	_lastErrorMsg = "";
+	yLeaveCriticalSection(&_lock);
+	memset(&_thread, 0, sizeof(_thread));
+	if (yThreadCreate(&_thread, _animThread, this) < 0)
+	{
+		errmsg = "Unable to start animation thread";
+		return YAPI_IO_ERROR;
+	}
+	return YAPI_SUCCESS;
+}
+
+void YLedAnimator::stop(void)
+{
+	if (_thread.st != YTHREAD_NOT_STARTED)
+	{
+		// the thread is never cancelled, since it may hold _lock or be in the
+		// middle of a request: it ends once its pending upload has completed
+		yThreadRequestEnd(&_thread);
+		ySetEvent(&_wakeup);
+		yWaitForEvent(&_done, -1);
+		memset(&_thread, 0, sizeof(_thread));
+	}
+	yEnterCriticalSection(&_lock);
+	_hasPending = false;
+	yLeaveCriticalSection(&_lock);
+}
+
+bool YLedAnimator::isRunning(void)
+{
+	return yThreadIsRunning(&_thread) != 0;
+}
+
+int YLedAnimator::set_frameRate(int fps)
+{
+	if (fps < 1 || fps > 1000)
+	{
+		return YAPI_INVALID_ARGUMENT;
+	}
+	yEnterCriticalSection(&_lock);
+	_interval = 1000 / fps;
+	yLeaveCriticalSection(&_lock);
+	return YAPI_SUCCESS;
+}
+
+int YLedAnimator::pushFrame(const vector<int>& rgbList)
+{
+	if ((int)rgbList.size() != _ledCount)
+	{
+		return YAPI_INVALID_ARGUMENT;
+	}
+	yEnterCriticalSection(&_lock);
+	if (_hasPending)
+	{
+		_framesDropped++;
+	}
+	_pending = rgbList;
+	_pendingStamp = yapiGetTickCount();
+	_hasPending = true;
+	yLeaveCriticalSection(&_lock);
+	return YAPI_SUCCESS;
+}
+
+void YLedAnimator::invalidate(void)
+{
+	yEnterCriticalSection(&_lock);
+	_ackedValid = false;
+	yLeaveCriticalSection(&_lock);
+}
+
+double YLedAnimator::get_achievedFps(void)
+{
+	double res = 0;
+	yEnterCriticalSection(&_lock);
+	if (_avgPeriod > 0)
+	{
+		res = 1000.0 / _avgPeriod;
+	}
+	yLeaveCriticalSection(&_lock);
+	return res;
+}
+
+int YLedAnimator::get_frameLatency(void)
+{
+	int res;
+	yEnterCriticalSection(&_lock);
+	res = _avgLatency;
+	yLeaveCriticalSection(&_lock);
+	return res;
+}
+
+int YLedAnimator::get_framesSent(void)
+{
+	int res;
+	yEnterCriticalSection(&_lock);
+	res = _framesSent;
+	yLeaveCriticalSection(&_lock);
+	return res;
+}
+
+int YLedAnimator::get_framesDropped(void)
+{
+	int res;
+	yEnterCriticalSection(&_lock);
+	res = _framesDropped;
+	yLeaveCriticalSection(&_lock);
+	return res;
+}
+
+int YLedAnimator::get_ledsSent(void)
+{
+	int res;
+	yEnterCriticalSection(&_lock);
+	res = _ledsSent;
+	yLeaveCriticalSection(&_lock);
+	return res;
+}
+
+int YLedAnimator::get_errorType(void)
+{
+	int res;
+	yEnterCriticalSection(&_lock);
+	res = _lastErrorType;
+	yLeaveCriticalSection(&_lock);
+	return res;
+}
+
+string YLedAnimator::get_errorMessage(void)
+{
+	string res;
+	yEnterCriticalSection(&_lock);
+	res = _lastErrorMsg;
+	yLeaveCriticalSection(&_lock);
+	return res;
+}
+
 //--- (ColorLedCluster functions)
 //--- (end of ColorLedCluster functions)
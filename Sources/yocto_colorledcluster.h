@@ -745,6 +745,133 @@ public:
 	//--- (end of YColorLedCluster accessors declaration)
 };
 
+// Largest run of unchanged LEDs that is still sent within a single upload,
+// rather than splitting the update into two uploads
+#define Y_LEDANIM_MERGE_GAP         32
+// Default frame clock, in frames per second
+#define Y_LEDANIM_DEFAULT_FPS       30
+
+/**
+ * YLedAnimator Class: LED animation streaming scheduler
+ *
+ * The animator receives frames from the application and sends them to a
+ * ColorLedCluster at a fixed frame clock, from a background thread. Each
+ * frame is compared with the last state acknowledged by the device, and only
+ * the ranges of LEDs that changed are uploaded. When the link cannot keep up,
+ * intermediate frames are merged into the most recent one instead of queuing.
+ * The thread drives the cluster through its own object, found by hardware id,
+ * since the object given by the application is not meant to be shared.
+ */
+class YOCTO_CLASS_EXPORT YLedAnimator
+{
+private:
+	YColorLedCluster* _cluster;
+	string _hwid;
+	int _firstLed;
+	int _ledCount;
+	int _interval;
+	yThread _thread;
+	yEvent _wakeup; // wakes the thread up when stop() is called
+	yEvent _done;   // set by the thread when it ends
+	yCRITICAL_SECTION _lock;
+	vector<int> _pending;
+	u64 _pendingStamp;
+	bool _hasPending;
+	vector<int> _acked;
+	bool _ackedValid;
+	int _framesSent;
+	int _framesDropped;
+	int _ledsSent;
+	int _avgPeriod;
+	int _avgLatency;
+	u64 _lastSent;
+	int _lastErrorType;
+	string _lastErrorMsg;
+
+	int _sendFrame(YColorLedCluster* cluster);
+	static void* _animThread(void* ctx);
+
+public:
+	/**
+	 * Creates an animator for a range of LEDs of a ColorLedCluster.
+	 *
+	 * @param cluster : the LED cluster to drive
+	 * @param firstLed : index of the first LED of the animated range
+	 * @param ledCount : number of LEDs in the animated range
+	 */
+	YLedAnimator(YColorLedCluster* cluster, int firstLed, int ledCount);
+	~YLedAnimator();
+
+	/**
+	 * Starts the background thread that sends frames to the device.
+	 *
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return YAPI_SUCCESS when the call succeeds.
+	 *
+	 * On failure returns a negative error code.
+	 */
+	int start(string& errmsg);
+
+	/**
+	 * Stops the background thread. Frames that have not been sent yet are discarded.
+	 */
+	void stop(void);
+
+	bool isRunning(void);
+
+	/**
+	 * Changes the frame clock of the animator.
+	 *
+	 * @param fps : the number of frames per second to send (1..1000)
+	 *
+	 * @return YAPI_SUCCESS when the call succeeds.
+	 */
+	int set_frameRate(int fps);
+
+	/**
+	 * Submits a new frame. If the previous frame has not been sent yet, it is
+	 * replaced by the new one and counted as dropped.
+	 *
+	 * @param rgbList : a list of 24bit RGB codes, in the form 0xRRGGBB, one
+	 *         for each LED of the animated range
+	 *
+	 * @return YAPI_SUCCESS when the call succeeds.
+	 *
+	 * On failure returns a negative error code.
+	 */
+	int pushFrame(const vector<int>& rgbList);
+
+	/**
+	 * Forgets the state acknowledged by the device, so that the next frame
+	 * is sent completely. Use this method if the LEDs have been modified by
+	 * other means than this animator.
+	 */
+	void invalidate(void);
+
+	/**
+	 * Returns the frame rate actually achieved, in frames per second.
+	 */
+	double get_achievedFps(void);
+
+	/**
+	 * Returns the average delay between the submission of a frame and its
+	 * acknowledgement by the device, in milliseconds.
+	 */
+	int get_frameLatency(void);
+
+	int get_framesSent(void);
+	int get_framesDropped(void);
+	int get_ledsSent(void);
+
+	/**
+	 * Returns the last error code that occurred while sending frames, or YAPI_SUCCESS.
+	 */
+	int get_errorType(void);
+
+	string get_errorMessage(void);
+};
+
 //--- (ColorLedCluster functions declaration)
 
 /**
@@ -45,6 +45,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 #define  __FILE_ID__  "display"
 
 
@@ -65,7 +66,11 @@ int YDisplayLayer::command_push(string cmd)
 {
 	int res = YAPI_SUCCESS;
 
-	if (_cmdbuff.length() + cmd.length() >= 100)
+	if (_display->isBatching())
+	{
+		_display->batchSwitchLayer(this);
+	}
+	if (_cmdbuff.length() + cmd.length() >= (unsigned)_display->get_commandSize())
 	{
 		// force flush before, to prevent overflow
 		res = flush_now();
@@ -83,7 +88,7 @@ int YDisplayLayer::command_push(string cmd)
 int YDisplayLayer::command_flush(string cmd)
 {
 	int res = command_push(cmd);
-	if (_hidden)
+	if (_hidden || _display->isBatching())
 	{
 		return res;
 	}
@@ -620,6 +625,9 @@ YDisplay::YDisplay(const string& func): YFunction(func)
                                         , _allDisplayLayers(0)
                                         , _recording(false)
                                         , _sequence("")
+                                        , _commandSize(Y_DISPLAY_COMMAND_SIZE)
+                                        , _batching(false)
+                                        , _batchLayer(NULL)
 {
 	_className = "Display";
 }
@@ -1435,6 +1443,15 @@ int YDisplay::stopSequence(void)
  */
 int YDisplay::upload(string pathname, string content)
 {
+	if (_batching)
+	{
+		// the upload is sent right away, send the commands issued before it
+		int res = this->flushBatch();
+		if (YISERR(res))
+		{
+			return res;
+		}
+	}
 	return this->_upload(pathname, content);
 }
 
@@ -1549,12 +1566,508 @@ int YDisplay::sendCommand(string cmd)
 {
 	if (!_recording)
 	{
+		if (_batching)
+		{
+			_batch.push_back(cmd);
+			return YAPI_SUCCESS;
+		}
 		return this->set_command(cmd);
 	}
 	_sequence += cmd + "\n";
 	return YAPI_SUCCESS;
 }
 
+// internal function to keep commands of different layers in order while batching
+void YDisplay::batchSwitchLayer(YDisplayLayer* layer)
+{
+	if (_batchLayer && _batchLayer != layer)
+	{
+		_batchLayer->flush_now();
+	}
+	_batchLayer = layer;
+}
+
+int YDisplay::set_commandSize(int size)
+{
+	if (size < 16)
+	{
+		this->_throw(YAPI_INVALID_ARGUMENT, "Command size too small");
+		return YAPI_INVALID_ARGUMENT;
+	}
+	this->flushLayers();
+	_commandSize = size;
+	return YAPI_SUCCESS;
+}
+
+int YDisplay::beginBatch(void)
+{
+	this->flushLayers();
+	_batching = true;
+	_batchLayer = NULL;
+	_batch.clear();
+	return YAPI_SUCCESS;
+}
+
+// Length of the layer number that starts a layer command, or 0 for a display command
+static size_t yDisplayLayerPrefix(const string& cmd)
+{
+	size_t len = 0;
+	while (len < cmd.length() && cmd[len] >= '0' && cmd[len] <= '9')
+	{
+		len++;
+	}
+	return len;
+}
+
+int YDisplay::flushBatch(void)
+{
+	vector<string> requests;
+	size_t prefix, lastPrefix = 0;
+
+	// layer buffers are appended to the batch while still batching
+	this->flushLayers();
+	_batchLayer = NULL;
+	// consecutive commands of the same layer, left partly filled by an explicit
+	// flush, are merged up to the command size accepted by the display
+	for (unsigned i = 0; i < _batch.size(); i++)
+	{
+		const string& cmd = _batch[i];
+		prefix = yDisplayLayerPrefix(cmd);
+		if (prefix > 0 && requests.size() > 0 && lastPrefix == prefix &&
+			requests.back().compare(0, prefix, cmd, 0, prefix) == 0 &&
+			requests.back().length() + cmd.length() - prefix < (unsigned)_commandSize)
+		{
+			requests.back().append(cmd, prefix, string::npos);
+			continue;
+		}
+		requests.push_back(cmd);
+		lastPrefix = prefix;
+	}
+	_batch.clear();
+	int res = YAPI_SUCCESS;
+	for (unsigned i = 0; i < requests.size(); i++)
+	{
+		// requests are queued asynchronously, so they are pipelined to the device
+		res = this->set_command(requests[i]);
+		if (YISERR(res))
+		{
+			break;
+		}
+	}
+	return res;
+}
+
+int YDisplay::endBatch(void)
+{
+	if (!_batching)
+	{
+		return YAPI_SUCCESS;
+	}
+	int res = this->flushBatch();
+	_batching = false;
+	return res;
+}
+
+int YDisplay::saveCachedSequence(string sequenceName)
+{
+	this->flushLayers();
+	_recording = false;
+	int res = YAPI_SUCCESS;
+	std::map<string, string>::iterator it = _sequenceCache.find(sequenceName);
+	if (it == _sequenceCache.end() || it->second != _sequence)
+	{
+		res = this->_upload(sequenceName, _sequence);
+		if (YISERR(res))
+		{
+			_sequenceCache.erase(sequenceName);
+		}
+		else
+		{
+			_sequenceCache[sequenceName] = _sequence;
+		}
+	}
+	_sequence = "";
+	return res;
+}
+
+void YDisplay::clearSequenceCache(void)
+{
+	_sequenceCache.clear();
+}
+
+
+YDisplayFrameBuffer::YDisplayFrameBuffer(YDisplay* display, int frontLayerId, int backLayerId):
+	_display(display), _frontId(frontLayerId), _backId(backLayerId), _width(0), _height(0),
+	_onGray(255), _offGray(0), _frontValid(false), _backValid(false), _backPen(-1),
+	_minInterval(1000 / Y_FRAMEBUF_DEFAULT_FPS), _avgSendTime(0), _lastFrame(0),
+	_frameCount(0), _lastFrameBytes(0), _lastDirtyRects(0)
+{
+}
+
+// internal function to allocate the buffers once the display size is known
+int YDisplayFrameBuffer::_init(void)
+{
+	if (_width > 0)
+	{
+		return YAPI_SUCCESS;
+	}
+	int w = _display->get_layerWidth();
+	int h = _display->get_layerHeight();
+	if (w <= 0 || h <= 0)
+	{
+		return YAPI_DEVICE_NOT_FOUND;
+	}
+	YDisplayLayer* back = _display->get_displayLayer(_backId);
+	if (!back || !_display->get_displayLayer(_frontId))
+	{
+		return YAPI_INVALID_ARGUMENT;
+	}
+	int res = back->hide();
+	if (YISERR(res))
+	{
+		return res;
+	}
+	_width = w;
+	_height = h;
+	_frame.assign(w * h, 0);
+	_shadowFront.assign(w * h, 0);
+	_shadowBack.assign(w * h, 0);
+	_frontValid = false;
+	_backValid = false;
+	_backPen = -1;
+	return YAPI_SUCCESS;
+}
+
+int YDisplayFrameBuffer::get_width(void)
+{
+	_init();
+	return _width;
+}
+
+int YDisplayFrameBuffer::get_height(void)
+{
+	_init();
+	return _height;
+}
+
+int YDisplayFrameBuffer::set_grayLevels(int onGray, int offGray)
+{
+	if (onGray < 0 || onGray > 255 || offGray < 0 || offGray > 255)
+	{
+		return YAPI_INVALID_ARGUMENT;
+	}
+	if (onGray != _onGray || offGray != _offGray)
+	{
+		_onGray = onGray;
+		_offGray = offGray;
+		this->invalidate();
+	}
+	return YAPI_SUCCESS;
+}
+
+int YDisplayFrameBuffer::set_maxFrameRate(int fps)
+{
+	if (fps < 0)
+	{
+		return YAPI_INVALID_ARGUMENT;
+	}
+	_minInterval = (fps > 0 ? 1000 / fps : 0);
+	return YAPI_SUCCESS;
+}
+
+int YDisplayFrameBuffer::get_frameInterval(void)
+{
+	return (_avgSendTime > _minInterval ? _avgSendTime : _minInterval);
+}
+
+bool YDisplayFrameBuffer::isReady(void)
+{
+	if (_lastFrame == 0)
+	{
+		return true;
+	}
+	return YAPI::GetTickCount() >= _lastFrame + (u64)this->get_frameInterval();
+}
+
+void YDisplayFrameBuffer::clear(void)
+{
+	std::fill(_frame.begin(), _frame.end(), 0);
+}
+
+void YDisplayFrameBuffer::setPixel(int x, int y, bool lit)
+{
+	if (x >= 0 && x < _width && y >= 0 && y < _height)
+	{
+		_frame[y * _width + x] = (lit ? 1 : 0);
+	}
+}
+
+bool YDisplayFrameBuffer::getPixel(int x, int y)
+{
+	if (x >= 0 && x < _width && y >= 0 && y < _height)
+	{
+		return _frame[y * _width + x] != 0;
+	}
+	return false;
+}
+
+void YDisplayFrameBuffer::fillRect(int x, int y, int w, int h, bool lit)
+{
+	int x2 = (x + w > _width ? _width : x + w);
+	int y2 = (y + h > _height ? _height : y + h);
+	if (x < 0) x = 0;
+	if (y < 0) y = 0;
+	for (int j = y; j < y2; j++)
+	{
+		for (int i = x; i < x2; i++)
+		{
+			_frame[j * _width + i] = (lit ? 1 : 0);
+		}
+	}
+}
+
+// same bitmap format as YDisplayLayer::drawBitmap, zero bits are drawn unlit
+void YDisplayFrameBuffer::drawBitmap(int x, int y, int w, const string& bitmap)
+{
+	int stride = (w + 7) / 8;
+	if (stride <= 0)
+	{
+		return;
+	}
+	int h = (int)bitmap.size() / stride;
+	for (int j = 0; j < h; j++)
+	{
+		const unsigned char* row = (const unsigned char*)bitmap.data() + j * stride;
+		for (int i = 0; i < w; i++)
+		{
+			this->setPixel(x + i, y + j, (row[i >> 3] & (0x80 >> (i & 7))) != 0);
+		}
+	}
+}
+
+void YDisplayFrameBuffer::invalidate(void)
+{
+	_frontValid = false;
+	_backValid = false;
+	_backPen = -1;
+}
+
+// Collects horizontal runs of pixels to redraw in the rectangle, as (x1,x2,y)
+// triples, and returns the estimated number of bytes needed to send them
+int YDisplayFrameBuffer::_cmdEncoding(int x, int y, int w, int h, vector<int>& on_runs, vector<int>& off_runs)
+{
+	int len = 0;
+
+	for (int j = y; j < y + h; j++)
+	{
+		const u8* frame = &_frame[j * _width];
+		const u8* shadow = &_shadowBack[j * _width];
+		int i = x;
+		while (i < x + w)
+		{
+			if (_backValid && frame[i] == shadow[i])
+			{
+				i++;
+				continue;
+			}
+			// extend the run over all pixels of the same value, dirty or not
+			u8 val = frame[i];
+			int start = i;
+			while (i + 1 < x + w && frame[i + 1] == val)
+			{
+				i++;
+			}
+			vector<int>& runs = (val ? on_runs : off_runs);
+			runs.push_back(start);
+			runs.push_back(i);
+			runs.push_back(j);
+			if (start == i)
+			{
+				len += (int)YapiWrapper::ysprintf("P%d,%d", start, j).length();
+			}
+			else
+			{
+				len += (int)YapiWrapper::ysprintf("B%d,%d,%d,%d", start, j, i, j).length();
+			}
+			i++;
+		}
+	}
+	return len;
+}
+
+// Packs the rectangle as a bitmap, and returns its size in bytes
+int YDisplayFrameBuffer::_bmpEncoding(int x, int y, int w, int h, string& bitmap)
+{
+	int stride = (w + 7) / 8;
+	bitmap.assign(stride * h, '\0');
+	for (int j = 0; j < h; j++)
+	{
+		const u8* frame = &_frame[(y + j) * _width];
+		for (int i = 0; i < w && x + i < _width; i++)
+		{
+			if (frame[x + i])
+			{
+				bitmap[j * stride + (i >> 3)] |= (char)(0x80 >> (i & 7));
+			}
+		}
+	}
+	return stride * h;
+}
+
+int YDisplayFrameBuffer::_selectPen(YDisplayLayer* layer, int gray)
+{
+	if (_backPen == gray)
+	{
+		return YAPI_SUCCESS;
+	}
+	_backPen = gray;
+	return layer->selectGrayPen(gray);
+}
+
+// Sends one dirty rectangle to the back layer using the most compact encoding,
+// and returns the estimated number of bytes sent (or a negative error code)
+int YDisplayFrameBuffer::_uploadRect(YDisplayLayer* layer, int x, int y, int w, int h)
+{
+	vector<int> on_runs, off_runs;
+	string bitmap;
+	int res;
+
+	// bitmap width must be a multiple of 8, extra pixels are clipped by the display
+	int bw = (w + 7) & ~7;
+	int cmdLen = this->_cmdEncoding(x, y, w, h, on_runs, off_runs);
+	int cmdCost = cmdLen + 4 * 2 + ((cmdLen + 99) / 100) * Y_FRAMEBUF_REQUEST_COST;
+	int bmpCost = this->_bmpEncoding(x, y, bw, h, bitmap) + 4 + 2 * Y_FRAMEBUF_REQUEST_COST;
+
+	if (cmdCost <= bmpCost)
+	{
+		for (int pass = 0; pass < 2; pass++)
+		{
+			vector<int>& runs = (pass == 0 ? on_runs : off_runs);
+			if (runs.size() == 0)
+			{
+				continue;
+			}
+			res = this->_selectPen(layer, pass == 0 ? _onGray : _offGray);
+			if (YISERR(res)) return res;
+			for (unsigned r = 0; r < runs.size(); r += 3)
+			{
+				if (runs[r] == runs[r + 1])
+				{
+					res = layer->drawPixel(runs[r], runs[r + 2]);
+				}
+				else
+				{
+					res = layer->drawBar(runs[r], runs[r + 2], runs[r + 1], runs[r + 2]);
+				}
+				if (YISERR(res)) return res;
+			}
+		}
+		return cmdCost;
+	}
+	res = this->_selectPen(layer, _onGray);
+	if (YISERR(res)) return res;
+	// the upload bypasses the layer command buffer, flush pending commands first
+	// (while batching, the upload itself sends the whole pending batch)
+	res = layer->flush_now();
+	if (YISERR(res)) return res;
+	res = layer->drawBitmap(x, y, bw, bitmap, _offGray);
+	if (YISERR(res)) return res;
+	return bmpCost;
+}
+
+int YDisplayFrameBuffer::render(void)
+{
+	string errmsg;
+	int res = this->_init();
+	if (YISERR(res))
+	{
+		return res;
+	}
+	// frame rate governor
+	u64 now = YAPI::GetTickCount();
+	u64 interval = (u64)this->get_frameInterval();
+	if (_lastFrame != 0 && now < _lastFrame + interval)
+	{
+		YAPI::Sleep((unsigned)(_lastFrame + interval - now), errmsg);
+		now = YAPI::GetTickCount();
+	}
+	_lastFrame = now;
+
+	YDisplayLayer* back = _display->get_displayLayer(_backId);
+	int bytes = 0;
+	int rects = 0;
+	if (!_backValid)
+	{
+		res = this->_uploadRect(back, 0, 0, _width, _height);
+		if (YISERR(res)) return res;
+		bytes += res;
+		rects++;
+	}
+	else
+	{
+		// group dirty rows into bands, each band is sent as one rectangle
+		int bandTop = -1, bandBottom = -1, bandLeft = _width, bandRight = -1;
+		for (int j = 0; j <= _height; j++)
+		{
+			int left = _width, right = -1;
+			if (j < _height)
+			{
+				const u8* frame = &_frame[j * _width];
+				const u8* shadow = &_shadowBack[j * _width];
+				for (int i = 0; i < _width; i++)
+				{
+					if (frame[i] != shadow[i])
+					{
+						if (i < left) left = i;
+						right = i;
+					}
+				}
+			}
+			bool split = (right >= 0 && bandTop >= 0 && j - bandBottom > Y_FRAMEBUF_MERGE_GAP + 1);
+			if (bandTop >= 0 && (split || j == _height))
+			{
+				res = this->_uploadRect(back, bandLeft, bandTop, bandRight - bandLeft + 1, bandBottom - bandTop + 1);
+				if (YISERR(res)) return res;
+				bytes += res;
+				rects++;
+				bandTop = -1;
+			}
+			if (right >= 0)
+			{
+				if (bandTop < 0)
+				{
+					bandTop = j;
+					bandLeft = left;
+					bandRight = right;
+				}
+				if (left < bandLeft) bandLeft = left;
+				if (right > bandRight) bandRight = right;
+				bandBottom = j;
+			}
+		}
+	}
+	res = back->flush_now();
+	if (YISERR(res)) return res;
+	_shadowBack = _frame;
+	_backValid = true;
+
+	// tear-free update: the prepared layer becomes visible at once
+	res = _display->swapLayerContent(_backId, _frontId);
+	if (YISERR(res)) return res;
+	_shadowBack.swap(_shadowFront);
+	bool valid = _backValid;
+	_backValid = _frontValid;
+	_frontValid = valid;
+
+	// adapt the frame interval to what the link actually sustains
+	int elapsed = (int)(YAPI::GetTickCount() - now);
+	_avgSendTime = (_avgSendTime * 3 + elapsed) / 4;
+	_frameCount++;
+	_lastFrameBytes = bytes;
+	_lastDirtyRects = rects;
+	return YAPI_SUCCESS;
+}
+
 
 //--- (generated code: Display functions)
 //--- (end of generated code: Display functions)
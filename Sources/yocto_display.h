@@ -121,6 +121,10 @@ typedef enum
 
 //--- (end of generated code: YDisplayLayer definitions)
 
+// Default maximal length of a single display command request: the longest
+// command value accepted by the firmware, as for serial port commands
+#define Y_DISPLAY_COMMAND_SIZE      100
+
 class YDisplay;
 
 //--- (generated code: YDisplayLayer declaration)
@@ -632,6 +636,11 @@ class YOCTO_CLASS_EXPORT YDisplay: public YFunction
 	vector<YDisplayLayer*> _allDisplayLayers;
 	bool _recording;
 	string _sequence;
+	int _commandSize;
+	bool _batching;
+	YDisplayLayer* _batchLayer;
+	vector<string> _batch;
+	std::map<string, string> _sequenceCache;
 
 	//--- (generated code: Display initialization)
 	//--- (end of generated code: Display initialization)
@@ -1122,6 +1131,230 @@ public:
 
 	// internal function to clear hidden flag during resetAll
 	void resetHiddenLayerFlags(void);
+
+	// internal function to keep commands of different layers in order while batching
+	void batchSwitchLayer(YDisplayLayer* layer);
+
+	// internal function to send the commands accumulated so far in a batch
+	int flushBatch(void);
+
+	/**
+	 * Returns the maximal length of a single command request sent to the display.
+	 *
+	 * @return an integer corresponding to the command request size, in bytes
+	 */
+	int get_commandSize(void)
+	{
+		return _commandSize;
+	}
+
+	/**
+	 * Changes the maximal length of a single command request sent to the display.
+	 * Larger requests reduce the number of round-trips, but must not exceed
+	 * the size supported by the display firmware.
+	 *
+	 * @param size : the command request size, in bytes
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	int set_commandSize(int size);
+
+	/**
+	 * Starts a command batch. Until endBatch() is called, drawing commands are
+	 * accumulated into requests as large as allowed by the command size, one
+	 * layer per request, instead of being sent immediately for visible layers.
+	 * File uploads made during a batch, including drawBitmap(), first send the
+	 * commands accumulated so far, so that the display sees them in order.
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	int beginBatch(void);
+
+	/**
+	 * Ends a command batch, and sends all accumulated requests back-to-back,
+	 * preserving the order in which the commands were issued. Consecutive
+	 * requests of the same layer are merged as long as they fit the command size.
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	int endBatch(void);
+
+	bool isBatching(void)
+	{
+		return _batching;
+	}
+
+	/**
+	 * Stops recording display commands and saves the sequence into the specified
+	 * file, unless an identical sequence has already been saved under the same
+	 * name by this object. This makes it possible to record static screen
+	 * elements each time they are needed, while uploading them only once.
+	 *
+	 * @param sequenceName : the name of the newly created sequence
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	int saveCachedSequence(string sequenceName);
+
+	/**
+	 * Forgets which sequences have been uploaded by saveCachedSequence(), so
+	 * that they are uploaded again on next save.
+	 */
+	void clearSequenceCache(void);
+};
+
+// Per-request overhead (in bytes) used by YDisplayFrameBuffer to compare
+// command-based and bitmap-based encodings of a dirty rectangle
+#define Y_FRAMEBUF_REQUEST_COST     160
+// Number of clean rows tolerated inside a single dirty rectangle
+#define Y_FRAMEBUF_MERGE_GAP        2
+// Default frame rate cap, in frames per second
+#define Y_FRAMEBUF_DEFAULT_FPS      25
+
+/**
+ * YDisplayFrameBuffer Class: client-side double-buffered frame buffer
+ *
+ * The frame buffer keeps a local monochrome image of the next frame, and a
+ * shadow copy of the content of two display layers. Each call to render()
+ * compares the new frame with the shadow of the hidden layer, uploads only
+ * the dirty rectangles (using either drawing commands or a bitmap, whichever
+ * is the most compact), and swaps the content of the two layers so that the
+ * new frame appears at once on the screen.
+ */
+class YOCTO_CLASS_EXPORT YDisplayFrameBuffer
+{
+private:
+	YDisplay* _display;
+	int _frontId;
+	int _backId;
+	int _width;
+	int _height;
+	int _onGray;
+	int _offGray;
+	vector<u8> _frame;
+	vector<u8> _shadowFront;
+	vector<u8> _shadowBack;
+	bool _frontValid;
+	bool _backValid;
+	int _backPen;
+	int _minInterval;
+	int _avgSendTime;
+	u64 _lastFrame;
+	int _frameCount;
+	int _lastFrameBytes;
+	int _lastDirtyRects;
+
+	int _init(void);
+	int _cmdEncoding(int x, int y, int w, int h, vector<int>& on_runs, vector<int>& off_runs);
+	int _bmpEncoding(int x, int y, int w, int h, string& bitmap);
+	int _selectPen(YDisplayLayer* layer, int gray);
+	int _uploadRect(YDisplayLayer* layer, int x, int y, int w, int h);
+
+public:
+	/**
+	 * Creates a frame buffer drawing on a pair of layers of a display. The
+	 * back layer is hidden and used to prepare each frame, while the front
+	 * layer is the one displayed on the screen.
+	 *
+	 * @param display : the display to draw on
+	 * @param frontLayerId : the identifier of the visible layer
+	 * @param backLayerId : the identifier of the hidden layer used for drawing
+	 */
+	YDisplayFrameBuffer(YDisplay* display, int frontLayerId, int backLayerId);
+
+	/**
+	 * Returns the width of the frame buffer, in pixels (or 0 if the display
+	 * could not be reached yet).
+	 */
+	int get_width(void);
+
+	/**
+	 * Returns the height of the frame buffer, in pixels (or 0 if the display
+	 * could not be reached yet).
+	 */
+	int get_height(void);
+
+	/**
+	 * Changes the gray levels used to draw lit and unlit pixels.
+	 *
+	 * @param onGray : the gray level for lit pixels (0..255)
+	 * @param offGray : the gray level for unlit pixels (0..255)
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 */
+	int set_grayLevels(int onGray, int offGray);
+
+	/**
+	 * Changes the maximal number of frames per second sent to the display.
+	 * The effective frame rate is further reduced automatically when the
+	 * link to the display cannot sustain the requested rate.
+	 *
+	 * @param fps : the maximal frame rate, or 0 for no limit
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 */
+	int set_maxFrameRate(int fps);
+
+	/**
+	 * Returns the current minimal delay between two frames, in milliseconds,
+	 * taking into account both the frame rate cap and the measured upload time.
+	 */
+	int get_frameInterval(void);
+
+	/**
+	 * Returns true when the frame rate governor would let render() send a
+	 * new frame immediately.
+	 */
+	bool isReady(void);
+
+	// Local frame drawing primitives (nothing is sent before render())
+	void clear(void);
+	void setPixel(int x, int y, bool lit);
+	bool getPixel(int x, int y);
+	void fillRect(int x, int y, int w, int h, bool lit);
+	void drawBitmap(int x, int y, int w, const string& bitmap);
+
+	/**
+	 * Forgets the shadow copies of the layers, so that the next two frames
+	 * are sent completely. Use this method if the layers have been modified
+	 * by other means than this frame buffer.
+	 */
+	void invalidate(void);
+
+	/**
+	 * Sends the current frame to the display. Waits if needed to respect
+	 * the frame rate governor, uploads the areas of the back layer that differ
+	 * from the new frame, then swaps the back and front layers.
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	int render(void);
+
+	// Statistics about the frames sent so far
+	int get_frameCount(void)
+	{
+		return _frameCount;
+	}
+
+	int get_lastFrameBytes(void)
+	{
+		return _lastFrameBytes;
+	}
+
+	int get_lastDirtyRects(void)
+	{
+		return _lastDirtyRects;
+	}
 };
 
 //--- (generated code: Display functions declaration)
@@ -127,6 +127,7 @@ YFiles::YFiles(const string& func): YFunction(func)
 //--- (end of generated code: Files initialization)
 {
 	_className = "Files";
+	_transferRetries = 3;
 }
 
 YFiles::~YFiles()
@@ -135,6 +136,526 @@ YFiles::~YFiles()
 	//--- (end of generated code: YFiles cleanup)
 }
 
+// size of the blocks read from caller-supplied streams
+#define YFILES_CHUNK_SIZE 65536
+
+static u32 yFilesCrcTable[256];
+static int yFilesCrcReady = 0;
+
+// Must be called from the caller thread before any worker thread uses yFilesCrc32
+static void yFilesCrcInit(void)
+{
+	u32 c;
+	int n, k;
+
+	if (yFilesCrcReady)
+	{
+		return;
+	}
+	for (n = 0; n < 256; n++)
+	{
+		c = (u32)n;
+		for (k = 0; k < 8; k++)
+		{
+			c = (c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1);
+		}
+		yFilesCrcTable[n] = c;
+	}
+	yFilesCrcReady = 1;
+}
+
+// Standard CRC-32 (as in zlib), which is the CRC reported by files.json.
+// Pass 0 as crc for the first block, and the previous result for the next ones
+static u32 yFilesCrc32(u32 crc, const u8* data, size_t len)
+{
+	crc = ~crc;
+	while (len-- > 0)
+	{
+		crc = yFilesCrcTable[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+struct YFilesTarget
+{
+	string serial;
+	string subpath;
+	int retries;
+	int uploaded;
+	int result;
+	string errmsg;
+};
+
+struct YFilesEntry
+{
+	string name;
+	int size;
+	u32 crc;
+};
+
+static int yFilesList(YFilesTarget& t, const string& pattern, vector<YFilesEntry>& list)
+{
+	yJsonStateMachine j;
+	YHTTPReply reply;
+	int res;
+
+	list.clear();
+	res = YapiWrapper::deviceRequest(t.serial, t.subpath, "GET /files.json?a=dir&f=" + pattern + " HTTP/1.1\r\n\r\n", reply, t.errmsg);
+	if (YISERR(res))
+	{
+		return res;
+	}
+	// parsed in place, within the library buffer
+	j.src = reply.body();
+	j.end = reply.body() + reply.bodySize();
+	j.st = YJSON_START;
+	if (yJsonParse(&j) != YJSON_PARSE_AVAIL || j.st != YJSON_PARSE_ARRAY)
+	{
+		t.errmsg = "invalid files.json reply";
+		return YAPI_IO_ERROR;
+	}
+	while (yJsonParse(&j) == YJSON_PARSE_AVAIL && j.st == YJSON_PARSE_STRUCT)
+	{
+		YFilesEntry entry;
+		entry.size = 0;
+		entry.crc = 0;
+		while (yJsonParse(&j) == YJSON_PARSE_AVAIL && j.st == YJSON_PARSE_MEMBNAME)
+		{
+			if (!strcmp(j.token, "name"))
+			{
+				if (yJsonParse(&j) != YJSON_PARSE_AVAIL)
+				{
+					break;
+				}
+				entry.name = (string)j.token;
+				while (j.next == YJSON_PARSE_STRINGCONT && yJsonParse(&j) == YJSON_PARSE_AVAIL)
+				{
+					entry.name += (string)j.token;
+				}
+			}
+			else if (!strcmp(j.token, "crc"))
+			{
+				if (yJsonParse(&j) != YJSON_PARSE_AVAIL)
+				{
+					break;
+				}
+				// the CRC may be reported either signed or unsigned
+				entry.crc = (u32)strtoul(j.token, NULL, 10);
+			}
+			else if (!strcmp(j.token, "size"))
+			{
+				if (yJsonParse(&j) != YJSON_PARSE_AVAIL)
+				{
+					break;
+				}
+				entry.size = atoi(j.token);
+			}
+			else
+			{
+				yJsonSkip(&j, 1);
+			}
+		}
+		list.push_back(entry);
+	}
+	return YAPI_SUCCESS;
+}
+
+static const YFilesEntry* yFilesFindEntry(const vector<YFilesEntry>& list, const string& pathname)
+{
+	for (unsigned i = 0; i < list.size(); i++)
+	{
+		if (list[i].name == pathname)
+		{
+			return &list[i];
+		}
+	}
+	return NULL;
+}
+
+// Reads a stream to its end in chunks, computing its CRC
+static int yFilesStreamCrc(FILE* in, u32* crc, int* size, string& errmsg)
+{
+	u8 buffer[4096];
+	size_t n;
+
+	*crc = 0;
+	*size = 0;
+	while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+	{
+		*crc = yFilesCrc32(*crc, buffer, n);
+		*size += (int)n;
+	}
+	if (ferror(in))
+	{
+		errmsg = "Unable to read input stream";
+		return YAPI_IO_ERROR;
+	}
+	return YAPI_SUCCESS;
+}
+
+// Builds the multipart upload request straight from the input stream, computing
+// the CRC of the content on the way. The boundary has a fixed length, so that it
+// can be replaced in place if it happens to appear in the content. upload.html
+// has no offset parameter, so a file must be sent whole in a single request: the
+// request is sized from the stream length, to be allocated only once
+static int yFilesBuildUpload(const string& pathname, FILE* in, string& request, u32* crc, int* size, string& errmsg)
+{
+	string boundary;
+	size_t bpos1, bpos2, start, pos, n;
+	long cur, end;
+
+	boundary = YapiWrapper::ysprintf("Zz%06xzZ", rand() & 0xffffff);
+	request = "POST /upload.html HTTP/1.1\r\nContent-Type: multipart/form-data; boundary=";
+	bpos1 = request.size();
+	request += boundary + "\r\n\r\n--";
+	bpos2 = request.size();
+	request += boundary + "\r\nContent-Disposition: form-data; name=\"" + pathname + "\"; filename=\"api\"\r\n" +
+		"Content-Type: application/octet-stream\r\n" +
+		"Content-Transfer-Encoding: binary\r\n\r\n";
+	start = request.size();
+	cur = ftell(in);
+	if (cur >= 0 && fseek(in, 0, SEEK_END) == 0)
+	{
+		end = ftell(in);
+		fseek(in, cur, SEEK_SET);
+		if (end > cur)
+		{
+			request.reserve(start + (size_t)(end - cur) + boundary.size() + 8);
+		}
+	}
+	*crc = 0;
+	pos = start;
+	do
+	{
+		request.resize(pos + YFILES_CHUNK_SIZE);
+		n = fread(&request[pos], 1, YFILES_CHUNK_SIZE, in);
+		*crc = yFilesCrc32(*crc, (const u8*)request.data() + pos, n);
+		pos += n;
+	}
+	while (n == YFILES_CHUNK_SIZE);
+	request.resize(pos);
+	if (ferror(in))
+	{
+		errmsg = "Unable to read input stream";
+		return YAPI_IO_ERROR;
+	}
+	*size = (int)(pos - start);
+	while (request.find(boundary, start) != string::npos)
+	{
+		boundary = YapiWrapper::ysprintf("Zz%06xzZ", rand() & 0xffffff);
+		request.replace(bpos1, boundary.size(), boundary);
+		request.replace(bpos2, boundary.size(), boundary);
+	}
+	request += "\r\n--" + boundary + "--\r\n";
+	return YAPI_SUCCESS;
+}
+
+// Sends an upload request until the device reports the expected size and CRC
+static int yFilesSendUpload(YFilesTarget& t, const string& pathname, const string& request, u32 crc, int size)
+{
+	vector<YFilesEntry> list;
+	const YFilesEntry* entry;
+	YHTTPReply reply;
+	int attempt, res;
+
+	for (attempt = 0; ; attempt++)
+	{
+		res = YapiWrapper::deviceRequest(t.serial, t.subpath, request, reply, t.errmsg);
+		reply.release();
+		if (!YISERR(res))
+		{
+			res = yFilesList(t, pathname, list);
+		}
+		if (!YISERR(res))
+		{
+			entry = yFilesFindEntry(list, pathname);
+			if (entry != NULL && entry->size == size && entry->crc == crc)
+			{
+				return YAPI_SUCCESS;
+			}
+			t.errmsg = "CRC mismatch after upload of " + pathname;
+			res = YAPI_IO_ERROR;
+		}
+		if (attempt >= t.retries)
+		{
+			return res;
+		}
+	}
+}
+
+YRETCODE YFiles::_getTransferPath(string& serial, string& subpath, string& errmsg)
+{
+	char errbuf[YOCTO_ERRMSG_LEN];
+	char rootdevice[YOCTO_SERIAL_LEN];
+	char path[256];
+	YFUN_DESCR fundescr;
+	YDEV_DESCR devdescr;
+	string funcId, funcName, funcVal;
+	YRETCODE res;
+
+	res = _getDescriptor(fundescr, errmsg);
+	if (YISERR(res))
+	{
+		return res;
+	}
+	res = YapiWrapper::getFunctionInfo(fundescr, devdescr, serial, funcId, funcName, funcVal, errmsg);
+	if (YISERR(res))
+	{
+		return res;
+	}
+	res = yapiGetDevicePath(devdescr, rootdevice, path, sizeof(path), NULL, errbuf);
+	if (YISERR(res))
+	{
+		errmsg = string(errbuf);
+		return res;
+	}
+	subpath = string(path);
+	return YAPI_SUCCESS;
+}
+
+void YFiles::set_transferRetries(int retries)
+{
+	_transferRetries = (retries < 0 ? 0 : retries);
+}
+
+int YFiles::download(const string& pathname, FILE* out)
+{
+	YFilesTarget t;
+	vector<YFilesEntry> list;
+	const YFilesEntry* entry;
+	YHTTPReply reply;
+	const char* body;
+	int bodysize;
+	int attempt, res;
+
+	yFilesCrcInit();
+	t.retries = _transferRetries;
+	res = _getTransferPath(t.serial, t.subpath, t.errmsg);
+	if (YISERR(res))
+	{
+		_throw((YRETCODE)res, t.errmsg);
+		return res;
+	}
+	for (attempt = 0; ; attempt++)
+	{
+		res = yFilesList(t, pathname, list);
+		if (!YISERR(res))
+		{
+			entry = yFilesFindEntry(list, pathname);
+			if (entry == NULL)
+			{
+				t.errmsg = "File not found: " + pathname;
+				res = YAPI_FILE_NOT_FOUND;
+				break;
+			}
+			res = YapiWrapper::deviceRequest(t.serial, t.subpath, "GET /" + pathname + " HTTP/1.1\r\n\r\n", reply, t.errmsg);
+		}
+		if (!YISERR(res))
+		{
+			body = reply.body();
+			bodysize = reply.bodySize();
+			if (bodysize == entry->size && yFilesCrc32(0, (const u8*)body, bodysize) == entry->crc)
+			{
+				// write straight from the library buffer
+				if (bodysize > 0 && fwrite(body, 1, bodysize, out) != (size_t)bodysize)
+				{
+					t.errmsg = "Unable to write output stream";
+					res = YAPI_IO_ERROR;
+				}
+				reply.release();
+				if (YISERR(res))
+				{
+					break;
+				}
+				return bodysize;
+			}
+			reply.release();
+			t.errmsg = "CRC mismatch while downloading " + pathname;
+			res = YAPI_IO_ERROR;
+		}
+		if (attempt >= t.retries)
+		{
+			break;
+		}
+	}
+	_throw((YRETCODE)res, t.errmsg);
+	return res;
+}
+
+int YFiles::upload(const string& pathname, FILE* in)
+{
+	YFilesTarget t;
+	string request;
+	u32 crc;
+	int size;
+	int res;
+
+	yFilesCrcInit();
+	t.retries = _transferRetries;
+	res = _getTransferPath(t.serial, t.subpath, t.errmsg);
+	if (!YISERR(res))
+	{
+		res = yFilesBuildUpload(pathname, in, request, &crc, &size, t.errmsg);
+	}
+	if (!YISERR(res))
+	{
+		res = yFilesSendUpload(t, pathname, request, crc, size);
+	}
+	if (YISERR(res))
+	{
+		_throw((YRETCODE)res, t.errmsg);
+		return res;
+	}
+	return YAPI_SUCCESS;
+}
+
+struct YFilesSyncCtx
+{
+	const vector<string>* pathnames;
+	const vector<string>* localFiles;
+	vector<u32> crcs;
+	vector<int> sizes;
+	vector<YFilesTarget> targets;
+};
+
+static void yFilesSyncTarget(YFilesSyncCtx* ctx, YFilesTarget& t)
+{
+	vector<YFilesEntry> list;
+	const YFilesEntry* entry;
+	string request;
+	FILE* in;
+	u32 crc;
+	int size;
+	int res;
+
+	res = yFilesList(t, "", list);
+	for (unsigned i = 0; i < ctx->pathnames->size() && !YISERR(res); i++)
+	{
+		const string& pathname = (*ctx->pathnames)[i];
+		entry = yFilesFindEntry(list, pathname);
+		if (entry != NULL && entry->size == ctx->sizes[i] && entry->crc == ctx->crcs[i])
+		{
+			continue;
+		}
+		in = fopen((*ctx->localFiles)[i].c_str(), "rb");
+		if (in == NULL)
+		{
+			t.errmsg = "Unable to open " + (*ctx->localFiles)[i];
+			res = YAPI_FILE_NOT_FOUND;
+			break;
+		}
+		res = yFilesBuildUpload(pathname, in, request, &crc, &size, t.errmsg);
+		fclose(in);
+		if (!YISERR(res))
+		{
+			res = yFilesSendUpload(t, pathname, request, crc, size);
+		}
+		if (!YISERR(res))
+		{
+			t.uploaded++;
+		}
+	}
+	t.result = res;
+}
+
+static void yFilesSyncJob(void* ctx, unsigned idx)
+{
+	YFilesSyncCtx* sync = (YFilesSyncCtx*)ctx;
+
+	if (!YISERR(sync->targets[idx].result))
+	{
+		yFilesSyncTarget(sync, sync->targets[idx]);
+	}
+}
+
+int YFiles::syncFiles(const vector<string>& pathnames, const vector<string>& localFiles)
+{
+	vector<YFiles*> targets;
+	string errmsg;
+	int res;
+
+	targets.push_back(this);
+	res = SyncFiles(targets, pathnames, localFiles, 1, errmsg);
+	if (YISERR(res))
+	{
+		_throw((YRETCODE)res, errmsg);
+	}
+	return res;
+}
+
+int YFiles::SyncFiles(const vector<YFiles*>& targets, const vector<string>& pathnames,
+                      const vector<string>& localFiles, int maxThreads, string& errmsg)
+{
+	YFilesSyncCtx ctx;
+	YWorkerPool pool;
+	FILE* in;
+	u32 crc;
+	int size, threadCount, total, res;
+
+	if (pathnames.size() != localFiles.size())
+	{
+		errmsg = "pathnames and localFiles must have the same size";
+		return YAPI_INVALID_ARGUMENT;
+	}
+	yFilesCrcInit();
+	// local CRCs are computed once for all modules
+	ctx.pathnames = &pathnames;
+	ctx.localFiles = &localFiles;
+	for (unsigned i = 0; i < localFiles.size(); i++)
+	{
+		in = fopen(localFiles[i].c_str(), "rb");
+		if (in == NULL)
+		{
+			errmsg = "Unable to open " + localFiles[i];
+			return YAPI_FILE_NOT_FOUND;
+		}
+		res = yFilesStreamCrc(in, &crc, &size, errmsg);
+		fclose(in);
+		if (YISERR(res))
+		{
+			return res;
+		}
+		ctx.crcs.push_back(crc);
+		ctx.sizes.push_back(size);
+	}
+	// resolve the modules in the caller thread, where the device list may safely be updated
+	ctx.targets.resize(targets.size());
+	for (unsigned i = 0; i < targets.size(); i++)
+	{
+		YFilesTarget& t = ctx.targets[i];
+		t.retries = targets[i]->_transferRetries;
+		t.uploaded = 0;
+		t.result = targets[i]->_getTransferPath(t.serial, t.subpath, t.errmsg);
+	}
+	threadCount = 0;
+	if (maxThreads > 1 && targets.size() > 1)
+	{
+		// wait() only returns once every thread has exited
+		threadCount = pool.start(maxThreads, (unsigned)ctx.targets.size(), yFilesSyncJob, &ctx);
+		pool.wait();
+	}
+	if (threadCount == 0)
+	{
+		// single module, or no thread available: run in the caller thread
+		for (unsigned i = 0; i < ctx.targets.size(); i++)
+		{
+			yFilesSyncJob(&ctx, i);
+		}
+	}
+	total = 0;
+	res = YAPI_SUCCESS;
+	for (unsigned i = 0; i < ctx.targets.size(); i++)
+	{
+		total += ctx.targets[i].uploaded;
+		if (YISERR(ctx.targets[i].result) && !YISERR(res))
+		{
+			res = ctx.targets[i].result;
+			errmsg = ctx.targets[i].serial + ": " + ctx.targets[i].errmsg;
+		}
+	}
+	return (YISERR(res) ? res : total);
+}
+
 //--- (generated code: YFiles implementation)
 // static attributes
 
@@ -136,8 +136,87 @@ class YOCTO_CLASS_EXPORT YFiles: public YFunction
 	//--- (generated code: Files initialization)
 	//--- (end of generated code: Files initialization)
 
+	int _transferRetries;
+
+	// Resolves the module serial number and the path prefix used to reach it
+	YRETCODE _getTransferPath(string& serial, string& subpath, string& errmsg);
+
 public:
 	~YFiles();
+
+	/**
+	 * Changes the number of times a streamed transfer is retried when the
+	 * transfer fails or when the CRC reported by the device does not match
+	 * the transferred content. The default is 3 retries.
+	 *
+	 * @param retries : the number of retries, 0 to disable retries
+	 */
+	void set_transferRetries(int retries);
+
+	/**
+	 * Downloads the requested file and writes its content to a caller-supplied
+	 * stream. The content is checked against the size and CRC reported by the
+	 * device before anything is written, so that the stream never receives
+	 * a corrupted copy of the file.
+	 *
+	 * @param pathname : path and name of the file to download
+	 * @param out : stream opened for writing in binary mode
+	 *
+	 * @return the number of bytes written if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	int download(const string& pathname, FILE* out);
+
+	/**
+	 * Uploads the content read from a caller-supplied stream, from its current
+	 * position to its end, to the specified full path name. The stream is read
+	 * in chunks, and the size and CRC reported by the device after the upload
+	 * are checked against the content that was sent.
+	 *
+	 * @param pathname : path and name of the new file to create
+	 * @param in : stream opened for reading in binary mode
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	int upload(const string& pathname, FILE* in);
+
+	/**
+	 * Makes sure that the filesystem contains the given local files. Files
+	 * which are already present with the same size and CRC are skipped, so
+	 * that an interrupted synchronization only resends the remaining files
+	 * when it is started again.
+	 *
+	 * @param pathnames : path and name of the files on the device
+	 * @param localFiles : path of the corresponding local files
+	 *
+	 * @return the number of files actually uploaded if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	int syncFiles(const vector<string>& pathnames, const vector<string>& localFiles);
+
+	/**
+	 * Synchronizes the same set of local files to several filesystems at
+	 * once, using up to maxThreads modules concurrently. Local CRCs are only
+	 * computed once, and files already present on a module with the same
+	 * size and CRC are skipped.
+	 *
+	 * @param targets : the filesystems to update
+	 * @param pathnames : path and name of the files on the devices
+	 * @param localFiles : path of the corresponding local files
+	 * @param maxThreads : maximal number of modules processed concurrently
+	 * @param errmsg : a string passed by reference to receive any error message.
+	 *
+	 * @return the total number of files uploaded if the call succeeds.
+	 *
+	 * On failure, returns a negative error code. The transfers to the other
+	 *         modules are completed nevertheless.
+	 */
+	static int SyncFiles(const vector<YFiles*>& targets, const vector<string>& pathnames,
+	                     const vector<string>& localFiles, int maxThreads, string& errmsg);
 	//--- (generated code: YFiles accessors declaration)
 
 	static const int FILESCOUNT_INVALID = YAPI_INVALID_UINT;
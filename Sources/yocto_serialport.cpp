@@ -68,12 +68,14 @@ YSerialPort::YSerialPort(const string& func): YFunction(func)
 //--- (end of SerialPort initialization)
 {
 	_className = "SerialPort";
+	_capture = NULL;
 }
 
 YSerialPort::~YSerialPort()
 {
 	//--- (YSerialPort cleanup)
 	//--- (end of YSerialPort cleanup)
+	YMessageCapture::Stop(_capture);
 }
 
 //--- (YSerialPort implementation)
@@ -2168,5 +2170,29 @@ YSerialPort* YSerialPort::FirstSerialPort(void)
 
 //--- (end of YSerialPort implementation)
 
+int YSerialPort::startCapture(const string& path, s64 maxSize)
+{
+	string errmsg;
+	int res;
+
+	res = YMessageCapture::Start(_capture, this, path, maxSize, _rxptr, errmsg);
+	if (YISERR(res))
+	{
+		_throw((YRETCODE)res, errmsg);
+	}
+	return res;
+}
+
+int YSerialPort::stopCapture(void)
+{
+	YMessageCapture::Stop(_capture);
+	return YAPI_SUCCESS;
+}
+
+YMessageCapture* YSerialPort::get_capture(void)
+{
+	return _capture;
+}
+
 //--- (SerialPort functions)
 //--- (end of SerialPort functions)
@@ -126,6 +126,8 @@ protected:
 	// Constructor is protected, use yFindSerialPort factory function to instantiate
 	YSerialPort(const string& func);
 	//--- (end of YSerialPort attributes)
+	// Background message capture, if any
+	YMessageCapture* _capture;
 
 public:
 	~YSerialPort();
@@ -939,6 +941,41 @@ public:
 #pragma option pop
 #endif
 	//--- (end of YSerialPort accessors declaration)
+
+	/**
+	 * Starts a continuous background capture of all messages exchanged on the serial port
+	 * into a binary capture file. Each record holds the message direction, the device
+	 * timestamp, the host reception time and the message itself, as reported by
+	 * readMessages(). The capture starts at the current stream position and runs
+	 * until stopCapture() is called. Use YMessageCaptureReader to read the file back.
+	 * Only one capture can run at a time on a given object: starting a new capture
+	 * stops the previous one.
+	 *
+	 * @param path : the name of the capture file to create (overwritten if it exists)
+	 * @param maxSize : the maximum size of the capture file in bytes. When the file is full,
+	 *         the oldest records are overwritten (ring buffer). Use 0 for an unbounded capture.
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	virtual int startCapture(const string& path, s64 maxSize);
+
+	/**
+	 * Stops the background capture started with startCapture(), and
+	 * closes the capture file.
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 */
+	virtual int stopCapture(void);
+
+	/**
+	 * Returns the capture object currently running on this serial port, if any.
+	 * It can be used to check the capture state and the number of captured records.
+	 *
+	 * @return a pointer to a YMessageCapture object, or NULL if no capture is running.
+	 */
+	YMessageCapture* get_capture(void);
 };
 
 //--- (SerialPort functions declaration)
@@ -70,12 +70,15 @@ YSpiPort::YSpiPort(const string& func): YFunction(func)
 //--- (end of SpiPort initialization)
 {
 	_className = "SpiPort";
+	_capture = NULL;
+	_txEnvelopeLen = 0;
 }
 
 YSpiPort::~YSpiPort()
 {
 	//--- (YSpiPort cleanup)
 	//--- (end of YSpiPort cleanup)
+	YMessageCapture::Stop(_capture);
 }
 
 //--- (YSpiPort implementation)
@@ -1673,5 +1676,335 @@ YSpiPort* YSpiPort::FirstSpiPort(void)
 
 //--- (end of YSpiPort implementation)
 
+int YSpiPort::startCapture(const string& path, s64 maxSize)
+{
+	string errmsg;
+	int res;
+
+	res = YMessageCapture::Start(_capture, this, path, maxSize, _rxptr, errmsg);
+	if (YISERR(res))
+	{
+		_throw((YRETCODE)res, errmsg);
+	}
+	return res;
+}
+
+int YSpiPort::stopCapture(void)
+{
+	YMessageCapture::Stop(_capture);
+	return YAPI_SUCCESS;
+}
+
+YMessageCapture* YSpiPort::get_capture(void)
+{
+	return _capture;
+}
+
+// Prepares the constant part of the txdata upload request, with a new random boundary
+void YSpiPort::_buildTxEnvelope(void)
+{
+	_txBoundary = YapiWrapper::ysprintf("Zz%06xzZ", rand() & 0xffffff);
+	_txEnvelope = "POST /upload.html HTTP/1.1\r\n";
+	_txEnvelope += "Content-Type: multipart/form-data; boundary=" + _txBoundary + "\r\n";
+	_txEnvelope += "\r\n--" + _txBoundary + "\r\n";
+	_txEnvelope += "Content-Disposition: form-data; name=\"txdata\"; filename=\"api\"\r\n";
+	_txEnvelope += "Content-Type: application/octet-stream\r\n";
+	_txEnvelope += "Content-Transfer-Encoding: binary\r\n\r\n";
+	_txEnvelopeLen = (int)_txEnvelope.size();
+}
+
+// Appends the given transmit data to the envelope, reusing the request buffer
+void YSpiPort::_fillTxEnvelope(const YSpiTransaction* trans, size_t count)
+{
+	size_t idx;
+
+	if (_txEnvelopeLen == 0)
+	{
+		this->_buildTxEnvelope();
+	}
+	while (true)
+	{
+		_txEnvelope.resize(_txEnvelopeLen);
+		for (idx = 0; idx < count; idx++)
+		{
+			_txEnvelope.append((const char*)trans[idx].txdata, trans[idx].len);
+		}
+		if (_txEnvelope.find(_txBoundary, _txEnvelopeLen) == string::npos)
+		{
+			break;
+		}
+		// the boundary appears in the data, pick another one
+		this->_buildTxEnvelope();
+	}
+	_txEnvelope += "\r\n--" + _txBoundary + "--\r\n";
+}
+
+int YSpiPort::_postTxEnvelope(bool waitAck)
+{
+	YDevice* dev;
+	YHTTPReply reply;
+	string errmsg;
+	int res;
+
+	if (waitAck)
+	{
+		res = this->_requestEx(0, _txEnvelope, reply, NULL, NULL);
+		if (YISERR(res))
+		{
+			return res;
+		}
+		if (!reply._skipHeader() || !reply._isSuccess())
+		{
+			this->_throw(YAPI_IO_ERROR, "http request failed");
+			return YAPI_IO_ERROR;
+		}
+		return YAPI_SUCCESS;
+	}
+	res = this->_getDevice(dev, errmsg);
+	if (YISERR(res))
+	{
+		this->_throw((YRETCODE)res, errmsg);
+		return res;
+	}
+	res = dev->HTTPRequestAsync(0, _txEnvelope, NULL, NULL, errmsg);
+	if (YISERR(res))
+	{
+		this->_throw((YRETCODE)res, errmsg);
+		return res;
+	}
+	return YAPI_SUCCESS;
+}
+
+// Reads raw data from rxdata.bin, without copying it out of the reply
+int YSpiPort::_readRxData(int pos, int len, string& reply, int& dataofs, int& datalen, int& endpos)
+{
+	size_t found;
+	int mult;
+	int bufflen;
+
+	reply = this->_request(YapiWrapper::ysprintf("GET /rxdata.bin?pos=%d&len=%d HTTP/1.1\r\n\r\n", pos, len));
+	if (reply == YAPI_INVALID_STRING)
+	{
+		return this->get_errorType();
+	}
+	found = reply.find("\r\n\r\n");
+	if (found == string::npos)
+	{
+		this->_throw(YAPI_IO_ERROR, "http request failed");
+		return YAPI_IO_ERROR;
+	}
+	dataofs = (int)found + 4;
+	// the data is followed by '@' and the new stream position
+	bufflen = (int)reply.size() - 1;
+	endpos = 0;
+	mult = 1;
+	while (bufflen > dataofs && ((u8)reply[bufflen]) != 64)
+	{
+		endpos = endpos + mult * (((u8)reply[bufflen]) - 48);
+		mult = mult * 10;
+		bufflen = bufflen - 1;
+	}
+	datalen = bufflen - dataofs;
+	if (datalen < 0)
+	{
+		datalen = 0;
+	}
+	return YAPI_SUCCESS;
+}
+
+// Gets the current end of the RX stream of the device, as read_avail does
+int YSpiPort::_rxStreamEnd(int& endpos)
+{
+	string buff;
+	int bufflen;
+
+	buff = this->_download(YapiWrapper::ysprintf("rxcnt.bin?pos=%d", _rxptr));
+	if (buff == YAPI_INVALID_STRING)
+	{
+		return this->get_errorType();
+	}
+	bufflen = (int)buff.size() - 1;
+	while (bufflen > 0 && ((u8)buff[bufflen]) != 64)
+	{
+		bufflen = bufflen - 1;
+	}
+	endpos = _rxptr + atoi((buff.substr(0, bufflen)).c_str());
+	return YAPI_SUCCESS;
+}
+
+int YSpiPort::writeBuffer(const u8* data, int len)
+{
+	YSpiTransaction tr;
+	int res;
+
+	if (len <= 0)
+	{
+		return YAPI_SUCCESS;
+	}
+	tr.txdata = data;
+	tr.rxbuffer = NULL;
+	tr.len = len;
+	// only this buffer is sent, queued transfers wait for flushTransfers()
+	this->_fillTxEnvelope(&tr, 1);
+	res = this->_postTxEnvelope(true);
+	return res;
+}
+
+int YSpiPort::readBuffer(u8* buffer, int maxLen)
+{
+	string reply;
+	int dataofs = 0;
+	int datalen = 0;
+	int endpos = 0;
+	int res;
+
+	if (maxLen > 65535)
+	{
+		maxLen = 65535;
+	}
+	res = this->_readRxData(_rxptr, maxLen, reply, dataofs, datalen, endpos);
+	if (YISERR(res))
+	{
+		return res;
+	}
+	if (datalen > maxLen)
+	{
+		datalen = maxLen;
+	}
+	memcpy(buffer, reply.data() + dataofs, datalen);
+	_rxptr = endpos;
+	return datalen;
+}
+
+int YSpiPort::queueTransfer(const u8* txdata, u8* rxbuffer, int len)
+{
+	YSpiTransaction tr;
+
+	if (len <= 0)
+	{
+		return YAPI_SUCCESS;
+	}
+	tr.txdata = txdata;
+	tr.rxbuffer = rxbuffer;
+	tr.len = len;
+	_txQueue.push_back(tr);
+	return YAPI_SUCCESS;
+}
+
+int YSpiPort::flushTransfers(int maxWait)
+{
+	string errmsg;
+	string reply;
+	int dataofs = 0;
+	int datalen = 0;
+	int endpos = 0;
+	int startpos = 0;
+	int total = 0;
+	int received = 0;
+	int trstart;
+	int ofs;
+	int n;
+	bool needRx = false;
+	size_t idx;
+	u64 deadline;
+	int res;
+
+	if (_txQueue.size() == 0)
+	{
+		return YAPI_SUCCESS;
+	}
+	for (idx = 0; idx < _txQueue.size(); idx++)
+	{
+		total += _txQueue[idx].len;
+		if (_txQueue[idx].rxbuffer != NULL)
+		{
+			needRx = true;
+		}
+	}
+	if (needRx)
+	{
+		// the replies start at the current end of the RX stream, which may
+		// be past the read pointer of the application
+		res = this->_rxStreamEnd(startpos);
+		if (YISERR(res))
+		{
+			_txQueue.clear();
+			return res;
+		}
+	}
+	this->_fillTxEnvelope(&_txQueue[0], _txQueue.size());
+	res = this->_postTxEnvelope(!needRx);
+	if (YISERR(res) || !needRx)
+	{
+		// like writeBuffer, leave the read pointer alone
+		_txQueue.clear();
+		return res;
+	}
+	deadline = YAPI::GetTickCount() + maxWait;
+	while (received < total)
+	{
+		n = total - received;
+		if (n > 65535)
+		{
+			n = 65535;
+		}
+		res = this->_readRxData(startpos + received, n, reply, dataofs, datalen, endpos);
+		if (YISERR(res))
+		{
+			_txQueue.clear();
+			return res;
+		}
+		if (datalen > n)
+		{
+			datalen = n;
+		}
+		// scatter received bytes into the transaction buffers
+		trstart = 0;
+		for (idx = 0; idx < _txQueue.size() && datalen > 0; idx++)
+		{
+			YSpiTransaction& tr = _txQueue[idx];
+			if (tr.rxbuffer != NULL && received < trstart + tr.len && received + datalen > trstart)
+			{
+				ofs = (received > trstart ? received - trstart : 0);
+				n = tr.len - ofs;
+				if (n > received + datalen - trstart - ofs)
+				{
+					n = received + datalen - trstart - ofs;
+				}
+				memcpy(tr.rxbuffer + ofs, reply.data() + dataofs + (trstart + ofs - received), n);
+			}
+			trstart += tr.len;
+		}
+		received += datalen;
+		if (received < total)
+		{
+			if (YAPI::GetTickCount() >= deadline)
+			{
+				_txQueue.clear();
+				this->_throw(YAPI_TIMEOUT, "SPI transaction did not complete in time");
+				return YAPI_TIMEOUT;
+			}
+			if (datalen == 0)
+			{
+				// the module has not clocked the data in yet
+				YAPI::Sleep(5, errmsg);
+			}
+		}
+	}
+	_txQueue.clear();
+	if (_rxptr == startpos)
+	{
+		// nothing was left unread, skip the replies handed to the caller
+		_rxptr = startpos + total;
+	}
+	return YAPI_SUCCESS;
+}
+
+int YSpiPort::transferBuffers(const u8* txdata, u8* rxbuffer, int len, int maxWait)
+{
+	this->queueTransfer(txdata, rxbuffer, len);
+	return this->flushTransfers(maxWait);
+}
+
 //--- (SpiPort functions)
 //--- (end of SpiPort functions)
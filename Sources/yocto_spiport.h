@@ -101,6 +101,14 @@ typedef enum
 
 //--- (end of YSpiPort definitions)
 
+// One queued full-duplex SPI transaction, see YSpiPort::queueTransfer()
+typedef struct
+{
+	const u8* txdata;
+	u8* rxbuffer;
+	int len;
+} YSpiTransaction;
+
 //--- (YSpiPort declaration)
 /**
  * YSpiPort Class: SPI Port function interface
@@ -148,6 +156,19 @@ protected:
 	// Constructor is protected, use yFindSpiPort factory function to instantiate
 	YSpiPort(const string& func);
 	//--- (end of YSpiPort attributes)
+	// Background message capture, if any
+	YMessageCapture* _capture;
+	// Bulk binary transfers: reusable upload envelope and queued transactions
+	string _txEnvelope;
+	int _txEnvelopeLen;
+	string _txBoundary;
+	vector<YSpiTransaction> _txQueue;
+
+	void _buildTxEnvelope(void);
+	void _fillTxEnvelope(const YSpiTransaction* trans, size_t count);
+	int _postTxEnvelope(bool waitAck);
+	int _readRxData(int pos, int len, string& reply, int& dataofs, int& datalen, int& endpos);
+	int _rxStreamEnd(int& endpos);
 
 public:
 	~YSpiPort();
@@ -854,6 +875,115 @@ public:
 #pragma option pop
 #endif
 	//--- (end of YSpiPort accessors declaration)
+
+	/**
+	 * Starts a continuous background capture of all messages exchanged on the SPI port
+	 * into a binary capture file. Each record holds the message direction, the device
+	 * timestamp, the host reception time and the message itself, as reported by
+	 * readMessages(). The capture starts at the current stream position and runs
+	 * until stopCapture() is called. Use YMessageCaptureReader to read the file back.
+	 * Only one capture can run at a time on a given object: starting a new capture
+	 * stops the previous one.
+	 *
+	 * @param path : the name of the capture file to create (overwritten if it exists)
+	 * @param maxSize : the maximum size of the capture file in bytes. When the file is full,
+	 *         the oldest records are overwritten (ring buffer). Use 0 for an unbounded capture.
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	virtual int startCapture(const string& path, s64 maxSize);
+
+	/**
+	 * Stops the background capture started with startCapture(), and
+	 * closes the capture file.
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 */
+	virtual int stopCapture(void);
+
+	/**
+	 * Returns the capture object currently running on this SPI port, if any.
+	 * It can be used to check the capture state and the number of captured records.
+	 *
+	 * @return a pointer to a YMessageCapture object, or NULL if no capture is running.
+	 */
+	YMessageCapture* get_capture(void);
+
+	/**
+	 * Sends a block of binary data to the SPI port, directly from a caller-owned buffer.
+	 * Unlike writeBin() and writeArray(), the data is not converted to an intermediate
+	 * object, and the upload request envelope is reused from one call to the next.
+	 *
+	 * @param data : a pointer to the bytes to send
+	 * @param len : the number of bytes to send
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	virtual int writeBuffer(const u8* data, int len);
+
+	/**
+	 * Reads data from the receive buffer, starting at current stream position,
+	 * directly into a caller-owned buffer.
+	 *
+	 * @param buffer : a pointer to the buffer receiving the data
+	 * @param maxLen : the maximum number of bytes to read (at most 65535)
+	 *
+	 * @return the number of bytes actually read.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	virtual int readBuffer(u8* buffer, int maxLen);
+
+	/**
+	 * Queues a full-duplex SPI transaction, to be sent by the next call to
+	 * flushTransfers(). As SPI clocks one byte in for each byte sent, the
+	 * transaction reads back len bytes from the receive stream. Buffers are
+	 * not copied when queued and must stay valid until flushTransfers() returns.
+	 *
+	 * @param txdata : a pointer to the bytes to send
+	 * @param rxbuffer : a pointer to a buffer of len bytes receiving the bytes
+	 *         clocked in during the transaction, or NULL to discard them
+	 * @param len : the transaction length, in bytes
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 */
+	virtual int queueTransfer(const u8* txdata, u8* rxbuffer, int len);
+
+	/**
+	 * Sends all queued transactions back to back in a single upload, then reads
+	 * back their received bytes with as few requests as possible. The upload is
+	 * posted without waiting for its acknowledgment, so that it overlaps with the
+	 * read-back on the link. Received bytes are taken from the end of the receive
+	 * stream at the time of the call. The current stream position is moved after
+	 * the last transaction only if no data was left unread before it.
+	 *
+	 * @param maxWait : the maximum number of milliseconds to wait for the received bytes
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	virtual int flushTransfers(int maxWait);
+
+	/**
+	 * Performs a single full-duplex SPI transaction: sends txdata and reads back
+	 * the bytes clocked in at the same time, using one upload and one read-back.
+	 * Any transaction previously queued with queueTransfer() is sent first.
+	 *
+	 * @param txdata : a pointer to the bytes to send
+	 * @param rxbuffer : a pointer to a buffer of len bytes receiving the data
+	 * @param len : the transaction length, in bytes
+	 * @param maxWait : the maximum number of milliseconds to wait for the received bytes
+	 *
+	 * @return YAPI_SUCCESS if the call succeeds.
+	 *
+	 * On failure, throws an exception or returns a negative error code.
+	 */
+	virtual int transferBuffers(const u8* txdata, u8* rxbuffer, int len, int maxWait);
 };
 
 //--- (SpiPort functions declaration)